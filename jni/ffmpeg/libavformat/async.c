@@ -35,6 +35,7 @@
 #include "libavutil/opt.h"
 #include "libavutil/thread.h"
 #include "url.h"
+#include <stdatomic.h>
 #include <stdint.h>
 
 #if HAVE_UNISTD_H
@@ -44,13 +45,24 @@
 #define BUFFER_CAPACITY         (4 * 1024 * 1024)
 #define READ_BACK_CAPACITY      (4 * 1024 * 1024)
 #define SHORT_SEEK_THRESHOLD    (256 * 1024)
+#define INITIAL_RING_SIZE       (64 * 1024)
+#define MAX_RINGS               8
 
 typedef struct RingBuffer
 {
     AVFifoBuffer *fifo;
     int           read_back_capacity;
+    int           max_size;
 
     int           read_pos;
+
+    /* bytes read from the ring, which scales its read-ahead */
+    int64_t       nb_read;
+
+    /* state of a parked ring, which is not the one being read */
+    int64_t       logical_pos;
+    int64_t       last_used;
+    int           eof_reached;
 } RingBuffer;
 
 typedef struct Context {
@@ -69,25 +81,45 @@ typedef struct Context {
 
     int64_t         logical_pos;
     int64_t         logical_size;
-    RingBuffer      ring;
+
+    /*
+     * Each ring buffers a range of the input. The reader and the background
+     * thread use the current one, the others are parked until a seek lands
+     * in them, so that the ranges a demuxer bounces between at open time
+     * (header, index at the end, playhead) stay in memory.
+     */
+    RingBuffer      rings[MAX_RINGS];
+    RingBuffer     *ring;
+    int             ring_generation;
+    int64_t         use_count;
+
+    /* only accessed by the background thread */
+    int64_t         inner_pos;
 
     pthread_cond_t  cond_wakeup_main;
     pthread_cond_t  cond_wakeup_background;
     pthread_mutex_t mutex;
     pthread_t       async_buffer_thread;
 
-    int             abort_request;
+    /* also read by the interrupt callback of the inner protocol */
+    atomic_int      abort_request;
     AVIOInterruptCB interrupt_callback;
+
+    /* options */
+    int             nb_rings;
+    int             max_memory;
 } Context;
 
 static int ring_init(RingBuffer *ring, unsigned int capacity, int read_back_capacity)
 {
     memset(ring, 0, sizeof(RingBuffer));
-    ring->fifo = av_fifo_alloc(capacity + read_back_capacity);
+    /* grown on demand, up to max_size */
+    ring->fifo = av_fifo_alloc(FFMIN(INITIAL_RING_SIZE, capacity + read_back_capacity));
     if (!ring->fifo)
         return AVERROR(ENOMEM);
 
     ring->read_back_capacity = read_back_capacity;
+    ring->max_size           = capacity + read_back_capacity;
     return 0;
 }
 
@@ -100,6 +132,7 @@ static void ring_reset(RingBuffer *ring)
 {
     av_fifo_reset(ring->fifo);
     ring->read_pos = 0;
+    ring->nb_read  = 0;
 }
 
 static int ring_size(RingBuffer *ring)
@@ -107,9 +140,9 @@ static int ring_size(RingBuffer *ring)
     return av_fifo_size(ring->fifo) - ring->read_pos;
 }
 
-static int ring_space(RingBuffer *ring)
+static int ring_allocated(RingBuffer *ring)
 {
-    return av_fifo_space(ring->fifo);
+    return ring->fifo ? ring->fifo->end - ring->fifo->buffer : 0;
 }
 
 static int ring_generic_read(RingBuffer *ring, void *dest, int buf_size, void (*func)(void*, void*, int))
@@ -119,6 +152,7 @@ static int ring_generic_read(RingBuffer *ring, void *dest, int buf_size, void (*
     av_assert2(buf_size <= ring_size(ring));
     ret = av_fifo_generic_peek_at(ring->fifo, dest, ring->read_pos, buf_size, func);
     ring->read_pos += buf_size;
+    ring->nb_read  += buf_size;
 
     if (ring->read_pos > ring->read_back_capacity) {
         av_fifo_drain(ring->fifo, ring->read_pos - ring->read_back_capacity);
@@ -130,7 +164,7 @@ static int ring_generic_read(RingBuffer *ring, void *dest, int buf_size, void (*
 
 static int ring_generic_write(RingBuffer *ring, void *src, int size, int (*func)(void*, void*, int))
 {
-    av_assert2(size <= ring_space(ring));
+    av_assert2(size <= av_fifo_space(ring->fifo));
     return av_fifo_generic_write(ring->fifo, src, size, func);
 }
 
@@ -147,18 +181,158 @@ static int ring_drain(RingBuffer *ring, int offset)
     return 0;
 }
 
+/* The functions below are called with the mutex locked. */
+
+static int64_t rings_memory(Context *c)
+{
+    int64_t size = 0;
+    int i;
+
+    for (i = 0; i < c->nb_rings; i++)
+        size += ring_allocated(&c->rings[i]);
+    return size;
+}
+
+/* Free the least recently used parked ring, return 0 if there is none. */
+static int rings_evict(Context *c)
+{
+    RingBuffer *lru = NULL;
+    int i;
+
+    for (i = 0; i < c->nb_rings; i++) {
+        RingBuffer *ring = &c->rings[i];
+        if (ring->fifo && ring != c->ring && (!lru || ring->last_used < lru->last_used))
+            lru = ring;
+    }
+    if (!lru)
+        return 0;
+    ring_destroy(lru);
+    return 1;
+}
+
+static RingBuffer *rings_unused(Context *c)
+{
+    int i;
+
+    for (i = 0; i < c->nb_rings; i++)
+        if (!c->rings[i].fifo)
+            return &c->rings[i];
+    return NULL;
+}
+
+static void ring_park(Context *c)
+{
+    RingBuffer *ring = c->ring;
+
+    ring->logical_pos = c->logical_pos;
+    ring->eof_reached = c->io_eof_reached && !c->io_error;
+    ring->last_used   = ++c->use_count;
+}
+
+static void ring_activate(Context *c, RingBuffer *ring, int64_t pos)
+{
+    ring->read_pos   += pos - ring->logical_pos;
+    c->ring           = ring;
+    c->logical_pos    = pos;
+    c->io_eof_reached = ring->eof_reached;
+    c->io_error       = 0;
+    c->ring_generation++;
+}
+
+/*
+ * Switch to a parked ring holding pos, the background thread then resumes
+ * filling it from its end. Return 0 if no ring holds pos.
+ */
+static int rings_resume(Context *c, int64_t pos)
+{
+    int i;
+
+    for (i = 0; i < c->nb_rings; i++) {
+        RingBuffer *ring = &c->rings[i];
+        int64_t start;
+
+        if (!ring->fifo || ring == c->ring)
+            continue;
+        start = ring->logical_pos - ring->read_pos;
+        if (pos >= start && pos < start + av_fifo_size(ring->fifo)) {
+            ring_park(c);
+            ring_activate(c, ring, pos);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Start buffering a new range at pos, parking the current ring if it holds data. */
+static void rings_restart(Context *c, int64_t pos)
+{
+    RingBuffer *ring = c->ring;
+
+    if (c->nb_rings > 1 && av_fifo_size(ring->fifo)) {
+        RingBuffer *next = NULL;
+
+        ring_park(c);
+        if (!(next = rings_unused(c)) && rings_evict(c))
+            next = rings_unused(c);
+        if (next && ring_init(next, BUFFER_CAPACITY, READ_BACK_CAPACITY) >= 0) {
+            c->ring = ring = next;
+            while (rings_memory(c) > c->max_memory && rings_evict(c))
+                ;
+        }
+    }
+    ring_reset(ring);
+    c->logical_pos = pos;
+    c->ring_generation++;
+}
+
+/*
+ * Make room for up to size bytes at the end of the current ring, within its
+ * read-ahead and the memory budget, and return the room there is.
+ */
+static int ring_reserve(Context *c, int size)
+{
+    RingBuffer *ring = c->ring;
+    int read_ahead   = FFMIN(BUFFER_CAPACITY, FFMAX(SHORT_SEEK_THRESHOLD, 2 * ring->nb_read));
+    int space;
+
+    /* a range only read a little, e.g. for an index lookup, is not read far ahead */
+    size = FFMIN(size, read_ahead - ring_size(ring));
+    if (size <= 0)
+        return 0;
+
+    space = av_fifo_space(ring->fifo);
+    if (space < size) {
+        int allocated = ring_allocated(ring);
+        int grow      = FFMIN(FFMAX(allocated, size), ring->max_size - allocated);
+
+        while (grow > 0 && rings_memory(c) + grow > c->max_memory && rings_evict(c))
+            ;
+        grow = FFMIN(grow, c->max_memory - rings_memory(c));
+        if (grow > 0 && av_fifo_realloc2(ring->fifo, allocated + grow) >= 0)
+            space = av_fifo_space(ring->fifo);
+        if (space < size && ring->read_pos > 0) {
+            /* out of budget, give up on some of the read back */
+            int drain = FFMIN(ring->read_pos, size - space);
+            av_fifo_drain(ring->fifo, drain);
+            ring->read_pos -= drain;
+            space          += drain;
+        }
+    }
+    return FFMIN(size, space);
+}
+
 static int async_check_interrupt(void *arg)
 {
     URLContext *h   = arg;
     Context    *c   = h->priv_data;
 
-    if (c->abort_request)
+    if (atomic_load(&c->abort_request))
         return 1;
 
     if (ff_check_interrupt(&c->interrupt_callback))
-        c->abort_request = 1;
+        atomic_store(&c->abort_request, 1);
 
-    return c->abort_request;
+    return atomic_load(&c->abort_request);
 }
 
 static int wrapped_url_read(void *src, void *dst, int size)
@@ -177,12 +351,13 @@ static void *async_buffer_task(void *arg)
 {
     URLContext   *h    = arg;
     Context      *c    = h->priv_data;
-    RingBuffer   *ring = &c->ring;
+    uint8_t       buf[4096];
     int           ret  = 0;
     int64_t       seek_ret;
 
     while (1) {
-        int fifo_space, to_copy;
+        int fifo_space, to_copy, generation;
+        int64_t fill_pos;
 
         pthread_mutex_lock(&c->mutex);
         if (async_check_interrupt(h)) {
@@ -195,10 +370,11 @@ static void *async_buffer_task(void *arg)
 
         if (c->seek_request) {
             seek_ret = ffurl_seek(c->inner, c->seek_pos, c->seek_whence);
+            c->inner_pos = seek_ret;
             if (seek_ret >= 0) {
                 c->io_eof_reached = 0;
                 c->io_error       = 0;
-                ring_reset(ring);
+                rings_restart(c, seek_ret);
             }
 
             c->seek_completed = 1;
@@ -211,23 +387,41 @@ static void *async_buffer_task(void *arg)
             continue;
         }
 
-        fifo_space = ring_space(ring);
-        if (c->io_eof_reached || fifo_space <= 0) {
+        fifo_space = c->io_eof_reached ? 0 : ring_reserve(c, sizeof(buf));
+        if (fifo_space <= 0) {
             pthread_cond_signal(&c->cond_wakeup_main);
             pthread_cond_wait(&c->cond_wakeup_background, &c->mutex);
             pthread_mutex_unlock(&c->mutex);
             continue;
         }
+        fill_pos   = c->logical_pos + ring_size(c->ring);
+        generation = c->ring_generation;
         pthread_mutex_unlock(&c->mutex);
 
-        to_copy = FFMIN(4096, fifo_space);
-        ret = ring_generic_write(ring, (void *)h, to_copy, wrapped_url_read);
+        if (c->inner_pos != fill_pos) {
+            /* back to the end of a ring that was parked */
+            seek_ret = ffurl_seek(c->inner, fill_pos, SEEK_SET);
+            c->inner_pos = seek_ret;
+            if (seek_ret >= 0)
+                continue;
+            c->inner_io_error = ret = seek_ret;
+        } else {
+            to_copy = FFMIN(sizeof(buf), fifo_space);
+            ret = wrapped_url_read(h, buf, to_copy);
+            if (ret > 0)
+                c->inner_pos += ret;
+        }
 
         pthread_mutex_lock(&c->mutex);
-        if (ret <= 0) {
-            c->io_eof_reached = 1;
-            if (c->inner_io_error < 0)
-                c->io_error = c->inner_io_error;
+        /* the data is dropped if the reader switched rings meanwhile */
+        if (generation == c->ring_generation) {
+            if (ret <= 0) {
+                c->io_eof_reached = 1;
+                if (c->inner_io_error < 0)
+                    c->io_error = c->inner_io_error;
+            } else {
+                ring_generic_write(c->ring, buf, ret, NULL);
+            }
         }
 
         pthread_cond_signal(&c->cond_wakeup_main);
@@ -245,7 +439,8 @@ static int async_open(URLContext *h, const char *arg, int flags, AVDictionary **
 
     av_strstart(arg, "async:", &arg);
 
-    ret = ring_init(&c->ring, BUFFER_CAPACITY, READ_BACK_CAPACITY);
+    c->ring = &c->rings[0];
+    ret = ring_init(c->ring, BUFFER_CAPACITY, READ_BACK_CAPACITY);
     if (ret < 0)
         goto fifo_fail;
 
@@ -295,7 +490,7 @@ cond_wakeup_main_fail:
 mutex_fail:
     ffurl_close(c->inner);
 url_fail:
-    ring_destroy(&c->ring);
+    ring_destroy(c->ring);
 fifo_fail:
     return ret;
 }
@@ -303,10 +498,10 @@ fifo_fail:
 static int async_close(URLContext *h)
 {
     Context *c = h->priv_data;
-    int      ret;
+    int      ret, i;
 
     pthread_mutex_lock(&c->mutex);
-    c->abort_request = 1;
+    atomic_store(&c->abort_request, 1);
     pthread_cond_signal(&c->cond_wakeup_background);
     pthread_mutex_unlock(&c->mutex);
 
@@ -318,7 +513,8 @@ static int async_close(URLContext *h)
     pthread_cond_destroy(&c->cond_wakeup_main);
     pthread_mutex_destroy(&c->mutex);
     ffurl_close(c->inner);
-    ring_destroy(&c->ring);
+    for (i = 0; i < MAX_RINGS; i++)
+        ring_destroy(&c->rings[i]);
 
     return 0;
 }
@@ -327,7 +523,6 @@ static int async_read_internal(URLContext *h, void *dest, int size, int read_com
                                void (*func)(void*, void*, int))
 {
     Context      *c       = h->priv_data;
-    RingBuffer   *ring    = &c->ring;
     int           to_read = size;
     int           ret     = 0;
 
@@ -339,10 +534,10 @@ static int async_read_internal(URLContext *h, void *dest, int size, int read_com
             ret = AVERROR_EXIT;
             break;
         }
-        fifo_size = ring_size(ring);
+        fifo_size = ring_size(c->ring);
         to_copy   = FFMIN(to_read, fifo_size);
         if (to_copy > 0) {
-            ring_generic_read(ring, dest, to_copy, func);
+            ring_generic_read(c->ring, dest, to_copy, func);
             if (!func)
                 dest = (uint8_t *)dest + to_copy;
             c->logical_pos += to_copy;
@@ -382,7 +577,6 @@ static void fifo_do_not_copy_func(void* dest, void* src, int size) {
 static int64_t async_seek(URLContext *h, int64_t pos, int whence)
 {
     Context      *c    = h->priv_data;
-    RingBuffer   *ring = &c->ring;
     int64_t       ret;
     int64_t       new_logical_pos;
     int fifo_size;
@@ -403,8 +597,10 @@ static int64_t async_seek(URLContext *h, int64_t pos, int whence)
     if (new_logical_pos < 0)
         return AVERROR(EINVAL);
 
-    fifo_size = ring_size(ring);
-    fifo_size_of_read_back = ring_size_of_read_back(ring);
+    pthread_mutex_lock(&c->mutex);
+    fifo_size = ring_size(c->ring);
+    fifo_size_of_read_back = ring_size_of_read_back(c->ring);
+    pthread_mutex_unlock(&c->mutex);
     if (new_logical_pos == c->logical_pos) {
         /* current position */
         return c->logical_pos;
@@ -417,12 +613,23 @@ static int64_t async_seek(URLContext *h, int64_t pos, int whence)
                 (int)(new_logical_pos - c->logical_pos), fifo_size);
 
         if (pos_delta > 0) {
+            pthread_mutex_lock(&c->mutex);
+            /* not buffered yet here, but maybe in a parked ring */
+            if (pos_delta >= ring_size(c->ring) && rings_resume(c, new_logical_pos)) {
+                av_log(h, AV_LOG_TRACE, "async_seek: resume ring at %"PRId64"\n", new_logical_pos);
+                pthread_cond_signal(&c->cond_wakeup_background);
+                pthread_mutex_unlock(&c->mutex);
+                return new_logical_pos;
+            }
+            pthread_mutex_unlock(&c->mutex);
             // fast seek forwards
             async_read_internal(h, NULL, pos_delta, 1, fifo_do_not_copy_func);
         } else {
             // fast seek backwards
-            ring_drain(ring, pos_delta);
+            pthread_mutex_lock(&c->mutex);
+            ring_drain(c->ring, pos_delta);
             c->logical_pos = new_logical_pos;
+            pthread_mutex_unlock(&c->mutex);
         }
 
         return c->logical_pos;
@@ -436,6 +643,14 @@ static int64_t async_seek(URLContext *h, int64_t pos, int whence)
 
     pthread_mutex_lock(&c->mutex);
 
+    if (rings_resume(c, new_logical_pos)) {
+        /* buffered in a parked ring */
+        av_log(h, AV_LOG_TRACE, "async_seek: resume ring at %"PRId64"\n", new_logical_pos);
+        pthread_cond_signal(&c->cond_wakeup_background);
+        pthread_mutex_unlock(&c->mutex);
+        return new_logical_pos;
+    }
+
     c->seek_request   = 1;
     c->seek_pos       = new_logical_pos;
     c->seek_whence    = SEEK_SET;
@@ -466,6 +681,8 @@ static int64_t async_seek(URLContext *h, int64_t pos, int whence)
 #define D AV_OPT_FLAG_DECODING_PARAM
 
 static const AVOption options[] = {
+    { "ranges", "maximum number of ranges kept buffered across seeks", OFFSET(nb_rings), AV_OPT_TYPE_INT, { .i64 = 3 }, 1, MAX_RINGS, D },
+    { "max_memory", "memory used by all the buffered ranges", OFFSET(max_memory), AV_OPT_TYPE_INT, { .i64 = 10 * 1024 * 1024 }, SHORT_SEEK_THRESHOLD, INT_MAX, D },
     {NULL},
 };
 
@@ -488,212 +705,3 @@ const URLProtocol ff_async_protocol = {
     .priv_data_size      = sizeof(Context),
     .priv_data_class     = &async_context_class,
 };
-
-#if 0
-
-#define TEST_SEEK_POS    (1536)
-#define TEST_STREAM_SIZE (2048)
-
-typedef struct TestContext {
-    AVClass        *class;
-    int64_t         logical_pos;
-    int64_t         logical_size;
-
-    /* options */
-    int             opt_read_error;
-} TestContext;
-
-static int async_test_open(URLContext *h, const char *arg, int flags, AVDictionary **options)
-{
-    TestContext *c = h->priv_data;
-    c->logical_pos  = 0;
-    c->logical_size = TEST_STREAM_SIZE;
-    return 0;
-}
-
-static int async_test_close(URLContext *h)
-{
-    return 0;
-}
-
-static int async_test_read(URLContext *h, unsigned char *buf, int size)
-{
-    TestContext *c = h->priv_data;
-    int          i;
-    int          read_len = 0;
-
-    if (c->opt_read_error)
-        return c->opt_read_error;
-
-    if (c->logical_pos >= c->logical_size)
-        return AVERROR_EOF;
-
-    for (i = 0; i < size; ++i) {
-        buf[i] = c->logical_pos & 0xFF;
-
-        c->logical_pos++;
-        read_len++;
-
-        if (c->logical_pos >= c->logical_size)
-            break;
-    }
-
-    return read_len;
-}
-
-static int64_t async_test_seek(URLContext *h, int64_t pos, int whence)
-{
-    TestContext *c = h->priv_data;
-    int64_t      new_logical_pos;
-
-    if (whence == AVSEEK_SIZE) {
-        return c->logical_size;
-    } else if (whence == SEEK_CUR) {
-        new_logical_pos = pos + c->logical_pos;
-    } else if (whence == SEEK_SET){
-        new_logical_pos = pos;
-    } else {
-        return AVERROR(EINVAL);
-    }
-    if (new_logical_pos < 0)
-        return AVERROR(EINVAL);
-
-    c->logical_pos = new_logical_pos;
-    return new_logical_pos;
-}
-
-#define OFFSET(x) offsetof(TestContext, x)
-#define D AV_OPT_FLAG_DECODING_PARAM
-
-static const AVOption async_test_options[] = {
-    { "async-test-read-error",      "cause read fail",
-        OFFSET(opt_read_error),     AV_OPT_TYPE_INT, { .i64 = 0 }, INT_MIN, INT_MAX, .flags = D },
-    {NULL},
-};
-
-#undef D
-#undef OFFSET
-
-static const AVClass async_test_context_class = {
-    .class_name = "Async-Test",
-    .item_name  = av_default_item_name,
-    .option     = async_test_options,
-    .version    = LIBAVUTIL_VERSION_INT,
-};
-
-const URLProtocol ff_async_test_protocol = {
-    .name                = "async-test",
-    .url_open2           = async_test_open,
-    .url_read            = async_test_read,
-    .url_seek            = async_test_seek,
-    .url_close           = async_test_close,
-    .priv_data_size      = sizeof(TestContext),
-    .priv_data_class     = &async_test_context_class,
-};
-
-int main(void)
-{
-    URLContext   *h = NULL;
-    int           i;
-    int           ret;
-    int64_t       size;
-    int64_t       pos;
-    int64_t       read_len;
-    unsigned char buf[4096];
-    AVDictionary *opts = NULL;
-
-    ffurl_register_protocol(&ff_async_protocol);
-    ffurl_register_protocol(&ff_async_test_protocol);
-
-    /*
-     * test normal read
-     */
-    ret = ffurl_open(&h, "async:async-test:", AVIO_FLAG_READ, NULL, NULL);
-    printf("open: %d\n", ret);
-
-    size = ffurl_size(h);
-    printf("size: %"PRId64"\n", size);
-
-    pos = ffurl_seek(h, 0, SEEK_CUR);
-    read_len = 0;
-    while (1) {
-        ret = ffurl_read(h, buf, sizeof(buf));
-        if (ret == AVERROR_EOF) {
-            printf("read-error: AVERROR_EOF at %"PRId64"\n", ffurl_seek(h, 0, SEEK_CUR));
-            break;
-        }
-        else if (ret == 0)
-            break;
-        else if (ret < 0) {
-            printf("read-error: %d at %"PRId64"\n", ret, ffurl_seek(h, 0, SEEK_CUR));
-            goto fail;
-        } else {
-            for (i = 0; i < ret; ++i) {
-                if (buf[i] != (pos & 0xFF)) {
-                    printf("read-mismatch: actual %d, expecting %d, at %"PRId64"\n",
-                           (int)buf[i], (int)(pos & 0xFF), pos);
-                    break;
-                }
-                pos++;
-            }
-        }
-
-        read_len += ret;
-    }
-    printf("read: %"PRId64"\n", read_len);
-
-    /*
-     * test normal seek
-     */
-    ret = ffurl_read(h, buf, 1);
-    printf("read: %d\n", ret);
-
-    pos = ffurl_seek(h, TEST_SEEK_POS, SEEK_SET);
-    printf("seek: %"PRId64"\n", pos);
-
-    read_len = 0;
-    while (1) {
-        ret = ffurl_read(h, buf, sizeof(buf));
-        if (ret == AVERROR_EOF)
-            break;
-        else if (ret == 0)
-            break;
-        else if (ret < 0) {
-            printf("read-error: %d at %"PRId64"\n", ret, ffurl_seek(h, 0, SEEK_CUR));
-            goto fail;
-        } else {
-            for (i = 0; i < ret; ++i) {
-                if (buf[i] != (pos & 0xFF)) {
-                    printf("read-mismatch: actual %d, expecting %d, at %"PRId64"\n",
-                           (int)buf[i], (int)(pos & 0xFF), pos);
-                    break;
-                }
-                pos++;
-            }
-        }
-
-        read_len += ret;
-    }
-    printf("read: %"PRId64"\n", read_len);
-
-    ret = ffurl_read(h, buf, 1);
-    printf("read: %d\n", ret);
-
-    /*
-     * test read error
-     */
-    ffurl_close(h);
-    av_dict_set_int(&opts, "async-test-read-error", -10000, 0);
-    ret = ffurl_open(&h, "async:async-test:", AVIO_FLAG_READ, NULL, &opts);
-    printf("open: %d\n", ret);
-
-    ret = ffurl_read(h, buf, 1);
-    printf("read: %d\n", ret);
-
-fail:
-    av_dict_free(&opts);
-    ffurl_close(h);
-    return 0;
-}
-
-#endif
@@ -23,17 +23,42 @@
 
 /**
  * @TODO
- *      support keeping files
  *      support filling with a background thread
  */
 
+/*
+ * With the cache_dir option, the cache is kept across sessions. Each
+ * resource has two files in the directory, named after the MD5 of its URL:
+ * key.data holds the cached bytes at their offset in the resource, as a
+ * sparse file, and key.index lists the cached ranges, with a validator made
+ * of the size, ETag and Last-Modified date of the resource. An entry whose
+ * validator does not match the reply anymore is replaced.
+ *
+ * Several readers may use the same entry. They all write the same bytes at
+ * the same offsets, and merge their ranges with the ones on disk when they
+ * save the index on close. Entries are never truncated in place: a replaced
+ * or evicted entry is unlinked, so that the readers still using it keep
+ * valid data, and they do not save their index if the data file they use is
+ * not the one in the directory anymore. The index updates and the eviction
+ * of the least recently used entries above cache_max_size are serialized by
+ * a lock file in the directory.
+ */
+
 #include "libavutil/avassert.h"
 #include "libavutil/avstring.h"
 #include "libavutil/internal.h"
+#include "libavutil/intreadwrite.h"
+#include "libavutil/md5.h"
 #include "libavutil/opt.h"
+#include "libavutil/thread.h"
+#include "libavutil/time.h"
 #include "libavutil/tree.h"
 #include "avformat.h"
+#include "internal.h"
 #include <fcntl.h>
+#if HAVE_DIRENT_H
+#include <dirent.h>
+#endif
 #if HAVE_IO_H
 #include <io.h>
 #endif
@@ -45,12 +70,31 @@
 #include "os_support.h"
 #include "url.h"
 
+#define INDEX_TAG     MKTAG('F', 'F', 'C', 'I')
+#define INDEX_VERSION 1
+/* tag, version, cached size, last use, validator length */
+#define INDEX_HEADER_SIZE 28
+#define INDEX_MAX_SIZE    (64 * 1024 * 1024)
+
 typedef struct CacheEntry {
     int64_t logical_pos;
     int64_t physical_pos;
     int size;
 } CacheEntry;
 
+typedef struct CacheRange {
+    int64_t start;
+    int64_t size;
+} CacheRange;
+
+typedef struct CacheIndex {
+    char *validator;
+    CacheRange *ranges;
+    int nb_ranges;
+    int64_t cached_size;
+    int64_t last_used;      ///< time of the last close, for the LRU eviction
+} CacheIndex;
+
 typedef struct Context {
     AVClass *class;
     int fd;
@@ -64,13 +108,427 @@ typedef struct Context {
     URLContext *inner;
     int64_t cache_hit, cache_miss;
     int read_ahead_limit;
+    char *cache_dir;
+    int64_t cache_max_size;
+    /* persistent entry, the data is stored at its logical position */
+    char *data_path;
+    char *index_path;
+    char *validator;
+    int64_t cached_size;
+    int cache_full;
 } Context;
 
+static int enu_free(void *opaque, void *elem)
+{
+    av_free(elem);
+    return 0;
+}
+
+/* serializes the index updates within the process, the lock file across processes */
+static AVMutex cache_dir_mutex = AV_MUTEX_INITIALIZER;
+
 static int cmp(const void *key, const void *node)
 {
     return FFDIFFSIGN(*(const int64_t *)key, ((const CacheEntry *) node)->logical_pos);
 }
 
+static int cache_lock(Context *c)
+{
+    int fd = -1;
+
+    ff_mutex_lock(&cache_dir_mutex);
+#if HAVE_FCNTL && defined(F_SETLKW)
+    {
+        char *path = av_asprintf("%s/lock", c->cache_dir);
+        if (path && (fd = avpriv_open(path, O_RDWR | O_CREAT, 0600)) >= 0) {
+            struct flock lock = { .l_type = F_WRLCK, .l_whence = SEEK_SET };
+            while (fcntl(fd, F_SETLKW, &lock) < 0 && errno == EINTR)
+                ;
+        }
+        av_free(path);
+    }
+#endif
+    return fd;
+}
+
+static void cache_unlock(int fd)
+{
+    if (fd >= 0)
+        close(fd);
+    ff_mutex_unlock(&cache_dir_mutex);
+}
+
+static void index_free(CacheIndex *index)
+{
+    av_freep(&index->validator);
+    av_freep(&index->ranges);
+    index->nb_ranges = 0;
+}
+
+/* Read an index file, only its header if ranges is 0. */
+static int index_read(const char *path, CacheIndex *index, int ranges)
+{
+    struct stat st;
+    uint8_t *buf = NULL;
+    const uint8_t *p;
+    int fd, ret = AVERROR_INVALIDDATA, len = 0, nb, i;
+    unsigned validator_len;
+
+    memset(index, 0, sizeof(*index));
+    if ((fd = avpriv_open(path, O_RDONLY)) < 0)
+        return AVERROR(errno);
+    if (fstat(fd, &st) < 0 || st.st_size < INDEX_HEADER_SIZE + 4 ||
+        st.st_size > INDEX_MAX_SIZE)
+        goto end;
+    if (!(buf = av_malloc(st.st_size))) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    while (len < st.st_size) {
+        int n = read(fd, buf + len, st.st_size - len);
+        if (n <= 0)
+            goto end;
+        len += n;
+    }
+
+    validator_len = AV_RL32(buf + 24);
+    if (AV_RL32(buf) != INDEX_TAG || AV_RL32(buf + 4) != INDEX_VERSION ||
+        validator_len > len - INDEX_HEADER_SIZE - 4)
+        goto end;
+    p  = buf + INDEX_HEADER_SIZE + validator_len;
+    nb = AV_RL32(p);
+    if (nb != (len - INDEX_HEADER_SIZE - 4 - validator_len) / 16 ||
+        (len - INDEX_HEADER_SIZE - 4 - validator_len) % 16)
+        goto end;
+
+    index->cached_size = AV_RL64(buf + 8);
+    index->last_used   = AV_RL64(buf + 16);
+    if (ranges) {
+        index->validator = av_strndup(buf + INDEX_HEADER_SIZE, validator_len);
+        index->ranges    = av_malloc_array(FFMAX(nb, 1), sizeof(*index->ranges));
+        if (!index->validator || !index->ranges) {
+            index_free(index);
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        for (i = 0, p += 4; i < nb; i++, p += 16) {
+            index->ranges[i].start = AV_RL64(p);
+            index->ranges[i].size  = AV_RL64(p + 8);
+        }
+        index->nb_ranges = nb;
+    }
+    ret = 0;
+end:
+    av_free(buf);
+    close(fd);
+    return ret;
+}
+
+/* Replace an index file, through a temporary file. Called with the lock held. */
+static int index_write(const char *path, const CacheIndex *index)
+{
+    int validator_len = strlen(index->validator);
+    char *tmp = NULL;
+    uint8_t *buf = NULL, *p;
+    int fd = -1, ret = 0, size, i;
+
+    if (validator_len > INDEX_MAX_SIZE / 2 ||
+        index->nb_ranges > (INDEX_MAX_SIZE / 2) / 16)
+        return AVERROR(EINVAL);
+    size = INDEX_HEADER_SIZE + validator_len + 4 + 16 * index->nb_ranges;
+    if (!(tmp = av_asprintf("%s.tmp", path)) || !(buf = av_malloc(size))) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    AV_WL32(buf,      INDEX_TAG);
+    AV_WL32(buf + 4,  INDEX_VERSION);
+    AV_WL64(buf + 8,  index->cached_size);
+    AV_WL64(buf + 16, index->last_used);
+    AV_WL32(buf + 24, validator_len);
+    memcpy(buf + INDEX_HEADER_SIZE, index->validator, validator_len);
+    p = buf + INDEX_HEADER_SIZE + validator_len;
+    AV_WL32(p, index->nb_ranges);
+    for (i = 0, p += 4; i < index->nb_ranges; i++, p += 16) {
+        AV_WL64(p,     index->ranges[i].start);
+        AV_WL64(p + 8, index->ranges[i].size);
+    }
+
+    if ((fd = avpriv_open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0 ||
+        write(fd, buf, size) != size) {
+        ret = AVERROR(errno);
+        goto end;
+    }
+    close(fd);
+    fd = -1;
+    if (rename(tmp, path) < 0)
+        ret = AVERROR(errno);
+end:
+    if (fd >= 0)
+        close(fd);
+    if (ret < 0 && tmp)
+        unlink(tmp);
+    av_free(tmp);
+    av_free(buf);
+    return ret;
+}
+
+static int cmp_range(const void *a, const void *b)
+{
+    return FFDIFFSIGN(((const CacheRange *)a)->start, ((const CacheRange *)b)->start);
+}
+
+/* Sort and merge the overlapping or adjacent ranges of an index. */
+static void merge_ranges(CacheIndex *index)
+{
+    CacheRange *ranges = index->ranges;
+    int i, n = 0;
+
+    index->cached_size = 0;
+    if (!index->nb_ranges)
+        return;
+    qsort(ranges, index->nb_ranges, sizeof(*ranges), cmp_range);
+    for (i = 1; i < index->nb_ranges; i++) {
+        CacheRange *last = &ranges[n];
+        if (ranges[i].start <= last->start + last->size) {
+            last->size = FFMAX(last->size, ranges[i].start + ranges[i].size - last->start);
+        } else {
+            index->cached_size += last->size;
+            ranges[++n] = ranges[i];
+        }
+    }
+    index->cached_size += ranges[n].size;
+    index->nb_ranges    = n + 1;
+}
+
+/* Append the entries of the tree to the ranges of an index, or count them. */
+static int enu_range(void *opaque, void *elem)
+{
+    CacheIndex *index = opaque;
+    const CacheEntry *entry = elem;
+
+    if (index->ranges) {
+        index->ranges[index->nb_ranges].start = entry->logical_pos;
+        index->ranges[index->nb_ranges].size  = entry->size;
+    }
+    index->nb_ranges++;
+    return 0;
+}
+
+typedef struct CacheFile {
+    char *index_path;
+    int64_t last_used;
+    int64_t size;
+} CacheFile;
+
+static int cmp_last_used(const void *a, const void *b)
+{
+    return FFDIFFSIGN(((const CacheFile *)a)->last_used, ((const CacheFile *)b)->last_used);
+}
+
+/*
+ * Remove the least recently used entries until the cached bytes fit in
+ * cache_max_size. Called with the lock held.
+ */
+static void cache_evict(URLContext *h)
+{
+#if HAVE_DIRENT_H
+    Context *c = h->priv_data;
+    CacheFile *files = NULL;
+    int nb_files = 0, i;
+    int64_t total = 0;
+    struct dirent *de;
+    DIR *dir;
+
+    if (!(dir = opendir(c->cache_dir)))
+        return;
+    while ((de = readdir(dir))) {
+        const char *ext = strrchr(de->d_name, '.');
+        CacheIndex index;
+        CacheFile file;
+        void *tmp;
+
+        if (!ext || strcmp(ext, ".index"))
+            continue;
+        if (!(file.index_path = av_asprintf("%s/%s", c->cache_dir, de->d_name)))
+            break;
+        if (index_read(file.index_path, &index, 0) < 0 ||
+            !(tmp = av_realloc_array(files, nb_files + 1, sizeof(*files)))) {
+            av_free(file.index_path);
+            continue;
+        }
+        file.last_used    = index.last_used;
+        file.size         = index.cached_size;
+        files             = tmp;
+        files[nb_files++] = file;
+        total            += file.size;
+    }
+    closedir(dir);
+
+    qsort(files, nb_files, sizeof(*files), cmp_last_used);
+    for (i = 0; i < nb_files && total > c->cache_max_size; i++) {
+        char *path = files[i].index_path;
+        size_t len = strlen(path) - strlen(".index");
+
+        av_log(h, AV_LOG_VERBOSE, "Evicting %.*s\n", (int)len, path);
+        unlink(path);
+        /* ".data" is shorter than ".index" */
+        memcpy(path + len, ".data", sizeof(".data"));
+        unlink(path);
+        total -= files[i].size;
+    }
+    for (i = 0; i < nb_files; i++)
+        av_free(files[i].index_path);
+    av_free(files);
+#endif
+}
+
+static int add_range(Context *c, int64_t pos, int64_t size)
+{
+    while (size > 0) {
+        CacheEntry *entry = av_malloc(sizeof(*entry));
+        struct AVTreeNode *node = av_tree_node_alloc();
+
+        if (!entry || !node) {
+            av_free(entry);
+            av_free(node);
+            return AVERROR(ENOMEM);
+        }
+        entry->logical_pos  = pos;
+        entry->physical_pos = pos;
+        entry->size         = FFMIN(size, 1 << 30);
+        av_tree_insert(&c->root, entry, cmp, &node);
+        /* another entry at the same position */
+        if (node) {
+            av_free(entry);
+            av_free(node);
+        }
+        pos  += 1 << 30;
+        size -= 1 << 30;
+    }
+    return 0;
+}
+
+/* The validator of the reply, or AVERROR(ENOSYS) if it cannot be validated. */
+static int cache_validator(URLContext *h)
+{
+    Context *c = h->priv_data;
+    int64_t size = ffurl_size(c->inner);
+    uint8_t *etag = NULL, *last_modified = NULL;
+
+    av_opt_get(c->inner, "etag", AV_OPT_SEARCH_CHILDREN, &etag);
+    av_opt_get(c->inner, "last_modified", AV_OPT_SEARCH_CHILDREN, &last_modified);
+    if (size > 0 || (etag && *etag) || (last_modified && *last_modified))
+        c->validator = av_asprintf("size=%"PRId64";etag=%s;last-modified=%s",
+                                   FFMAX(size, -1), etag ? (char *)etag : "",
+                                   last_modified ? (char *)last_modified : "");
+    av_free(etag);
+    av_free(last_modified);
+    if (size <= 0 && !c->validator)
+        return AVERROR(ENOSYS);
+    return c->validator ? 0 : AVERROR(ENOMEM);
+}
+
+static int cache_open_persistent(URLContext *h, const char *url)
+{
+    Context *c = h->priv_data;
+    CacheIndex index = { NULL };
+    char key[33];
+    uint8_t md5[16];
+    int lock_fd, ret, i;
+
+    if ((ret = cache_validator(h)) < 0)
+        return ret;
+    av_md5_sum(md5, url, strlen(url));
+    ff_data_to_hex(key, md5, sizeof(md5), 1);
+    key[32] = '\0';
+    if (!(c->data_path  = av_asprintf("%s/%s.data",  c->cache_dir, key)) ||
+        !(c->index_path = av_asprintf("%s/%s.index", c->cache_dir, key)))
+        return AVERROR(ENOMEM);
+    mkdir(c->cache_dir, 0700);
+
+    lock_fd = cache_lock(c);
+    c->fd = -1;
+    if (index_read(c->index_path, &index, 1) >= 0 &&
+        !strcmp(index.validator, c->validator))
+        c->fd = avpriv_open(c->data_path, O_RDWR);
+    if (c->fd < 0) {
+        /* new files, the readers of the old ones can go on with them */
+        index_free(&index);
+        index.validator = c->validator;
+        index.last_used = av_gettime();
+        unlink(c->data_path);
+        c->fd = avpriv_open(c->data_path, O_RDWR | O_CREAT | O_EXCL, 0600);
+        ret   = c->fd < 0 ? AVERROR(errno) : index_write(c->index_path, &index);
+        index.validator = NULL;
+    }
+    cache_unlock(lock_fd);
+
+    for (i = 0; ret >= 0 && i < index.nb_ranges; i++) {
+        CacheRange *r = &index.ranges[i];
+        ret = add_range(c, r->start, r->size);
+        c->end          = FFMAX(c->end, r->start + r->size);
+        c->cached_size += r->size;
+    }
+    index_free(&index);
+    if (ret < 0) {
+        if (c->fd >= 0)
+            close(c->fd);
+        av_tree_enumerate(c->root, NULL, NULL, enu_free);
+        av_tree_destroy(c->root);
+        c->root        = NULL;
+        c->end         = 0;
+        c->cached_size = 0;
+        return ret;
+    }
+    av_log(h, AV_LOG_VERBOSE, "Cache entry %s: %"PRId64" bytes\n",
+           key, c->cached_size);
+    return 0;
+}
+
+/* Merge the ranges of this reader in the index, then enforce the size cap. */
+static void cache_save(URLContext *h)
+{
+    Context *c = h->priv_data;
+    CacheIndex index = { NULL }, disk;
+    int nb_entries, lock_fd, ret;
+    struct stat st_path, st_fd;
+
+    av_tree_enumerate(c->root, &index, NULL, enu_range);
+    nb_entries      = index.nb_ranges;
+    index.nb_ranges = 0;
+
+    lock_fd = cache_lock(c);
+    /* the entry was replaced or evicted while we were using it */
+    if (stat(c->data_path, &st_path) < 0 || fstat(c->fd, &st_fd) < 0 ||
+        st_path.st_dev != st_fd.st_dev || st_path.st_ino != st_fd.st_ino)
+        goto end;
+
+    /* the ranges other readers saved since we opened */
+    if (index_read(c->index_path, &disk, 1) >= 0 && strcmp(disk.validator, c->validator))
+        index_free(&disk);
+    index.ranges = av_malloc_array(disk.nb_ranges + nb_entries + 1, sizeof(*index.ranges));
+    if (!index.ranges) {
+        index_free(&disk);
+        goto end;
+    }
+    memcpy(index.ranges, disk.ranges, disk.nb_ranges * sizeof(*index.ranges));
+    index.nb_ranges = disk.nb_ranges;
+    index_free(&disk);
+    av_tree_enumerate(c->root, &index, NULL, enu_range);
+    merge_ranges(&index);
+
+    index.validator = c->validator;
+    index.last_used = av_gettime();
+    ret = index_write(c->index_path, &index);
+    index.validator = NULL;
+    if (ret < 0)
+        av_log(h, AV_LOG_ERROR, "Could not write %s: %s\n", c->index_path, av_err2str(ret));
+    cache_evict(h);
+end:
+    cache_unlock(lock_fd);
+    index_free(&index);
+}
+
 static int cache_open(URLContext *h, const char *arg, int flags, AVDictionary **options)
 {
     int ret;
@@ -79,9 +537,26 @@ static int cache_open(URLContext *h, const char *arg, int flags, AVDictionary **
 
     av_strstart(arg, "cache:", &arg);
 
+    ret = ffurl_open_whitelist(&c->inner, arg, flags, &h->interrupt_callback,
+                               options, h->protocol_whitelist, h->protocol_blacklist, h);
+    if (ret < 0)
+        return ret;
+
+    if (c->cache_dir && *c->cache_dir) {
+        ret = cache_open_persistent(h, arg);
+        if (ret >= 0)
+            return 0;
+        av_log(h, ret == AVERROR(ENOSYS) ? AV_LOG_VERBOSE : AV_LOG_WARNING,
+               "Cannot keep %s in %s, using a temporary file\n", arg, c->cache_dir);
+        av_freep(&c->data_path);
+        av_freep(&c->index_path);
+        av_freep(&c->validator);
+    }
+
     c->fd = avpriv_tempfile("ffcache", &buffername, 0, h);
     if (c->fd < 0){
         av_log(h, AV_LOG_ERROR, "Failed to create tempfile\n");
+        ffurl_closep(&c->inner);
         return c->fd;
     }
 
@@ -92,8 +567,7 @@ static int cache_open(URLContext *h, const char *arg, int flags, AVDictionary **
     else
         c->filename = buffername;
 
-    return ffurl_open_whitelist(&c->inner, arg, flags, &h->interrupt_callback,
-                                options, h->protocol_whitelist, h->protocol_blacklist, h);
+    return 0;
 }
 
 static int add_entry(URLContext *h, const unsigned char *buf, int size)
@@ -105,8 +579,20 @@ static int add_entry(URLContext *h, const unsigned char *buf, int size)
     CacheEntry *entry_ret;
     struct AVTreeNode *node = NULL;
 
-    //FIXME avoid lseek
-    pos = lseek(c->fd, 0, SEEK_END);
+    if (c->index_path) {
+        /* a persistent entry keeps the data at its logical position */
+        if (c->cached_size + size > c->cache_max_size) {
+            if (!c->cache_full)
+                av_log(h, AV_LOG_VERBOSE, "cache_max_size reached, "
+                       "not caching the rest of the entry\n");
+            c->cache_full = 1;
+            return 0;
+        }
+        pos = lseek(c->fd, c->logical_pos, SEEK_SET);
+    } else {
+        //FIXME avoid lseek
+        pos = lseek(c->fd, 0, SEEK_END);
+    }
     if (pos < 0) {
         ret = AVERROR(errno);
         av_log(h, AV_LOG_ERROR, "seek in cache failed\n");
@@ -121,6 +607,8 @@ static int add_entry(URLContext *h, const unsigned char *buf, int size)
         goto fail;
     }
     c->cache_pos += ret;
+    if (c->index_path)
+        c->cached_size += ret;
 
     entry = av_tree_find(c->root, &c->logical_pos, cmp, (void**)next);
 
@@ -197,6 +685,10 @@ static int cache_read(URLContext *h, unsigned char *buf, int size)
 
     // Cache miss or some kind of fault with the cache
 
+    // stop at the next cached block, which is read from the cache
+    if (next[1] && next[1]->logical_pos > c->logical_pos)
+        size = FFMIN(size, next[1]->logical_pos - c->logical_pos);
+
     if (c->logical_pos != c->inner_pos) {
         r = ffurl_seek(c->inner, c->logical_pos, SEEK_SET);
         if (r<0) {
@@ -289,12 +781,6 @@ resolve_eof:
     return ret;
 }
 
-static int enu_free(void *opaque, void *elem)
-{
-    av_free(elem);
-    return 0;
-}
-
 static int cache_close(URLContext *h)
 {
     Context *c= h->priv_data;
@@ -303,6 +789,8 @@ static int cache_close(URLContext *h)
     av_log(h, AV_LOG_INFO, "Statistics, cache hits:%"PRId64" cache misses:%"PRId64"\n",
            c->cache_hit, c->cache_miss);
 
+    if (c->index_path)
+        cache_save(h);
     close(c->fd);
     if (c->filename) {
         ret = unlink(c->filename);
@@ -313,6 +801,9 @@ static int cache_close(URLContext *h)
     ffurl_close(c->inner);
     av_tree_enumerate(c->root, NULL, NULL, enu_free);
     av_tree_destroy(c->root);
+    av_freep(&c->data_path);
+    av_freep(&c->index_path);
+    av_freep(&c->validator);
 
     return 0;
 }
@@ -322,6 +813,8 @@ static int cache_close(URLContext *h)
 
 static const AVOption options[] = {
     { "read_ahead_limit", "Amount in bytes that may be read ahead when seeking isn't supported, -1 for unlimited", OFFSET(read_ahead_limit), AV_OPT_TYPE_INT, { .i64 = 65536 }, -1, INT_MAX, D },
+    { "cache_dir", "Directory where the cache is kept across sessions, a temporary file is used if empty", OFFSET(cache_dir), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, D },
+    { "cache_max_size", "Maximum size in bytes of the cache directory", OFFSET(cache_max_size), AV_OPT_TYPE_INT64, { .i64 = 512 * 1024 * 1024 }, 0, INT64_MAX, D },
     {NULL},
 };
 
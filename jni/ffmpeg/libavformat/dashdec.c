@@ -20,6 +20,7 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 #include <libxml/parser.h>
+#include <libxml/SAX2.h>
 #include "libavutil/intreadwrite.h"
 #include "libavutil/opt.h"
 #include "libavutil/time.h"
@@ -27,6 +28,7 @@
 #include "internal.h"
 #include "avio_internal.h"
 #include "dash.h"
+#include "prefetch.h"
 
 #define INITIAL_BUFFER_SIZE 32768
 
@@ -93,7 +95,8 @@ struct representation {
     struct fragment **fragments; /* VOD list of fragment for profile */
 
     int n_timelines;
-    struct timeline **timelines;
+    struct timeline *timelines;
+    unsigned int timelines_size;
 
     int64_t first_seq_no;
     int64_t last_seq_no;
@@ -117,6 +120,10 @@ struct representation {
     uint32_t init_sec_buf_read_offset;
     int64_t cur_timestamp;
     int is_restart_needed;
+
+    /* the current fragment is read from the prefetch queue */
+    int prefetching;
+    FFPrefetchQueue *prefetch;
 };
 
 typedef struct DASHContext {
@@ -170,6 +177,9 @@ typedef struct DASHContext {
     char *io_manager_ctx;
     char *app_ctx;
 
+    int prefetch_segments;
+    int64_t prefetch_max_memory;
+    FFPrefetch *prefetch;
 } DASHContext;
 
 static int ishttp(char *url)
@@ -271,24 +281,24 @@ static int64_t get_segment_start_time_based_on_timeline(struct representation *p
 
     if (pls->n_timelines) {
         for (i = 0; i < pls->n_timelines; i++) {
-            if (pls->timelines[i]->starttime > 0) {
-                start_time = pls->timelines[i]->starttime;
+            if (pls->timelines[i].starttime > 0) {
+                start_time = pls->timelines[i].starttime;
             }
             if (num == cur_seq_no)
                 goto finish;
 
-            start_time += pls->timelines[i]->duration;
+            start_time += pls->timelines[i].duration;
 
-            if (pls->timelines[i]->repeat == -1) {
-                start_time = pls->timelines[i]->duration * cur_seq_no;
+            if (pls->timelines[i].repeat == -1) {
+                start_time = pls->timelines[i].duration * cur_seq_no;
                 goto finish;
             }
 
-            for (j = 0; j < pls->timelines[i]->repeat; j++) {
+            for (j = 0; j < pls->timelines[i].repeat; j++) {
                 num++;
                 if (num == cur_seq_no)
                     goto finish;
-                start_time += pls->timelines[i]->duration;
+                start_time += pls->timelines[i].duration;
             }
             num++;
         }
@@ -305,18 +315,18 @@ static int64_t calc_next_seg_no_from_timelines(struct representation *pls, int64
     int64_t start_time = 0;
 
     for (i = 0; i < pls->n_timelines; i++) {
-        if (pls->timelines[i]->starttime > 0) {
-            start_time = pls->timelines[i]->starttime;
+        if (pls->timelines[i].starttime > 0) {
+            start_time = pls->timelines[i].starttime;
         }
         if (start_time > cur_time)
             goto finish;
 
-        start_time += pls->timelines[i]->duration;
-        for (j = 0; j < pls->timelines[i]->repeat; j++) {
+        start_time += pls->timelines[i].duration;
+        for (j = 0; j < pls->timelines[i].repeat; j++) {
             num++;
             if (start_time > cur_time)
                 goto finish;
-            start_time += pls->timelines[i]->duration;
+            start_time += pls->timelines[i].duration;
         }
         num++;
     }
@@ -349,13 +359,9 @@ static void free_fragment_list(struct representation *pls)
 
 static void free_timelines_list(struct representation *pls)
 {
-    int i;
-
-    for (i = 0; i < pls->n_timelines; i++) {
-        av_freep(&pls->timelines[i]);
-    }
     av_freep(&pls->timelines);
     pls->n_timelines = 0;
+    pls->timelines_size = 0;
 }
 
 static void free_representation(struct representation *pls)
@@ -681,38 +687,206 @@ static int parse_manifest_segmenturlnode(AVFormatContext *s, struct representati
     return 0;
 }
 
-static int parse_manifest_segmenttimeline(AVFormatContext *s, struct representation *rep,
-                                          xmlNodePtr fragment_timeline_node)
+/*
+ * The S elements of a SegmentTimeline are not built into the document:
+ * long timelines would cost a node and three attributes per segment. They
+ * are decoded while the manifest is parsed, into a list attached to the
+ * SegmentTimeline node.
+ */
+struct timeline_list {
+    struct timeline *entries;
+    int n_entries;
+    unsigned int entries_size;
+    /* start time of a following S element without @t */
+    int64_t end;
+};
+
+typedef struct MPDParser {
+    /* depth inside an element that is not built into the document */
+    int skip_depth;
+    int n_timeline_lists;
+    struct timeline_list **timeline_lists;
+    int error;
+} MPDParser;
+
+static void free_timeline_lists(MPDParser *p)
 {
-    xmlAttrPtr attr = NULL;
-    char *val  = NULL;
+    int i;
 
-    if (!av_strcasecmp(fragment_timeline_node->name, (const char *)"S")) {
-        struct timeline *tml = av_mallocz(sizeof(struct timeline));
-        if (!tml) {
+    for (i = 0; i < p->n_timeline_lists; i++) {
+        av_freep(&p->timeline_lists[i]->entries);
+        av_freep(&p->timeline_lists[i]);
+    }
+    av_freep(&p->timeline_lists);
+    p->n_timeline_lists = 0;
+}
+
+static int add_timeline_entry(MPDParser *p, xmlNodePtr timeline_node,
+                              int nb_attributes, const xmlChar **attributes)
+{
+    struct timeline_list *list = timeline_node->_private;
+    struct timeline tml = { 0 }, *entries;
+    int64_t t = -1;
+    int i;
+
+    if (!list) {
+        list = av_mallocz(sizeof(*list));
+        if (!list)
+            return AVERROR(ENOMEM);
+        if (av_dynarray_add_nofree(&p->timeline_lists, &p->n_timeline_lists, list) < 0) {
+            av_free(list);
             return AVERROR(ENOMEM);
         }
-        attr = fragment_timeline_node->properties;
-        while (attr) {
-            val = xmlGetProp(fragment_timeline_node, attr->name);
+        timeline_node->_private = list;
+    }
 
-            if (!val) {
-                av_log(s, AV_LOG_WARNING, "parse_manifest_segmenttimeline attr->name = %s val is NULL\n", attr->name);
-                continue;
-            }
+    /* each attribute is localname, prefix, URI, value and end of value */
+    for (i = 0; i < nb_attributes; i++) {
+        const xmlChar **attr = attributes + 5 * i;
+        char val[32];
+        int len = FFMIN(attr[4] - attr[3], sizeof(val) - 1);
 
-            if (!av_strcasecmp(attr->name, (const char *)"t")) {
-                tml->starttime = (int64_t)strtoll(val, NULL, 10);
-            } else if (!av_strcasecmp(attr->name, (const char *)"r")) {
-                tml->repeat =(int64_t) strtoll(val, NULL, 10);
-            } else if (!av_strcasecmp(attr->name, (const char *)"d")) {
-                tml->duration = (int64_t)strtoll(val, NULL, 10);
-            }
-            attr = attr->next;
-            xmlFree(val);
+        memcpy(val, attr[3], len);
+        val[len] = '\0';
+        if (!av_strcasecmp(attr[0], "t")) {
+            t = strtoll(val, NULL, 10);
+        } else if (!av_strcasecmp(attr[0], "r")) {
+            tml.repeat = strtoll(val, NULL, 10);
+        } else if (!av_strcasecmp(attr[0], "d")) {
+            tml.duration = strtoll(val, NULL, 10);
         }
-        dynarray_add(&rep->timelines, &rep->n_timelines, tml);
     }
+    tml.starttime = t >= 0 ? t : list->end;
+    list->end = tml.starttime + tml.duration * (FFMAX(tml.repeat, 0) + 1);
+
+    entries = av_fast_realloc(list->entries, &list->entries_size,
+                              (list->n_entries + 1) * sizeof(*entries));
+    if (!entries)
+        return AVERROR(ENOMEM);
+    list->entries = entries;
+    list->entries[list->n_entries++] = tml;
+    return 0;
+}
+
+static int is_timeline_node(xmlNodePtr node)
+{
+    return node && node->type == XML_ELEMENT_NODE &&
+           !av_strcasecmp(node->name, "SegmentTimeline");
+}
+
+static void mpd_start_element(void *ctx, const xmlChar *localname,
+                              const xmlChar *prefix, const xmlChar *URI,
+                              int nb_namespaces, const xmlChar **namespaces,
+                              int nb_attributes, int nb_defaulted,
+                              const xmlChar **attributes)
+{
+    xmlParserCtxtPtr ctxt = ctx;
+    MPDParser *p = ctxt->_private;
+
+    if (p->skip_depth) {
+        p->skip_depth++;
+        return;
+    }
+    if (is_timeline_node(ctxt->node) && !av_strcasecmp(localname, "S")) {
+        p->skip_depth = 1;
+        if ((p->error = add_timeline_entry(p, ctxt->node, nb_attributes, attributes)) < 0)
+            xmlStopParser(ctxt);
+        return;
+    }
+    xmlSAX2StartElementNs(ctx, localname, prefix, URI, nb_namespaces,
+                          namespaces, nb_attributes, nb_defaulted, attributes);
+}
+
+static void mpd_end_element(void *ctx, const xmlChar *localname,
+                            const xmlChar *prefix, const xmlChar *URI)
+{
+    xmlParserCtxtPtr ctxt = ctx;
+    MPDParser *p = ctxt->_private;
+
+    if (p->skip_depth) {
+        p->skip_depth--;
+        return;
+    }
+    xmlSAX2EndElementNs(ctx, localname, prefix, URI);
+}
+
+static void mpd_characters(void *ctx, const xmlChar *ch, int len)
+{
+    xmlParserCtxtPtr ctxt = ctx;
+    MPDParser *p = ctxt->_private;
+
+    /* nor the whitespace between the S elements */
+    if (p->skip_depth || is_timeline_node(ctxt->node))
+        return;
+    xmlSAX2Characters(ctx, ch, len);
+}
+
+/*
+ * Parse the manifest while it is read, building the document except for the
+ * S elements of the SegmentTimelines.
+ */
+static int read_manifest(AVFormatContext *s, AVIOContext *in, const char *url,
+                         MPDParser *p, xmlDoc **doc)
+{
+    xmlSAXHandler sax;
+    xmlParserCtxtPtr ctxt;
+    char *buffer;
+    int64_t size = 0;
+    int ret;
+
+    *doc = NULL;
+    buffer = av_malloc(INITIAL_BUFFER_SIZE);
+    if (!buffer)
+        return AVERROR(ENOMEM);
+
+    xmlSAXVersion(&sax, 2);
+    sax.startElementNs      = mpd_start_element;
+    sax.endElementNs        = mpd_end_element;
+    sax.characters          = mpd_characters;
+    sax.ignorableWhitespace = mpd_characters;
+    ctxt = xmlCreatePushParserCtxt(&sax, NULL, NULL, 0, url);
+    if (!ctxt) {
+        av_free(buffer);
+        return AVERROR(ENOMEM);
+    }
+    ctxt->_private = p;
+
+    while ((ret = avio_read(in, buffer, INITIAL_BUFFER_SIZE)) > 0) {
+        size += ret;
+        if (xmlParseChunk(ctxt, buffer, ret, 0) || p->error)
+            break;
+    }
+    if (ret >= 0 || ret == AVERROR_EOF) {
+        ret = p->error;
+        if (!ret && !size)
+            ret = AVERROR_INVALIDDATA;
+    }
+    if (!ret) {
+        xmlParseChunk(ctxt, NULL, 0, 1);
+        ret = p->error;
+    }
+    if (!ret && ctxt->wellFormed)
+        *doc = ctxt->myDoc;
+    else
+        xmlFreeDoc(ctxt->myDoc);
+    ctxt->myDoc = NULL;
+    xmlFreeParserCtxt(ctxt);
+    av_free(buffer);
+    return ret;
+}
+
+static int parse_manifest_segmenttimeline(AVFormatContext *s, struct representation *rep,
+                                          xmlNodePtr fragment_timeline_node)
+{
+    struct timeline_list *list = fragment_timeline_node->_private;
+
+    if (!list || !list->n_entries)
+        return 0;
+    rep->timelines = av_memdup(list->entries, list->n_entries * sizeof(*list->entries));
+    if (!rep->timelines)
+        return AVERROR(ENOMEM);
+    rep->n_timelines    = list->n_entries;
+    rep->timelines_size = list->n_entries * sizeof(*list->entries);
 
     return 0;
 }
@@ -992,13 +1166,9 @@ static int parse_manifest_representation(AVFormatContext *s, const char *url,
             if (!fragment_timeline_node)
                 fragment_timeline_node = find_child_node_by_name(period_segmentlist_node, "SegmentTimeline");
             if (fragment_timeline_node) {
-                fragment_timeline_node = xmlFirstElementChild(fragment_timeline_node);
-                while (fragment_timeline_node) {
-                    ret = parse_manifest_segmenttimeline(s, rep, fragment_timeline_node);
-                    if (ret < 0) {
-                        return ret;
-                    }
-                    fragment_timeline_node = xmlNextElementSibling(fragment_timeline_node);
+                ret = parse_manifest_segmenttimeline(s, rep, fragment_timeline_node);
+                if (ret < 0) {
+                    return ret;
                 }
             }
         } else if (representation_baseurl_node && !representation_segmentlist_node) {
@@ -1063,13 +1233,9 @@ static int parse_manifest_representation(AVFormatContext *s, const char *url,
             if (!fragment_timeline_node)
                 fragment_timeline_node = find_child_node_by_name(period_segmentlist_node, "SegmentTimeline");
             if (fragment_timeline_node) {
-                fragment_timeline_node = xmlFirstElementChild(fragment_timeline_node);
-                while (fragment_timeline_node) {
-                    ret = parse_manifest_segmenttimeline(s, rep, fragment_timeline_node);
-                    if (ret < 0) {
-                        return ret;
-                    }
-                    fragment_timeline_node = xmlNextElementSibling(fragment_timeline_node);
+                ret = parse_manifest_segmenttimeline(s, rep, fragment_timeline_node);
+                if (ret < 0) {
+                    return ret;
                 }
             }
         } else {
@@ -1222,9 +1388,8 @@ static int parse_manifest(AVFormatContext *s, const char *url, AVIOContext *in)
     int ret = 0;
     int close_in = 0;
     uint8_t *new_url = NULL;
-    int64_t filesize = 0;
-    char *buffer = NULL;
     AVDictionary *opts = NULL;
+    MPDParser parser = { 0 };
     xmlDoc *doc = NULL;
     xmlNodePtr root_element = NULL;
     xmlNodePtr node = NULL;
@@ -1260,25 +1425,12 @@ static int parse_manifest(AVFormatContext *s, const char *url, AVIOContext *in)
         c->base_url = av_strdup(url);
     }
 
-    filesize = avio_size(in);
-    if (filesize <= 0) {
-        filesize = 8 * 1024;
-    }
-
-    buffer = av_mallocz(filesize);
-    if (!buffer) {
-        av_free(c->base_url);
-        return AVERROR(ENOMEM);
-    }
+    LIBXML_TEST_VERSION
 
-    filesize = avio_read(in, buffer, filesize);
-    if (filesize <= 0) {
-        av_log(s, AV_LOG_ERROR, "Unable to read to offset '%s'\n", url);
-        ret = AVERROR_INVALIDDATA;
+    ret = read_manifest(s, in, c->base_url, &parser, &doc);
+    if (ret < 0) {
+        av_log(s, AV_LOG_ERROR, "Unable to read '%s'\n", url);
     } else {
-        LIBXML_TEST_VERSION
-
-        doc = xmlReadMemory(buffer, filesize, c->base_url, NULL, 0);
         root_element = xmlDocGetRootElement(doc);
         node = root_element;
 
@@ -1400,8 +1552,8 @@ cleanup:
         xmlFreeNode(mpd_baseurl_node);
     }
 
+    free_timeline_lists(&parser);
     av_free(new_url);
-    av_free(buffer);
     if (close_in) {
         avio_close(in);
     }
@@ -1470,11 +1622,11 @@ static int64_t calc_max_seg_no(struct representation *pls, DASHContext *c)
         int i = 0;
         num = pls->first_seq_no + pls->n_timelines - 1;
         for (i = 0; i < pls->n_timelines; i++) {
-            if (pls->timelines[i]->repeat == -1) {
-                int length_of_each_segment = pls->timelines[i]->duration / pls->fragment_timescale;
+            if (pls->timelines[i].repeat == -1) {
+                int length_of_each_segment = pls->timelines[i].duration / pls->fragment_timescale;
                 num =  c->period_duration / length_of_each_segment;
             } else {
-                num += pls->timelines[i]->repeat;
+                num += pls->timelines[i].repeat;
             }
         }
     } else if (c->is_live && pls->fragment_duration) {
@@ -1500,6 +1652,81 @@ static void move_timelines(struct representation *rep_src, struct representation
     }
 }
 
+static int64_t timeline_end(const struct timeline *tml)
+{
+    return tml->starttime + tml->duration * (tml->repeat + 1);
+}
+
+/*
+ * Merge the timeline of a refreshed manifest into the current one: drop the
+ * segments that left the window, append the new ones, and keep cur_seq_no on
+ * the same segment. Returns a negative value if the timelines cannot be
+ * merged, e.g. do not overlap.
+ */
+static int merge_timelines(struct representation *rep_src, struct representation *rep_dest, DASHContext *c)
+{
+    struct timeline *dst = rep_dest->timelines, *src = rep_src->timelines;
+    int n = rep_dest->n_timelines, i, k;
+    int64_t start, end, dropped = 0;
+
+    if (!n || !rep_src->n_timelines)
+        return AVERROR_INVALIDDATA;
+    for (i = 0; i < n; i++)
+        if (dst[i].repeat < 0 || dst[i].duration <= 0)
+            return AVERROR_INVALIDDATA;
+    for (i = 0; i < rep_src->n_timelines; i++)
+        if (src[i].repeat < 0 || src[i].duration <= 0)
+            return AVERROR_INVALIDDATA;
+    start = src[0].starttime;
+    end   = timeline_end(&dst[n - 1]);
+    if (start < dst[0].starttime || start > end)
+        return AVERROR_INVALIDDATA;
+
+    /* drop the segments before the new window */
+    for (i = 0; i < n && timeline_end(&dst[i]) <= start; i++)
+        dropped += dst[i].repeat + 1;
+    if (i < n && dst[i].starttime < start) {
+        k = (start - dst[i].starttime) / dst[i].duration;
+        dst[i].starttime += k * dst[i].duration;
+        dst[i].repeat    -= k;
+        dropped          += k;
+    }
+    n -= i;
+    memmove(dst, dst + i, n * sizeof(*dst));
+    rep_dest->cur_seq_no = FFMAX(rep_dest->cur_seq_no - dropped, 0);
+
+    /* append the segments after the current end */
+    for (i = 0; i < rep_src->n_timelines; i++) {
+        struct timeline tml = src[i];
+
+        if (timeline_end(&tml) <= end)
+            continue;
+        if (tml.starttime < end) {
+            k = (end - tml.starttime + tml.duration - 1) / tml.duration;
+            tml.starttime += k * tml.duration;
+            tml.repeat    -= k;
+        }
+        if (n && dst[n - 1].duration == tml.duration &&
+            timeline_end(&dst[n - 1]) == tml.starttime) {
+            dst[n - 1].repeat += tml.repeat + 1;
+        } else {
+            dst = av_fast_realloc(rep_dest->timelines, &rep_dest->timelines_size,
+                                  (n + 1) * sizeof(*dst));
+            if (!dst) {
+                rep_dest->n_timelines = n;
+                return AVERROR(ENOMEM);
+            }
+            rep_dest->timelines = dst;
+            dst[n++] = tml;
+        }
+    }
+
+    rep_dest->n_timelines  = n;
+    rep_dest->first_seq_no = rep_src->first_seq_no;
+    rep_dest->last_seq_no  = calc_max_seg_no(rep_dest, c);
+    return 0;
+}
+
 static void move_segments(struct representation *rep_src, struct representation *rep_dest, DASHContext *c)
 {
     if (rep_dest && rep_src ) {
@@ -1564,7 +1791,7 @@ static int refresh_manifest(AVFormatContext *s)
     for (i = 0; i < n_videos; i++) {
         struct representation *cur_video = videos[i];
         struct representation *ccur_video = c->videos[i];
-        if (cur_video->timelines) {
+        if (cur_video->timelines && merge_timelines(ccur_video, cur_video, c) < 0) {
             // calc current time
             int64_t currentTime = get_segment_start_time_based_on_timeline(cur_video, cur_video->cur_seq_no) / cur_video->fragment_timescale;
             // update segments
@@ -1580,7 +1807,7 @@ static int refresh_manifest(AVFormatContext *s)
     for (i = 0; i < n_audios; i++) {
         struct representation *cur_audio = audios[i];
         struct representation *ccur_audio = c->audios[i];
-        if (cur_audio->timelines) {
+        if (cur_audio->timelines && merge_timelines(ccur_audio, cur_audio, c) < 0) {
             // calc current time
             int64_t currentTime = get_segment_start_time_based_on_timeline(cur_audio, cur_audio->cur_seq_no) / cur_audio->fragment_timescale;
             // update segments
@@ -1617,29 +1844,60 @@ finish:
     return ret;
 }
 
+/* Get a copy of the fragment with the given number, without refreshing. */
+static struct fragment *get_fragment(struct representation *pls, int64_t seq_no)
+{
+    DASHContext *c = pls->parent->priv_data;
+    struct fragment *seg = av_mallocz(sizeof(struct fragment));
+    char *tmpfilename;
+
+    if (!seg) {
+        return NULL;
+    }
+    if (seq_no >= 0 && seq_no < pls->n_fragments) {
+        struct fragment *seg_ptr = pls->fragments[seq_no];
+        seg->url = av_strdup(seg_ptr->url);
+        if (!seg->url) {
+            av_free(seg);
+            return NULL;
+        }
+        seg->size = seg_ptr->size;
+        seg->url_offset = seg_ptr->url_offset;
+        return seg;
+    }
+
+    tmpfilename = av_mallocz(c->max_url_size);
+    if (!tmpfilename) {
+        av_free(seg);
+        return NULL;
+    }
+    ff_dash_fill_tmpl_params(tmpfilename, c->max_url_size, pls->url_template, 0, seq_no, 0, get_segment_start_time_based_on_timeline(pls, seq_no));
+    seg->url = av_strireplace(pls->url_template, pls->url_template, tmpfilename);
+    if (!seg->url) {
+        av_log(pls->parent, AV_LOG_WARNING, "Unable to resolve template url '%s', try to use origin template\n", pls->url_template);
+        seg->url = av_strdup(pls->url_template);
+        if (!seg->url) {
+            av_log(pls->parent, AV_LOG_ERROR, "Cannot resolve template url '%s'\n", pls->url_template);
+            av_free(tmpfilename);
+            av_free(seg);
+            return NULL;
+        }
+    }
+    av_free(tmpfilename);
+    seg->size = -1;
+
+    return seg;
+}
+
 static struct fragment *get_current_fragment(struct representation *pls)
 {
     int64_t min_seq_no = 0;
     int64_t max_seq_no = 0;
-    struct fragment *seg = NULL;
-    struct fragment *seg_ptr = NULL;
     DASHContext *c = pls->parent->priv_data;
 
     while (( !ff_check_interrupt(c->interrupt_callback)&& pls->n_fragments > 0)) {
         if (pls->cur_seq_no < pls->n_fragments) {
-            seg_ptr = pls->fragments[pls->cur_seq_no];
-            seg = av_mallocz(sizeof(struct fragment));
-            if (!seg) {
-                return NULL;
-            }
-            seg->url = av_strdup(seg_ptr->url);
-            if (!seg->url) {
-                av_free(seg);
-                return NULL;
-            }
-            seg->size = seg_ptr->size;
-            seg->url_offset = seg_ptr->url_offset;
-            return seg;
+            return get_fragment(pls, pls->cur_seq_no);
         } else if (c->is_live) {
             refresh_manifest(pls->parent);
         } else {
@@ -1659,37 +1917,11 @@ static struct fragment *get_current_fragment(struct representation *pls)
         } else if (pls->cur_seq_no > max_seq_no) {
             av_log(pls->parent, AV_LOG_VERBOSE, "new fragment: min[%"PRId64"] max[%"PRId64"], playlist %d\n", min_seq_no, max_seq_no, (int)pls->rep_idx);
         }
-        seg = av_mallocz(sizeof(struct fragment));
-        if (!seg) {
-            return NULL;
-        }
-    } else if (pls->cur_seq_no <= pls->last_seq_no) {
-        seg = av_mallocz(sizeof(struct fragment));
-        if (!seg) {
-            return NULL;
-        }
-    }
-    if (seg) {
-        char *tmpfilename= av_mallocz(c->max_url_size);
-        if (!tmpfilename) {
-            return NULL;
-        }
-        ff_dash_fill_tmpl_params(tmpfilename, c->max_url_size, pls->url_template, 0, pls->cur_seq_no, 0, get_segment_start_time_based_on_timeline(pls, pls->cur_seq_no));
-        seg->url = av_strireplace(pls->url_template, pls->url_template, tmpfilename);
-        if (!seg->url) {
-            av_log(pls->parent, AV_LOG_WARNING, "Unable to resolve template url '%s', try to use origin template\n", pls->url_template);
-            seg->url = av_strdup(pls->url_template);
-            if (!seg->url) {
-                av_log(pls->parent, AV_LOG_ERROR, "Cannot resolve template url '%s'\n", pls->url_template);
-                av_free(tmpfilename);
-                return NULL;
-            }
-        }
-        av_free(tmpfilename);
-        seg->size = -1;
+    } else if (pls->cur_seq_no > pls->last_seq_no) {
+        return NULL;
     }
 
-    return seg;
+    return get_fragment(pls, pls->cur_seq_no);
 }
 
 static int read_from_url(struct representation *pls, struct fragment *seg,
@@ -1701,7 +1933,10 @@ static int read_from_url(struct representation *pls, struct fragment *seg,
     if (seg->size >= 0)
         buf_size = FFMIN(buf_size, pls->cur_seg_size - pls->cur_seg_offset);
 
-    ret = avio_read(pls->input, buf, buf_size);
+    if (pls->prefetching)
+        ret = ff_prefetch_read(pls->prefetch, buf, buf_size);
+    else
+        ret = avio_read(pls->input, buf, buf_size);
     if (ret > 0)
         pls->cur_seg_offset += ret;
 
@@ -1740,6 +1975,128 @@ cleanup:
     return ret;
 }
 
+/*
+ * Identifier of a fragment in the prefetch queue. Unlike the fragment number,
+ * it does not change when a live manifest is refreshed.
+ */
+static int64_t fragment_id(struct representation *pls, int64_t seq_no)
+{
+    if (pls->n_timelines)
+        return get_segment_start_time_based_on_timeline(pls, seq_no);
+    if (pls->n_fragments)
+        return pls->start_number + seq_no;
+    return seq_no;
+}
+
+/*
+ * Last fragment that may be downloaded ahead. The fragments of a live
+ * template are available once complete, counting from availabilityStartTime.
+ */
+static int64_t calc_last_available_seg_no(struct representation *pls, DASHContext *c)
+{
+    int64_t num = -1;
+    int i;
+
+    if (pls->n_fragments) {
+        num = pls->n_fragments - 1;
+    } else if (pls->n_timelines) {
+        for (i = 0; i < pls->n_timelines; i++) {
+            if (pls->timelines[i].repeat < 0)
+                return -1;
+            num += pls->timelines[i].repeat + 1;
+        }
+    } else if (c->is_live && pls->fragment_duration) {
+        num = pls->first_seq_no + (int64_t)(get_current_time_in_sec() - c->availability_start_time) * pls->fragment_timescale / pls->fragment_duration - 1;
+    } else {
+        num = pls->last_seq_no;
+    }
+    return num;
+}
+
+/* A fragment download queued in the prefetch queue of a representation. */
+struct prefetch_request {
+    char *url;
+    AVDictionary *opts;
+};
+
+static int prefetch_open(void *opaque, AVIOContext **pb, AVIOInterruptCB *int_cb)
+{
+    struct prefetch_request *req = opaque;
+
+    return avio_open2(pb, req->url, AVIO_FLAG_READ, int_cb, &req->opts);
+}
+
+static void prefetch_request_free(void *opaque)
+{
+    struct prefetch_request *req = opaque;
+
+    av_free(req->url);
+    av_dict_free(&req->opts);
+    av_free(req);
+}
+
+/*
+ * Queue the downloads of the current fragment and of up to depth fragments
+ * after it. Only network fragments are prefetched, with the options
+ * open_input() would use.
+ */
+static void prefetch_fragments(DASHContext *c, struct representation *pls, int depth)
+{
+    int64_t seq_no, end, last_id;
+
+    if (!c->prefetch || pls->n_fragments == 1)
+        return;
+    if (!pls->prefetch &&
+        ff_prefetch_queue_alloc(c->prefetch, &pls->prefetch) < 0)
+        return;
+
+    last_id = ff_prefetch_last_id(pls->prefetch);
+    end     = FFMIN(pls->cur_seq_no + depth, calc_last_available_seg_no(pls, c));
+    for (seq_no = pls->cur_seq_no; seq_no <= end; seq_no++) {
+        int64_t id = fragment_id(pls, seq_no);
+        struct prefetch_request *req;
+        struct fragment *seg;
+        int64_t size;
+
+        if (id <= last_id)
+            continue;
+        if (!(seg = get_fragment(pls, seq_no)))
+            break;
+        size = seg->size;
+        if (!(req = av_mallocz(sizeof(*req))) ||
+            !(req->url = av_mallocz(c->max_url_size))) {
+            av_free(req);
+            free_fragment(&seg);
+            break;
+        }
+        ff_make_absolute_url(req->url, c->max_url_size, c->base_url, seg->url);
+        if (seg->size >= 0) {
+            av_dict_set_int(&req->opts, "offset", seg->url_offset, 0);
+            av_dict_set_int(&req->opts, "end_offset", seg->url_offset + seg->size, 0);
+        }
+        free_fragment(&seg);
+        if (!av_strstart(req->url, "http", NULL) ||
+            av_dict_copy(&req->opts, c->avio_opts, 0) < 0) {
+            prefetch_request_free(req);
+            break;
+        }
+        av_dict_set(&req->opts, "ijkiomanager", c->io_manager_ctx, 0);
+        av_dict_set(&req->opts, "ijkapplication", c->app_ctx, 0);
+        av_dict_set_int(&req->opts, "medialive", (int64_t)c->is_live, 0);
+        if (ff_prefetch_add(pls->prefetch, id, size,
+                            prefetch_open, req, prefetch_request_free) < 0)
+            break;
+    }
+}
+
+/* Drop the prefetched fragments, the representation is not read sequentially. */
+static void reset_prefetch(struct representation *pls)
+{
+    if (pls->prefetch)
+        ff_prefetch_flush(pls->prefetch);
+    pls->prefetching = 0;
+}
+
 static int update_init_section(struct representation *pls)
 {
     static const int max_init_section_size = 1024 * 1024;
@@ -1791,6 +2148,13 @@ static int64_t seek_data(void *opaque, int64_t offset, int whence)
 {
     struct representation *v = opaque;
     if (v->n_fragments && !v->init_sec_data_len) {
+        if (v->prefetching) {
+            /* seek in a connection of our own */
+            int ret = open_input(v->parent->priv_data, v, v->cur_seg);
+            if (ret < 0)
+                return ret;
+            v->prefetching = 0;
+        }
         return avio_seek(v->input, offset, whence);
     }
 
@@ -1804,7 +2168,7 @@ static int read_data(void *opaque, uint8_t *buf, int buf_size)
     DASHContext *c = v->parent->priv_data;
 
 restart:
-    if (!v->input) {
+    if (!v->input && !v->prefetching) {
         free_fragment(&v->cur_seg);
         v->cur_seg = get_current_fragment(v);
         if (!v->cur_seg) {
@@ -1817,7 +2181,16 @@ restart:
         if (ret)
             goto end;
 
-        ret = open_input(c, v, v->cur_seg);
+        prefetch_fragments(c, v, c->prefetch_segments);
+        if (v->prefetch && ff_prefetch_start(v->prefetch, fragment_id(v, v->cur_seq_no))) {
+            /* the fragment is already being downloaded */
+            v->prefetching = 1;
+            v->cur_seg_offset = 0;
+            v->cur_seg_size = v->cur_seg->size;
+            ret = 0;
+        } else {
+            ret = open_input(c, v, v->cur_seg);
+        }
         if (ret < 0) {
             if (ff_check_interrupt(c->interrupt_callback)) {
                 ret = AVERROR_EXIT;
@@ -1981,17 +2354,33 @@ fail:
     return ret;
 }
 
-static int open_demux_for_component(AVFormatContext *s, struct representation *pls)
+/*
+ * Set the first fragment of the representations, and start downloading it so
+ * that the components are not fetched one after another when their demuxers
+ * are opened.
+ */
+static void start_representations(AVFormatContext *s, struct representation **p, int n)
 {
-    int ret = 0;
+    DASHContext *c = s->priv_data;
     int i;
 
-    pls->parent = s;
-    pls->cur_seq_no  = calc_cur_seg_no(s, pls);
+    for (i = 0; i < n; i++) {
+        struct representation *pls = p[i];
+
+        pls->parent = s;
+        pls->cur_seq_no  = calc_cur_seg_no(s, pls);
 
-    if (!pls->last_seq_no) {
-        pls->last_seq_no = calc_max_seg_no(pls, s->priv_data);
+        if (!pls->last_seq_no) {
+            pls->last_seq_no = calc_max_seg_no(pls, c);
+        }
+        prefetch_fragments(c, pls, 0);
     }
+}
+
+static int open_demux_for_component(AVFormatContext *s, struct representation *pls)
+{
+    int ret = 0;
+    int i;
 
     ret = reopen_demux_for_component(s, pls);
     if (ret < 0) {
@@ -2052,6 +2441,17 @@ static int copy_init_section(struct representation *rep_dest, struct representat
 }
 
 
+static int dash_close(AVFormatContext *s)
+{
+    DASHContext *c = s->priv_data;
+    ff_prefetch_free(&c->prefetch);
+    free_audio_list(c);
+    free_video_list(c);
+    av_dict_free(&c->avio_opts);
+    av_freep(&c->base_url);
+    return 0;
+}
+
 static int dash_read_header(AVFormatContext *s)
 {
     DASHContext *c = s->priv_data;
@@ -2076,6 +2476,15 @@ static int dash_read_header(AVFormatContext *s)
         av_dict_set(&c->avio_opts, "seekable", "0", 0);
     }
 
+    if (c->prefetch_segments > 0 &&
+        !(c->prefetch = ff_prefetch_alloc(s, c->interrupt_callback,
+                                          c->prefetch_max_memory)))
+        av_log(s, AV_LOG_WARNING, "Fragment prefetching is not available\n");
+
+    start_representations(s, c->videos, c->n_videos);
+    start_representations(s, c->audios, c->n_audios);
+    start_representations(s, c->subtitles, c->n_subtitles);
+
     if(c->n_videos)
         c->is_init_section_common_video = is_common_init_section_exist(c->videos, c->n_videos);
 
@@ -2141,6 +2550,7 @@ static int dash_read_header(AVFormatContext *s)
         AVProgram *program;
         program = av_new_program(s, 0);
         if (!program) {
+            ret = AVERROR(ENOMEM);
             goto fail;
         }
 
@@ -2173,6 +2583,7 @@ static int dash_read_header(AVFormatContext *s)
 
     return 0;
 fail:
+    dash_close(s);
     return ret;
 }
 
@@ -2196,6 +2607,7 @@ static void recheck_discard_flags(AVFormatContext *s, struct representation **p,
         } else if (!needed && pls->ctx) {
             close_demux_for_component(pls);
             ff_format_io_close(pls->parent, &pls->input);
+            reset_prefetch(pls);
             av_log(s, AV_LOG_INFO, "No longer receiving stream_index %d\n", pls->stream_index);
         }
     }
@@ -2257,6 +2669,7 @@ static int dash_read_packet(AVFormatContext *s, AVPacket *pkt)
             cur->cur_seg_offset = 0;
             cur->init_sec_buf_read_offset = 0;
             ff_format_io_close(cur->parent, &cur->input);
+            cur->prefetching = 0;
             ret = reopen_demux_for_component(s, cur);
             cur->is_restart_needed = 0;
         }
@@ -2264,16 +2677,6 @@ static int dash_read_packet(AVFormatContext *s, AVPacket *pkt)
     return AVERROR_EOF;
 }
 
-static int dash_close(AVFormatContext *s)
-{
-    DASHContext *c = s->priv_data;
-    free_audio_list(c);
-    free_video_list(c);
-    av_dict_free(&c->avio_opts);
-    av_freep(&c->base_url);
-    return 0;
-}
-
 static int dash_seek(AVFormatContext *s, struct representation *pls, int64_t seek_pos_msec, int flags, int dry_run)
 {
     int ret = 0;
@@ -2295,6 +2698,7 @@ static int dash_seek(AVFormatContext *s, struct representation *pls, int64_t see
     }
 
     ff_format_io_close(pls->parent, &pls->input);
+    reset_prefetch(pls);
 
     // find the nearest fragment
     if (pls->n_timelines > 0 && pls->fragment_timescale > 0) {
@@ -2303,15 +2707,15 @@ static int dash_seek(AVFormatContext *s, struct representation *pls, int64_t see
                "last_seq_no[%"PRId64"], playlist %d.\n",
                (int)pls->n_timelines, (int64_t)pls->last_seq_no, (int)pls->rep_idx);
         for (i = 0; i < pls->n_timelines; i++) {
-            if (pls->timelines[i]->starttime > 0) {
-                duration = pls->timelines[i]->starttime;
+            if (pls->timelines[i].starttime > 0) {
+                duration = pls->timelines[i].starttime;
             }
-            duration += pls->timelines[i]->duration;
+            duration += pls->timelines[i].duration;
             if (seek_pos_msec < ((duration * 1000) /  pls->fragment_timescale)) {
                 goto set_seq_num;
             }
-            for (j = 0; j < pls->timelines[i]->repeat; j++) {
-                duration += pls->timelines[i]->duration;
+            for (j = 0; j < pls->timelines[i].repeat; j++) {
+                duration += pls->timelines[i].duration;
                 num++;
                 if (seek_pos_msec < ((duration * 1000) /  pls->fragment_timescale)) {
                     goto set_seq_num;
@@ -2396,6 +2800,10 @@ static const AVOption dash_options[] = {
             OFFSET(io_manager_ctx), AV_OPT_TYPE_STRING, { .str = 0 }, 0, 0, FLAGS },
     { "dashapplication", "AVApplicationContext",
             OFFSET(app_ctx), AV_OPT_TYPE_STRING, { .str = 0 }, 0, 0, FLAGS },
+    {"prefetch_segments", "Number of fragments to download ahead of the current one",
+        OFFSET(prefetch_segments), AV_OPT_TYPE_INT, {.i64 = 0}, 0, INT_MAX, FLAGS},
+    {"prefetch_max_memory", "Maximum memory used by prefetched fragments",
+        OFFSET(prefetch_max_memory), AV_OPT_TYPE_INT64, {.i64 = 16 << 20}, 0, INT64_MAX, FLAGS},
     {NULL}
 };
 
@@ -21,6 +21,8 @@
 
 
 #include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "config.h"
 
 #include "libavutil/avassert.h"
@@ -28,6 +30,7 @@
 #include "libavutil/bprint.h"
 #include "libavutil/opt.h"
 #include "libavutil/time.h"
+#include "libavutil/thread.h"
 #include "libavutil/parseutils.h"
 
 #include "avformat.h"
@@ -108,6 +111,14 @@ typedef struct HTTPContext {
     int is_multi_client;
     int is_connected_server;
 
+    int fd;
+    /* downloaded blocks, NULL if the whole file is there */
+    const uint8_t *ranges;
+    /* held by the download manager while it sets bits of ranges */
+    pthread_mutex_t *ranges_lock;
+    int block_size;
+    int waiting;
+    int64_t wait_start;
 } HTTPContext;
 
 #define OFFSET(x) offsetof(HTTPContext, x)
@@ -123,46 +134,54 @@ static int http_open(URLContext *h, const char *uri, int flags,
                      AVDictionary **options)
 {
     HTTPContext *s = h->priv_data;
+    int64_t total_size;
+    struct stat st;
     int ret;
 
-    s->seekable = 0;
-    h->is_streamed = 0;
-    h->is_streamed = 1;
-
     s->location = av_strdup(uri);
 
     if (options)
         av_dict_copy(&s->chained_options, *options, 0);
 
-    av_log(h, AV_LOG_INFO,
-           "download_http_open() open %s %d.\n", uri, __LINE__);
-
     ret = download_http_open(s, uri + 8, flags);
-    if (ret >= 0) {
-        fseek(s->file, 0L, SEEK_END);
-        s->filesize = ftell(s->file);
-
-        fseek(s->file, 0L, SEEK_SET);
+    if (ret < 0)
+        return ret;
 
-        av_log(h, AV_LOG_INFO,
-               "download_http_open() done %s %ld %d. \n", uri, s->filesize, __LINE__);
-        return 0;
+    s->fd  = fileno(s->file);
+    s->off = 0;
+    if (download_http_get_ranges(s, &s->ranges, &s->ranges_lock,
+                                 &s->block_size, &total_size) >= 0 &&
+        s->ranges && s->ranges_lock && s->block_size > 0 && total_size > 0) {
+        s->filesize = total_size;
     } else {
-        return ret;
+        s->ranges      = NULL;
+        s->ranges_lock = NULL;
+        if (fstat(s->fd, &st) < 0) {
+            ret = AVERROR(errno);
+            download_http_close(s);
+            return ret;
+        }
+        s->filesize = st.st_size;
     }
+    h->is_streamed = 0;
+
+    av_log(h, AV_LOG_VERBOSE, "Opened %s, %"PRIu64" bytes%s\n", uri,
+           s->filesize, s->ranges ? ", downloading" : "");
+    return 0;
 }
 
 
 static int http_close(URLContext *h)
 {
     HTTPContext *s = h->priv_data;
-    av_log(h, AV_LOG_INFO,
-           "download_http_close() %s %d.\n", s->location, __LINE__);
     int ret = 0;
 
+    if (s->waiting)
+        download_http_wait(s, s->off, 0);
     ret = download_http_close(s);
 
     av_dict_free(&s->chained_options);
+    av_freep(&s->location);
 
     return ret;
 }
@@ -170,38 +189,19 @@ static int http_close(URLContext *h)
 static int64_t http_seek(URLContext *h, int64_t off, int whence)
 {
     HTTPContext *s = h->priv_data;
-    av_log(h, AV_LOG_INFO,
-           "download_http_seek() %s, %ld, %d, %d.\n", s->location, off, whence, __LINE__);
 
     if (whence == AVSEEK_SIZE)
         return s->filesize;
-
-    int64_t current = ftell(s->file);
-
-    if ((whence == SEEK_CUR && off == 0) ||
-              (whence == SEEK_SET && off == current))
-        return current;
-
-
-    if (whence == SEEK_CUR)
-        off += current;
+    else if (whence == SEEK_CUR)
+        off += s->off;
     else if (whence == SEEK_END)
         off += s->filesize;
     else if (whence != SEEK_SET)
         return AVERROR(EINVAL);
     if (off < 0)
         return AVERROR(EINVAL);
-    current = off;
-
-    int ret = fseek(s->file, current, SEEK_SET);
-    if (ret == 0) {
-        int64_t c = ftell(s->file);
-        av_log(h, AV_LOG_INFO,
-               "download_http_seek() done %s, %ld, %d, %ld, %ld, %d.\n", s->location, off, whence, c, current, __LINE__);
-        return c;
-    }
-
-    return AVERROR(EINVAL);
+    s->off = off;
+    return off;
 }
 
 static int http_get_file_handle(URLContext *h)
@@ -221,32 +221,65 @@ static int http_get_short_seek(URLContext *h)
     return -1;
 }
 
-static int http_read(URLContext *h, uint8_t *buf, int size) {
-    HTTPContext *s = h->priv_data;
-
-    int64_t current = ftell(s->file);
+/* Number of bytes from pos on, up to size, that are in the file already. */
+static int available_bytes(HTTPContext *s, uint64_t pos, int size)
+{
+    uint64_t end = FFMIN(pos + size, s->filesize);
+    uint64_t block;
+
+    if (!s->ranges)
+        return end - pos;
+    pthread_mutex_lock(s->ranges_lock);
+    for (block = pos / s->block_size; block * s->block_size < end; block++)
+        if (!(s->ranges[block >> 3] & (1 << (block & 7)))) {
+            end = FFMAX(block * s->block_size, pos);
+            break;
+        }
+    pthread_mutex_unlock(s->ranges_lock);
+    return end - pos;
+}
 
-    av_log(h, AV_LOG_INFO,
-           "download_http_read() %d, %ld, %s %d.\n", size, current, s->location, __LINE__);
+/*
+ * Bytes that are not downloaded yet make the read return EAGAIN. ffurl_read()
+ * then retries, honouring the interrupt callback and rw_timeout, so the
+ * wait can be cancelled like any network read. The download manager is
+ * told where the player is waiting, so that it can fetch that range first.
+ */
+static int http_read(URLContext *h, uint8_t *buf, int size)
+{
+    HTTPContext *s = h->priv_data;
+    int ret;
 
-    if (current == s->filesize) {
+    if (s->off >= s->filesize)
         return AVERROR_EOF;
-    }
 
-    int64_t remain = s->filesize - current;
-    int64_t max_buffer = 1024 * 64;
-    if (size > remain) {
-        size = remain;
-    }
-
-    if (size > max_buffer) {
-        size = max_buffer;
+    size = available_bytes(s, s->off, size);
+    if (size > 0)
+        ret = pread(s->fd, buf, size, s->off);
+    else
+        ret = 0;
+    if (ret < 0)
+        return AVERROR(errno);
+    if (ret == 0) {
+        if (!s->ranges)
+            return AVERROR_EOF;
+        if (!s->waiting) {
+            s->waiting    = 1;
+            s->wait_start = av_gettime_relative();
+            av_log(h, AV_LOG_VERBOSE, "Waiting for the download at %"PRIu64"\n",
+                   s->off);
+            download_http_wait(s, s->off, 1);
+        }
+        return AVERROR(EAGAIN);
     }
 
-    int ret = fread(buf, 1, size, s->file);
-    if (ret <= 0) {
-        return AVERROR_EOF;
+    if (s->waiting) {
+        s->waiting = 0;
+        av_log(h, AV_LOG_VERBOSE, "Download reached %"PRIu64" after %"PRId64" ms\n",
+               s->off, (av_gettime_relative() - s->wait_start) / 1000);
+        download_http_wait(s, s->off, 0);
     }
+    s->off += ret;
     return ret;
 }
 
@@ -266,7 +299,7 @@ const URLProtocol ff_download_http_protocol = {
     .url_handshake       = 0,
     .url_read            = http_read,
 //    .url_write           = http_write,
-//    .url_seek            = http_seek,
+    .url_seek            = http_seek,
     .url_close           = http_close,
 //    .url_get_file_handle = http_get_file_handle,
     .priv_data_size      = sizeof(HTTPContext),
@@ -281,7 +314,7 @@ const URLProtocol ff_download_https_protocol = {
     .url_handshake       = 0,
     .url_read            = http_read,
 //    .url_write           = http_write,
-//    .url_seek            = http_seek,
+    .url_seek            = http_seek,
     .url_close           = http_close,
 //    .url_get_file_handle = http_get_file_handle,
     .priv_data_size      = sizeof(HTTPContext),
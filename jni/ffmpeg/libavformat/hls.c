@@ -38,8 +38,10 @@
 #include "internal.h"
 #include "avio_internal.h"
 #include "id3v2.h"
+#include "prefetch.h"
 
 #define INITIAL_BUFFER_SIZE 32768
+#define ABR_SAMPLES 4
 
 #define MAX_FIELD_LEN 64
 #define MAX_CHARACTERISTICS_LEN 512
@@ -98,6 +100,16 @@ struct playlist {
     int input_read_done;
     AVIOContext *input_next;
     int input_next_requested;
+    /* the current segment is read from the prefetch queue */
+    int prefetching;
+    FFPrefetchQueue *prefetch;
+    /* key cache of the prefetch thread of this playlist */
+    char prefetch_key_url[MAX_URL_SIZE];
+    uint8_t prefetch_key[16];
+    /* time spent downloading the current segment */
+    int64_t seg_download_time;
+    /* the main Media Playlist of a variant, switched by ABR */
+    int abr_main;
     AVFormatContext *parent;
     int index;
     AVFormatContext *ctx;
@@ -122,6 +134,11 @@ struct playlist {
     int m3u8_hold_counters;
     int64_t cur_seg_offset;
     int64_t last_load_time;
+    /* EXT-X-SERVER-CONTROL: the server holds reloads until the requested
+     * segment is available, and sends delta updates skipping the segments
+     * older than can_skip_until from the end */
+    int can_block_reload;
+    int64_t can_skip_until;
 
     /* Currently active Media Initialization Section */
     struct segment *cur_init_section;
@@ -212,6 +229,21 @@ typedef struct HLSContext {
     int http_persistent;
     int http_multiple;
     int http_seekable;
+    int prefetch_segments;
+    int64_t prefetch_max_memory;
+    FFPrefetch *prefetch;
+    int abr;
+    int64_t abr_min_buffer;
+    /* ABR state: current variant and the one switched to once the current
+     * one is drained */
+    int abr_variant;
+    int abr_next_variant;
+    /* throughput of the last segment downloads in bit/s */
+    double abr_samples[ABR_SAMPLES];
+    int abr_nb_samples;
+    /* media duration downloaded, and wall clock time of the first packet */
+    int64_t abr_downloaded;
+    int64_t abr_start_time;
     AVIOContext *playlist_pb;
 #ifdef MXTECHS
     int8_t local_file_only;
@@ -398,6 +430,37 @@ static void handle_key_args(struct key_info *info, const char *key,
     }
 }
 
+struct server_control_info {
+    char can_block_reload[4];
+    char can_skip_until[32];
+};
+
+static void handle_server_control_args(struct server_control_info *info,
+                                       const char *key, int key_len,
+                                       char **dest, int *dest_len)
+{
+    if (!strncmp(key, "CAN-BLOCK-RELOAD=", key_len)) {
+        *dest     =        info->can_block_reload;
+        *dest_len = sizeof(info->can_block_reload);
+    } else if (!strncmp(key, "CAN-SKIP-UNTIL=", key_len)) {
+        *dest     =        info->can_skip_until;
+        *dest_len = sizeof(info->can_skip_until);
+    }
+}
+
+struct skip_info {
+    char skipped_segments[16];
+};
+
+static void handle_skip_args(struct skip_info *info, const char *key,
+                             int key_len, char **dest, int *dest_len)
+{
+    if (!strncmp(key, "SKIPPED-SEGMENTS=", key_len)) {
+        *dest     =        info->skipped_segments;
+        *dest_len = sizeof(info->skipped_segments);
+    }
+}
+
 struct init_section_info {
     char uri[MAX_URL_SIZE];
     char byterange[32];
@@ -444,6 +507,33 @@ static struct segment *new_init_section(struct playlist *pls,
     return sec;
 }
 
+/*
+ * Reloads of a live playlist repeat its EXT-X-MAP tags: if the section just
+ * added is already known, drop it and return the known one.
+ */
+static struct segment *dedup_init_section(struct playlist *pls,
+                                          struct segment *sec)
+{
+    int i;
+
+    for (i = 0; i < pls->n_init_sections - 1; i++) {
+        struct segment *old = pls->init_sections[i];
+
+        if (old->size == sec->size && old->url_offset == sec->url_offset &&
+            old->key_type == sec->key_type && !strcmp(old->url, sec->url) &&
+            (sec->key_type == KEY_NONE ||
+             (!strcmp(old->key, sec->key) &&
+              !memcmp(old->iv, sec->iv, sizeof(sec->iv))))) {
+            pls->n_init_sections--;
+            av_freep(&sec->key);
+            av_freep(&sec->url);
+            av_free(sec);
+            return old;
+        }
+    }
+    return sec;
+}
+
 static void handle_init_section_args(struct init_section_info *info, const char *key,
                                            int key_len, char **dest, int *dest_len)
 {
@@ -624,8 +714,14 @@ static int open_url_keepalive(AVFormatContext *s, AVIOContext **pb,
 #endif
 }
 
+/*
+ * If int_cb is set, the URL is opened from a prefetch thread: it is opened
+ * directly with that interrupt callback, and the demuxer state is not
+ * touched.
+ */
 static int open_url(AVFormatContext *s, AVIOContext **pb, const char *url,
-                    AVDictionary *opts, AVDictionary *opts2, int *is_http_out)
+                    AVDictionary *opts, AVDictionary *opts2, int *is_http_out,
+                    AVIOInterruptCB *int_cb)
 {
     HLSContext *c = s->priv_data;
     AVDictionary *tmp = NULL;
@@ -677,7 +773,10 @@ static int open_url(AVFormatContext *s, AVIOContext **pb, const char *url,
     av_dict_copy(&tmp, opts, 0);
     av_dict_copy(&tmp, opts2, 0);
 
-    if (is_http && c->http_persistent && *pb) {
+    if (int_cb) {
+        ret = ffio_open_whitelist(pb, url, AVIO_FLAG_READ, int_cb, &tmp,
+                                  s->protocol_whitelist, s->protocol_blacklist);
+    } else if (is_http && c->http_persistent && *pb) {
         ret = open_url_keepalive(c->ctx, pb, url, &tmp);
         if (ret == AVERROR_EXIT) {
             av_dict_free(&tmp);
@@ -692,7 +791,7 @@ static int open_url(AVFormatContext *s, AVIOContext **pb, const char *url,
     } else {
         ret = s->io_open(s, pb, url, AVIO_FLAG_READ, &tmp);
     }
-    if (ret >= 0) {
+    if (ret >= 0 && !int_cb) {
         // update cookies on http response with setcookies.
         char *new_cookies = NULL;
 
@@ -758,6 +857,18 @@ static int indexOf(const char* s, char ch)
 }
 #endif //MXTECHS
 
+/*
+ * Return where the segment with sequence number seq is in the segments of
+ * the previous load of a live playlist, or NULL.
+ */
+static struct segment **prev_segment(struct segment **segments, int n_segments,
+                                     int start_seq_no, int seq)
+{
+    if (!segments || seq < start_seq_no || seq - start_seq_no >= n_segments)
+        return NULL;
+    return &segments[seq - start_seq_no];
+}
+
 static int parse_playlist(HLSContext *c, const char *url,
                           struct playlist *pls, AVIOContext *in)
 {
@@ -780,6 +891,8 @@ static int parse_playlist(HLSContext *c, const char *url,
     struct segment **prev_segments = NULL;
     int prev_n_segments = 0;
     int prev_start_seq_no = -1;
+    int prev_finished = 0;
+    enum PlaylistType prev_type = PLS_TYPE_UNSPECIFIED;
 
     if (is_http && !in && c->http_persistent && c->playlist_pb) {
         in = c->playlist_pb;
@@ -835,11 +948,15 @@ static int parse_playlist(HLSContext *c, const char *url,
         prev_start_seq_no = pls->start_seq_no;
         prev_segments = pls->segments;
         prev_n_segments = pls->n_segments;
+        prev_finished = pls->finished;
+        prev_type = pls->type;
         pls->segments = NULL;
         pls->n_segments = 0;
 
         pls->finished = 0;
         pls->type = PLS_TYPE_UNSPECIFIED;
+        pls->can_block_reload = 0;
+        pls->can_skip_until = 0;
     }
     while (!avio_feof(in)) {
         ff_get_chomp_line(in, line, sizeof(line));
@@ -889,6 +1006,57 @@ static int parse_playlist(HLSContext *c, const char *url,
             if (ret < 0)
                 goto fail;
             pls->start_seq_no = atoi(ptr);
+        } else if (av_strstart(line, "#EXT-X-SERVER-CONTROL:", &ptr)) {
+            struct server_control_info info = {{0}};
+            ret = ensure_playlist(c, &pls, url);
+            if (ret < 0)
+                goto fail;
+            ff_parse_key_value(ptr, (ff_parse_key_val_cb) handle_server_control_args,
+                               &info);
+            pls->can_block_reload = !strcmp(info.can_block_reload, "YES");
+            pls->can_skip_until   = atof(info.can_skip_until) * AV_TIME_BASE;
+        } else if (av_strstart(line, "#EXT-X-SKIP:", &ptr)) {
+            /* a delta update: the first segments are the ones of the
+             * previous load with the same sequence numbers */
+            struct skip_info info = {{0}};
+            struct segment **slot, *last;
+            int i, n, seq;
+            ret = ensure_playlist(c, &pls, url);
+            if (ret < 0)
+                goto fail;
+            ff_parse_key_value(ptr, (ff_parse_key_val_cb) handle_skip_args,
+                               &info);
+            n   = atoi(info.skipped_segments);
+            seq = pls->start_seq_no + pls->n_segments;
+            for (i = 0; i < n; i++) {
+                slot = prev_segment(prev_segments, prev_n_segments,
+                                    prev_start_seq_no, seq + i);
+                if (!slot || !*slot) {
+                    av_log(c->ctx, AV_LOG_WARNING,
+                           "Delta update skips unknown segment %d\n", seq + i);
+                    ret = AVERROR_INVALIDDATA;
+                    goto fail;
+                }
+            }
+            for (i = 0; i < n; i++) {
+                slot = prev_segment(prev_segments, prev_n_segments,
+                                    prev_start_seq_no, seq + i);
+                dynarray_add(&pls->segments, &pls->n_segments, *slot);
+                *slot = NULL;
+            }
+            if (n > 0) {
+                /* the tags of the skipped segments still apply */
+                uint8_t seq_iv[16] = { 0 };
+                last = pls->segments[pls->n_segments - 1];
+                key_type = last->key_type;
+                av_strlcpy(key, last->key ? last->key : "", sizeof(key));
+                AV_WB32(seq_iv + 12, seq + n - 1);
+                has_iv = memcmp(last->iv, seq_iv, sizeof(seq_iv)) != 0;
+                if (has_iv)
+                    memcpy(iv, last->iv, sizeof(iv));
+                cur_init_section = last->init_section;
+                seg_offset = last->size >= 0 ? last->url_offset + last->size : 0;
+            }
         } else if (av_strstart(line, "#EXT-X-PLAYLIST-TYPE:", &ptr)) {
             ret = ensure_playlist(c, &pls, url);
             if (ret < 0)
@@ -925,6 +1093,7 @@ static int parse_playlist(HLSContext *c, const char *url,
             } else {
                 cur_init_section->key = NULL;
             }
+            cur_init_section = dedup_init_section(pls, cur_init_section);
 
         } else if (av_strstart(line, "#EXT-X-ENDLIST", &ptr)) {
             if (pls)
@@ -953,7 +1122,7 @@ static int parse_playlist(HLSContext *c, const char *url,
 #endif
 #ifdef MXTECHS
             if (is_variant || (isExtendedM3U == false && try_variant)) {
-                if (!new_variant(c, NULL, line, url)) {
+                if (!new_variant(c, is_variant ? &variant_info : NULL, line, url)) {
 #else
             if (is_variant) {
                 if (!new_variant(c, &variant_info, line, url)) {
@@ -968,45 +1137,61 @@ static int parse_playlist(HLSContext *c, const char *url,
 #else
             if (is_segment) {
 #endif
-                struct segment *seg;
+                struct segment *seg = NULL, **slot;
+                int seq;
                 ret = ensure_playlist(c, &pls, url);
                 if (ret < 0)
                     goto fail;
-                seg = av_malloc(sizeof(struct segment));
-                if (!seg) {
-                    ret = AVERROR(ENOMEM);
-                    goto fail;
-                }
-                seg->duration = duration;
-                seg->key_type = key_type;
-                if (has_iv) {
-                    memcpy(seg->iv, iv, sizeof(iv));
-                } else {
-                    int seq = pls->start_seq_no + pls->n_segments;
-                    memset(seg->iv, 0, sizeof(seg->iv));
-                    AV_WB32(seg->iv + 12, seq);
+                seq = pls->start_seq_no + pls->n_segments;
+
+                /* on reloads, keep the segments already known: a media
+                 * sequence number names the same segment until the
+                 * sequence restarts, so their lines need no resolving */
+                if (pls->start_seq_no >= prev_start_seq_no) {
+                    slot = prev_segment(prev_segments, prev_n_segments,
+                                        prev_start_seq_no, seq);
+                    if (slot && *slot) {
+                        seg = *slot;
+                        *slot = NULL;
+                    }
                 }
 
-                if (key_type != KEY_NONE) {
-                    ff_make_absolute_url(tmp_str, sizeof(tmp_str), url, key);
-                    seg->key = av_strdup(tmp_str);
-                    if (!seg->key) {
+                if (!seg) {
+                    ff_make_absolute_url(tmp_str, sizeof(tmp_str), url, line);
+                    seg = av_malloc(sizeof(struct segment));
+                    if (!seg) {
+                        ret = AVERROR(ENOMEM);
+                        goto fail;
+                    }
+                    seg->url = av_strdup(tmp_str);
+                    if (!seg->url) {
                         av_free(seg);
                         ret = AVERROR(ENOMEM);
                         goto fail;
                     }
-                } else {
-                    seg->key = NULL;
-                }
 
-                ff_make_absolute_url(tmp_str, sizeof(tmp_str), url, line);
-                seg->url = av_strdup(tmp_str);
-                if (!seg->url) {
-                    av_free(seg->key);
-                    av_free(seg);
-                    ret = AVERROR(ENOMEM);
-                    goto fail;
+                    seg->key_type = key_type;
+                    if (has_iv) {
+                        memcpy(seg->iv, iv, sizeof(iv));
+                    } else {
+                        memset(seg->iv, 0, sizeof(seg->iv));
+                        AV_WB32(seg->iv + 12, seq);
+                    }
+
+                    if (key_type != KEY_NONE) {
+                        ff_make_absolute_url(tmp_str, sizeof(tmp_str), url, key);
+                        seg->key = av_strdup(tmp_str);
+                        if (!seg->key) {
+                            av_free(seg->url);
+                            av_free(seg);
+                            ret = AVERROR(ENOMEM);
+                            goto fail;
+                        }
+                    } else {
+                        seg->key = NULL;
+                    }
                 }
+                seg->duration = duration;
 
                 dynarray_add(&pls->segments, &pls->n_segments, seg);
                 is_segment = 0;
@@ -1040,8 +1225,6 @@ static int parse_playlist(HLSContext *c, const char *url,
             av_log(c->ctx, AV_LOG_WARNING, "Media sequence changed unexpectedly: %d -> %d\n",
                    prev_start_seq_no, pls->start_seq_no);
         }
-        free_segment_dynarray(prev_segments, prev_n_segments);
-        av_freep(&prev_segments);
     }
     if (pls)
         pls->last_load_time = av_gettime_relative();
@@ -1051,9 +1234,30 @@ if (isExtendedM3U == false && pls) {
     }
 #endif
 fail:
+    if (prev_segments) {
+        int i;
+        if (ret < 0 && !pls->n_segments) {
+            /* nothing was parsed, keep the previous load */
+            av_free(pls->segments);
+            pls->segments     = prev_segments;
+            pls->n_segments   = prev_n_segments;
+            pls->start_seq_no = prev_start_seq_no;
+            pls->finished     = prev_finished;
+            pls->type         = prev_type;
+        } else {
+            /* free the segments that were not kept */
+            for (i = 0; i < prev_n_segments; i++)
+                if (prev_segments[i])
+                    free_segment_dynarray(&prev_segments[i], 1);
+            av_freep(&prev_segments);
+        }
+    }
     av_free(new_url);
     if (close_in)
         ff_format_io_close(c->ctx, &in);
+    else if (ret < 0 && in == c->playlist_pb)
+        /* the rest of the reply is still pending on the connection */
+        ff_format_io_close(c->ctx, &c->playlist_pb);
     c->ctx->ctx_flags = c->ctx->ctx_flags & ~(unsigned)AVFMTCTX_UNSEEKABLE;
     if (!c->n_variants || !c->variants[0]->n_playlists ||
         !(c->variants[0]->playlists[0]->finished ||
@@ -1062,6 +1266,40 @@ fail:
     return ret;
 }
 
+/*
+ * Reload a live playlist. If block_msn is not negative, the server holds
+ * the request until the segment with that sequence number is available.
+ * A delta update is requested if the server supports them and the playlist
+ * is recent enough, and a full reload is done if it cannot be applied.
+ */
+static int reload_playlist(HLSContext *c, struct playlist *pls, int block_msn)
+{
+    char url[MAX_URL_SIZE];
+    int skip = pls->can_skip_until > 0 &&
+               av_gettime_relative() - pls->last_load_time < pls->can_skip_until / 2;
+    int ret;
+
+    while (1) {
+        const char *sep = strchr(pls->url, '?') ? "&" : "?";
+
+        av_strlcpy(url, pls->url, sizeof(url));
+        if (block_msn >= 0) {
+            av_strlcatf(url, sizeof(url), "%s_HLS_msn=%d", sep, block_msn);
+            sep = "&";
+        }
+        if (skip)
+            av_strlcatf(url, sizeof(url), "%s_HLS_skip=YES", sep);
+
+        ret = parse_playlist(c, url, pls, NULL);
+        if (ret != AVERROR_INVALIDDATA || !skip)
+            return ret;
+        av_log(c->ctx, AV_LOG_VERBOSE,
+               "Cannot apply the delta update of playlist %d, reloading it\n",
+               pls->index);
+        skip = 0;
+    }
+}
+
 static struct segment *current_segment(struct playlist *pls)
 {
     return pls->segments[pls->cur_seq_no - pls->start_seq_no];
@@ -1084,7 +1322,13 @@ static int read_from_url(struct playlist *pls, struct segment *seg,
     if (seg->size >= 0)
         buf_size = FFMIN(buf_size, seg->size - pls->cur_seg_offset);
 
-    ret = avio_read(pls->input, buf, buf_size);
+    if (pls->prefetching) {
+        ret = ff_prefetch_read(pls->prefetch, buf, buf_size);
+    } else {
+        int64_t start = av_gettime_relative();
+        ret = avio_read(pls->input, buf, buf_size);
+        pls->seg_download_time += av_gettime_relative() - start;
+    }
     if (ret > 0)
         pls->cur_seg_offset += ret;
 
@@ -1289,8 +1533,26 @@ static void intercept_id3(struct playlist *pls, uint8_t *buf,
         pls->is_id3_timestamped = (pls->id3_mpegts_timestamp != AV_NOPTS_VALUE);
 }
 
-static int open_input(HLSContext *c, struct playlist *pls, struct segment *seg, AVIOContext **in)
+static void close_url(AVFormatContext *s, AVIOContext **pb,
+                      AVIOInterruptCB *int_cb)
+{
+    if (int_cb)
+        avio_closep(pb);
+    else
+        ff_format_io_close(s, pb);
+}
+
+/*
+ * Open a segment of the playlist with the given index. key_url and key
+ * cache the last AES-128 key. int_cb is set when called from the prefetch
+ * thread, see open_url(); avio_opts is then a copy owned by that thread.
+ */
+static int open_segment(AVFormatContext *s, int index, int live,
+                        const struct segment *seg, AVDictionary *avio_opts,
+                        char *key_url, uint8_t *key,
+                        AVIOInterruptCB *int_cb, AVIOContext **in)
 {
+    HLSContext *c = s->priv_data;
     AVDictionary *opts = NULL;
     int ret;
     int is_http = 0;
@@ -1300,7 +1562,7 @@ static int open_input(HLSContext *c, struct playlist *pls, struct segment *seg,
 
     av_dict_set( &opts, "ijkiomanager", c->io_manager_ctx, 0);
     av_dict_set( &opts, "ijkapplication", c->app_ctx, 0);
-    av_dict_set_int( &opts, "medialive", (int64_t)!pls->finished, 0);
+    av_dict_set_int( &opts, "medialive", live, 0);
 
     if (seg->size >= 0) {
         /* try to restrict the HTTP request to the part we want
@@ -1309,46 +1571,46 @@ static int open_input(HLSContext *c, struct playlist *pls, struct segment *seg,
         av_dict_set_int(&opts, "end_offset", seg->url_offset + seg->size, 0);
     }
 
-    av_log(pls->parent, AV_LOG_VERBOSE, "HLS request for url '%s', offset %"PRId64", playlist %d\n",
-           seg->url, seg->url_offset, pls->index);
+    av_log(s, AV_LOG_VERBOSE, "HLS %s for url '%s', offset %"PRId64", playlist %d\n",
+           int_cb ? "prefetch" : "request", seg->url, seg->url_offset, index);
 
     if (seg->key_type == KEY_NONE) {
-        ret = open_url(pls->parent, in, seg->url, c->avio_opts, opts, &is_http);
+        ret = open_url(s, in, seg->url, avio_opts, opts, &is_http, int_cb);
     } else if (seg->key_type == KEY_AES_128) {
-        char iv[33], key[33], url[MAX_URL_SIZE];
-        if (strcmp(seg->key, pls->key_url)) {
+        char iv[33], key_hex[33], url[MAX_URL_SIZE];
+        if (strcmp(seg->key, key_url)) {
             AVIOContext *pb = NULL;
-            if (open_url(pls->parent, &pb, seg->key, c->avio_opts, opts, NULL) == 0) {
-                ret = avio_read(pb, pls->key, sizeof(pls->key));
-                if (ret != sizeof(pls->key)) {
-                    av_log(pls->parent, AV_LOG_ERROR, "Unable to read key file %s\n",
+            if (open_url(s, &pb, seg->key, avio_opts, opts, NULL, int_cb) == 0) {
+                ret = avio_read(pb, key, 16);
+                if (ret != 16) {
+                    av_log(s, AV_LOG_ERROR, "Unable to read key file %s\n",
                            seg->key);
                 }
-                ff_format_io_close(pls->parent, &pb);
+                close_url(s, &pb, int_cb);
             } else {
-                av_log(pls->parent, AV_LOG_ERROR, "Unable to open key file %s\n",
+                av_log(s, AV_LOG_ERROR, "Unable to open key file %s\n",
                        seg->key);
             }
-            av_strlcpy(pls->key_url, seg->key, sizeof(pls->key_url));
+            av_strlcpy(key_url, seg->key, MAX_URL_SIZE);
         }
         ff_data_to_hex(iv, seg->iv, sizeof(seg->iv), 0);
-        ff_data_to_hex(key, pls->key, sizeof(pls->key), 0);
-        iv[32] = key[32] = '\0';
+        ff_data_to_hex(key_hex, key, 16, 0);
+        iv[32] = key_hex[32] = '\0';
         if (strstr(seg->url, "://"))
             snprintf(url, sizeof(url), "crypto+%s", seg->url);
         else
             snprintf(url, sizeof(url), "crypto:%s", seg->url);
 
-        av_dict_set(&opts, "key", key, 0);
+        av_dict_set(&opts, "key", key_hex, 0);
         av_dict_set(&opts, "iv", iv, 0);
 
-        ret = open_url(pls->parent, in, url, c->avio_opts, opts, &is_http);
+        ret = open_url(s, in, url, avio_opts, opts, &is_http, int_cb);
         if (ret < 0) {
             goto cleanup;
         }
         ret = 0;
     } else if (seg->key_type == KEY_SAMPLE_AES) {
-        av_log(pls->parent, AV_LOG_ERROR,
+        av_log(s, AV_LOG_ERROR,
                "SAMPLE-AES encryption is not supported yet\n");
         ret = AVERROR_PATCHWELCOME;
     }
@@ -1368,18 +1630,103 @@ static int open_input(HLSContext *c, struct playlist *pls, struct segment *seg,
     if (ret == 0 && !is_http && seg->key_type == KEY_NONE && seg->url_offset) {
         int64_t seekret = avio_seek(*in, seg->url_offset, SEEK_SET);
         if (seekret < 0) {
-            av_log(pls->parent, AV_LOG_ERROR, "Unable to seek to offset %"PRId64" of HLS segment '%s'\n", seg->url_offset, seg->url);
+            av_log(s, AV_LOG_ERROR, "Unable to seek to offset %"PRId64" of HLS segment '%s'\n", seg->url_offset, seg->url);
             ret = seekret;
-            ff_format_io_close(pls->parent, in);
+            close_url(s, in, int_cb);
         }
     }
 
 cleanup:
     av_dict_free(&opts);
+    return ret;
+}
+
+static int open_input(HLSContext *c, struct playlist *pls, struct segment *seg, AVIOContext **in)
+{
+    int ret = open_segment(pls->parent, pls->index, !pls->finished, seg,
+                           c->avio_opts, pls->key_url, pls->key, NULL, in);
     pls->cur_seg_offset = 0;
     return ret;
 }
 
+/* A segment download queued in the prefetch queue of a playlist. */
+struct prefetch_request {
+    struct playlist *pls;
+    struct segment seg;
+    AVDictionary *avio_opts;
+    int live;
+};
+
+static int prefetch_open(void *opaque, AVIOContext **pb, AVIOInterruptCB *int_cb)
+{
+    struct prefetch_request *req = opaque;
+    struct playlist *pls = req->pls;
+
+    return open_segment(pls->parent, pls->index, req->live, &req->seg,
+                        req->avio_opts, pls->prefetch_key_url, pls->prefetch_key,
+                        int_cb, pb);
+}
+
+static void prefetch_request_free(void *opaque)
+{
+    struct prefetch_request *req = opaque;
+
+    av_free(req->seg.url);
+    av_free(req->seg.key);
+    av_dict_free(&req->avio_opts);
+    av_free(req);
+}
+
+/*
+ * Queue the downloads of the segments after the current one, up to the
+ * prefetch depth. Only network segments are prefetched.
+ */
+static void prefetch_segments(HLSContext *c, struct playlist *pls)
+{
+    int64_t seq_no, end;
+
+    if (!c->prefetch)
+        return;
+    if (!pls->prefetch &&
+        ff_prefetch_queue_alloc(c->prefetch, &pls->prefetch) < 0)
+        return;
+
+    seq_no = FFMAX(pls->cur_seq_no + 1, ff_prefetch_last_id(pls->prefetch) + 1);
+    end    = FFMIN(pls->cur_seq_no + c->prefetch_segments,
+                   pls->start_seq_no + pls->n_segments - 1);
+    for (; seq_no <= end; seq_no++) {
+        struct segment *seg = pls->segments[seq_no - pls->start_seq_no];
+        struct prefetch_request *req;
+
+        if (seg->key_type == KEY_SAMPLE_AES || !av_strstart(seg->url, "http", NULL))
+            break;
+        if (!(req = av_mallocz(sizeof(*req))))
+            break;
+        req->pls      = pls;
+        req->seg      = *seg;
+        req->seg.url  = av_strdup(seg->url);
+        req->seg.key  = seg->key ? av_strdup(seg->key) : NULL;
+        req->seg.init_section = NULL;
+        req->live     = !pls->finished;
+        if (!req->seg.url || (seg->key && !req->seg.key) ||
+            av_dict_copy(&req->avio_opts, c->avio_opts, 0) < 0) {
+            prefetch_request_free(req);
+            break;
+        }
+        if (ff_prefetch_add(pls->prefetch, seq_no, seg->size,
+                            prefetch_open, req, prefetch_request_free) < 0)
+            break;
+    }
+}
+
+/* Drop the prefetched segments, the playlist is not read sequentially. */
+static void reset_prefetch(struct playlist *pls)
+{
+    if (pls->prefetch)
+        ff_prefetch_flush(pls->prefetch);
+    pls->prefetching = 0;
+}
+
 static int update_init_section(struct playlist *pls, struct segment *seg)
 {
     static const int max_init_section_size = 1024*1024;
@@ -1444,9 +1791,46 @@ static int64_t default_reload_interval(struct playlist *pls)
                           pls->target_duration;
 }
 
+static int variant_has_playlist(struct variant *var, struct playlist *pls)
+{
+    int i;
+
+    for (i = 0; i < var->n_playlists; i++)
+        if (var->playlists[i] == pls)
+            return 1;
+    return 0;
+}
+
+static int streams_needed(struct playlist *pls)
+{
+    int i;
+
+    for (i = 0; i < pls->n_main_streams; i++)
+        if (pls->main_streams[i]->discard < AVDISCARD_ALL)
+            return 1;
+    return 0;
+}
+
+/*
+ * With ABR, the packets of the main playlists of all variants are output on
+ * the streams of one of them: the first one the caller did not discard.
+ */
+static struct playlist *abr_output_playlist(HLSContext *c)
+{
+    int i;
+
+    for (i = 0; i < c->n_variants; i++) {
+        struct playlist *pls = c->variants[i]->playlists[0];
+        if (pls->n_main_streams && streams_needed(pls))
+            return pls;
+    }
+    return c->variants[c->abr_variant]->playlists[0];
+}
+
 static int playlist_needed(struct playlist *pls)
 {
     AVFormatContext *s = pls->parent;
+    HLSContext *c;
     int i, j;
     int stream_needed = 0;
     int first_st;
@@ -1455,14 +1839,18 @@ static int playlist_needed(struct playlist *pls)
     if (!pls->ctx || !pls->n_main_streams)
         return 1;
 
-    /* check if any of the streams in the playlist are needed */
-    for (i = 0; i < pls->n_main_streams; i++) {
-        if (pls->main_streams[i]->discard < AVDISCARD_ALL) {
-            stream_needed = 1;
-            break;
-        }
+    /* With ABR, only the playlists of the current variant are needed */
+    c = s->priv_data;
+    if (c->abr) {
+        if (!variant_has_playlist(c->variants[c->abr_variant], pls))
+            return 0;
+        if (pls->abr_main)
+            return streams_needed(abr_output_playlist(c));
     }
 
+    /* check if any of the streams in the playlist are needed */
+    stream_needed = streams_needed(pls);
+
     /* If all streams in the playlist were discarded, the playlist is not
      * needed (regardless of whether whole programs are discarded or not). */
     if (!stream_needed)
@@ -1490,6 +1878,119 @@ static int playlist_needed(struct playlist *pls)
     return 0;
 }
 
+/* fraction of the estimated throughput a variant may use to switch up to
+ * it, or to stay on it or switch down to it */
+#define ABR_UP_FACTOR      0.7
+#define ABR_DOWN_FACTOR    0.9
+
+/* Add the download of a segment to the throughput estimate. */
+static void abr_add_sample(HLSContext *c, int64_t bytes, int64_t time)
+{
+    if (bytes <= 0 || time <= 0)
+        return;
+    c->abr_samples[c->abr_nb_samples++ % ABR_SAMPLES] =
+        bytes * 8.0 * AV_TIME_BASE / time;
+}
+
+/*
+ * @return the estimated throughput in bit/s, -1 if unknown: the harmonic
+ * mean of the last samples, or the last one if lower. It follows a drop of
+ * the throughput at once, and a rise only once all the samples are higher.
+ */
+static int64_t abr_throughput(HLSContext *c)
+{
+    int i, n = FFMIN(c->abr_nb_samples, ABR_SAMPLES);
+    double sum = 0;
+
+    if (!n)
+        return -1;
+    for (i = 0; i < n; i++)
+        sum += 1 / c->abr_samples[i];
+    return FFMIN(n / sum, c->abr_samples[(c->abr_nb_samples - 1) % ABR_SAMPLES]);
+}
+
+/*
+ * @return the media duration downloaded ahead of a real time playback
+ * started with the first packet
+ */
+static int64_t abr_buffer(HLSContext *c)
+{
+    if (!c->abr_start_time)
+        return c->abr_downloaded;
+    return FFMAX(c->abr_downloaded - (av_gettime_relative() - c->abr_start_time), 0);
+}
+
+static int abr_variant_usable(struct variant *var)
+{
+    struct playlist *pls = var->playlists[0];
+
+    return pls->ctx && pls->n_main_streams && !pls->broken;
+}
+
+/* Choose the variant to read the next segment from. */
+static int abr_select_variant(HLSContext *c)
+{
+    struct variant *cur = c->variants[c->abr_variant];
+    int64_t throughput = abr_throughput(c);
+    int i, best = -1, lowest = -1;
+
+    if (throughput < 0)
+        return c->abr_variant;
+
+    for (i = 0; i < c->n_variants; i++) {
+        struct variant *var = c->variants[i];
+        double factor = var->bandwidth > cur->bandwidth ? ABR_UP_FACTOR :
+                                                          ABR_DOWN_FACTOR;
+
+        if (!abr_variant_usable(var))
+            continue;
+        if (lowest < 0 || var->bandwidth < c->variants[lowest]->bandwidth)
+            lowest = i;
+        if (var->bandwidth <= throughput * factor &&
+            (best < 0 || var->bandwidth > c->variants[best]->bandwidth))
+            best = i;
+    }
+    if (best < 0)
+        best = lowest;
+
+    /* do not risk a stall on a higher bitrate with a low buffer */
+    if (best < 0 || (c->variants[best]->bandwidth > cur->bandwidth &&
+                     abr_buffer(c) < c->abr_min_buffer))
+        return c->abr_variant;
+    return best;
+}
+
+/* Update the estimates once a segment of the playlist was read. */
+static void abr_segment_done(HLSContext *c, struct playlist *pls,
+                             struct segment *seg)
+{
+    int64_t time = pls->prefetching ? ff_prefetch_download_time(pls->prefetch) :
+                                      pls->seg_download_time;
+    struct variant *cur = c->variants[c->abr_variant];
+
+    abr_add_sample(c, pls->cur_seg_offset, time);
+
+    if (pls != cur->playlists[0] || c->abr_next_variant != c->abr_variant)
+        return;
+    c->abr_downloaded += seg->duration;
+    c->abr_next_variant = abr_select_variant(c);
+    if (c->abr_next_variant != c->abr_variant)
+        av_log(pls->parent, AV_LOG_VERBOSE,
+               "Switching from variant %d (%d bit/s) to variant %d (%d bit/s), "
+               "throughput %"PRId64" bit/s, buffer %"PRId64" ms\n",
+               c->abr_variant, cur->bandwidth, c->abr_next_variant,
+               c->variants[c->abr_next_variant]->bandwidth,
+               abr_throughput(c), abr_buffer(c) / 1000);
+}
+
+/* The playlist is drained before the next variant is read. */
+static int abr_switching_from(HLSContext *c, struct playlist *pls)
+{
+    return c->abr && c->abr_next_variant != c->abr_variant &&
+           pls == c->variants[c->abr_variant]->playlists[0] &&
+           pls != c->variants[c->abr_next_variant]->playlists[0];
+}
+
 static int read_data(void *opaque, uint8_t *buf, int buf_size)
 {
     struct playlist *v = opaque;
@@ -1497,15 +1998,20 @@ static int read_data(void *opaque, uint8_t *buf, int buf_size)
     int ret;
     int just_opened = 0;
     int reload_count = 0;
+    int block_reload = 0;
     struct segment *seg;
 
 restart:
     if (!v->needed)
         return AVERROR_EOF;
 
-    if (!v->input || (c->http_persistent && v->input_read_done)) {
+    if ((!v->input && !v->prefetching) ||
+        (c->http_persistent && v->input_read_done)) {
         int64_t reload_interval;
 
+        if (abr_switching_from(c, v))
+            return AVERROR_EOF;
+
         /* Check that the playlist is still needed before opening a new
          * segment. */
         v->needed = playlist_needed(v);
@@ -1517,16 +2023,21 @@ restart:
         }
 
         /* If this is a live stream and the reload interval has elapsed since
-         * the last playlist reload, reload the playlists now. */
+         * the last playlist reload, reload the playlists now. If the server
+         * supports blocking reloads, the playlist is only reloaded once its
+         * segments are exhausted, waiting for the next one. */
         reload_interval = default_reload_interval(v);
 
 reload:
         reload_count++;
         if (reload_count > c->max_reload)
             return AVERROR_EOF;
-        if (!v->finished &&
-            av_gettime_relative() - v->last_load_time >= reload_interval) {
-            if ((ret = parse_playlist(c, v->url, v, NULL)) < 0) {
+        if (!v->finished && (block_reload ||
+            (!v->can_block_reload &&
+             av_gettime_relative() - v->last_load_time >= reload_interval))) {
+            ret = reload_playlist(c, v, block_reload ?
+                                  v->start_seq_no + v->n_segments : -1);
+            if (ret < 0) {
                 if (ret != AVERROR_EXIT)
                     av_log(v->parent, AV_LOG_WARNING, "Failed to reload playlist %d\n",
                            v->index);
@@ -1557,6 +2068,12 @@ reload:
         if (v->cur_seq_no >= v->start_seq_no + v->n_segments) {
             if (v->finished)
                 return AVERROR_EOF;
+            if (v->can_block_reload && !block_reload) {
+                block_reload = 1;
+                goto reload;
+            }
+            /* wait before reloading again, also if a blocking reload
+             * returned without the next segment */
             while (av_gettime_relative() - v->last_load_time < reload_interval) {
                 if (ff_check_interrupt(c->interrupt_callback))
                     return AVERROR_EXIT;
@@ -1574,13 +2091,22 @@ reload:
         if (ret)
             return ret;
 
-        if (c->http_multiple == 1 && v->input_next_requested) {
+        v->seg_download_time = 0;
+        if (v->prefetch && ff_prefetch_start(v->prefetch, v->cur_seq_no)) {
+            /* the segment is already being downloaded */
+            ff_format_io_close(v->parent, &v->input);
+            v->prefetching = 1;
+            v->cur_seg_offset = 0;
+            ret = 0;
+        } else if (c->http_multiple == 1 && v->input_next_requested) {
             FFSWAP(AVIOContext *, v->input, v->input_next);
             v->cur_seg_offset = 0;
             v->input_next_requested = 0;
             ret = 0;
         } else {
+            int64_t start = av_gettime_relative();
             ret = open_input(c, v, seg, &v->input);
+            v->seg_download_time = av_gettime_relative() - start;
         }
         if (ret < 0) {
             if (ff_check_interrupt(c->interrupt_callback))
@@ -1592,9 +2118,10 @@ reload:
             goto reload;
         }
         just_opened = 1;
+        prefetch_segments(c, v);
     }
 
-    if (c->http_multiple == -1) {
+    if (c->http_multiple == -1 && v->input) {
         uint8_t *http_version_opt = NULL;
         int r = av_opt_get(v->input, "http_version", AV_OPT_SEARCH_CHILDREN, &http_version_opt);
         if (r >= 0) {
@@ -1604,7 +2131,7 @@ reload:
     }
 
     seg = next_segment(v);
-    if (c->http_multiple == 1 && !v->input_next_requested &&
+    if (!c->prefetch && c->http_multiple == 1 && !v->input_next_requested &&
         seg && seg->key_type == KEY_NONE && av_strstart(seg->url, "http", NULL)) {
         ret = open_input(c, v, seg, &v->input_next);
         if (ret < 0) {
@@ -1637,7 +2164,11 @@ reload:
 
         return ret;
     }
-    if (c->http_persistent &&
+    if (c->abr && (!ret || ret == AVERROR_EOF))
+        abr_segment_done(c, v, seg);
+    if (v->prefetching) {
+        v->prefetching = 0;
+    } else if (c->http_persistent &&
         seg->key_type == KEY_NONE && av_strstart(seg->url, "http", NULL)) {
         v->input_read_done = 1;
     } else {
@@ -1898,6 +2429,7 @@ static int hls_close(AVFormatContext *s)
 {
     HLSContext *c = s->priv_data;
 
+    ff_prefetch_free(&c->prefetch);
     free_playlist_list(c);
     free_variant_list(c);
     free_rendition_list(c);
@@ -1929,6 +2461,11 @@ static int hls_read_header(AVFormatContext *s)
        the range header */
     av_dict_set_int(&c->avio_opts, "seekable", c->http_seekable, 0);
 
+    if (c->prefetch_segments > 0 &&
+        !(c->prefetch = ff_prefetch_alloc(s, c->interrupt_callback,
+                                          c->prefetch_max_memory)))
+        av_log(s, AV_LOG_WARNING, "Segment prefetching is not available\n");
+
     if ((ret = parse_playlist(c, s->url, NULL, s->pb)) < 0)
         goto fail;
 
@@ -2167,6 +2704,7 @@ static int recheck_discard_flags(AVFormatContext *s, int first)
             pls->input_read_done = 0;
             ff_format_io_close(pls->parent, &pls->input_next);
             pls->input_next_requested = 0;
+            reset_prefetch(pls);
             pls->needed = 0;
             changed = 1;
             av_log(s, AV_LOG_INFO, "No longer receiving playlist %d\n", i);
@@ -2217,11 +2755,141 @@ static int compare_ts_with_wrapdetect(int64_t ts_a, struct playlist *pls_a,
     return av_compare_mod(scaled_ts_a, scaled_ts_b, 1LL << 33);
 }
 
+static void abr_init(AVFormatContext *s)
+{
+    HLSContext *c = s->priv_data;
+    int i;
+
+    c->abr = 0;
+    if (c->n_variants < 2)
+        return;
+    for (i = 0; i < c->n_variants && !c->variants[i]->bandwidth; i++)
+        ;
+    if (i == c->n_variants) {
+        av_log(s, AV_LOG_WARNING,
+               "No variant has a BANDWIDTH, not switching between them\n");
+        return;
+    }
+    for (i = 0; i < c->n_variants; i++) {
+        if (abr_variant_usable(c->variants[i]) && !c->abr) {
+            c->abr = 1;
+            c->abr_variant = c->abr_next_variant = i;
+        }
+        c->variants[i]->playlists[0]->abr_main = 1;
+    }
+    c->abr_start_time = av_gettime_relative();
+}
+
+/* Reset the reading of a playlist, to start at cur_seq_no. */
+static void reset_playlist(struct playlist *pls)
+{
+    ff_format_io_close(pls->parent, &pls->input);
+    pls->input_read_done = 0;
+    ff_format_io_close(pls->parent, &pls->input_next);
+    pls->input_next_requested = 0;
+    reset_prefetch(pls);
+    av_packet_unref(&pls->pkt);
+    pls->pb.eof_reached = 0;
+    /* Clear any buffered data */
+    pls->pb.buf_end = pls->pb.buf_ptr = pls->pb.buffer;
+    /* Reset the pos, to let the mpegts demuxer know we've seeked. */
+    pls->pb.pos = 0;
+    /* Flush the packet queue of the subdemuxer. */
+    ff_read_frame_flush(pls->ctx);
+}
+
+/*
+ * Switch to the next variant once the current one was drained, continuing
+ * at the next segment.
+ */
+static void abr_switch(AVFormatContext *s)
+{
+    HLSContext *c = s->priv_data;
+    struct playlist *cur = c->variants[c->abr_variant]->playlists[0];
+    struct variant *var = c->variants[c->abr_next_variant];
+    int i;
+
+    c->abr_variant = c->abr_next_variant;
+
+    cur->needed = 0;
+    reset_playlist(cur);
+
+    for (i = 0; i < var->n_playlists; i++) {
+        struct playlist *pls = var->playlists[i];
+
+        if (pls->needed || !playlist_needed(pls))
+            continue;
+        pls->needed = 1;
+        reset_playlist(pls);
+        if (pls->abr_main && cur->cur_seq_no >= pls->start_seq_no &&
+            cur->cur_seq_no < pls->start_seq_no + pls->n_segments) {
+            /* the segments of the variants are aligned */
+            pls->cur_seq_no = cur->cur_seq_no;
+        } else {
+            find_timestamp_in_playlist(c, pls, c->cur_timestamp, &pls->cur_seq_no);
+            pls->seek_timestamp = c->cur_timestamp;
+            pls->seek_flags = AVSEEK_FLAG_ANY;
+            pls->seek_stream_index = -1;
+        }
+    }
+
+    av_dict_set_int(&s->metadata, "variant_bitrate", var->bandwidth, 0);
+    s->event_flags |= AVFMT_EVENT_FLAG_METADATA_UPDATED;
+}
+
+/*
+ * With ABR, output the packets of a main playlist on the matching stream of
+ * the output playlist, updating its parameters if the variant differs.
+ */
+static AVStream *abr_output_stream(AVFormatContext *s, struct playlist *pls,
+                                   AVPacket *pkt)
+{
+    HLSContext *c = s->priv_data;
+    struct playlist *out;
+    AVStream *ist = pls->ctx->streams[pkt->stream_index];
+    AVStream *st  = pls->main_streams[pkt->stream_index];
+    AVStream *ost;
+
+    if (!c->abr || !pls->abr_main || (out = abr_output_playlist(c)) == pls ||
+        pkt->stream_index >= out->n_main_streams)
+        return st;
+    ost = out->main_streams[pkt->stream_index];
+    if (ost->codecpar->codec_type != ist->codecpar->codec_type)
+        return st;
+
+    av_packet_rescale_ts(pkt, st->time_base, ost->time_base);
+    if (ost->codecpar->codec_id    != ist->codecpar->codec_id    ||
+        ost->codecpar->width       != ist->codecpar->width       ||
+        ost->codecpar->height      != ist->codecpar->height      ||
+        ost->codecpar->sample_rate != ist->codecpar->sample_rate ||
+        ost->codecpar->channels    != ist->codecpar->channels    ||
+        ost->codecpar->extradata_size != ist->codecpar->extradata_size ||
+        (ist->codecpar->extradata_size &&
+         memcmp(ost->codecpar->extradata, ist->codecpar->extradata,
+                ist->codecpar->extradata_size))) {
+        if (avcodec_parameters_copy(ost->codecpar, ist->codecpar) >= 0) {
+            ost->internal->need_context_update = 1;
+            if (ist->codecpar->extradata_size) {
+                uint8_t *side = av_packet_new_side_data(pkt, AV_PKT_DATA_NEW_EXTRADATA,
+                                                        ist->codecpar->extradata_size);
+                if (side)
+                    memcpy(side, ist->codecpar->extradata,
+                           ist->codecpar->extradata_size);
+            }
+        }
+    }
+    return ost;
+}
+
 static int hls_read_packet(AVFormatContext *s, AVPacket *pkt)
 {
     HLSContext *c = s->priv_data;
-    int ret, i, minplaylist = -1;
+    int ret, i, minplaylist;
 
+    if (c->first_packet && c->abr)
+        abr_init(s);
+restart:
+    minplaylist = -1;
     recheck_discard_flags(s, c->first_packet);
     c->first_packet = 0;
 
@@ -2238,6 +2906,10 @@ static int hls_read_packet(AVFormatContext *s, AVPacket *pkt)
                     if (!avio_feof(&pls->pb) && ret != AVERROR_EOF)
                         return ret;
                     reset_packet(&pls->pkt);
+                    if (abr_switching_from(c, pls)) {
+                        abr_switch(s);
+                        goto restart;
+                    }
                     break;
                 } else {
                     /* stream_index check prevents matching picture attachments etc. */
@@ -2333,16 +3005,19 @@ static int hls_read_packet(AVFormatContext *s, AVPacket *pkt)
         st = pls->main_streams[pls->pkt.stream_index];
 
         av_packet_move_ref(pkt, &pls->pkt);
-        pkt->stream_index = st->index;
 
         if (pkt->dts != AV_NOPTS_VALUE)
             c->cur_timestamp = av_rescale_q(pkt->dts,
                                             ist->time_base,
                                             AV_TIME_BASE_Q);
 
+        st = abr_output_stream(s, pls, pkt);
+        pkt->stream_index = st->index;
+
         /* There may be more situations where this would be useful, but this at least
          * handles newly probed codecs properly (i.e. request_probe by mpegts). */
-        if (ist->codecpar->codec_id != st->codecpar->codec_id) {
+        if (st == pls->main_streams[ist->index] &&
+            ist->codecpar->codec_id != st->codecpar->codec_id) {
             ret = set_stream_info_from_input_stream(st, pls, ist);
             if (ret < 0) {
                 return ret;
@@ -2404,18 +3079,7 @@ static int hls_read_seek(AVFormatContext *s, int stream_index,
     for (i = 0; i < c->n_playlists; i++) {
         /* Reset reading */
         struct playlist *pls = c->playlists[i];
-        ff_format_io_close(pls->parent, &pls->input);
-        pls->input_read_done = 0;
-        ff_format_io_close(pls->parent, &pls->input_next);
-        pls->input_next_requested = 0;
-        av_packet_unref(&pls->pkt);
-        pls->pb.eof_reached = 0;
-        /* Clear any buffered data */
-        pls->pb.buf_end = pls->pb.buf_ptr = pls->pb.buffer;
-        /* Reset the pos, to let the mpegts demuxer know we've seeked. */
-        pls->pb.pos = 0;
-        /* Flush the packet queue of the subdemuxer. */
-        ff_read_frame_flush(pls->ctx);
+        reset_playlist(pls);
 
         pls->seek_timestamp = seek_timestamp;
         pls->seek_flags = flags;
@@ -2432,6 +3096,7 @@ static int hls_read_seek(AVFormatContext *s, int stream_index,
     }
 
     c->cur_timestamp = seek_timestamp;
+    c->abr_next_variant = c->abr_variant;
 
     return 0;
 }
@@ -2469,6 +3134,14 @@ static const AVOption hls_options[] = {
         OFFSET(http_multiple), AV_OPT_TYPE_BOOL, {.i64 = -1}, -1, 1, FLAGS},
     {"http_seekable", "Use HTTP partial requests, 0 = disable, 1 = enable, -1 = auto",
         OFFSET(http_seekable), AV_OPT_TYPE_BOOL, { .i64 = -1}, -1, 1, FLAGS},
+    {"prefetch_segments", "Number of segments to download ahead of the current one",
+        OFFSET(prefetch_segments), AV_OPT_TYPE_INT, {.i64 = 0}, 0, INT_MAX, FLAGS},
+    {"prefetch_max_memory", "Maximum memory used by prefetched segments",
+        OFFSET(prefetch_max_memory), AV_OPT_TYPE_INT64, {.i64 = 16 << 20}, 0, INT64_MAX, FLAGS},
+    {"abr", "Switch between the variants depending on the download throughput",
+        OFFSET(abr), AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, FLAGS},
+    {"abr_min_buffer", "Minimum buffered duration to switch to a higher bitrate variant",
+        OFFSET(abr_min_buffer), AV_OPT_TYPE_DURATION, {.i64 = 0}, 0, INT64_MAX, FLAGS},
     /* To reject creating from local file.*/
 #ifdef MXTECHS
     {"local-file-only", "Reject.", OFFSET(local_file_only), AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, AV_OPT_FLAG_DECODING_PARAM},
@@ -31,6 +31,7 @@
 #include "libavutil/opt.h"
 #include "libavutil/time.h"
 #include "libavutil/parseutils.h"
+#include "libavutil/thread.h"
 
 #include "avformat.h"
 #include "http.h"
@@ -75,6 +76,8 @@ typedef struct HTTPContext {
     char *http_proxy;
     char *headers;
     char *mime_type;
+    char *etag;
+    char *last_modified;
     char *http_version;
     char *user_agent;
     char *referer;
@@ -127,6 +130,12 @@ typedef struct HTTPContext {
     int is_multi_client;
     HandshakeState handshake_step;
     int is_connected_server;
+    struct HTTPConnection *conn;
+    /* Content-Length of the current reply, UINT64_MAX if unknown. */
+    uint64_t content_length;
+    /* Offset after the body of the current reply, UINT64_MAX if unknown. */
+    uint64_t body_end;
+    int idle_timeout;
 } HTTPContext;
 
 #define OFFSET(x) offsetof(HTTPContext, x)
@@ -152,6 +161,8 @@ static const AVOption options[] = {
     { "multiple_requests", "use persistent connections", OFFSET(multiple_requests), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, D | E },
     { "post_data", "set custom HTTP post data", OFFSET(post_data), AV_OPT_TYPE_BINARY, .flags = D | E },
     { "mime_type", "export the MIME type", OFFSET(mime_type), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY },
+    { "etag", "export the entity tag of the reply", OFFSET(etag), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY },
+    { "last_modified", "export the Last-Modified date of the reply", OFFSET(last_modified), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY },
     { "http_version", "export the http response version", OFFSET(http_version), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY },
     { "cookies", "set cookies to be sent in applicable future requests, use newline delimited Set-Cookie HTTP field value syntax", OFFSET(cookies), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, D },
     { "icy", "request ICY metadata", OFFSET(icy), AV_OPT_TYPE_BOOL, { .i64 = 1 }, 0, 1, D },
@@ -173,6 +184,7 @@ static const AVOption options[] = {
     { "listen", "listen on HTTP", OFFSET(listen), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 2, D | E },
     { "resource", "The resource requested by a client", OFFSET(resource), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, E },
     { "reply_code", "The http status code to return to a client", OFFSET(reply_code), AV_OPT_TYPE_INT, { .i64 = 200}, INT_MIN, 599, E},
+    { "idle_timeout", "keep finished persistent connections for reuse by later requests for this many seconds, 0 to disable", OFFSET(idle_timeout), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, INT_MAX, D },
     { NULL }
 };
 
@@ -192,6 +204,246 @@ void ff_http_init_auth_state(URLContext *dest, const URLContext *src)
            sizeof(HTTPAuthState));
 }
 
+/*
+ * Persistent connections whose last reply was read completely are kept in a
+ * process wide pool when their URLContext is closed, so that the next
+ * request to the same server (the next HLS or DASH segment, a playlist
+ * reload, a key) does not pay for DNS, TCP and TLS again. The pool is keyed
+ * by the lower protocol URL, which holds the scheme, host and port, by the
+ * proxy and by the lower protocol options, so that a connection is only
+ * reused with the certificate checks it was opened with. A connection
+ * belongs to one URLContext at a time.
+ *
+ * The lower protocols copy the interrupt callback they are opened with, so
+ * they are given one that forwards to the callback of the current owner.
+ */
+typedef struct HTTPConnection {
+    URLContext *hd;                     ///< only set while in the pool
+    AVIOInterruptCB interrupt_callback; ///< callback of the current owner
+    char *key;
+    int64_t expiry;
+    struct HTTPConnection *next;
+} HTTPConnection;
+
+#define MAX_IDLE_CONNECTIONS 8
+
+static AVMutex connection_pool_mutex = AV_MUTEX_INITIALIZER;
+static HTTPConnection *connection_pool;
+
+static int connection_interrupt_cb(void *opaque)
+{
+    HTTPConnection *conn = opaque;
+    return ff_check_interrupt(&conn->interrupt_callback);
+}
+
+static void connection_free(URLContext **hd, HTTPConnection **conn)
+{
+    ffurl_closep(hd);
+    if (*conn)
+        av_freep(&(*conn)->key);
+    av_freep(conn);
+}
+
+/* Must be called with the pool locked. */
+static int connection_pool_expire(int64_t now)
+{
+    HTTPConnection **p = &connection_pool;
+    int nb_connections = 0;
+    while (*p) {
+        HTTPConnection *conn = *p;
+        if (conn->expiry <= now) {
+            *p = conn->next;
+            connection_free(&conn->hd, &conn);
+        } else {
+            p = &conn->next;
+            nb_connections++;
+        }
+    }
+    return nb_connections;
+}
+
+/*
+ * An idle connection must not have anything to read: that is either the
+ * server closing it (EOF, TLS close_notify) or garbage.
+ */
+static int connection_is_stale(HTTPConnection *conn)
+{
+    struct pollfd p = { ffurl_get_file_handle(conn->hd), POLLIN, 0 };
+    if (p.fd < 0)
+        return 0;
+    return poll(&p, 1, 0) != 0;
+}
+
+static HTTPConnection *connection_pool_get(const char *key)
+{
+    HTTPConnection *found = NULL, **p;
+
+    ff_mutex_lock(&connection_pool_mutex);
+    connection_pool_expire(av_gettime_relative());
+    for (p = &connection_pool; *p; ) {
+        HTTPConnection *conn = *p;
+        if (strcmp(conn->key, key)) {
+            p = &conn->next;
+            continue;
+        }
+        *p = conn->next;
+        if (!connection_is_stale(conn)) {
+            found = conn;
+            break;
+        }
+        connection_free(&conn->hd, &conn);
+    }
+    ff_mutex_unlock(&connection_pool_mutex);
+    return found;
+}
+
+static void connection_pool_put(HTTPConnection *conn, URLContext *hd, int idle_timeout)
+{
+    HTTPConnection **p;
+    int64_t now = av_gettime_relative();
+
+    conn->hd     = hd;
+    conn->expiry = now + idle_timeout * INT64_C(1000000);
+    memset(&conn->interrupt_callback, 0, sizeof(conn->interrupt_callback));
+
+    ff_mutex_lock(&connection_pool_mutex);
+    /* the most recently used connections come first, drop the oldest */
+    if (connection_pool_expire(now) >= MAX_IDLE_CONNECTIONS) {
+        for (p = &connection_pool; (*p)->next; p = &(*p)->next)
+            ;
+        connection_free(&(*p)->hd, p);
+    }
+    conn->next      = connection_pool;
+    connection_pool = conn;
+    ff_mutex_unlock(&connection_pool_mutex);
+}
+
+/* The current reply was read completely and the server keeps the connection. */
+static int http_connection_reusable(URLContext *h)
+{
+    HTTPContext *s = h->priv_data;
+
+    if (!s->hd || !s->conn || s->idle_timeout <= 0 || s->willclose ||
+        !s->end_header || (h->flags & AVIO_FLAG_WRITE) ||
+        s->buf_ptr != s->buf_end)
+        return 0;
+    if (s->chunksize != UINT64_MAX)
+        return s->chunkend;
+    return s->body_end != UINT64_MAX && s->off == s->body_end;
+}
+
+/* Close the connection of h, or put it in the pool if it can be reused. */
+static void http_release_connection(URLContext *h)
+{
+    HTTPContext *s = h->priv_data;
+
+    if (http_connection_reusable(h)) {
+        connection_pool_put(s->conn, s->hd, s->idle_timeout);
+        s->hd   = NULL;
+        s->conn = NULL;
+    } else {
+        connection_free(&s->hd, &s->conn);
+    }
+}
+
+static char *connection_key(URLContext *h, const char *lower_url,
+                            const char *proxy, AVDictionary *options)
+{
+    const URLProtocol **protocols;
+    const AVClass *class = NULL;
+    AVDictionaryEntry *e = NULL;
+    AVBPrint key;
+    char proto[16], *str;
+    int i;
+
+    av_url_split(proto, sizeof(proto), NULL, 0, NULL, 0, NULL, NULL, 0, lower_url);
+    if (!(protocols = ffurl_get_protocols(h->protocol_whitelist,
+                                          h->protocol_blacklist)))
+        return NULL;
+    for (i = 0; protocols[i]; i++)
+        if (!strcmp(protocols[i]->name, proto))
+            class = protocols[i]->priv_data_class;
+
+    av_bprint_init(&key, 0, AV_BPRINT_SIZE_UNLIMITED);
+    av_bprintf(&key, "%s;%s", lower_url, proxy ? proxy : "");
+    while (class && (e = av_dict_get(options, "", e, AV_DICT_IGNORE_SUFFIX)))
+        if (av_opt_find(&class, e->key, NULL, 0, AV_OPT_SEARCH_FAKE_OBJ))
+            av_bprintf(&key, ";%s=%s", e->key, e->value);
+    av_free(protocols);
+
+    if (av_bprint_finalize(&key, &str) < 0)
+        return NULL;
+    return str;
+}
+
+/**
+ * Open the lower protocol connection, or take an idle one from the pool.
+ *
+ * @return 1 if the connection was reused, 0 if it is new, < 0 on error
+ */
+static int http_open_connection(URLContext *h, const char *lower_url,
+                                const char *proxy, AVDictionary **options,
+                                int use_pool)
+{
+    HTTPContext *s = h->priv_data;
+    HTTPConnection *conn;
+    AVIOInterruptCB int_cb;
+    char *key;
+    int err;
+
+    if (!(key = connection_key(h, lower_url, proxy, options ? *options : NULL)))
+        return AVERROR(ENOMEM);
+
+    if (use_pool && s->idle_timeout > 0 && (conn = connection_pool_get(key))) {
+        av_free(key);
+        conn->interrupt_callback = h->interrupt_callback;
+        s->hd    = conn->hd;
+        s->conn  = conn;
+        conn->hd = NULL;
+        av_log(h, AV_LOG_DEBUG, "Reusing connection to %s\n", lower_url);
+        return 1;
+    }
+
+    if (!(conn = av_mallocz(sizeof(*conn)))) {
+        av_free(key);
+        return AVERROR(ENOMEM);
+    }
+    conn->key                = key;
+    conn->interrupt_callback = h->interrupt_callback;
+    int_cb.callback          = connection_interrupt_cb;
+    int_cb.opaque            = conn;
+    err = ffurl_open_whitelist(&s->hd, lower_url, AVIO_FLAG_READ_WRITE,
+                               &int_cb, options,
+                               h->protocol_whitelist, h->protocol_blacklist, h);
+    if (err < 0) {
+        connection_free(&s->hd, &conn);
+        return err;
+    }
+    s->conn = conn;
+    return 0;
+}
+
+/*
+ * A request that failed on a reused connection is sent again on a new one
+ * only if the server most likely closed the idle connection before reading
+ * it: the transport failed before any byte of a reply arrived, and the
+ * request can safely be repeated.
+ */
+static int http_can_retry(URLContext *h, int err)
+{
+    HTTPContext *s = h->priv_data;
+
+    if (err != AVERROR_EOF && err != AVERROR(EIO) && err != AVERROR(EPIPE) &&
+        err != AVERROR(ECONNRESET) && err != AVERROR(ECONNABORTED))
+        return 0;
+    if (s->buf_end != s->buffer)
+        return 0;
+    if ((h->flags & AVIO_FLAG_WRITE) || s->post_data)
+        return 0;
+    return !s->method || !av_strcasecmp(s->method, "GET") ||
+           !av_strcasecmp(s->method, "HEAD");
+}
+
 static int http_open_cnx_internal(URLContext *h, AVDictionary **options)
 {
     const char *path, *proxy_path, *lower_proto = "tcp", *local_path;
@@ -200,7 +452,7 @@ static int http_open_cnx_internal(URLContext *h, AVDictionary **options)
     char auth[1024], proxyauth[1024] = "";
     char path1[MAX_URL_SIZE], sanitized_path[MAX_URL_SIZE];
     char buf[1024], urlbuf[MAX_URL_SIZE];
-    int port, use_proxy, err, location_changed = 0;
+    int port, use_proxy, err, location_changed = 0, reused = 0;
     HTTPContext *s = h->priv_data;
 
     av_url_split(proto, sizeof(proto), auth, sizeof(auth),
@@ -247,15 +499,26 @@ static int http_open_cnx_internal(URLContext *h, AVDictionary **options)
     ff_url_join(buf, sizeof(buf), lower_proto, NULL, hostname, port, NULL);
 
     if (!s->hd) {
-        err = ffurl_open_whitelist(&s->hd, buf, AVIO_FLAG_READ_WRITE,
-                                   &h->interrupt_callback, options,
-                                   h->protocol_whitelist, h->protocol_blacklist, h);
-        if (err < 0)
-            return err;
+        reused = http_open_connection(h, buf, use_proxy ? proxy_path : NULL,
+                                      options, 1);
+        if (reused < 0)
+            return reused;
+        /* nothing of a reply was received yet */
+        s->buf_ptr = s->buf_end = s->buffer;
     }
 
     err = http_connect(h, path, local_path, hoststr,
                        auth, proxyauth, &location_changed);
+    if (err < 0 && reused > 0 && http_can_retry(h, err)) {
+        /* the server may have closed it just before our request arrived */
+        av_log(h, AV_LOG_DEBUG, "Reused connection failed, reconnecting\n");
+        connection_free(&s->hd, &s->conn);
+        if ((err = http_open_connection(h, buf, use_proxy ? proxy_path : NULL,
+                                        options, 0)) < 0)
+            return err;
+        err = http_connect(h, path, local_path, hoststr,
+                           auth, proxyauth, &location_changed);
+    }
     if (err < 0)
         return err;
 
@@ -282,7 +545,7 @@ redo:
     if (s->http_code == 401) {
         if ((cur_auth_type == HTTP_AUTH_NONE || s->auth_state.stale) &&
             s->auth_state.auth_type != HTTP_AUTH_NONE && attempts < 4) {
-            ffurl_closep(&s->hd);
+            connection_free(&s->hd, &s->conn);
             goto redo;
         } else
             goto fail;
@@ -290,7 +553,7 @@ redo:
     if (s->http_code == 407) {
         if ((cur_proxy_auth_type == HTTP_AUTH_NONE || s->proxy_auth_state.stale) &&
             s->proxy_auth_state.auth_type != HTTP_AUTH_NONE && attempts < 4) {
-            ffurl_closep(&s->hd);
+            connection_free(&s->hd, &s->conn);
             goto redo;
         } else
             goto fail;
@@ -299,7 +562,7 @@ redo:
          s->http_code == 303 || s->http_code == 307) &&
         location_changed == 1) {
         /* url moved, get next */
-        ffurl_closep(&s->hd);
+        connection_free(&s->hd, &s->conn);
         if (redirects++ >= MAX_REDIRECTS)
             return AVERROR(EIO);
         /* Restart the authentication process with the new target, which
@@ -312,8 +575,7 @@ redo:
     return 0;
 
 fail:
-    if (s->hd)
-        ffurl_closep(&s->hd);
+    connection_free(&s->hd, &s->conn);
     if (location_changed < 0)
         return location_changed;
     return ff_http_averror(s->http_code, AVERROR(EIO));
@@ -1006,9 +1268,10 @@ static int process_line(URLContext *h, char *line, int line_count,
             if ((ret = parse_location(s, p)) < 0)
                 return ret;
             *new_location = 1;
-        } else if (!av_strcasecmp(tag, "Content-Length") &&
-                   s->filesize == UINT64_MAX) {
-            s->filesize = strtoull(p, NULL, 10);
+        } else if (!av_strcasecmp(tag, "Content-Length")) {
+            s->content_length = strtoull(p, NULL, 10);
+            if (s->filesize == UINT64_MAX)
+                s->filesize = s->content_length;
         } else if (!av_strcasecmp(tag, "Content-Range")) {
             parse_content_range(h, p);
         } else if (!av_strcasecmp(tag, "Accept-Ranges") &&
@@ -1037,6 +1300,12 @@ static int process_line(URLContext *h, char *line, int line_count,
         } else if (!av_strcasecmp(tag, "Content-Type")) {
             av_free(s->mime_type);
             s->mime_type = av_strdup(p);
+        } else if (!av_strcasecmp(tag, "ETag")) {
+            av_free(s->etag);
+            s->etag = av_strdup(p);
+        } else if (!av_strcasecmp(tag, "Last-Modified")) {
+            av_free(s->last_modified);
+            s->last_modified = av_strdup(p);
         } else if (!av_strcasecmp(tag, "Set-Cookie")) {
             if (parse_cookie(s, p, &s->cookie_dict))
                 av_log(h, AV_LOG_WARNING, "Unable to parse '%s'\n", p);
@@ -1299,7 +1568,8 @@ static int http_connect(URLContext *h, const char *path, const char *local_path,
         av_bprintf(&request, "Expect: 100-continue\r\n");
 
     if (!has_header(s->headers, "\r\nConnection: "))
-        av_bprintf(&request, "Connection: %s\r\n", s->multiple_requests ? "keep-alive" : "close");
+        av_bprintf(&request, "Connection: %s\r\n",
+                   s->multiple_requests || s->idle_timeout > 0 ? "keep-alive" : "close");
 
     if (!has_header(s->headers, "\r\nHost: "))
         av_bprintf(&request, "Host: %s\r\n", hoststr);
@@ -1350,6 +1620,8 @@ static int http_connect(URLContext *h, const char *path, const char *local_path,
     s->off              = 0;
     s->icy_data_read    = 0;
     s->filesize         = UINT64_MAX;
+    s->content_length   = UINT64_MAX;
+    s->body_end         = UINT64_MAX;
     s->willclose        = 0;
     s->end_chunked_post = 0;
     s->end_header       = 0;
@@ -1370,6 +1642,9 @@ static int http_connect(URLContext *h, const char *path, const char *local_path,
     if (err < 0)
         goto done;
 
+    if (s->content_length != UINT64_MAX)
+        s->body_end = s->off + s->content_length;
+
     if (*new_location)
         s->off = off;
 
@@ -1404,14 +1679,14 @@ static int http_buf_read(URLContext *h, uint8_t *buf, int size)
                    "Chunked encoding data size: %"PRIu64"\n",
                     s->chunksize);
 
-            if (!s->chunksize && s->multiple_requests) {
+            if (!s->chunksize && (s->multiple_requests || s->idle_timeout > 0)) {
                 http_get_line(s, line, sizeof(line)); // read empty chunk
                 s->chunkend = 1;
                 return 0;
             }
             else if (!s->chunksize) {
                 av_log(h, AV_LOG_DEBUG, "Last chunk received, closing conn\n");
-                ffurl_closep(&s->hd);
+                connection_free(&s->hd, &s->conn);
                 return 0;
             }
             else if (s->chunksize == UINT64_MAX) {
@@ -1708,8 +1983,7 @@ static int http_close(URLContext *h)
         /* Close the write direction by sending the end of chunked encoding. */
         ret = http_shutdown(h, h->flags);
 
-    if (s->hd)
-        ffurl_closep(&s->hd);
+    http_release_connection(h);
     av_dict_free(&s->chained_options);
     return ret;
 }
@@ -1718,9 +1992,10 @@ static int64_t http_seek_internal(URLContext *h, int64_t off, int whence, int fo
 {
     HTTPContext *s = h->priv_data;
     URLContext *old_hd = s->hd;
+    HTTPConnection *old_conn = s->conn;
     uint64_t old_off = s->off;
     uint8_t old_buf[BUFFER_SIZE];
-    int old_buf_size, ret;
+    int old_buf_size, ret, reusable;
     AVDictionary *options = NULL;
 
     if (whence == AVSEEK_SIZE)
@@ -1740,6 +2015,7 @@ static int64_t http_seek_internal(URLContext *h, int64_t off, int whence, int fo
         return AVERROR(EINVAL);
     if (off < 0)
         return AVERROR(EINVAL);
+    reusable = http_connection_reusable(h);
     s->off = off;
 
     if (s->off && h->is_streamed)
@@ -1755,7 +2031,16 @@ static int64_t http_seek_internal(URLContext *h, int64_t off, int whence, int fo
     /* we save the old context in case the seek fails */
     old_buf_size = s->buf_end - s->buf_ptr;
     memcpy(old_buf, s->buf_ptr, old_buf_size);
-    s->hd = NULL;
+    s->hd   = NULL;
+    s->conn = NULL;
+
+    /* the old reply is complete, the new request can be sent on the same
+     * connection */
+    if (reusable) {
+        connection_pool_put(old_conn, old_hd, s->idle_timeout);
+        old_hd   = NULL;
+        old_conn = NULL;
+    }
 
     /* if it fails, continue on old connection */
     if ((ret = http_open_cnx(h, &options)) < 0) {
@@ -1764,11 +2049,12 @@ static int64_t http_seek_internal(URLContext *h, int64_t off, int whence, int fo
         s->buf_ptr = s->buffer;
         s->buf_end = s->buffer + old_buf_size;
         s->hd      = old_hd;
+        s->conn    = old_conn;
         s->off     = old_off;
         return ret;
     }
     av_dict_free(&options);
-    ffurl_close(old_hd);
+    connection_free(&old_hd, &old_conn);
     return off;
 }
 
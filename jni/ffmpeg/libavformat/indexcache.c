@@ -0,0 +1,244 @@
+/*
+ * Sidecar seek index cache
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <sys/stat.h>
+
+#include "libavutil/avstring.h"
+#include "libavutil/crc.h"
+#include "libavutil/mem.h"
+#include "avio_internal.h"
+#include "indexcache.h"
+#include "internal.h"
+
+#define INDEX_CACHE_TAG     MKBETAG('F', 'F', 'I', 'C')
+#define INDEX_CACHE_VERSION 1
+#define HEADER_HASH_SIZE    4096
+
+static int64_t local_mtime(const char *url)
+{
+    const char *proto = avio_find_protocol_name(url);
+    struct stat st;
+
+    if (!proto || strcmp(proto, "file"))
+        return 0;
+    av_strstart(url, "file:", &url);
+    return stat(url, &st) ? 0 : st.st_mtime;
+}
+
+static int header_crc(AVIOContext *pb, uint32_t *crc)
+{
+    uint8_t buf[HEADER_HASH_SIZE];
+    int64_t pos = avio_tell(pb);
+    int64_t ret;
+    int size;
+
+    if ((ret = avio_seek(pb, 0, SEEK_SET)) < 0)
+        return ret;
+    size = avio_read(pb, buf, sizeof(buf));
+    if ((ret = avio_seek(pb, pos, SEEK_SET)) < 0)
+        return ret;
+    if (size <= 0)
+        return size < 0 ? size : AVERROR_INVALIDDATA;
+
+    *crc = av_crc(av_crc_get_table(AV_CRC_32_IEEE_LE), UINT32_MAX, buf, size);
+    return 0;
+}
+
+static int count_entries(AVFormatContext *s)
+{
+    int i, nb = 0;
+
+    for (i = 0; i < s->nb_streams; i++)
+        nb += s->streams[i]->nb_index_entries;
+    return nb;
+}
+
+typedef struct CacheEntry {
+    int64_t pos;
+    int64_t timestamp;
+} CacheEntry;
+
+static int read_cache(AVFormatContext *s, FFIndexCache *c, AVIOContext *pb)
+{
+    CacheEntry *entries = NULL, *e;
+    unsigned *counts, size = 0;
+    int i, j, nb = 0, ret;
+
+    if (avio_rb32(pb) != INDEX_CACHE_TAG ||
+        avio_rb32(pb) != INDEX_CACHE_VERSION ||
+        avio_rb64(pb) != c->file_size ||
+        avio_rb64(pb) != c->mtime ||
+        avio_rb32(pb) != c->header_crc ||
+        avio_rb32(pb) != s->nb_streams)
+        return 0;
+
+    if (!(counts = av_calloc(s->nb_streams, sizeof(*counts))))
+        return AVERROR(ENOMEM);
+
+    /* parse the whole file first, a truncated or corrupt one must not
+     * leave part of its entries in the index */
+    for (i = 0; i < s->nb_streams; i++) {
+        counts[i] = avio_rb32(pb);
+        for (j = 0; j < counts[i]; j++, nb++) {
+            if (avio_feof(pb) || nb >= INT_MAX / sizeof(*entries)) {
+                ret = AVERROR_INVALIDDATA;
+                goto end;
+            }
+            if (!(e = av_fast_realloc(entries, &size,
+                                      (nb + 1) * sizeof(*entries)))) {
+                ret = AVERROR(ENOMEM);
+                goto end;
+            }
+            entries = e;
+            e[nb].pos       = avio_rb64(pb);
+            e[nb].timestamp = avio_rb64(pb);
+            if (e[nb].pos < 0 || e[nb].pos >= c->file_size) {
+                ret = AVERROR_INVALIDDATA;
+                goto end;
+            }
+        }
+    }
+    if (pb->error) {
+        ret = pb->error;
+        goto end;
+    }
+    /* the entries must end exactly at the end of the file */
+    if (avio_feof(pb)) {
+        ret = AVERROR_INVALIDDATA;
+        goto end;
+    }
+    avio_r8(pb);
+    if (!avio_feof(pb)) {
+        ret = AVERROR_INVALIDDATA;
+        goto end;
+    }
+
+    for (i = 0, e = entries; i < s->nb_streams; i++) {
+        for (j = 0; j < counts[i]; j++, e++) {
+            if (av_add_index_entry(s->streams[i], e->pos, e->timestamp,
+                                   0, 0, AVINDEX_KEYFRAME) < 0) {
+                ret = AVERROR(ENOMEM);
+                goto end;
+            }
+        }
+    }
+    ret = nb;
+
+end:
+    av_free(entries);
+    av_free(counts);
+    return ret;
+}
+
+int ff_index_cache_open(AVFormatContext *s, FFIndexCache *c, const char *dir)
+{
+    AVIOContext *pb = NULL;
+    int64_t size;
+    int ret;
+
+    memset(c, 0, sizeof(*c));
+    if (!dir || !*dir || !s->pb || !(s->pb->seekable & AVIO_SEEKABLE_NORMAL))
+        return 0;
+    if ((size = avio_size(s->pb)) <= 0)
+        return 0;
+    if ((ret = header_crc(s->pb, &c->header_crc)) < 0)
+        return ret;
+    c->file_size = size;
+    c->mtime     = local_mtime(s->url);
+
+    c->path = av_asprintf("%s/%08"PRIx32"-%016"PRIx64".idx", dir,
+                          c->header_crc, c->file_size);
+    if (!c->path)
+        return AVERROR(ENOMEM);
+
+    if (s->io_open(s, &pb, c->path, AVIO_FLAG_READ, NULL) < 0) {
+        c->nb_entries = count_entries(s);
+        return 0;
+    }
+    ret = read_cache(s, c, pb);
+    ff_format_io_close(s, &pb);
+    c->nb_entries = count_entries(s);
+
+    if (ret < 0)
+        av_log(s, AV_LOG_WARNING, "Ignoring broken index cache %s\n", c->path);
+    else if (ret > 0)
+        av_log(s, AV_LOG_VERBOSE, "Loaded %d index entries from %s\n",
+               ret, c->path);
+    return ret;
+}
+
+static int write_cache(AVFormatContext *s, FFIndexCache *c, const char *path)
+{
+    AVIOContext *pb = NULL;
+    int i, j, ret;
+
+    if ((ret = s->io_open(s, &pb, path, AVIO_FLAG_WRITE, NULL)) < 0)
+        return ret;
+
+    avio_wb32(pb, INDEX_CACHE_TAG);
+    avio_wb32(pb, INDEX_CACHE_VERSION);
+    avio_wb64(pb, c->file_size);
+    avio_wb64(pb, c->mtime);
+    avio_wb32(pb, c->header_crc);
+    avio_wb32(pb, s->nb_streams);
+
+    for (i = 0; i < s->nb_streams; i++) {
+        AVStream *st = s->streams[i];
+        int nb = 0;
+
+        for (j = 0; j < st->nb_index_entries; j++)
+            nb += !!(st->index_entries[j].flags & AVINDEX_KEYFRAME);
+        avio_wb32(pb, nb);
+        for (j = 0; j < st->nb_index_entries; j++) {
+            if (!(st->index_entries[j].flags & AVINDEX_KEYFRAME))
+                continue;
+            avio_wb64(pb, st->index_entries[j].pos);
+            avio_wb64(pb, st->index_entries[j].timestamp);
+        }
+    }
+    avio_flush(pb);
+    ret = pb->error;
+    ff_format_io_close(s, &pb);
+    return ret;
+}
+
+void ff_index_cache_close(AVFormatContext *s, FFIndexCache *c)
+{
+    char *tmp;
+    int ret;
+
+    if (!c->path)
+        return;
+
+    if (count_entries(s) > c->nb_entries) {
+        /* write to a temporary file first, another player instance may be
+         * reading the cache */
+        if (!(tmp = av_asprintf("%s.tmp", c->path))) {
+            ret = AVERROR(ENOMEM);
+        } else if ((ret = write_cache(s, c, tmp)) >= 0) {
+            ret = ff_rename(tmp, c->path, s);
+        }
+        if (ret < 0)
+            av_log(s, AV_LOG_WARNING, "Could not write index cache %s: %s\n",
+                   c->path, av_err2str(ret));
+        av_free(tmp);
+    }
+    av_freep(&c->path);
+}
@@ -0,0 +1,63 @@
+/*
+ * Sidecar seek index cache
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef AVFORMAT_INDEXCACHE_H
+#define AVFORMAT_INDEXCACHE_H
+
+#include <stdint.h>
+
+#include "avformat.h"
+
+/**
+ * Persistent copy of the keyframe index of a file that has no index of its
+ * own (e.g. Matroska without Cues). The demuxer records index entries while
+ * reading, as it always does; they are written to a small binary file in a
+ * cache directory on close and loaded again on the next open, so that
+ * seeking does not have to scan the file.
+ *
+ * The cache file is keyed by the file size, its modification time when it
+ * is a local file, and a CRC of its first bytes.
+ */
+typedef struct FFIndexCache {
+    char    *path;          ///< cache file name, NULL if the cache is unused
+    uint64_t file_size;
+    int64_t  mtime;
+    uint32_t header_crc;
+    int      nb_entries;    ///< entries in the index when it was last synced
+} FFIndexCache;
+
+/**
+ * Compute the cache key of the input of s and add the cached index entries,
+ * if any, to its streams. Must be called at the end of read_header(), with
+ * all streams created. Does nothing if dir is NULL or empty or if the input
+ * is not seekable.
+ *
+ * @param dir cache directory
+ * @return number of index entries loaded, 0 on cache miss, < 0 on error
+ */
+int ff_index_cache_open(AVFormatContext *s, FFIndexCache *c, const char *dir);
+
+/**
+ * Write the current index of s to the cache if it grew since it was loaded,
+ * and free c.
+ */
+void ff_index_cache_close(AVFormatContext *s, FFIndexCache *c);
+
+#endif /* AVFORMAT_INDEXCACHE_H */
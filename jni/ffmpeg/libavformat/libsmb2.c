@@ -32,12 +32,33 @@
 #include "smb2/libsmb2-raw.h"
 #include "libavutil/avstring.h"
 #include "libavutil/opt.h"
+#include "libavutil/sha.h"
+#include "libavutil/thread.h"
+#include "libavutil/time.h"
 #include "urldecode.h"
 #include "avformat.h"
 #include "internal.h"
+#include "network.h"
 #include "url.h"
 
-typedef struct {
+#define READAHEAD_SIZE (4 * 1024 * 1024)
+
+/*
+ * One READ request of the read-ahead window. Requests are pipelined, libsmb2
+ * sends them as soon as the server granted enough credits and the replies
+ * land in buf asynchronously, so a request must not be reused before done
+ * is set.
+ */
+typedef struct SMB2ReadRequest {
+    uint8_t *buf;
+    int64_t offset;
+    int     size;
+    int     len;        ///< bytes received
+    int     status;     ///< < 0 on error
+    uint8_t done;
+} SMB2ReadRequest;
+
+typedef struct LIBSMB2Context {
     const AVClass *class;
     struct smb2_context *smb2;
     struct smb2_url *url;
@@ -46,8 +67,12 @@ typedef struct {
     int64_t filesize;
     struct smb2dir *dir;
     struct smb2dirent *ent;
+    AVIOInterruptCB *interrupt_callback;
+    int     broken;             ///< connection error, the session cannot be reused
     int     status;
     uint8_t connected;
+    uint8_t from_pool;          ///< the session was taken from the pool
+    char   *session_key;
     uint8_t is_finished;
     int64_t bytes_read;
     int64_t bytes_written;
@@ -56,36 +81,90 @@ typedef struct {
     char *user;
     char *password;
     char *workgroup;
+    int readahead_requests;
+    int readahead_size;
+    int session_idle_timeout;
+    int dir_offset;
+    int dir_limit;
+    int64_t dir_index;          ///< directory entries consumed so far
+    /* read-ahead window, a ring of requests for consecutive file ranges */
+    SMB2ReadRequest *requests;
+    int nb_requests;
+    int request_size;
+    int head;                   ///< oldest request in the window
+    int nb_issued;              ///< requests in the window, from head on
+    int64_t next_offset;        ///< offset of the next request to issue
+    int64_t pos;                ///< read position
 } LIBSMB2Context;
 
-static int wait_for_reply(LIBSMB2Context *libsmb2)
+/*
+ * Service the connection until *done is set. The socket is polled in short
+ * slices so that the interrupt callback is honoured promptly; the timeout
+ * counts from the last socket activity, on the monotonic clock.
+ */
+static int service_until(LIBSMB2Context *libsmb2, const uint8_t *done)
 {
-    libsmb2->is_finished = 0;
-    int64_t time_elapsed = 0;
-    while ( ( 0 == libsmb2->status ) && !libsmb2->is_finished) {
+    int64_t last_activity = av_gettime_relative();
+    if (libsmb2->broken) {
+        return libsmb2->broken;
+    }
+    while ( ( 0 == libsmb2->status ) && !*done) {
         struct pollfd pfd;
+        if (ff_check_interrupt(libsmb2->interrupt_callback)) {
+            return AVERROR_EXIT;
+        }
         pfd.fd = smb2_get_fd(libsmb2->smb2);
         pfd.events = smb2_which_events(libsmb2->smb2);
 
-        if (poll(&pfd, 1, 1000) < 0) {
+        if (poll(&pfd, 1, POLLING_TIME) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
             av_log(NULL, AV_LOG_ERROR, "Poll failed\n");
-            return -1;
+            return libsmb2->broken = -1;
         }
-        time_elapsed += 1000;
         if (pfd.revents == 0) {
-            if (libsmb2->timeout != -1 && time_elapsed >= libsmb2->timeout) {
+            if (libsmb2->timeout != -1 &&
+                av_gettime_relative() - last_activity >= libsmb2->timeout * INT64_C(1000)) {
                 return AVERROR(ETIMEDOUT);
             }
             continue;
         }
+        last_activity = av_gettime_relative();
         if (smb2_service(libsmb2->smb2, pfd.revents) < 0) {
             av_log(NULL, AV_LOG_ERROR, "smb2_service failed with : %s\n", smb2_get_error(libsmb2->smb2));
-            return -1;
+            return libsmb2->broken = -1;
         }
     }
     return libsmb2->status;
 }
 
+/*
+ * Errors after which the connection must not be used for another request.
+ */
+static int is_connection_error(int err)
+{
+    return err == -1 || err == AVERROR_EXIT || err == AVERROR(ETIMEDOUT) ||
+           err == AVERROR(ENETRESET) || err == AVERROR(ECONNRESET) ||
+           err == AVERROR(EPIPE);
+}
+
+static int wait_for_reply(LIBSMB2Context *libsmb2)
+{
+    int ret;
+    libsmb2->status = 0;
+    libsmb2->is_finished = 0;
+    ret = service_until(libsmb2, &libsmb2->is_finished);
+    libsmb2->status = 0;
+    /*
+     * After an interruption or a timeout, the abandoned reply would
+     * complete a later request, the context can only be closed now.
+     */
+    if (is_connection_error(ret))
+        libsmb2->broken = ret;
+    return ret;
+}
+
 static void generic_callback(struct smb2_context *smb2, int status, void *command_data, void *private_data)
 {
     LIBSMB2Context *libsmb2 = private_data;
@@ -124,6 +203,17 @@ static void read_callback(struct smb2_context *smb2, int status, void *command_d
     }
 }
 
+static void readahead_callback(struct smb2_context *smb2, int status, void *command_data, void *private_data)
+{
+    SMB2ReadRequest *req = private_data;
+    if (status < 0) {
+        req->status = status;
+    } else {
+        req->len = status;
+    }
+    req->done = 1;
+}
+
 static void write_callback(struct smb2_context *smb2, int status, void *command_data, void *private_data)
 {
     LIBSMB2Context *libsmb2 = private_data;
@@ -150,13 +240,130 @@ static void opendir_callback(struct smb2_context *smb2, int status, void *comman
     }
 }
 
+/*
+ * Wait for all requests in flight, their buffers cannot be reused before.
+ */
+static int drain_window(LIBSMB2Context *libsmb2)
+{
+    int ret = 0;
+    for (int i = 0; i < libsmb2->nb_requests && !ret; i++)
+        ret = service_until(libsmb2, &libsmb2->requests[i].done);
+    if (ret)
+        return ret;
+    libsmb2->head      = 0;
+    libsmb2->nb_issued = 0;
+    return 0;
+}
+
+/*
+ * Authenticated tree connections are kept for a while after close, so that
+ * opening another file of the same share only costs a CREATE. libsmb2
+ * contexts are not thread safe, so a session belongs to one URLContext at a
+ * time: it is taken out of the pool on open and put back on close.
+ */
+typedef struct SMB2Session {
+    char *key;
+    struct smb2_context *smb2;
+    int64_t expiry;
+    struct SMB2Session *next;
+} SMB2Session;
+
+#define MAX_IDLE_SESSIONS 4
+
+static AVMutex session_pool_mutex = AV_MUTEX_INITIALIZER;
+static SMB2Session *session_pool;
+
+static void session_free(SMB2Session *session)
+{
+    smb2_destroy_context(session->smb2);
+    av_free(session->key);
+    av_free(session);
+}
+
+/* Must be called with the pool locked. */
+static int session_pool_expire(int64_t now)
+{
+    SMB2Session **p = &session_pool;
+    int nb_sessions = 0;
+    while (*p) {
+        SMB2Session *session = *p;
+        if (session->expiry <= now) {
+            *p = session->next;
+            session_free(session);
+        } else {
+            p = &session->next;
+            nb_sessions++;
+        }
+    }
+    return nb_sessions;
+}
+
+static struct smb2_context *session_pool_get(const char *key)
+{
+    struct smb2_context *smb2 = NULL;
+    SMB2Session **p;
+
+    ff_mutex_lock(&session_pool_mutex);
+    session_pool_expire(av_gettime_relative());
+    for (p = &session_pool; *p; p = &(*p)->next) {
+        SMB2Session *session = *p;
+        if (!strcmp(session->key, key)) {
+            *p = session->next;
+            smb2 = session->smb2;
+            av_free(session->key);
+            av_free(session);
+            break;
+        }
+    }
+    ff_mutex_unlock(&session_pool_mutex);
+    return smb2;
+}
+
+static void session_pool_sweep(void)
+{
+    ff_mutex_lock(&session_pool_mutex);
+    session_pool_expire(av_gettime_relative());
+    ff_mutex_unlock(&session_pool_mutex);
+}
+
+static int session_pool_put(const char *key, struct smb2_context *smb2, int idle_timeout)
+{
+    SMB2Session *session = av_mallocz(sizeof(*session));
+    SMB2Session **p;
+    int64_t now = av_gettime_relative();
+
+    if (!session || !(session->key = av_strdup(key))) {
+        av_free(session);
+        return AVERROR(ENOMEM);
+    }
+    session->smb2   = smb2;
+    session->expiry = now + idle_timeout * INT64_C(1000000);
+
+    ff_mutex_lock(&session_pool_mutex);
+    /* the most recently used sessions come first, drop the oldest */
+    if (session_pool_expire(now) >= MAX_IDLE_SESSIONS) {
+        for (p = &session_pool; (*p)->next; p = &(*p)->next)
+            ;
+        session_free(*p);
+        *p = NULL;
+    }
+    session->next = session_pool;
+    session_pool  = session;
+    ff_mutex_unlock(&session_pool_mutex);
+    return 0;
+}
+
 static av_cold int libsmb2_close(URLContext *h)
 {
     LIBSMB2Context *libsmb2 = h->priv_data;
     if (libsmb2->smb2 != NULL) {
+        /* no reply may be left that refers to this URLContext */
+        int reusable = drain_window(libsmb2) == 0;
+
         if (libsmb2->fh != NULL) {
             smb2_close_async(libsmb2->smb2, libsmb2->fh, generic_callback, libsmb2);
-            wait_for_reply(libsmb2);
+            if (wait_for_reply(libsmb2) != 0)
+                reusable = 0;
             libsmb2->fh = NULL;
         }
 
@@ -166,14 +373,35 @@ static av_cold int libsmb2_close(URLContext *h)
         }
 
         if (libsmb2->connected) {
-            smb2_disconnect_share_async(libsmb2->smb2, generic_callback, libsmb2);
-            wait_for_reply(libsmb2);
+            if (libsmb2->session_idle_timeout > 0 && reusable && !libsmb2->broken &&
+                session_pool_put(libsmb2->session_key, libsmb2->smb2,
+                                 libsmb2->session_idle_timeout) >= 0) {
+                libsmb2->smb2 = NULL;
+            } else {
+                smb2_disconnect_share_async(libsmb2->smb2, generic_callback, libsmb2);
+                wait_for_reply(libsmb2);
+            }
             libsmb2->connected = 0;
         }
 
-        smb2_destroy_context(libsmb2->smb2);
-        libsmb2->smb2 = NULL;
+        if (libsmb2->smb2) {
+            smb2_destroy_context(libsmb2->smb2);
+            libsmb2->smb2 = NULL;
+        }
     }
+    libsmb2->broken    = 0;
+    libsmb2->from_pool = 0;
+    av_freep(&libsmb2->session_key);
+
+    /* do not wait for the next open to let go of expired sessions */
+    session_pool_sweep();
+
+    /* only now, destroying the context cancels the requests still queued */
+    for (int i = 0; i < libsmb2->nb_requests; i++)
+        av_freep(&libsmb2->requests[i].buf);
+    av_freep(&libsmb2->requests);
+    libsmb2->nb_requests = 0;
+    libsmb2->nb_issued   = 0;
 
     if (libsmb2->url != NULL) {
         smb2_destroy_url(libsmb2->url);
@@ -182,13 +410,44 @@ static av_cold int libsmb2_close(URLContext *h)
     return 0;
 }
 
-static av_cold int libsmb2_connect(URLContext *h)
+/*
+ * The pool outlives the URLContext, so the credentials are only kept in it
+ * as a hash.
+ */
+static int make_session_key(LIBSMB2Context *libsmb2, const char *share,
+                            const char *domain, const char *user,
+                            const char *password)
+{
+    struct AVSHA *sha = av_sha_alloc();
+    uint8_t digest[32];
+    char hex[2 * sizeof(digest) + 1];
+
+    if (!sha)
+        return AVERROR(ENOMEM);
+    if (!password)
+        password = "";
+    av_sha_init(sha, 256);
+    av_sha_update(sha, (const uint8_t *)domain,   strlen(domain) + 1);
+    av_sha_update(sha, (const uint8_t *)user,     strlen(user) + 1);
+    av_sha_update(sha, (const uint8_t *)password, strlen(password) + 1);
+    av_sha_final(sha, digest);
+    av_free(sha);
+    ff_data_to_hex(hex, digest, sizeof(digest), 1);
+    hex[2 * sizeof(digest)] = '\0';
+
+    libsmb2->session_key = av_asprintf("%s/%s;%s", libsmb2->url->server,
+                                       share, hex);
+    return libsmb2->session_key ? 0 : AVERROR(ENOMEM);
+}
+
+static av_cold int libsmb2_connect(URLContext *h, int use_pool)
 {
     LIBSMB2Context *libsmb2 = h->priv_data;
     int ret = -1;
     const char* user = NULL;
     const char* password = NULL;
     const char* share = NULL;
+    libsmb2->interrupt_callback = &h->interrupt_callback;
     libsmb2->smb2 = smb2_init_context();
     if (!libsmb2->smb2) {
         av_log(h, AV_LOG_ERROR, "Failed to init context for smb2.\n");
@@ -221,6 +480,26 @@ static av_cold int libsmb2_connect(URLContext *h)
     smb2_set_security_mode(libsmb2->smb2, SMB2_NEGOTIATE_SIGNING_ENABLED);
 
     share = ff_urldecode(libsmb2->url->share, 0);
+    if (!share || !user ||
+        make_session_key(libsmb2, share,
+                         libsmb2->url->domain ? libsmb2->url->domain :
+                         libsmb2->workgroup ? libsmb2->workgroup : "",
+                         user, password) < 0) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    if (libsmb2->session_idle_timeout > 0 && use_pool) {
+        struct smb2_context *smb2 = session_pool_get(libsmb2->session_key);
+        if (smb2) {
+            av_log(h, AV_LOG_DEBUG, "Reusing session to %s\n", libsmb2->url->server);
+            smb2_destroy_context(libsmb2->smb2);
+            libsmb2->smb2 = smb2;
+            libsmb2->connected = 1;
+            libsmb2->from_pool = 1;
+            ret = 0;
+            goto fail;
+        }
+    }
     ff_dlog(h, "domain=%s server=%s share=%s user=%s\n", libsmb2->url->domain, libsmb2->url->server, share, user);
     ret = smb2_connect_share_async(libsmb2->smb2, libsmb2->url->server, share, user, generic_callback, libsmb2);
     if (ret != 0) {
@@ -243,12 +522,50 @@ fail:
     return ret;
 }
 
+/*
+ * The server may have dropped a pooled session while it was idle. Replace
+ * it with a new connection if the first request on it failed.
+ */
+static int reconnect_pooled_session(URLContext *h, int err)
+{
+    LIBSMB2Context *libsmb2 = h->priv_data;
+    if (!libsmb2->from_pool || err == AVERROR_EXIT ||
+        !(is_connection_error(err) || err == AVERROR(EIO)))
+        return err;
+
+    av_log(h, AV_LOG_VERBOSE, "Reused session failed, reconnecting.\n");
+    smb2_destroy_context(libsmb2->smb2);
+    libsmb2->smb2 = NULL;
+    libsmb2->connected = 0;
+    libsmb2->from_pool = 0;
+    libsmb2->broken    = 0;
+    smb2_destroy_url(libsmb2->url);
+    libsmb2->url = NULL;
+    av_freep(&libsmb2->session_key);
+    return libsmb2_connect(h, 0);
+}
+
+static int open_file(URLContext *h, const char *path, int access)
+{
+    LIBSMB2Context *libsmb2 = h->priv_data;
+    int ret = smb2_open_async(libsmb2->smb2, path, access, open_callback, libsmb2);
+    if (ret != 0) {
+        av_log(h, AV_LOG_ERROR, "smb2_open_async failed. %s\n", smb2_get_error(libsmb2->smb2));
+        return ret;
+    }
+    ret = wait_for_reply(libsmb2);
+    if (ret != 0) {
+        av_log(h, AV_LOG_ERROR, "wait_for_reply failed. %s\n", smb2_get_error(libsmb2->smb2));
+    }
+    return ret;
+}
+
 static av_cold int libsmb2_open(URLContext *h, const char *url, int flags)
 {
     LIBSMB2Context *libsmb2 = h->priv_data;
     int access, ret;
     const char* path = NULL;
-    if ((ret = libsmb2_connect(h)) < 0) {
+    if ((ret = libsmb2_connect(h, 1)) < 0) {
         goto fail;
     }
 
@@ -260,14 +577,12 @@ static av_cold int libsmb2_open(URLContext *h, const char *url, int flags)
         access = O_RDONLY;
 
     path = ff_urldecode(libsmb2->url->path, 0);
-    ret = smb2_open_async(libsmb2->smb2, path, access, open_callback, libsmb2);
-    if (ret != 0) {
-        av_log(h, AV_LOG_ERROR, "smb2_open_async failed. %s\n", smb2_get_error(libsmb2->smb2));
-        goto fail;
+    ret = open_file(h, path, access);
+    if (ret != 0 && libsmb2->from_pool) {
+        if ((ret = reconnect_pooled_session(h, ret)) == 0)
+            ret = open_file(h, path, access);
     }
-    ret = wait_for_reply(libsmb2);
     if (ret != 0) {
-        av_log(h, AV_LOG_ERROR, "wait_for_reply failed. %s\n", smb2_get_error(libsmb2->smb2));
         goto fail;
     }
 
@@ -285,6 +600,28 @@ static av_cold int libsmb2_open(URLContext *h, const char *url, int flags)
 
     libsmb2->filesize = st.smb2_size;
     libsmb2->max_read_size = smb2_get_max_read_size(libsmb2->smb2);
+
+    if (!(flags & AVIO_FLAG_WRITE) && libsmb2->readahead_requests > 0 &&
+        libsmb2->max_read_size > 0) {
+        libsmb2->request_size = FFMIN(libsmb2->max_read_size,
+                                      libsmb2->readahead_size / libsmb2->readahead_requests);
+        libsmb2->request_size = FFMAX(libsmb2->request_size, 4096);
+        libsmb2->requests = av_mallocz_array(libsmb2->readahead_requests,
+                                             sizeof(*libsmb2->requests));
+        if (!libsmb2->requests) {
+            ret = AVERROR(ENOMEM);
+            goto fail;
+        }
+        libsmb2->nb_requests = libsmb2->readahead_requests;
+        for (int i = 0; i < libsmb2->nb_requests; i++) {
+            libsmb2->requests[i].done = 1;
+            libsmb2->requests[i].buf  = av_malloc(libsmb2->request_size);
+            if (!libsmb2->requests[i].buf) {
+                ret = AVERROR(ENOMEM);
+                goto fail;
+            }
+        }
+    }
     if (path)
         av_freep(&path);
     return 0;
@@ -295,6 +632,133 @@ fail:
     return ret;
 }
 
+static int send_request(URLContext *h, SMB2ReadRequest *req,
+                        int64_t offset, int size)
+{
+    LIBSMB2Context *libsmb2 = h->priv_data;
+    int ret;
+
+    req->offset = offset;
+    req->size   = size;
+    req->len    = 0;
+    req->status = 0;
+    req->done   = 0;
+    ret = smb2_pread_async(libsmb2->smb2, libsmb2->fh, req->buf, size, offset,
+                           readahead_callback, req);
+    if (0 != ret) {
+        req->done = 1;
+        av_log(h, AV_LOG_ERROR, "smb2_pread_async failed. %s\n", smb2_get_error(libsmb2->smb2));
+    }
+    return ret;
+}
+
+/*
+ * Issue a request for the range following the window.
+ * Returns 1 if a request was issued, 0 at the end of the file.
+ */
+static int issue_request(URLContext *h)
+{
+    LIBSMB2Context *libsmb2 = h->priv_data;
+    SMB2ReadRequest *req = &libsmb2->requests[(libsmb2->head + libsmb2->nb_issued) % libsmb2->nb_requests];
+    int64_t size = libsmb2->request_size;
+    int ret;
+
+    if (libsmb2->filesize >= 0)
+        size = FFMIN(size, libsmb2->filesize - libsmb2->next_offset);
+    if (size <= 0)
+        return 0;
+
+    if ((ret = send_request(h, req, libsmb2->next_offset, size)) != 0)
+        return ret;
+    libsmb2->nb_issued++;
+    libsmb2->next_offset += size;
+    return 1;
+}
+
+static int fill_window(URLContext *h)
+{
+    LIBSMB2Context *libsmb2 = h->priv_data;
+    int ret = 1;
+    while (libsmb2->nb_issued < libsmb2->nb_requests && ret > 0)
+        ret = issue_request(h);
+    return FFMIN(ret, 0);
+}
+
+/*
+ * Retire the oldest request of the window and reuse it at its end.
+ */
+static int advance_window(URLContext *h)
+{
+    LIBSMB2Context *libsmb2 = h->priv_data;
+    libsmb2->head = (libsmb2->head + 1) % libsmb2->nb_requests;
+    libsmb2->nb_issued--;
+    return fill_window(h);
+}
+
+/*
+ * Move on from the oldest request of the window once its data is used up.
+ * smb2_pread_async() shortens a request to the credits the server granted
+ * when it is sent, so a short reply is followed by a request for the rest
+ * of its range in the same slot, keeping the rest of the window in flight.
+ */
+static int next_request(URLContext *h, SMB2ReadRequest *req)
+{
+    if (req->len == req->size)
+        return advance_window(h);
+    return send_request(h, req, req->offset + req->len, req->size - req->len);
+}
+
+static int libsmb2_read_ahead(URLContext *h, unsigned char *buf, int size)
+{
+    LIBSMB2Context *libsmb2 = h->priv_data;
+    SMB2ReadRequest *req;
+    int ret;
+
+    for (;;) {
+        if (!libsmb2->nb_issued) {
+            libsmb2->next_offset = libsmb2->pos;
+            if ((ret = fill_window(h)) < 0)
+                return ret;
+            if (!libsmb2->nb_issued)
+                return AVERROR_EOF;
+        }
+
+        req = &libsmb2->requests[libsmb2->head];
+        ret = service_until(libsmb2, &req->done);
+        if (0 != ret) {
+            av_log(h, AV_LOG_ERROR, "wait_for_reply failed. %s\n", smb2_get_error(libsmb2->smb2));
+            return ret;
+        }
+        if (req->status < 0) {
+            av_log(h, AV_LOG_ERROR, "Read at %"PRId64" failed. %s\n", req->offset, smb2_get_error(libsmb2->smb2));
+            ret = req->status;
+            drain_window(libsmb2);
+            return ret;
+        }
+
+        if (libsmb2->pos < req->offset) {
+            if ((ret = drain_window(libsmb2)) != 0)
+                return ret;
+            continue;
+        }
+        if (libsmb2->pos < req->offset + req->len)
+            break;
+        if (!req->len)
+            return AVERROR_EOF;
+        if ((ret = next_request(h, req)) < 0)
+            return ret;
+    }
+
+    size = FFMIN(size, req->offset + req->len - libsmb2->pos);
+    memcpy(buf, req->buf + (libsmb2->pos - req->offset), size);
+    libsmb2->pos += size;
+    if (libsmb2->pos == req->offset + req->len) {
+        if ((ret = next_request(h, req)) < 0)
+            return ret;
+    }
+    return size;
+}
+
 static int64_t libsmb2_seek(URLContext *h, int64_t pos, int whence)
 {
     LIBSMB2Context *libsmb2 = h->priv_data;
@@ -306,6 +770,36 @@ static int64_t libsmb2_seek(URLContext *h, int64_t pos, int whence)
             return libsmb2->filesize;
     }
 
+    if (libsmb2->requests) {
+        switch (whence) {
+        case SEEK_SET:
+            break;
+        case SEEK_CUR:
+            pos += libsmb2->pos;
+            break;
+        case SEEK_END:
+            pos += libsmb2->filesize;
+            break;
+        default:
+            return AVERROR(EINVAL);
+        }
+        if (pos < 0)
+            return AVERROR(EINVAL);
+
+        /* keep the window if the target is still inside */
+        if (libsmb2->nb_issued &&
+            (pos < libsmb2->requests[libsmb2->head].offset || pos >= libsmb2->next_offset)) {
+            int ret = drain_window(libsmb2);
+            if (ret != 0) {
+                if (ret != AVERROR_EXIT)
+                    av_log(h, AV_LOG_ERROR, "wait_for_reply failed. %s\n", smb2_get_error(libsmb2->smb2));
+                return ret < 0 ? ret : AVERROR(EIO);
+            }
+        }
+        libsmb2->pos = pos;
+        return pos;
+    }
+
     uint64_t current_offset;
     if (smb2_lseek(libsmb2->smb2, libsmb2->fh, pos, whence, &current_offset) < 0) {
         av_log(h, AV_LOG_ERROR, "smb2_lseek failed. %s\n", smb2_get_error(libsmb2->smb2));
@@ -317,6 +811,9 @@ static int64_t libsmb2_seek(URLContext *h, int64_t pos, int whence)
 static int libsmb2_read(URLContext *h, unsigned char *buf, int size)
 {
     LIBSMB2Context *libsmb2 = h->priv_data;
+    if (libsmb2->requests)
+        return libsmb2_read_ahead(h, buf, size);
+
     int ret = smb2_read_async(libsmb2->smb2, libsmb2->fh, buf, FFMIN(libsmb2->max_read_size, size), read_callback, libsmb2);
     if (0 != ret) {
         av_log(h, AV_LOG_ERROR, "smb2_read_async failed. %s\n", smb2_get_error(libsmb2->smb2));
@@ -353,17 +850,21 @@ fail:
 static int libsmb2_open_dir(URLContext *h)
 {
     LIBSMB2Context *libsmb2 = h->priv_data;
-    int ret;
+    int ret, max_entries = 0;
     const char* path = NULL;
 
-    if ((ret = libsmb2_connect(h)) < 0) {
+    if ((ret = libsmb2_connect(h, 1)) < 0) {
         goto fail;
     }
 
     path = ff_urldecode(libsmb2->url->path, 0);
-    ret = smb2_opendir_async(libsmb2->smb2, path, opendir_callback, libsmb2);
+    libsmb2->dir_index = 0;
+    /* only fetch the entries of the page, "." and ".." come with them */
+    if (libsmb2->dir_limit > 0)
+        max_entries = FFMIN((int64_t)libsmb2->dir_offset + libsmb2->dir_limit + 2, INT_MAX);
+    ret = smb2_opendir_max_async(libsmb2->smb2, path, max_entries, opendir_callback, libsmb2);
     if (0 != ret) {
-        av_log(h, AV_LOG_ERROR, "smb2_opendir_async failed. %s\n", smb2_get_error(libsmb2->smb2));
+        av_log(h, AV_LOG_ERROR, "smb2_opendir_max_async failed. %s\n", smb2_get_error(libsmb2->smb2));
         goto fail;
     }
     ret = wait_for_reply(libsmb2);
@@ -381,62 +882,73 @@ fail:
     return ret;
 }
 
+static struct smb2dirent *next_dir_entry(LIBSMB2Context *libsmb2)
+{
+    struct smb2dirent *ent;
+    do {
+        ent = smb2_readdir(libsmb2->smb2, libsmb2->dir);
+    } while (ent && (!strcmp(ent->name, ".") || !strcmp(ent->name, "..")));
+    return ent;
+}
+
+/*
+ * The listing was fetched with QUERY_DIRECTORY when the directory was
+ * opened, and its replies carry the attributes of every entry, so no
+ * request is needed here.
+ */
 static int libsmb2_read_dir(URLContext *h, AVIODirEntry **next)
 {
     LIBSMB2Context *libsmb2 = h->priv_data;
     AVIODirEntry *entry;
     struct smb2dirent *ent = NULL;
-    char *url = NULL;
+
+    *next = NULL;
+    /* pagination */
+    for (; libsmb2->dir_index < libsmb2->dir_offset; libsmb2->dir_index++) {
+        if (!next_dir_entry(libsmb2))
+            return 0;
+    }
+    if (libsmb2->dir_limit > 0 &&
+        libsmb2->dir_index >= (int64_t)libsmb2->dir_offset + libsmb2->dir_limit)
+        return 0;
+    if (!(ent = next_dir_entry(libsmb2)))
+        return 0;
+    libsmb2->dir_index++;
 
     *next = entry = ff_alloc_dir_entry();
     if (!entry)
         return AVERROR(ENOMEM);
 
-    do {
-        ent = smb2_readdir(libsmb2->smb2, libsmb2->dir);
-        if (!ent) {
-            av_freep(next);
-            return 0;
-        }
-        switch (ent->st.smb2_type) {
-        case SMB2_TYPE_DIRECTORY:
-            entry->type = AVIO_ENTRY_DIRECTORY;
-            break;
-        case SMB2_TYPE_FILE:
-            entry->type = AVIO_ENTRY_FILE;
-            break;
-        default:
-            entry->type = AVIO_ENTRY_UNKNOWN;
-            break;
-        }
-    } while (!strcmp(ent->name, ".") ||
-             !strcmp(ent->name, ".."));
+    switch (ent->st.smb2_type) {
+    case SMB2_TYPE_DIRECTORY:
+        entry->type = AVIO_ENTRY_DIRECTORY;
+        entry->filemode = 0755;
+        break;
+    case SMB2_TYPE_FILE:
+        entry->type = AVIO_ENTRY_FILE;
+        entry->filemode = 0644;
+        break;
+    case SMB2_TYPE_LINK:
+        entry->type = AVIO_ENTRY_SYMBOLIC_LINK;
+        entry->filemode = 0777;
+        break;
+    default:
+        entry->type = AVIO_ENTRY_UNKNOWN;
+        break;
+    }
+    /* like the Linux CIFS client, map the DOS read-only attribute */
+    if (entry->filemode != -1 && (ent->file_attributes & SMB2_FILE_ATTRIBUTE_READONLY))
+        entry->filemode &= ~0222;
 
     entry->name = av_strdup(ent->name);
     if (!entry->name) {
         av_freep(next);
         return AVERROR(ENOMEM);
     }
-
-    url = av_append_path_component(libsmb2->url->path, ent->name);
-    if (url) {
-        struct smb2_stat_64 st;
-        int ret = smb2_stat_async(libsmb2->smb2, url, &st, generic_callback, libsmb2);
-        if (0 == ret) {
-            ret = wait_for_reply(libsmb2);
-            if (0 == ret) {
-                entry->size = st.smb2_size;
-                entry->modification_timestamp = INT64_C(1000000) * st.smb2_mtime;
-                entry->access_timestamp =  INT64_C(1000000) * st.smb2_atime;
-                entry->status_change_timestamp = INT64_C(1000000) * st.smb2_ctime;
-            } else {
-                av_log(h, AV_LOG_ERROR, "wait_for_reply(%s) failed. %s\n", ent->name, smb2_get_error(libsmb2->smb2));
-            }
-        } else {
-            av_log(h, AV_LOG_ERROR, "smb2_fstat_async(%s) failed. %s\n", ent->name, smb2_get_error(libsmb2->smb2));
-        }
-        av_free(url);
-    }
+    entry->size = ent->st.smb2_size;
+    entry->modification_timestamp  = INT64_C(1000000) * ent->st.smb2_mtime + ent->st.smb2_mtime_nsec / 1000;
+    entry->access_timestamp        = INT64_C(1000000) * ent->st.smb2_atime + ent->st.smb2_atime_nsec / 1000;
+    entry->status_change_timestamp = INT64_C(1000000) * ent->st.smb2_ctime + ent->st.smb2_ctime_nsec / 1000;
 
     return 0;
 }
@@ -459,7 +971,7 @@ static int libsmb2_delete(URLContext *h)
     const char* path = NULL;
     struct smb2_stat_64 st;
 
-    if ((ret = libsmb2_connect(h)) < 0)
+    if ((ret = libsmb2_connect(h, 1)) < 0)
         goto cleanup;
 
     path = ff_urldecode(libsmb2->url->path, 0);
@@ -521,7 +1033,7 @@ static int libsmb2_move(URLContext *h_src, URLContext *h_dst)
     LIBSMB2Context *libsmb2 = h_src->priv_data;
     int ret;
 
-    if ((ret = libsmb2_connect(h_src)) < 0)
+    if ((ret = libsmb2_connect(h_src, 1)) < 0)
         goto cleanup;
 
     ret = smb2_rename_async(libsmb2->smb2, h_src->filename, h_dst->filename, generic_callback, libsmb2);
@@ -549,6 +1061,11 @@ static const AVOption options[] = {
     {"user",      "set the user name used for making connections", OFFSET(user), AV_OPT_TYPE_STRING, { .str = "Guest" }, 0, 0, D|E },
     {"password",  "set the password used for making connections",  OFFSET(password), AV_OPT_TYPE_STRING, { .str = "" }, 0, 0, D|E },
     {"workgroup", "set the workgroup used for making connections", OFFSET(workgroup), AV_OPT_TYPE_STRING, { 0 }, 0, 0, D|E },
+    {"readahead_requests", "set the number of outstanding READ requests, 0 disables read-ahead", OFFSET(readahead_requests), AV_OPT_TYPE_INT, { .i64 = 4 }, 0, 64, D },
+    {"session_idle_timeout", "set how long in seconds a connection to the share is kept for reuse after close, 0 disables reuse", OFFSET(session_idle_timeout), AV_OPT_TYPE_INT, { .i64 = 30 }, 0, INT_MAX / 1000000, D|E },
+    {"dir_offset", "set the index of the first directory entry to list", OFFSET(dir_offset), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, INT_MAX, D },
+    {"dir_limit",  "set the maximum number of directory entries to list, 0 for all", OFFSET(dir_limit), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, INT_MAX, D },
+    {"readahead_size", "set the size of the read-ahead window", OFFSET(readahead_size), AV_OPT_TYPE_INT, { .i64 = READAHEAD_SIZE }, 65536, INT_MAX, D },
     {NULL}
 };
 
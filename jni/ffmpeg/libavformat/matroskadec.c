@@ -52,6 +52,7 @@
 #include "avformat.h"
 #include "avio_internal.h"
 #include "internal.h"
+#include "indexcache.h"
 #include "isom.h"
 #include "matroska.h"
 #include "oggdec.h"
@@ -386,6 +387,10 @@ typedef struct MatroskaDemuxContext {
 
     /* Bandwidth value for WebM DASH Manifest */
     int bandwidth;
+
+    /* Sidecar seek index for files without Cues */
+    char *index_cache_dir;
+    FFIndexCache index_cache;
 } MatroskaDemuxContext;
 
 #define CHILD_OF(parent) { .def = { .n = parent } }
@@ -1915,6 +1920,18 @@ static void matroska_add_index_entries(MatroskaDemuxContext *matroska)
     }
 }
 
+static int matroska_has_cues(MatroskaDemuxContext *matroska)
+{
+    int i;
+
+    if (matroska->index.nb_elem)
+        return 1;
+    for (i = 0; i < matroska->num_level1_elems; i++)
+        if (matroska->level1_elems[i].id == MATROSKA_ID_CUES)
+            return 1;
+    return 0;
+}
+
 static void matroska_parse_cues(MatroskaDemuxContext *matroska) {
     int i;
 
@@ -3070,6 +3087,8 @@ static int matroska_read_header(AVFormatContext *s)
         }
 
     matroska_add_index_entries(matroska);
+    if (!matroska_has_cues(matroska))
+        ff_index_cache_open(s, &matroska->index_cache, matroska->index_cache_dir);
 
     matroska_convert_tags(s);
 
@@ -3924,6 +3943,7 @@ static int matroska_read_close(AVFormatContext *s)
         if (tracks[n].type == MATROSKA_TRACK_TYPE_AUDIO)
             av_freep(&tracks[n].audio.buf);
     ebml_free(matroska_segment, matroska);
+    ff_index_cache_close(s, &matroska->index_cache);
 
     return 0;
 }
@@ -4328,6 +4348,18 @@ static const AVOption options[] = {
     { NULL },
 };
 
+static const AVOption matroska_options[] = {
+    { "index_cache_dir", "directory of the seek index cache for files without Cues", OFFSET(index_cache_dir), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, AV_OPT_FLAG_DECODING_PARAM },
+    { NULL },
+};
+
+static const AVClass matroska_class = {
+    .class_name = "Matroska demuxer",
+    .item_name  = av_default_item_name,
+    .option     = matroska_options,
+    .version    = LIBAVUTIL_VERSION_INT,
+};
+
 static const AVClass webm_dash_class = {
     .class_name = "WebM DASH Manifest demuxer",
     .item_name  = av_default_item_name,
@@ -4345,6 +4377,7 @@ AVInputFormat ff_matroska_demuxer = {
     .read_packet    = matroska_read_packet,
     .read_close     = matroska_read_close,
     .read_seek      = matroska_read_seek,
+    .priv_class     = &matroska_class,
     .mime_type      = "audio/webm,audio/x-matroska,video/webm,video/x-matroska"
 };
 
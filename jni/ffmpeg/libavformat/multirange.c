@@ -0,0 +1,516 @@
+/*
+ * Parallel ranged download protocol
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Read an HTTP resource over several connections at once.
+ *
+ * The file is split in fixed size byte ranges. The ranges following the read
+ * position are downloaded in parallel by a pool of threads, each with its own
+ * connection, and returned in order. The throughput of a single connection
+ * is bound by its window and round trip time, which is what limits
+ * progressive playback on lossy mobile links.
+ *
+ * The ranges are kept in a ring of slots: the range number n lives in the
+ * slot n % nb_ranges, and the window holds the range of the read position
+ * and the ones after it. When the read position leaves a range, or after a
+ * seek, the slots of the ranges that left the window are given to the new
+ * ones, and the downloads of the ranges that were dropped are cancelled.
+ *
+ * Resources that cannot be read by ranges are read directly.
+ */
+
+#include <stdatomic.h>
+
+#include "libavutil/avstring.h"
+#include "libavutil/mem.h"
+#include "libavutil/opt.h"
+#include "libavutil/thread.h"
+#include "url.h"
+
+#define CHUNK_SIZE (32 * 1024)
+
+typedef struct Range {
+    int64_t  start;             ///< offset of the range in the file
+    int      size;              ///< 0 past the end of the file
+    int      filled;            ///< bytes downloaded
+    int      busy;              ///< a worker is downloading the range
+    int      worker;            ///< index of that worker
+    int      error;             ///< the download failed, retried after a seek
+    uint8_t *data;
+} Range;
+
+typedef struct Worker {
+    URLContext *h;
+    URLContext *uc;
+    Range      *range;          ///< range being downloaded
+    atomic_int  cancel;         ///< the range left the window
+    pthread_t   thread;
+    uint8_t     buf[CHUNK_SIZE];
+} Worker;
+
+typedef struct Context {
+    AVClass        *class;
+    URLContext     *inner;      ///< only set when reading directly
+    char           *url;
+    AVDictionary   *inner_opts;
+
+    int64_t         logical_pos;
+    int64_t         logical_size;
+
+    uint8_t        *buffer;
+    Range          *ranges;
+    int             nb_ranges;
+    int64_t         first_range;
+
+    Worker         *workers;
+    int             nb_workers;
+
+    pthread_cond_t  cond_wakeup_main;
+    pthread_cond_t  cond_wakeup_background;
+    pthread_mutex_t mutex;
+
+    atomic_int      abort_request;
+    AVIOInterruptCB interrupt_callback;
+
+    /* options */
+    int             connections;
+    int             range_size;
+    int             buffer_size;
+} Context;
+
+static int worker_interrupt_cb(void *arg)
+{
+    Worker  *w = arg;
+    Context *c = w->h->priv_data;
+
+    /* called without the mutex, from within the reads of the worker */
+    return atomic_load(&w->cancel) || atomic_load(&c->abort_request) ||
+           ff_check_interrupt(&c->interrupt_callback);
+}
+
+/*
+ * Make the window start at the range holding pos. Must be called with the
+ * mutex locked.
+ */
+static void window_move(Context *c, int64_t pos)
+{
+    int64_t first = pos / c->range_size;
+    int i;
+
+    for (i = 0; i < c->nb_ranges; i++) {
+        int64_t start = (first + i) * c->range_size;
+        Range  *r     = &c->ranges[(first + i) % c->nb_ranges];
+
+        if (r->start == start) {
+            if (!r->busy)
+                r->error = 0;
+            continue;
+        }
+        if (r->busy)
+            atomic_store(&c->workers[r->worker].cancel, 1);
+        r->start  = start;
+        r->size   = av_clip64(c->logical_size - start, 0, c->range_size);
+        r->filled = 0;
+        r->busy   = 0;
+        r->error  = 0;
+    }
+    c->first_range = first;
+    pthread_cond_broadcast(&c->cond_wakeup_background);
+}
+
+/* The first range of the window that needs a worker, with the mutex locked. */
+static Range *window_next_range(Context *c)
+{
+    int i;
+
+    for (i = 0; i < c->nb_ranges; i++) {
+        Range *r = &c->ranges[(c->first_range + i) % c->nb_ranges];
+        if (!r->busy && !r->error && r->filled < r->size)
+            return r;
+    }
+    return NULL;
+}
+
+/*
+ * Make sure the range of the read position gets a worker after a seek: when
+ * all the workers are downloading ranges after it, the download of the last
+ * one is interrupted, and resumed from its filled bytes later. Must be called
+ * with the mutex locked.
+ */
+static void window_preempt(Context *c)
+{
+    Range *cur = &c->ranges[c->first_range % c->nb_ranges];
+    int i;
+
+    if (cur->busy || cur->error || cur->filled >= cur->size)
+        return;
+    /* an idle or cancelled worker takes it next */
+    for (i = 0; i < c->nb_workers; i++)
+        if (!c->workers[i].range || atomic_load(&c->workers[i].cancel))
+            return;
+    for (i = c->nb_ranges - 1; i > 0; i--) {
+        Range *r = &c->ranges[(c->first_range + i) % c->nb_ranges];
+
+        if (r->busy) {
+            atomic_store(&c->workers[r->worker].cancel, 1);
+            r->busy = 0;
+            return;
+        }
+    }
+}
+
+static int open_range(Worker *w, int64_t pos, int64_t end)
+{
+    URLContext     *h      = w->h;
+    Context        *c      = h->priv_data;
+    AVIOInterruptCB int_cb = { worker_interrupt_cb, w };
+    AVDictionary   *opts   = NULL;
+    int ret;
+
+    if ((ret = av_dict_copy(&opts, c->inner_opts, 0)) < 0 ||
+        (ret = av_dict_set_int(&opts, "offset", pos, 0)) < 0 ||
+        (ret = av_dict_set_int(&opts, "end_offset", end, 0)) < 0) {
+        av_dict_free(&opts);
+        return ret;
+    }
+    ret = ffurl_open_whitelist(&w->uc, c->url, AVIO_FLAG_READ, &int_cb, &opts,
+                               h->protocol_whitelist, h->protocol_blacklist, h);
+    av_dict_free(&opts);
+    if (ret < 0)
+        return ret;
+    /* a server ignoring the Range header answers with the whole file */
+    if (ffurl_seek(w->uc, 0, SEEK_CUR) != pos) {
+        av_log(h, AV_LOG_ERROR, "Range request at %"PRId64" not honoured\n", pos);
+        ffurl_closep(&w->uc);
+        return AVERROR(EIO);
+    }
+    return 0;
+}
+
+/* Download the bytes [pos, end) of the range of w, without the mutex. */
+static void fetch_range(Worker *w, int64_t pos, int64_t end)
+{
+    Context *c = w->h->priv_data;
+    Range   *r = w->range;
+
+    while (pos < end) {
+        int ret = w->uc ? 0 : open_range(w, pos, end);
+        if (ret >= 0)
+            ret = ffurl_read(w->uc, w->buf, FFMIN(sizeof(w->buf), end - pos));
+
+        pthread_mutex_lock(&c->mutex);
+        /* the slot may already hold another range */
+        if (atomic_load(&w->cancel)) {
+            pthread_mutex_unlock(&c->mutex);
+            break;
+        }
+        if (ret > 0) {
+            memcpy(r->data + r->filled, w->buf, ret);
+            r->filled += ret;
+            pos       += ret;
+        } else {
+            r->error = ret ? ret : AVERROR_EOF;
+        }
+        if (ret <= 0 || pos == end)
+            r->busy = 0;
+        pthread_cond_signal(&c->cond_wakeup_main);
+        pthread_mutex_unlock(&c->mutex);
+        if (ret <= 0)
+            break;
+    }
+    /* a completely read reply leaves the connection to the next range */
+    ffurl_closep(&w->uc);
+}
+
+static void *worker_task(void *arg)
+{
+    Worker  *w = arg;
+    Context *c = w->h->priv_data;
+    int64_t  pos, end;
+
+    pthread_mutex_lock(&c->mutex);
+    while (!atomic_load(&c->abort_request)) {
+        Range *r = w->range;
+
+        if (!r) {
+            if (!(r = window_next_range(c))) {
+                pthread_cond_wait(&c->cond_wakeup_background, &c->mutex);
+                continue;
+            }
+            r->busy   = 1;
+            r->worker = w - c->workers;
+            w->range  = r;
+            atomic_store(&w->cancel, 0);
+        }
+        pos = r->start + r->filled;
+        end = r->start + r->size;
+        pthread_mutex_unlock(&c->mutex);
+        fetch_range(w, pos, end);
+        pthread_mutex_lock(&c->mutex);
+        w->range = NULL;
+    }
+    pthread_mutex_unlock(&c->mutex);
+    ffurl_closep(&w->uc);
+
+    return NULL;
+}
+
+/*
+ * Open the first range, which gives the size of the file and is then
+ * downloaded by the first worker.
+ *
+ * @return 1 if the file can be read by ranges, 0 if not, < 0 on error
+ */
+static int probe_ranges(URLContext *h, int flags)
+{
+    Context *c = h->priv_data;
+    Worker  *w = &c->workers[0];
+    int ret;
+
+    if ((flags & AVIO_FLAG_WRITE) ||
+        (!av_strstart(c->url, "http:", NULL) && !av_strstart(c->url, "https:", NULL)))
+        return 0;
+
+    if ((ret = open_range(w, 0, c->range_size)) < 0)
+        return ret == AVERROR(EIO) ? 0 : ret;
+    c->logical_size = ffurl_size(w->uc);
+    if (w->uc->is_streamed || c->logical_size <= 0) {
+        ffurl_closep(&w->uc);
+        return 0;
+    }
+    return 1;
+}
+
+static int multirange_close(URLContext *h)
+{
+    Context *c = h->priv_data;
+    int i, ret;
+
+    if (c->ranges) {
+        pthread_mutex_lock(&c->mutex);
+        atomic_store(&c->abort_request, 1);
+        pthread_cond_broadcast(&c->cond_wakeup_background);
+        pthread_mutex_unlock(&c->mutex);
+
+        for (i = 0; i < c->nb_workers; i++) {
+            ret = pthread_join(c->workers[i].thread, NULL);
+            if (ret != 0)
+                av_log(h, AV_LOG_ERROR, "pthread_join(): %s\n", av_err2str(AVERROR(ret)));
+        }
+        pthread_cond_destroy(&c->cond_wakeup_background);
+        pthread_cond_destroy(&c->cond_wakeup_main);
+        pthread_mutex_destroy(&c->mutex);
+    }
+    /* the probe connection, if no worker was started */
+    for (i = 0; c->workers && i < c->connections; i++)
+        ffurl_closep(&c->workers[i].uc);
+    ffurl_closep(&c->inner);
+    av_freep(&c->ranges);
+    av_freep(&c->buffer);
+    av_freep(&c->workers);
+    av_dict_free(&c->inner_opts);
+    av_freep(&c->url);
+
+    return 0;
+}
+
+static int multirange_open(URLContext *h, const char *arg, int flags, AVDictionary **options)
+{
+    Context *c = h->priv_data;
+    int ret, i;
+
+    av_strstart(arg, "multirange:", &arg);
+
+    c->interrupt_callback = h->interrupt_callback;
+    if (!(c->url = av_strdup(arg)) ||
+        !(c->workers = av_mallocz_array(c->connections, sizeof(*c->workers)))) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    if (options && (ret = av_dict_copy(&c->inner_opts, *options, 0)) < 0)
+        goto fail;
+    for (i = 0; i < c->connections; i++)
+        c->workers[i].h = h;
+
+    if ((ret = probe_ranges(h, flags)) <= 0) {
+        if (ret < 0)
+            goto fail;
+        av_log(h, AV_LOG_VERBOSE, "%s cannot be read by ranges\n", c->url);
+        ret = ffurl_open_whitelist(&c->inner, arg, flags, &h->interrupt_callback,
+                                   options, h->protocol_whitelist,
+                                   h->protocol_blacklist, h);
+        if (ret < 0)
+            goto fail;
+        h->is_streamed = c->inner->is_streamed;
+        return 0;
+    }
+
+    c->nb_ranges = FFMAX(c->buffer_size / c->range_size, 2);
+    if (!(c->buffer = av_malloc_array(c->nb_ranges, c->range_size)) ||
+        !(c->ranges = av_mallocz_array(c->nb_ranges, sizeof(*c->ranges)))) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    for (i = 0; i < c->nb_ranges; i++) {
+        c->ranges[i].start = -1;
+        c->ranges[i].data  = c->buffer + (size_t)i * c->range_size;
+    }
+
+    if (!(ret = pthread_mutex_init(&c->mutex, NULL))) {
+        if (!(ret = pthread_cond_init(&c->cond_wakeup_main, NULL)) &&
+            (ret = pthread_cond_init(&c->cond_wakeup_background, NULL)))
+            pthread_cond_destroy(&c->cond_wakeup_main);
+        if (ret)
+            pthread_mutex_destroy(&c->mutex);
+    }
+    if (ret) {
+        av_log(h, AV_LOG_ERROR, "pthread init failed : %s\n", av_err2str(AVERROR(ret)));
+        av_freep(&c->ranges);
+        ret = AVERROR(ret);
+        goto fail;
+    }
+
+    window_move(c, 0);
+    /* the first worker goes on with the reply of the probe */
+    c->ranges[0].busy   = 1;
+    c->ranges[0].worker = 0;
+    c->workers[0].range = &c->ranges[0];
+
+    for (; c->nb_workers < c->connections; c->nb_workers++) {
+        Worker *w = &c->workers[c->nb_workers];
+        ret = pthread_create(&w->thread, NULL, worker_task, w);
+        if (ret) {
+            av_log(h, AV_LOG_ERROR, "pthread_create failed : %s\n", av_err2str(AVERROR(ret)));
+            if (!c->nb_workers) {
+                ret = AVERROR(ret);
+                goto fail;
+            }
+            break;
+        }
+    }
+    h->is_streamed = 0;
+
+    return 0;
+
+fail:
+    multirange_close(h);
+    return ret;
+}
+
+static int multirange_read(URLContext *h, unsigned char *buf, int size)
+{
+    Context *c   = h->priv_data;
+    int      ret = 0;
+
+    if (c->inner)
+        return ffurl_read(c->inner, buf, size);
+
+    pthread_mutex_lock(&c->mutex);
+    while (1) {
+        Range  *r;
+        int64_t off;
+
+        if (ff_check_interrupt(&c->interrupt_callback)) {
+            ret = AVERROR_EXIT;
+            break;
+        }
+        if (c->logical_pos >= c->logical_size) {
+            ret = AVERROR_EOF;
+            break;
+        }
+        r   = &c->ranges[(c->logical_pos / c->range_size) % c->nb_ranges];
+        off = c->logical_pos - r->start;
+        if (r->filled > off) {
+            ret = FFMIN(size, r->filled - off);
+            memcpy(buf, r->data + off, ret);
+            c->logical_pos += ret;
+            if (c->logical_pos == r->start + r->size)
+                window_move(c, c->logical_pos);
+            break;
+        }
+        if (r->error) {
+            ret = r->error;
+            break;
+        }
+        pthread_cond_wait(&c->cond_wakeup_main, &c->mutex);
+    }
+    pthread_mutex_unlock(&c->mutex);
+
+    return ret;
+}
+
+static int64_t multirange_seek(URLContext *h, int64_t pos, int whence)
+{
+    Context *c = h->priv_data;
+
+    if (c->inner)
+        return ffurl_seek(c->inner, pos, whence);
+
+    if (whence == AVSEEK_SIZE)
+        return c->logical_size;
+    else if (whence == SEEK_CUR)
+        pos += c->logical_pos;
+    else if (whence == SEEK_END)
+        pos += c->logical_size;
+    else if (whence != SEEK_SET)
+        return AVERROR(EINVAL);
+    if (pos < 0 || pos > c->logical_size)
+        return AVERROR(EINVAL);
+
+    /* the ranges still ahead of pos are kept, the others are cancelled */
+    pthread_mutex_lock(&c->mutex);
+    c->logical_pos = pos;
+    window_move(c, pos);
+    window_preempt(c);
+    pthread_mutex_unlock(&c->mutex);
+
+    return pos;
+}
+
+#define OFFSET(x) offsetof(Context, x)
+#define D AV_OPT_FLAG_DECODING_PARAM
+
+static const AVOption options[] = {
+    { "connections", "number of parallel connections", OFFSET(connections), AV_OPT_TYPE_INT, { .i64 = 4 }, 1, 16, D },
+    { "range_size", "size of the requested byte ranges", OFFSET(range_size), AV_OPT_TYPE_INT, { .i64 = 512 * 1024 }, CHUNK_SIZE, 64 * 1024 * 1024, D },
+    { "buffer_size", "memory for the ranges ahead of the read position", OFFSET(buffer_size), AV_OPT_TYPE_INT, { .i64 = 4 * 1024 * 1024 }, 0, INT_MAX, D },
+    {NULL},
+};
+
+#undef D
+#undef OFFSET
+
+static const AVClass multirange_context_class = {
+    .class_name = "MultiRange",
+    .item_name  = av_default_item_name,
+    .option     = options,
+    .version    = LIBAVUTIL_VERSION_INT,
+};
+
+const URLProtocol ff_multirange_protocol = {
+    .name                = "multirange",
+    .url_open2           = multirange_open,
+    .url_read            = multirange_read,
+    .url_seek            = multirange_seek,
+    .url_close           = multirange_close,
+    .priv_data_size      = sizeof(Context),
+    .priv_data_class     = &multirange_context_class,
+};
@@ -24,6 +24,7 @@
 #include "libavutil/time.h"
 #include "libavutil/md5.h"
 #include "libavutil/parseutils.h"
+#include "libavutil/xordsp.h"
 #include "internal.h"
 #include "avio_internal.h"
 
@@ -35,6 +36,8 @@ static const int HEADER_IDENTIFIER_OFFSET  = 512;
 static const int HEADER_LENGTH_OFFSET      = 492;
 static const int HEADER_MD5_OFFSET         = 496;
 #define INITIAL_BUFFER_SIZE 32768
+#define READAHEAD_SIZE      (512 * 1024)
+#define WRAP_SIZE           (64 * 1024)
 static const char* FILE_IDENTIFIERS[]  = { "NEMO ENCRYPT", "56d3fbd2a209" };
 
 enum MXDChunkType
@@ -56,14 +59,25 @@ typedef struct MXDChunk {
     int64_t nonencrypted_size;
     int64_t encrypted_size;
     int64_t encrypted_offset;
-    AVIOContext *input;
+    /*
+     * All chunks are read through the parent's AVIOContext. Each keeps its
+     * own read-ahead window, so that interleaved reads of the video and
+     * audio chunks do not move the shared file position on every packet.
+     */
+    int64_t pos;
+    uint8_t *readahead;
+    int64_t readahead_pos;
+    int readahead_len;
+    /* logical start of the window around the encrypted/clear boundary */
+    int64_t wrap_pos;
+    uint8_t *wrap;
+    int wrap_len;
     AVFormatContext *ctx;
     AVFormatContext *parent;
     int stream_index_map_size;
     int *stream_index_map;
     AVPacket pkt;
     int64_t cur_timestamp;
-    uint8_t eof;
 } MXDChunk;
 
 typedef struct MXDContext {
@@ -84,216 +98,206 @@ typedef struct MXDContext {
     uint32_t metadata_size;
     const char* metadata;
     MXDChunk chunks[TOTAL];
+    int readahead_size;
+    XORDSPContext xordsp;
+    /* I/O statistics of the shared input */
+    int64_t bytes_read;
+    int nb_seeks;
 } MXDContext;
 
 /*
  * It is better to check buffer and size in caller part.
  */
-static void decrypt(unsigned char* buf, int size)
+static void decrypt(MXDContext *c, unsigned char* buf, int size)
 {
     /*
      * Data decryption
      */
-    for (int i = 0; i < size; ++i) {
-        buf[i] ^= 73;
+    c->xordsp.xor_const(buf, size, 73);
+}
+
+/*
+ * Map a position inside the chunk to a position in the file. The encrypted
+ * part of a chunk is stored after its clear part, but comes first. avail is
+ * set to the number of bytes that are contiguous in the file from there.
+ */
+static int64_t chunk_file_pos(struct MXDChunk *chunk, int64_t pos, int64_t *avail)
+{
+    if (chunk->encrypted && pos < chunk->encrypted_size) {
+        *avail = chunk->encrypted_size - pos;
+        return chunk->encrypted_offset + pos;
     }
+    pos -= chunk->encrypted_size;
+    *avail = chunk->nonencrypted_size - pos;
+    return chunk->start + pos;
 }
 
-static int open_chunk_input(struct MXDChunk *chunk) {
-    /*
-     * First of all, open required url and seek to start point.
-     */
+/*
+ * Read up to size bytes of the chunk at pos into buf, without crossing the
+ * encrypted/clear boundary.
+ */
+static int read_region(struct MXDChunk *chunk, int64_t pos, uint8_t *buf, int size)
+{
     MXDContext *c = chunk->parent->priv_data;
-    int ret = avio_open2(&chunk->input, chunk->parent->url, AVIO_FLAG_READ, c->interrupt_callback, NULL);
-    if (ret < 0) {
-        av_log(c, AV_LOG_ERROR, "Unable to open chunk input.\n");
-        goto exit;
-    }
+    AVIOContext *pb = chunk->parent->pb;
+    int64_t avail, file_pos = chunk_file_pos(chunk, pos, &avail);
+    int ret;
+
+    size = FFMIN(avail, size);
+    if (size <= 0)
+        return AVERROR_EOF;
 
     /*
-     * For encrypted chunk, its actual start point is encrypted_offset.
+     * avio_seek() reads through short forward gaps instead of issuing a new
+     * request, so nearby reads of different chunks get coalesced.
      */
-    if (avio_seek(chunk->input, chunk->encrypted ? chunk->encrypted_offset : chunk->start, SEEK_SET) < 0) {
-        av_log(c, AV_LOG_ERROR, "Unable to seek to chunk start point.\n");
-        ret = AVERROR(EIO);
-        goto exit;
+    if (avio_tell(pb) != file_pos) {
+        if (avio_seek(pb, file_pos, SEEK_SET) < 0) {
+            av_log(c, AV_LOG_ERROR, "Unable to seek data.\n");
+            return AVERROR(EIO);
+        }
+        c->nb_seeks++;
     }
-    ret = 0;
-exit:
+
+    ret = avio_read(pb, buf, size);
+    if (ret < 0) {
+        av_log(c, AV_LOG_ERROR, "Unable to read buffer %s\n", av_err2str(ret));
+        return ret;
+    }
+    if (chunk->encrypted && pos < chunk->encrypted_size)
+        decrypt(c, buf, ret);
+
+    c->bytes_read += ret;
     return ret;
 }
 
-static void close_chunk_input(struct MXDChunk *chunk) {
-    if (chunk->input) {
-        av_freep(&chunk->input->buffer);
-        avio_context_free(&chunk->input);
+/*
+ * The end of the encrypted part and the start of the clear part are far
+ * apart in the file. Both sides of the boundary are kept in a window of
+ * their own, so that demuxer reads around it (probing, resyncing, seeking
+ * back near the start) only cost a seek the first time.
+ */
+static int has_wrap(struct MXDChunk *chunk)
+{
+    return chunk->encrypted && chunk->encrypted_size > 0 &&
+           chunk->nonencrypted_size > 0;
+}
+
+static int fill_wrap(struct MXDChunk *chunk)
+{
+    int64_t pos = chunk->wrap_pos;
+    int64_t end = FFMIN(chunk->size, chunk->encrypted_size + WRAP_SIZE / 2);
+    int len = 0, ret;
+
+    while (pos + len < end) {
+        ret = read_region(chunk, pos + len, chunk->wrap + len, end - pos - len);
+        if (ret <= 0)
+            return ret ? ret : AVERROR_EOF;
+        len += ret;
     }
+    chunk->wrap_len = len;
+    return len;
+}
+
+static int fill_readahead(struct MXDChunk *chunk)
+{
+    MXDContext *c = chunk->parent->priv_data;
+    int size = c->readahead_size;
+    int ret;
+
+    /* leave the boundary to the wrap window */
+    if (has_wrap(chunk) && chunk->pos < chunk->wrap_pos)
+        size = FFMIN(size, chunk->wrap_pos - chunk->pos);
+
+    ret = read_region(chunk, chunk->pos, chunk->readahead, size);
+    if (ret < 0)
+        return ret;
+
+    chunk->readahead_pos = chunk->pos;
+    chunk->readahead_len = ret;
+    return ret;
 }
 
 static int64_t seek_data(void *opaque, int64_t offset, int whence)
 {
     struct MXDChunk *chunk = opaque;
-    MXDContext *c = chunk->parent->priv_data;
-    int64_t ret;
-    if (!chunk->input) {
-        ret = open_chunk_input(chunk);
-        if (ret < 0) {
-            av_log(c, AV_LOG_ERROR, "Unable to open chunk input.\n");
-            goto exit;
-        }
-    }
+
     /*
-     * reset eof state
+     * Only the position is updated here, the data is read on demand, and
+     * not at all if the target is still inside the read-ahead window.
      */
-    chunk->eof = 0;
-
-    switch(whence) {
+    switch (whence & ~AVSEEK_FORCE) {
         case SEEK_SET:
-            if (chunk->encrypted) {
-                if (offset >= 0 && offset < chunk->encrypted_size) {
-                    offset += chunk->encrypted_offset;
-                } else {
-                    offset += chunk->start - chunk->encrypted_size;
-                }
-            } else {
-                offset += chunk->start;
-            }
-            if (avio_seek(chunk->input, offset, whence) < 0) {
-                ret = AVERROR(EIO);
-                av_log(c, AV_LOG_ERROR, "Unable to seek data.\n");
-                goto exit;
-            }
             break;
-
         case SEEK_CUR:
+            offset += chunk->pos;
+            break;
         case SEEK_END:
-            if (avio_seek(chunk->input, offset, whence) < 0) {
-                ret = AVERROR(EIO);
-                av_log(c, AV_LOG_ERROR, "Unable to seek data relatively.\n");
-                goto exit;
-            }
+            offset += chunk->size;
             break;
-
         case AVSEEK_SIZE:
             return chunk->size;
-            break;
+        default:
+            return AVERROR(EINVAL);
     }
-exit:
-    return ret;
+    if (offset < 0 || offset > chunk->size)
+        return AVERROR(EINVAL);
+
+    chunk->pos = offset;
+    return offset;
 }
 
 static int read_data(void *opaque, uint8_t *buf, int buf_size)
 {
     struct MXDChunk *chunk = opaque;
-    MXDContext *c = chunk->parent->priv_data;
+    int64_t offset = chunk->pos - chunk->readahead_pos;
+    const uint8_t *src;
     int ret;
-    int64_t pos;
-    if (!chunk->input) {
-        ret = open_chunk_input(chunk);
-        if (ret < 0) {
-            av_log(c, AV_LOG_ERROR, "Unable to open chunk input.\n");
-            goto exit;
-        }
-    }
 
-    if (chunk->eof) {
-        ret = AVERROR_EOF;
-        goto exit;
-    }
-    /*
-     *
-     */
-    pos = avio_tell(chunk->input);
-    if (chunk->encrypted) {
-        /*
-         * Best effort read logic
-         */
-        if (pos >= chunk->encrypted_offset) {
-            /*
-             * If remaining encrypted data could fulfill the request, read
-             * and decrypt buffer directly.
-             */
-            if (pos + buf_size < chunk->end) {
-                ret = avio_read(chunk->input, buf, buf_size);
-                if (ret < 0) {
-                    av_log(c, AV_LOG_ERROR, "Unable to read buffer %s\n", av_err2str(ret));
-                    goto exit;
-                }
-                /*
-                 * Data decryption
-                 */
-                decrypt(buf, ret);
-            } else {
-                /*
-                 * If remaining encrypted data could not fulfill the request, read
-                 * all remaining encrypted and decrypt them at first.
-                 */
-                int64_t encrypted_size = chunk->end - pos;
-                ret = avio_read(chunk->input, buf, encrypted_size);
-                if (ret < 0) {
-                    av_log(c, AV_LOG_ERROR, "Unable to read buffer %s\n", av_err2str(ret));
-                    goto exit;
-                }
-                /*
-                 * Data decryption
-                 */
-                decrypt(buf, ret);
-
-                /*
-                 * Seek to the non-encrypted start position and read non-encrypted data.
-                 */
-                if (avio_seek(chunk->input, chunk->start, SEEK_SET) < 0) {
-                    av_log(c, AV_LOG_ERROR, "Unable to reset read position.\n");
-                    goto exit;
-                }
-
-                int nonecrypted_size = avio_read(chunk->input, buf + encrypted_size, FFMIN(buf_size - encrypted_size, chunk->nonencrypted_size));
-                if (nonecrypted_size < 0) {
-                    av_log(c, AV_LOG_ERROR, "Unable to read buffer %s\n", av_err2str(nonecrypted_size));
-                    goto exit;
-                }
-                /*
-                 * Update the data size by adding non-encrypted data size.
-                 */
-                ret += nonecrypted_size;
-            }
-        } else {
-            /*
-             * We are reading non-encrypted data now.Simply read them directly.
-             */
-            ret = avio_read(chunk->input, buf, FFMIN(buf_size, (chunk->encrypted_offset - pos)));
-            if (ret < 0) {
-                av_log(c, AV_LOG_ERROR, "Unable to read buffer %s\n", av_err2str(ret));
-                goto exit;
-            }
-
-            if (avio_tell(chunk->input) >= chunk->encrypted_offset) {
-                chunk->eof = 1;
-                goto exit;
-            }
+    if (chunk->pos >= chunk->size)
+        return AVERROR_EOF;
+
+    if (offset >= 0 && offset < chunk->readahead_len) {
+        src = chunk->readahead + offset;
+        ret = chunk->readahead_len - offset;
+    } else if (has_wrap(chunk) && chunk->pos >= chunk->wrap_pos &&
+               chunk->pos < chunk->encrypted_size + WRAP_SIZE / 2) {
+        if (!chunk->wrap_len) {
+            ret = fill_wrap(chunk);
+            if (ret < 0)
+                return ret;
         }
+        offset = chunk->pos - chunk->wrap_pos;
+        if (offset >= chunk->wrap_len)
+            return AVERROR_EOF;
+        src = chunk->wrap + offset;
+        ret = chunk->wrap_len - offset;
     } else {
-            ret = avio_read(chunk->input, buf, FFMIN(chunk->end - pos, buf_size));
-            if (ret < 0) {
-                av_log(NULL, AV_LOG_ERROR, "Unable to read buffer.\n");
-                goto exit;
-            }
-
-            if (avio_tell(chunk->input) >= chunk->end) {
-                chunk->eof = 1;
-            }
+        ret = fill_readahead(chunk);
+        if (ret <= 0)
+            return ret ? ret : AVERROR_EOF;
+        src = chunk->readahead;
     }
-exit:
+
+    ret = FFMIN(buf_size, ret);
+    memcpy(buf, src, ret);
+    chunk->pos += ret;
     return ret;
 }
 
 static void close_demuxer_for_chunk(struct MXDChunk *chunk)
 {
-    close_chunk_input(chunk);
+    av_freep(&chunk->readahead);
+    av_freep(&chunk->wrap);
+    chunk->wrap_len = 0;
 
     if (chunk->ctx) {
-        av_freep(&chunk->ctx->pb->buffer);
+        AVIOContext *pb = chunk->ctx->pb;
         avformat_close_input(&chunk->ctx);
+        if (pb) {
+            av_freep(&pb->buffer);
+            avio_context_free(&pb);
+        }
     }
 
     if (chunk->stream_index_map) {
@@ -314,6 +318,20 @@ static int do_open_demuxer_for_chunk(AVFormatContext *s, struct MXDChunk *chunk)
         goto fail;
     }
 
+    chunk->readahead = av_malloc(((MXDContext *)s->priv_data)->readahead_size);
+    if (!chunk->readahead) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    if (has_wrap(chunk)) {
+        chunk->wrap_pos = FFMAX(0, chunk->encrypted_size - WRAP_SIZE / 2);
+        chunk->wrap = av_malloc(WRAP_SIZE);
+        if (!chunk->wrap) {
+            ret = AVERROR(ENOMEM);
+            goto fail;
+        }
+    }
+
     if (!(chunk->ctx = avformat_alloc_context())) {
         ret = AVERROR(ENOMEM);
         av_log(s, AV_LOG_ERROR, "Unable to create AVFormatContext for chunk.\n");
@@ -405,6 +423,8 @@ static int mxd_read_header(AVFormatContext *s)
     uint8_t *buffer = NULL;
     AVIOContext *pb = s->pb;
     int stream_index = 0;
+
+    avpriv_xordsp_init(&c->xordsp);
     /*
      * The structure of vidmate file format is very strange
      * because its file header(file structure description)
@@ -497,7 +517,7 @@ static int mxd_read_header(AVFormatContext *s)
              */
             uint8_t length[4];
             memcpy(length, buffer + HEADER_LENGTH_OFFSET, 4);
-            decrypt(length, sizeof(length));
+            decrypt(c, length, sizeof(length));
             c->header_size = AV_RB32(length);
 
             /*
@@ -542,7 +562,7 @@ static int mxd_read_header(AVFormatContext *s)
             /*
              * The file header is encrypted, so decrypt it at first.
              */
-            decrypt(header, c->header_size);
+            decrypt(c, header, c->header_size);
             int encrypt_version = AV_RB32(header);
 
             if (encrypt_version <=0) {
@@ -747,7 +767,7 @@ static int mxd_read_packet(AVFormatContext *s, AVPacket *pkt)
     if (audio->ctx) {
         if (audio->pkt.pts != AV_NOPTS_VALUE) {
             av_packet_ref(pkt, &audio->pkt);
-            if (pkt->stream_index >= 0 && pkt->stream_index < video->stream_index_map_size) {
+            if (pkt->stream_index >= 0 && pkt->stream_index < audio->stream_index_map_size) {
                 pkt->stream_index = audio->stream_index_map[pkt->stream_index];
             }
             av_packet_unref(&audio->pkt);
@@ -784,6 +804,8 @@ static int mxd_read_packet(AVFormatContext *s, AVPacket *pkt)
 static int mxd_read_close(AVFormatContext *s)
 {
     MXDContext *c = s->priv_data;
+    av_log(s, AV_LOG_VERBOSE, "Read %"PRId64" bytes with %d seeks.\n",
+           c->bytes_read, c->nb_seeks);
     for (int i = PREPEND; i < TOTAL; ++i) {
         close_demuxer_for_chunk(&c->chunks[i]);
     }
@@ -793,45 +815,79 @@ static int mxd_read_close(AVFormatContext *s)
     return 0;
 }
 
-static int mxd_read_seek(AVFormatContext *s, int stream_index, int64_t timestamp, int flags)
+/*
+ * Seek the demuxer of a chunk and queue its first packet. The nested
+ * demuxers stay open across seeks, so their index and the read-ahead
+ * windows of the chunks are reused; queueing a packet of each chunk right
+ * away fetches the video and audio data at the target together.
+ */
+static int seek_chunk(MXDChunk *chunk, int64_t min_ts, int64_t ts, int64_t max_ts, int flags)
+{
+    int ret;
+
+    av_packet_unref(&chunk->pkt);
+    ret = avformat_seek_file(chunk->ctx, -1, min_ts, ts, max_ts, flags);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = av_read_frame(chunk->ctx, &chunk->pkt);
+    if (ret < 0) {
+        chunk->cur_timestamp = ts;
+        return ret;
+    }
+    if (chunk->pkt.pts != AV_NOPTS_VALUE) {
+        chunk->cur_timestamp = av_rescale_q(chunk->pkt.pts,
+                                            chunk->ctx->streams[chunk->pkt.stream_index]->time_base,
+                                            AV_TIME_BASE_Q);
+    } else {
+        chunk->cur_timestamp = ts;
+    }
+    return 0;
+}
+
+static int mxd_read_seek2(AVFormatContext *s, int stream_index,
+                          int64_t min_ts, int64_t ts, int64_t max_ts, int flags)
 {
     MXDContext *c = s->priv_data;
-    timestamp = av_rescale_q(timestamp, s->streams[stream_index]->time_base, AV_TIME_BASE_Q);
     MXDChunk *video = &c->chunks[VIDEO];
+    MXDChunk *audio = &c->chunks[AUDIO];
     int ret = 0;
-    if (video->ctx) {
-        ret = av_seek_frame(video->ctx, -1, timestamp, flags);
-        if (ret < 0) {
-            goto exit;
-        }
-        video->cur_timestamp = 0;
 
-        av_packet_unref(&video->pkt);
-        ret = av_read_frame(video->ctx, &video->pkt);
+    /*
+     * The nested demuxers are seeked with stream_index -1, in AV_TIME_BASE.
+     */
+    if (stream_index >= 0) {
+        AVRational tb = s->streams[stream_index]->time_base;
+        min_ts = av_rescale_q_rnd(min_ts, tb, AV_TIME_BASE_Q, AV_ROUND_UP   | AV_ROUND_PASS_MINMAX);
+        ts     = av_rescale_q_rnd(ts,     tb, AV_TIME_BASE_Q, AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX);
+        max_ts = av_rescale_q_rnd(max_ts, tb, AV_TIME_BASE_Q, AV_ROUND_DOWN | AV_ROUND_PASS_MINMAX);
+    }
+
+    if (video->ctx) {
+        ret = seek_chunk(video, min_ts, ts, max_ts, flags);
         if (ret < 0) {
             goto exit;
         }
 
         /*
-         * Adjust timestamp according to the seek result of video.
+         * Adjust timestamp according to the seek result of video, audio
+         * has to start at the keyframe that video landed on.
          */
-        if (video->pkt.pts != AV_NOPTS_VALUE) {
-            timestamp = av_rescale_q(video->pkt.pts, video->ctx->streams[0]->time_base, AV_TIME_BASE_Q);
-        }
+        ts = video->cur_timestamp;
+        min_ts = INT64_MIN;
+        max_ts = INT64_MAX;
+        flags &= ~AVSEEK_FLAG_ANY;
     }
 
-    MXDChunk *audio = &c->chunks[AUDIO];
     if (audio->ctx) {
-        ret = av_seek_frame(audio->ctx, -1, timestamp, flags);
-        if (ret < 0) {
+        ret = seek_chunk(audio, min_ts, ts, max_ts, flags);
+        /*
+         * Audio may end before video does.
+         */
+        if (ret < 0 && ret != AVERROR_EOF) {
             goto exit;
         }
-        audio->cur_timestamp = 0;
-
-        // ret = av_read_frame(audio->ctx, &audio->pkt);
-        // if (ret < 0) {
-        //     goto exit;
-        // }
     }
     ret = 0;
 exit:
@@ -853,9 +909,11 @@ static int mxd_read_probe(const AVProbeData *p)
     return score;
 }
 
-#define OFFSET(x) offsetof(MXDASHContext, x)
+#define OFFSET(x) offsetof(MXDContext, x)
 #define FLAGS AV_OPT_FLAG_DECODING_PARAM
 static const AVOption mxd_options[] = {
+    {"readahead_size", "size of the read-ahead window of each chunk",
+        OFFSET(readahead_size), AV_OPT_TYPE_INT, {.i64 = READAHEAD_SIZE}, 4096, INT_MAX / 2, FLAGS},
     {NULL}
 };
 
@@ -876,7 +934,7 @@ AVInputFormat ff_mxd_demuxer = {
     .read_header    = mxd_read_header,
     .read_packet    = mxd_read_packet,
     .read_close     = mxd_read_close,
-    .read_seek      = mxd_read_seek,
+    .read_seek2     = mxd_read_seek2,
 };
 
 #else
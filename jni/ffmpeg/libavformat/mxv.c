@@ -260,55 +260,50 @@ void ff_mxv_generate_aes_key(uint8_t *key, int key_size)
     printf("---------------%s--------------\n", key);//输出生成的随机数。
 }
 
-void ff_mxv_encrypt_aes128(uint8_t *output, const uint8_t *key, const uint8_t *input, int size)
+int ff_mxv_aes128_init(struct AVAES **aes, const uint8_t *key, int decrypt)
 {
+    int ret;
 
-    uint8_t *encInput = NULL;
-    uint8_t *inputPadding = NULL;
-    uint8_t *encOutput = NULL;
-
-    int paddingSize = size % oneBlockSize;
-    int encrytSize = size - paddingSize;
-
-    struct AVAES *encrypt = av_aes_alloc();
-    uint8_t *encKey = av_malloc(TRACK_ENCRYPTION_KEY_SIZE);
-    memcpy(encKey, key, TRACK_ENCRYPTION_KEY_SIZE);
-    av_aes_init(encrypt, encKey, 128, 0);
+    if (!*aes && !(*aes = av_aes_alloc()))
+        return AVERROR(ENOMEM);
 
-    if (paddingSize == 0) {
-        av_aes_crypt(encrypt, output, input, size >> 4, NULL, 0);
-    }
-    else {
-        encInput = av_mallocz(encrytSize);
-        inputPadding = av_mallocz(paddingSize);
+    ret = av_aes_init(*aes, key, 128, decrypt);
+    if (ret < 0)
+        av_freep(aes);
+    return ret;
+}
 
-        memcpy(encInput, input, encrytSize);
-        memcpy(inputPadding, input+encrytSize, paddingSize);
+void ff_mxv_aes128_crypt(struct AVAES *aes, uint8_t *output, const uint8_t *input,
+                         int size, int decrypt)
+{
+    int paddingSize = size & ( oneBlockSize - 1 );
+    int cryptSize = size - paddingSize;
 
-        av_aes_crypt(encrypt, output, encInput, encrytSize >> 4, NULL, 0);
+    /* Only whole blocks are ciphered, the trailing bytes are stored in clear. */
+    if (cryptSize > 0)
+        av_aes_crypt(aes, output, input, cryptSize >> 4, NULL, decrypt);
+    if (paddingSize > 0 && input != output)
+        memcpy(output + cryptSize, input + cryptSize, paddingSize);
+}
 
-        memcpy(output+encrytSize, inputPadding, paddingSize);
+void ff_mxv_encrypt_aes128(uint8_t *output, const uint8_t *key, const uint8_t *input, int size)
+{
+    struct AVAES *encrypt = NULL;
 
-        av_free(encInput);
-        av_free(inputPadding);
-    }
-    av_free(encKey);
+    if (ff_mxv_aes128_init(&encrypt, key, 0) < 0)
+        return;
+    ff_mxv_aes128_crypt(encrypt, output, input, size, 0);
+    av_free(encrypt);
 }
 
 void ff_mxv_decrypt_aes128(uint8_t *output, const uint8_t *key, const uint8_t *input, int size)
 {
-    int paddingSize = size & ( oneBlockSize - 1 );
-    int decryptSize = size - paddingSize;
+    struct AVAES *decrypt = NULL;
 
-    struct AVAES *decrypt = av_aes_alloc();
-    if (decrypt) {
-        av_aes_init(decrypt, key, 128, 1);
-        av_aes_crypt(decrypt, output, input, decryptSize >> 4, NULL, 1);
-        if (paddingSize > 0 && input != output) {
-            memcpy(output + decryptSize, input + decryptSize, paddingSize);
-        }
-        av_free(decrypt);
-    }
+    if (ff_mxv_aes128_init(&decrypt, key, 1) < 0)
+        return;
+    ff_mxv_aes128_crypt(decrypt, output, input, size, 1);
+    av_free(decrypt);
 }
 
 //unsigned char key[16] = {0,1,2,3,4,5,6,7,8,9,0,1,2,3,4,5};
@@ -430,6 +430,22 @@ extern const char * const ff_mxv_video_stereo_plane[MXV_VIDEO_STEREO_PLANE_COUNT
 
 int ff_mxv_stereo3d_conv(AVStream *st, MXVVideoStereoModeType stereo_mode);
 void ff_mxv_generate_aes_key(uint8_t *key, int key_size);
+struct AVAES;
+
+/**
+ * Allocate (if *aes is NULL) and expand the key schedule of an AES-128
+ * context, so it can be reused for every block of a track.
+ * On failure *aes is freed and set to NULL.
+ */
+int ff_mxv_aes128_init(struct AVAES **aes, const uint8_t *key, int decrypt);
+
+/**
+ * Cipher size bytes with an initialized context. Only whole 16-byte blocks
+ * are processed, the remainder is copied as is. output may equal input.
+ */
+void ff_mxv_aes128_crypt(struct AVAES *aes, uint8_t *output, const uint8_t *input,
+                         int size, int decrypt);
+
 void ff_mxv_encrypt_aes128(uint8_t *output, const uint8_t *key, const uint8_t *input, int size);
 void ff_mxv_decrypt_aes128(uint8_t *output, const uint8_t *key, const uint8_t *input, int size);
 void printBuffer( const uint8_t* buffer, int size );
@@ -44,6 +44,7 @@
 #include "avformat.h"
 #include "avio_internal.h"
 #include "internal.h"
+#include "indexcache.h"
 #include "isom.h"
 #include "mxv.h"
 #include "oggdec.h"
@@ -246,6 +247,9 @@ typedef struct MXVTrack {
 
     uint32_t palette[AVPALETTE_COUNT];
     int has_palette;
+
+    /* expanded key schedule, kept for the lifetime of the demuxer */
+    struct AVAES *aes;
 } MXVTrack;
 
 typedef struct MXVAttachment {
@@ -379,7 +383,10 @@ typedef struct MXVDemuxContext {
 
     /* Bandwidth value for WebM DASH Manifest */
     int bandwidth;
-    uint8_t *aes_key;
+
+    /* Sidecar seek index for files without Cues */
+    char *index_cache_dir;
+    FFIndexCache index_cache;
 } MXVDemuxContext;
 
 #define CHILD_OF(parent) { .def = { .n = parent } }
@@ -968,10 +975,12 @@ static int ebml_read_ascii(AVIOContext *pb, int size, char **str)
 }
 
 /*
- * Read the next element as binary data.
+ * Read the next element as binary data, the first head_size bytes of
+ * which have already been read into head.
  * 0 is success, < 0 or NEEDS_CHECKING is failure.
  */
 static int ebml_read_binary(AVIOContext *pb, int length,
+                            const uint8_t *head, int head_size,
                             int64_t pos, EbmlBin *bin)
 {
     int ret;
@@ -984,7 +993,9 @@ static int ebml_read_binary(AVIOContext *pb, int length,
     bin->data = bin->buf->data;
     bin->size = length;
     bin->pos  = pos;
-    if ((ret = avio_read(pb, bin->data, length)) != length) {
+    memcpy(bin->data, head, head_size);
+    if ((ret = avio_read(pb, bin->data + head_size,
+                         length - head_size)) != length - head_size) {
         av_buffer_unref(&bin->buf);
         bin->data = NULL;
         bin->size = 0;
@@ -1048,6 +1059,52 @@ static int mxv_ebmlnum_sint(MXVDemuxContext *mxv,
     return res;
 }
 
+/*
+ * Check the track number of the (Simple)Block starting at the current
+ * position. Returns 1 if the track is discarded, so that the whole element
+ * can be skipped without reading, decrypting or decoding its payload.
+ * The track number is peeked at in the IO buffer if it's there, otherwise
+ * it is read and its *head_size bytes are stored in head.
+ */
+static int mxv_block_is_discarded(MXVDemuxContext *mxv, AVIOContext *pb,
+                                  uint64_t length, uint8_t *head,
+                                  int *head_size)
+{
+    MXVTrack *tracks = mxv->tracks.elem;
+    uint64_t num;
+    int i, size;
+
+    *head_size = 0;
+    if (length == EBML_UNKNOWN_LENGTH)
+        return 0;
+
+    if (pb->buf_end - pb->buf_ptr >= 8) {
+        const uint8_t *buf = pb->buf_ptr;
+
+        if (!buf[0] || (size = 8 - ff_log2_tab[buf[0]]) > length)
+            return 0;
+        num = buf[0] ^ (1 << ff_log2_tab[buf[0]]);
+        for (i = 1; i < size; i++)
+            num = (num << 8) | buf[i];
+    } else {
+        uint64_t coded;
+
+        if ((size = ebml_read_num(mxv, pb, FFMIN(length, 8), &num, 1)) < 0)
+            return size;
+        /* put the length marker back to get the bytes that were read */
+        coded = num | 1ULL << 7 * size;
+        for (i = 0; i < size; i++)
+            head[i] = coded >> 8 * (size - 1 - i);
+        *head_size = size;
+    }
+
+    for (i = 0; i < mxv->tracks.nb_elem; i++)
+        if (tracks[i].num == num)
+            return tracks[i].stream &&
+                   tracks[i].stream->discard >= AVDISCARD_ALL;
+    return 0;
+}
+
 static int ebml_parse(MXVDemuxContext *mxv,
                       EbmlSyntax *syntax, void *data);
 
@@ -1376,9 +1433,22 @@ static int ebml_parse(MXVDemuxContext *mxv,
     case EBML_UTF8:
         res = ebml_read_ascii(pb, length, data);
         break;
-    case EBML_BIN:
-        res = ebml_read_binary(pb, length, pos_alt, data);
+    case EBML_BIN: {
+        uint8_t head[8];
+        int head_size = 0;
+
+        if (id == MXV_ID_SIMPLEBLOCK || id == MXV_ID_BLOCK) {
+            if ((res = mxv_block_is_discarded(mxv, pb, length,
+                                              head, &head_size)) < 0)
+                break;
+            if (res) {
+                length -= head_size;
+                goto skip;
+            }
+        }
+        res = ebml_read_binary(pb, length, head, head_size, pos_alt, data);
         break;
+    }
     case EBML_LEVEL1:
     case EBML_NEST:
         if ((res = ebml_read_master(mxv, length, pos_alt)) < 0)
@@ -1722,7 +1792,9 @@ static int mxv_decrypt_buffer(uint8_t **buf, int *buf_size,
         */
         case MXV_TRACK_ENCODING_ENC_AES:
         {
-            ff_mxv_decrypt_aes128(data, mxv->aes_key, data, pkt_size);
+            if (!track->aes)
+                return AVERROR_INVALIDDATA;
+            ff_mxv_aes128_crypt(track->aes, data, data, pkt_size, 1);
         }
         break;
 
@@ -2076,6 +2148,18 @@ static void mxv_add_index_entries(MXVDemuxContext *mxv)
     }
 }
 
+static int mxv_has_cues(MXVDemuxContext *mxv)
+{
+    int i;
+
+    if (mxv->index.nb_elem)
+        return 1;
+    for (i = 0; i < mxv->num_level1_elems; i++)
+        if (mxv->level1_elems[i].id == MXV_ID_CUES)
+            return 1;
+    return 0;
+}
+
 static void mxv_parse_cues(MXVDemuxContext *mxv) {
     int i;
 
@@ -2535,9 +2619,15 @@ static int mxv_parse_tracks(AVFormatContext *s)
 //                        return AVERROR(ENOMEM);
 
                     const int b64_size = AV_BASE64_DECODE_SIZE(encodings[0].encryption.key_id.size);
-                    mxv->aes_key = av_mallocz(b64_size);
-                    av_base64_decode(mxv->aes_key, (const char *)encodings[0].encryption.key_id.data, b64_size);
+                    uint8_t *aes_key = av_mallocz(FFMAX(b64_size, TRACK_ENCRYPTION_KEY_SIZE));
 
+                    if (!aes_key)
+                        return AVERROR(ENOMEM);
+                    av_base64_decode(aes_key, (const char *)encodings[0].encryption.key_id.data, b64_size);
+                    ret = ff_mxv_aes128_init(&track->aes, aes_key, 1);
+                    av_free(aes_key);
+                    if (ret < 0)
+                        return ret;
 
                 } else {
 //                    encodings[0].scope = 0;
@@ -3138,6 +3228,8 @@ static int mxv_read_header(AVFormatContext *s)
         }
 
     mxv_add_index_entries(mxv);
+    if (!mxv_has_cues(mxv))
+        ff_index_cache_open(s, &mxv->index_cache, mxv->index_cache_dir);
 
     mxv_convert_tags(s);
 
@@ -4004,13 +4096,15 @@ static int mxv_read_close(AVFormatContext *s)
     MXVTrack *tracks = mxv->tracks.elem;
     int n;
 
-    av_free(mxv->aes_key);
     mxv_clear_queue(mxv);
 
-    for (n = 0; n < mxv->tracks.nb_elem; n++)
+    for (n = 0; n < mxv->tracks.nb_elem; n++) {
         if (tracks[n].type == MXV_TRACK_TYPE_AUDIO)
             av_freep(&tracks[n].audio.buf);
+        av_freep(&tracks[n].aes);
+    }
     ebml_free(mxv_segment, mxv);
+    ff_index_cache_close(s, &mxv->index_cache);
 
     return 0;
 }
@@ -4415,6 +4509,18 @@ static const AVOption options[] = {
     { NULL },
 };
 
+static const AVOption mxv_options[] = {
+    { "index_cache_dir", "directory of the seek index cache for files without Cues", OFFSET(index_cache_dir), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, AV_OPT_FLAG_DECODING_PARAM },
+    { NULL },
+};
+
+static const AVClass mxv_class = {
+    .class_name = "MXV demuxer",
+    .item_name  = av_default_item_name,
+    .option     = mxv_options,
+    .version    = LIBAVUTIL_VERSION_INT,
+};
+
 AVInputFormat ff_mxv_demuxer = {
     .name           = "mxv",
     .long_name      = NULL_IF_CONFIG_SMALL("MXV Container"),
@@ -4425,6 +4531,7 @@ AVInputFormat ff_mxv_demuxer = {
     .read_packet    = mxv_read_packet,
     .read_close     = mxv_read_close,
     .read_seek      = mxv_read_seek,
+    .priv_class     = &mxv_class,
     .mime_type      = "audio/x-mxv,video/x-mxv"
 };
 #else
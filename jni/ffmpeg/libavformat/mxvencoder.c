@@ -155,6 +155,7 @@ typedef struct MXVMuxContext {
     int write_crc;
 
     const uint8_t *aes_key;
+    struct AVAES *aes;
 
     uint32_t chapter_id_offset;
     int wrote_chapters;
@@ -423,6 +424,7 @@ static void mxv_free(MXVMuxContext *mxv) {
         av_freep(&mxv->attachments);
     }
     av_freep(&mxv->aes_key);
+    av_freep(&mxv->aes);
     av_freep(&mxv->tracks);
     av_freep(&mxv->stream_durations);
     av_freep(&mxv->stream_duration_offsets);
@@ -2044,7 +2046,14 @@ static int mxv_write_header(AVFormatContext *s)
     }
 
     mxv->aes_key = av_malloc(TRACK_ENCRYPTION_KEY_SIZE);
+    if (!mxv->aes_key) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
     ff_mxv_generate_aes_key(mxv->aes_key, TRACK_ENCRYPTION_KEY_SIZE);
+    ret = ff_mxv_aes128_init(&mxv->aes, mxv->aes_key, 0);
+    if (ret < 0)
+        goto fail;
     ret = mxv_write_tracks(s);
     if (ret < 0)
         goto fail;
@@ -2176,6 +2185,27 @@ fail:
     return ret;
 }
 
+/* Equivalent of avio_write() for encrypted block payloads: whole 16-byte
+ * blocks are ciphered through a small scratch buffer, a trailing partial
+ * block is written in clear. */
+static void mxv_write_encrypted(AVIOContext *pb, struct AVAES *aes,
+                                const uint8_t *data, int size)
+{
+    uint8_t buf[4096];
+    int tail = size & 15;
+
+    size -= tail;
+    while (size > 0) {
+        int len = FFMIN(size, sizeof(buf));
+
+        ff_mxv_aes128_crypt(aes, buf, data, len, 0);
+        avio_write(pb, buf, len);
+        data += len;
+        size -= len;
+    }
+    avio_write(pb, data, tail);
+}
+
 static void mxv_write_block(AVFormatContext *s, AVIOContext *pb,
                             uint32_t blockid, AVPacket *pkt, int keyframe)
 {
@@ -2248,19 +2278,15 @@ static void mxv_write_block(AVFormatContext *s, AVIOContext *pb,
         blockid = MXV_ID_BLOCK;
     }
 
-    uint8_t *writeData = av_mallocz(size);
-    ff_mxv_encrypt_aes128(writeData, mxv->aes_key, data, size);
-
     put_ebml_id(pb, blockid);
     put_ebml_num(pb, size + 4, 0);
     // this assumes stream_index is less than 126
     avio_w8(pb, 0x80 | track_number);
     avio_wb16(pb, ts - mxv->cluster_pts);
     avio_w8(pb, (blockid == MXV_ID_SIMPLEBLOCK && keyframe) ? (1 << 7) : 0);
-    avio_write(pb, writeData + offset, size);
+    mxv_write_encrypted(pb, mxv->aes, data + offset, size);
     if (data != pkt->data)
         av_free(data);
-    av_free(writeData);
 
     if (blockid == MXV_ID_BLOCK && !keyframe) {
         put_ebml_sint(pb, MXV_ID_BLOCKREFERENCE,
@@ -0,0 +1,429 @@
+/*
+ * Background download of the next segments of a stream
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "config.h"
+
+#include <stdatomic.h>
+
+#include "libavutil/error.h"
+#include "libavutil/log.h"
+#include "libavutil/mem.h"
+#include "libavutil/thread.h"
+#include "libavutil/time.h"
+#include "prefetch.h"
+#include "url.h"
+
+#if HAVE_THREADS
+
+#define BLOCK_SIZE (64 * 1024)
+
+typedef struct PrefetchBlock {
+    struct PrefetchBlock *next;
+    int size;
+    int pos;
+    uint8_t data[BLOCK_SIZE];
+} PrefetchBlock;
+
+typedef struct PrefetchRequest {
+    struct PrefetchRequest *next;
+    int64_t id;
+    int64_t size;
+    int64_t received;
+    /* time spent opening and reading, excluding waits for memory */
+    int64_t time;
+
+    FFPrefetchOpenFunc open;
+    void *opaque;
+    void (*free_opaque)(void *opaque);
+    AVIOContext *pb;
+
+    /* downloaded data not read yet */
+    PrefetchBlock *head, *tail;
+    /* AVERROR_EOF once complete */
+    int error;
+    /* dropped while the download thread was using it */
+    atomic_int cancelled;
+} PrefetchRequest;
+
+struct FFPrefetchQueue {
+    FFPrefetch *p;
+    struct FFPrefetchQueue *next;
+    PrefetchRequest *requests;
+    /* the request the download thread works on without holding the lock */
+    PrefetchRequest *busy;
+    atomic_int abort;
+    AVIOInterruptCB interrupt_callback;
+    pthread_t thread;
+};
+
+struct FFPrefetch {
+    void *log_ctx;
+    AVIOInterruptCB *interrupt_callback;
+    int64_t max_memory;
+    int64_t memory;
+    FFPrefetchQueue *queues;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+static int prefetch_interrupt_cb(void *opaque)
+{
+    FFPrefetchQueue *q = opaque;
+    PrefetchRequest *req = q->busy;
+
+    /* no locking: the callback may be reached from avio_closep() calls
+     * made with the lock held */
+    return atomic_load(&q->abort) || (req && atomic_load(&req->cancelled)) ||
+           ff_check_interrupt(q->p->interrupt_callback);
+}
+
+/* Must be called with the lock held, and only for requests not busy. */
+static void request_free(FFPrefetch *p, PrefetchRequest *req)
+{
+    while (req->head) {
+        PrefetchBlock *block = req->head;
+        req->head = block->next;
+        p->memory -= sizeof(*block);
+        av_free(block);
+    }
+    avio_closep(&req->pb);
+    if (req->free_opaque)
+        req->free_opaque(req->opaque);
+    av_free(req);
+}
+
+/* Must be called with the lock held. */
+static void request_drop(FFPrefetchQueue *q, PrefetchRequest *req)
+{
+    if (req == q->busy)
+        atomic_store(&req->cancelled, 1);
+    else
+        request_free(q->p, req);
+}
+
+static void *prefetch_thread(void *arg)
+{
+    FFPrefetchQueue *q = arg;
+    FFPrefetch *p = q->p;
+
+    pthread_mutex_lock(&p->mutex);
+    while (!atomic_load(&q->abort)) {
+        PrefetchRequest *req;
+        PrefetchBlock *block = NULL;
+        int64_t start;
+        int ret;
+
+        for (req = q->requests; req && req->error; req = req->next)
+            ;
+        /* the next request to read may always buffer one block, so that
+         * the reader cannot wait on a queue stalled by the others */
+        if (!req || (p->memory + (int64_t)sizeof(*block) > p->max_memory &&
+                     (req != q->requests || req->head))) {
+            pthread_cond_wait(&p->cond, &p->mutex);
+            continue;
+        }
+
+        q->busy = req;
+        pthread_mutex_unlock(&p->mutex);
+        start = av_gettime_relative();
+        if (!req->pb) {
+            ret = req->open(req->opaque, &req->pb, &q->interrupt_callback);
+        } else if (!(block = av_malloc(sizeof(*block)))) {
+            ret = AVERROR(ENOMEM);
+        } else {
+            int size = BLOCK_SIZE;
+            if (req->size >= 0)
+                size = FFMIN(size, req->size - req->received);
+            ret = size ? avio_read(req->pb, block->data, size) : AVERROR_EOF;
+        }
+        pthread_mutex_lock(&p->mutex);
+        q->busy = NULL;
+        req->time += av_gettime_relative() - start;
+
+        if (atomic_load(&req->cancelled)) {
+            av_free(block);
+            request_free(p, req);
+        } else if (ret < 0) {
+            av_free(block);
+            req->error = ret;
+            if (ret != AVERROR_EOF && ret != AVERROR_EXIT)
+                av_log(p->log_ctx, AV_LOG_WARNING,
+                       "Prefetching segment %"PRId64" failed: %s\n",
+                       req->id, av_err2str(ret));
+            avio_closep(&req->pb);
+        } else if (block) {
+            block->size = ret;
+            block->pos  = 0;
+            block->next = NULL;
+            if (req->tail)
+                req->tail->next = block;
+            else
+                req->head = block;
+            req->tail      = block;
+            req->received += ret;
+            p->memory     += sizeof(*block);
+        }
+        pthread_cond_broadcast(&p->cond);
+    }
+    pthread_mutex_unlock(&p->mutex);
+    return NULL;
+}
+
+FFPrefetch *ff_prefetch_alloc(void *log_ctx, AVIOInterruptCB *int_cb,
+                              int64_t max_memory)
+{
+    FFPrefetch *p = av_mallocz(sizeof(*p));
+
+    if (!p)
+        return NULL;
+    if (pthread_mutex_init(&p->mutex, NULL)) {
+        av_free(p);
+        return NULL;
+    }
+    if (pthread_cond_init(&p->cond, NULL)) {
+        pthread_mutex_destroy(&p->mutex);
+        av_free(p);
+        return NULL;
+    }
+    p->log_ctx            = log_ctx;
+    p->interrupt_callback = int_cb;
+    p->max_memory         = max_memory;
+    return p;
+}
+
+void ff_prefetch_free(FFPrefetch **pp)
+{
+    FFPrefetch *p = *pp;
+    FFPrefetchQueue *q;
+
+    if (!p)
+        return;
+
+    pthread_mutex_lock(&p->mutex);
+    for (q = p->queues; q; q = q->next)
+        atomic_store(&q->abort, 1);
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->mutex);
+
+    while ((q = p->queues)) {
+        p->queues = q->next;
+        pthread_join(q->thread, NULL);
+        while (q->requests) {
+            PrefetchRequest *req = q->requests;
+            q->requests = req->next;
+            request_free(p, req);
+        }
+        av_free(q);
+    }
+    pthread_cond_destroy(&p->cond);
+    pthread_mutex_destroy(&p->mutex);
+    av_freep(pp);
+}
+
+int ff_prefetch_queue_alloc(FFPrefetch *p, FFPrefetchQueue **qp)
+{
+    FFPrefetchQueue *q = av_mallocz(sizeof(*q));
+    int ret;
+
+    if (!q)
+        return AVERROR(ENOMEM);
+    q->p = p;
+    q->interrupt_callback.callback = prefetch_interrupt_cb;
+    q->interrupt_callback.opaque   = q;
+    if ((ret = pthread_create(&q->thread, NULL, prefetch_thread, q))) {
+        av_free(q);
+        return AVERROR(ret);
+    }
+    q->next   = p->queues;
+    p->queues = q;
+    *qp = q;
+    return 0;
+}
+
+int ff_prefetch_add(FFPrefetchQueue *q, int64_t id, int64_t size,
+                    FFPrefetchOpenFunc open, void *opaque,
+                    void (*free_opaque)(void *opaque))
+{
+    FFPrefetch *p = q->p;
+    PrefetchRequest *req, **r;
+
+    if (!(req = av_mallocz(sizeof(*req)))) {
+        if (free_opaque)
+            free_opaque(opaque);
+        return AVERROR(ENOMEM);
+    }
+    req->id          = id;
+    req->size        = size;
+    req->open        = open;
+    req->opaque      = opaque;
+    req->free_opaque = free_opaque;
+
+    pthread_mutex_lock(&p->mutex);
+    for (r = &q->requests; *r; r = &(*r)->next)
+        ;
+    *r = req;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->mutex);
+    return 0;
+}
+
+int64_t ff_prefetch_last_id(FFPrefetchQueue *q)
+{
+    PrefetchRequest *req;
+    int64_t id = -1;
+
+    pthread_mutex_lock(&q->p->mutex);
+    for (req = q->requests; req; req = req->next)
+        id = req->id;
+    pthread_mutex_unlock(&q->p->mutex);
+    return id;
+}
+
+int ff_prefetch_start(FFPrefetchQueue *q, int64_t id)
+{
+    FFPrefetch *p = q->p;
+    int found;
+
+    pthread_mutex_lock(&p->mutex);
+    while (q->requests && q->requests->id < id) {
+        PrefetchRequest *req = q->requests;
+        q->requests = req->next;
+        request_drop(q, req);
+    }
+    found = q->requests && q->requests->id == id;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->mutex);
+
+    if (!found)
+        ff_prefetch_flush(q);
+    return found;
+}
+
+int ff_prefetch_read(FFPrefetchQueue *q, uint8_t *buf, int size)
+{
+    FFPrefetch *p = q->p;
+    PrefetchRequest *req;
+    int ret = 0;
+
+    pthread_mutex_lock(&p->mutex);
+    if (!(req = q->requests)) {
+        pthread_mutex_unlock(&p->mutex);
+        return AVERROR_EOF;
+    }
+    while (!req->head && !req->error)
+        pthread_cond_wait(&p->cond, &p->mutex);
+
+    while (req->head && ret < size) {
+        PrefetchBlock *block = req->head;
+        int len = FFMIN(block->size - block->pos, size - ret);
+
+        memcpy(buf + ret, block->data + block->pos, len);
+        block->pos += len;
+        ret        += len;
+        if (block->pos == block->size) {
+            if (!(req->head = block->next))
+                req->tail = NULL;
+            p->memory -= sizeof(*block);
+            av_free(block);
+        }
+    }
+    if (!ret)
+        ret = req->error;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->mutex);
+    return ret;
+}
+
+int64_t ff_prefetch_download_time(FFPrefetchQueue *q)
+{
+    int64_t time;
+
+    pthread_mutex_lock(&q->p->mutex);
+    time = q->requests ? q->requests->time : 0;
+    pthread_mutex_unlock(&q->p->mutex);
+    return time;
+}
+
+void ff_prefetch_flush(FFPrefetchQueue *q)
+{
+    FFPrefetch *p = q->p;
+
+    pthread_mutex_lock(&p->mutex);
+    while (q->requests) {
+        PrefetchRequest *req = q->requests;
+        q->requests = req->next;
+        request_drop(q, req);
+    }
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->mutex);
+}
+
+#else
+
+FFPrefetch *ff_prefetch_alloc(void *log_ctx, AVIOInterruptCB *int_cb,
+                              int64_t max_memory)
+{
+    return NULL;
+}
+
+void ff_prefetch_free(FFPrefetch **p)
+{
+}
+
+int ff_prefetch_queue_alloc(FFPrefetch *p, FFPrefetchQueue **q)
+{
+    return AVERROR(ENOSYS);
+}
+
+int ff_prefetch_add(FFPrefetchQueue *q, int64_t id, int64_t size,
+                    FFPrefetchOpenFunc open, void *opaque,
+                    void (*free_opaque)(void *opaque))
+{
+    if (free_opaque)
+        free_opaque(opaque);
+    return AVERROR(ENOSYS);
+}
+
+int64_t ff_prefetch_last_id(FFPrefetchQueue *q)
+{
+    return -1;
+}
+
+int ff_prefetch_start(FFPrefetchQueue *q, int64_t id)
+{
+    return 0;
+}
+
+int ff_prefetch_read(FFPrefetchQueue *q, uint8_t *buf, int size)
+{
+    return AVERROR(ENOSYS);
+}
+
+int64_t ff_prefetch_download_time(FFPrefetchQueue *q)
+{
+    return 0;
+}
+
+void ff_prefetch_flush(FFPrefetchQueue *q)
+{
+}
+
+#endif /* HAVE_THREADS */
@@ -0,0 +1,119 @@
+/*
+ * Background download of the next segments of a stream
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef AVFORMAT_PREFETCH_H
+#define AVFORMAT_PREFETCH_H
+
+#include <stdint.h>
+
+#include "avio.h"
+
+/*
+ * Segmented demuxers (HLS, DASH) read their segments one after another.
+ * A prefetch queue downloads the next segments of one stream into memory
+ * in a background thread while the current one is demuxed, so that the
+ * connection setup and first byte latency of a segment is not paid when
+ * the demuxer reaches it.
+ *
+ * Each queue has its own download thread and downloads its requests in
+ * order. The queues of a FFPrefetch share a memory budget; the request the
+ * reader is waiting for is always allowed to make progress.
+ *
+ * All functions must be called from the demuxer thread.
+ */
+typedef struct FFPrefetch FFPrefetch;
+typedef struct FFPrefetchQueue FFPrefetchQueue;
+
+/**
+ * Open the resource of a prefetch request. Called from the download thread
+ * of the queue, so it must only use data owned by the request.
+ *
+ * @param opaque the opaque pointer given to ff_prefetch_add()
+ * @param int_cb interrupt callback to open the resource with
+ */
+typedef int (*FFPrefetchOpenFunc)(void *opaque, AVIOContext **pb,
+                                  AVIOInterruptCB *int_cb);
+
+/**
+ * @param int_cb     interrupt callback of the demuxer, also checked by the
+ *                   download threads
+ * @param max_memory memory budget for the downloaded data of all queues
+ * @return NULL on error, or if threads are not available
+ */
+FFPrefetch *ff_prefetch_alloc(void *log_ctx, AVIOInterruptCB *int_cb,
+                              int64_t max_memory);
+
+/**
+ * Stop all downloads and free the queues.
+ */
+void ff_prefetch_free(FFPrefetch **p);
+
+/**
+ * Add a queue and start its download thread. The queue is freed with p.
+ */
+int ff_prefetch_queue_alloc(FFPrefetch *p, FFPrefetchQueue **q);
+
+/**
+ * Queue a download.
+ *
+ * @param id          increasing identifier of the request, e.g. the
+ *                    sequence number of the segment
+ * @param size        number of bytes to read, -1 to read until EOF
+ * @param free_opaque called to free opaque once the request is done with
+ * @return 0 or a negative error code, in which case free_opaque was called
+ */
+int ff_prefetch_add(FFPrefetchQueue *q, int64_t id, int64_t size,
+                    FFPrefetchOpenFunc open, void *opaque,
+                    void (*free_opaque)(void *opaque));
+
+/**
+ * @return the id of the last queued request, -1 if there is none
+ */
+int64_t ff_prefetch_last_id(FFPrefetchQueue *q);
+
+/**
+ * Start reading the request with the given id. Requests with a lower id
+ * are dropped. If there is no such request, the queue is flushed.
+ *
+ * @return 1 if the request was found, 0 otherwise
+ */
+int ff_prefetch_start(FFPrefetchQueue *q, int64_t id);
+
+/**
+ * Read data of the request passed to ff_prefetch_start(), waiting for the
+ * download if needed.
+ *
+ * @return the number of bytes read, AVERROR_EOF at the end of the request,
+ *         or the error that stopped its download
+ */
+int ff_prefetch_read(FFPrefetchQueue *q, uint8_t *buf, int size);
+
+/**
+ * @return the time in microseconds the download thread spent on the request
+ *         being read, e.g. to estimate the throughput
+ */
+int64_t ff_prefetch_download_time(FFPrefetchQueue *q);
+
+/**
+ * Drop all requests of the queue.
+ */
+void ff_prefetch_flush(FFPrefetchQueue *q);
+
+#endif /* AVFORMAT_PREFETCH_H */
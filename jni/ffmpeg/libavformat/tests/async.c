@@ -0,0 +1,199 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "libavutil/avstring.h"
+#include "libavutil/thread.h"
+#include "libavutil/time.h"
+#include "libavformat/avformat.h"
+#include "libavformat/url.h"
+
+#include "httpserver.h"
+
+#define FILE_SIZE (8 * 1024 * 1024)
+
+/* each reply starts after LATENCY us, then CHUNK bytes are sent every PACING us */
+#define LATENCY   100000
+#define CHUNK     65536
+#define PACING    10000
+
+#define MAX_REQUESTS 256
+
+/* the start offsets of the requests received, in order */
+static pthread_mutex_t request_lock = PTHREAD_MUTEX_INITIALIZER;
+static int64_t request_starts[MAX_REQUESTS];
+static int nb_requests;
+
+static uint8_t file_byte(int64_t pos)
+{
+    return (uint32_t)(pos * 2654435761U) >> 24;
+}
+
+static int serve_request(int fd, const char *request)
+{
+    const char *range = av_stristr(request, "\r\nRange: bytes=");
+    int64_t start = 0, end = FILE_SIZE - 1, pos;
+    uint8_t buf[CHUNK + 256];
+    int len, ret;
+
+    if (range) {
+        char *p;
+        start = strtoll(range + 15, &p, 10);
+        if (*p == '-' && p[1] >= '0' && p[1] <= '9')
+            end = FFMIN(strtoll(p + 1, NULL, 10), FILE_SIZE - 1);
+    }
+    pthread_mutex_lock(&request_lock);
+    if (nb_requests < MAX_REQUESTS)
+        request_starts[nb_requests++] = start;
+    pthread_mutex_unlock(&request_lock);
+    len = snprintf((char *)buf, sizeof(buf), "HTTP/1.1 %s\r\n"
+                   "Content-Range: bytes %"PRId64"-%"PRId64"/%d\r\n"
+                   "Content-Length: %"PRId64"\r\n\r\n",
+                   range ? "206 Partial Content" : "200 OK",
+                   start, end, FILE_SIZE, end - start + 1);
+    av_usleep(LATENCY);
+    /* the header goes with the first chunk */
+    for (pos = start, ret = 0; pos <= end && !ret; len = 0) {
+        int n = FFMIN(CHUNK, end - pos + 1);
+        while (n--)
+            buf[len++] = file_byte(pos++);
+        ret = http_server_send(fd, buf, len);
+        if (pos <= end)
+            av_usleep(PACING);
+    }
+    return ret;
+}
+
+/*
+ * Seek to pos, read and check size bytes, then leave the demuxer some time
+ * to parse them. Print whether a request was sent for the bytes read when
+ * name is set; the requests refilling the buffers start after them.
+ */
+static int read_at(URLContext *h, int64_t pos, int size, const char *name)
+{
+    int requested = 0, first_request;
+    uint8_t buf[8192];
+    int len = 0, ret, i;
+
+    pthread_mutex_lock(&request_lock);
+    first_request = nb_requests;
+    pthread_mutex_unlock(&request_lock);
+
+    if ((ret = ffurl_seek(h, pos, SEEK_SET)) != pos)
+        return ret < 0 ? ret : AVERROR(EIO);
+    while (len < size) {
+        ret = ffurl_read(h, buf, FFMIN(sizeof(buf), size - len));
+        if (ret < 0)
+            return ret;
+        for (i = 0; i < ret; i++)
+            if (buf[i] != file_byte(pos + len + i)) {
+                fprintf(stderr, "Wrong data at %"PRId64"\n", pos + len + i);
+                return AVERROR_INVALIDDATA;
+            }
+        len += ret;
+    }
+    pthread_mutex_lock(&request_lock);
+    for (i = first_request; i < nb_requests; i++)
+        requested |= request_starts[i] >= pos && request_starts[i] < pos + size;
+    pthread_mutex_unlock(&request_lock);
+    if (name)
+        printf("  %s: %s\n", name, requested ? "requested" : "from memory");
+    av_usleep(20000);
+    return 0;
+}
+
+/*
+ * Open a file the way a demuxer opens an mp4 with the moov atom at the end,
+ * then do an index lookup during playback, like matroska reading its cues.
+ */
+static int play(int port, int ranges, int max_memory)
+{
+    AVDictionary *opts = NULL;
+    URLContext *h = NULL;
+    int64_t playhead = 40000;
+    char url[128];
+    int ret;
+
+    snprintf(url, sizeof(url), "async:http://127.0.0.1:%d/file", port);
+    av_dict_set_int(&opts, "ranges", ranges, 0);
+    av_dict_set_int(&opts, "max_memory", max_memory, 0);
+    ret = ffurl_open_whitelist(&h, url, AVIO_FLAG_READ, NULL, &opts,
+                               NULL, NULL, NULL);
+    av_dict_free(&opts);
+    if (ret < 0) {
+        fprintf(stderr, "Cannot open %s: %s\n", url, av_err2str(ret));
+        return ret;
+    }
+
+    printf("ranges %d, max_memory %d\n", ranges, max_memory);
+    if ((ret = read_at(h, 0, 32768, NULL)) < 0 ||
+        (ret = read_at(h, FILE_SIZE - 100000, 100000, "index at the end")) < 0 ||
+        (ret = read_at(h, playhead, 65536, "back to the data")) < 0)
+        goto end;
+
+    playhead += 65536;
+    if ((ret = read_at(h, playhead, 1024 * 1024, NULL)) < 0)
+        goto end;
+    playhead += 1024 * 1024;
+    /* the background thread reads ahead while the player plays */
+    av_usleep(3 * LATENCY);
+
+    if ((ret = read_at(h, FILE_SIZE - 50000, 16384, "index lookup")) < 0 ||
+        (ret = read_at(h, playhead + 100000, 65536, "back to the playhead")) < 0)
+        goto end;
+
+    /* a short seek forward into a range buffered before the current one */
+    if ((ret = read_at(h, playhead + 5000000, 16384, NULL)) < 0)
+        goto end;
+    av_usleep(3 * LATENCY);
+    if ((ret = read_at(h, playhead + 4800000, 16384, NULL)) < 0 ||
+        (ret = read_at(h, playhead + 5000000, 16384, "short seek ahead")) < 0)
+        goto end;
+
+end:
+    if (ret < 0)
+        fprintf(stderr, "ranges %d: %s\n", ranges, av_err2str(ret));
+    ffurl_closep(&h);
+    return ret;
+}
+
+int main(void)
+{
+    HTTPServer server;
+    int port, ret = 1;
+
+    avformat_network_init();
+
+    if (http_server_start(&server, serve_request, HTTP_SERVER_NODELAY) < 0) {
+        fprintf(stderr, "Cannot set up the server\n");
+        return 1;
+    }
+    port = server.port;
+
+    /* a single range is the old behaviour, dropping the buffer on far seeks */
+    if (play(port, 1, 10 * 1024 * 1024) < 0 ||
+        play(port, 3, 10 * 1024 * 1024) < 0 ||
+        /* the playhead ring evicts the others when the budget is small */
+        play(port, 3, 1024 * 1024) < 0)
+        goto end;
+    ret = 0;
+
+end:
+    http_server_stop(&server);
+    avformat_network_deinit();
+    return ret;
+}
@@ -0,0 +1,263 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "libavutil/avstring.h"
+#include "libavutil/thread.h"
+#include "libavformat/avformat.h"
+#include "libavformat/url.h"
+
+#include "httpserver.h"
+
+#define FILE_SIZE 300000
+
+/*
+ * The server changes the content of the files without changing their ETag
+ * when body_version is bumped, so that the bytes read from the cache can be
+ * told from the ones read from the network.
+ */
+static atomic_int body_version, etag_version;
+static char cache_dir[64];
+
+static uint8_t file_byte(int64_t pos, int version)
+{
+    return ((uint32_t)(pos * 2654435761U) >> 24) + version;
+}
+
+static int serve_request(int fd, const char *request)
+{
+    static const int header_size = 256;
+    const char *range = av_stristr(request, "\r\nRange: bytes=");
+    int64_t start = 0, end = FILE_SIZE - 1, pos;
+    int version = atomic_load(&body_version);
+    uint8_t *buf;
+    int len, ret;
+
+    if (range) {
+        char *p;
+        start = strtoll(range + 15, &p, 10);
+        if (*p == '-' && p[1] >= '0' && p[1] <= '9')
+            end = FFMIN(strtoll(p + 1, NULL, 10), FILE_SIZE - 1);
+    }
+    if (!(buf = av_malloc(header_size + end - start + 1)))
+        return -1;
+    len = snprintf((char *)buf, header_size, "HTTP/1.1 %s\r\n"
+                   "ETag: \"v%d\"\r\n"
+                   "Content-Range: bytes %"PRId64"-%"PRId64"/%d\r\n"
+                   "Content-Length: %"PRId64"\r\n\r\n",
+                   range ? "206 Partial Content" : "200 OK",
+                   atomic_load(&etag_version), start, end, FILE_SIZE,
+                   end - start + 1);
+    /* one send per reply, so that Nagle does not delay the end of it */
+    for (pos = start; pos <= end; pos++)
+        buf[len++] = file_byte(pos, version);
+    ret = http_server_send(fd, buf, len);
+    av_free(buf);
+    return ret;
+}
+
+static int open_cache(URLContext **h, int port, int file, int64_t max_size)
+{
+    AVDictionary *opts = NULL;
+    char url[128];
+    int ret;
+
+    snprintf(url, sizeof(url), "cache:http://127.0.0.1:%d/file%d", port, file);
+    av_dict_set(&opts, "cache_dir", cache_dir, 0);
+    av_dict_set_int(&opts, "cache_max_size", max_size, 0);
+    ret = ffurl_open_whitelist(h, url, AVIO_FLAG_READ, NULL, &opts,
+                               NULL, NULL, NULL);
+    av_dict_free(&opts);
+    if (ret < 0)
+        fprintf(stderr, "Cannot open %s: %s\n", url, av_err2str(ret));
+    return ret;
+}
+
+/*
+ * Read size bytes at pos, and count the ones that were read from the cache,
+ * that is which have the content of an older body version.
+ */
+static int read_range(URLContext *h, int64_t pos, int size, int *from_cache)
+{
+    int version = atomic_load(&body_version);
+    uint8_t buf[8192];
+    int len = 0, ret, i;
+
+    if ((ret = ffurl_seek(h, pos, SEEK_SET)) != pos)
+        return ret < 0 ? ret : AVERROR(EIO);
+    while (len < size) {
+        ret = ffurl_read(h, buf, FFMIN(sizeof(buf), size - len));
+        if (ret < 0)
+            return ret;
+        for (i = 0; i < ret; i++) {
+            int64_t p = pos + len + i;
+            if (buf[i] == file_byte(p, version))
+                continue;
+            if ((uint8_t)(buf[i] - file_byte(p, 0)) >= version) {
+                fprintf(stderr, "Wrong data at %"PRId64"\n", p);
+                return AVERROR_INVALIDDATA;
+            }
+            (*from_cache)++;
+        }
+        len += ret;
+    }
+    return 0;
+}
+
+/* Read [start, end) of a file with a new body version. */
+static int play(int port, int file, int64_t start, int64_t end,
+                int64_t max_size, const char *name)
+{
+    URLContext *h = NULL;
+    int ret, from_cache = 0;
+
+    atomic_fetch_add(&body_version, 1);
+    if ((ret = open_cache(&h, port, file, max_size)) < 0)
+        return ret;
+    ret = read_range(h, start, end - start, &from_cache);
+    ffurl_closep(&h);
+    if (ret < 0)
+        return ret;
+    printf("%s: file%d [%"PRId64", %"PRId64"): %d bytes from the cache\n",
+           name, file, start, end, from_cache);
+    return 0;
+}
+
+/* Two readers of the same file at once, their ranges are merged. */
+static int play_concurrent(int port, int file)
+{
+    URLContext *a = NULL, *b = NULL;
+    int ret, from_cache = 0;
+
+    atomic_fetch_add(&body_version, 1);
+    if ((ret = open_cache(&a, port, file, INT64_MAX)) < 0 ||
+        (ret = open_cache(&b, port, file, INT64_MAX)) < 0 ||
+        (ret = read_range(a, 0, FILE_SIZE / 4, &from_cache)) < 0 ||
+        (ret = read_range(b, FILE_SIZE / 2, FILE_SIZE / 4, &from_cache)) < 0 ||
+        (ret = read_range(a, FILE_SIZE / 8, FILE_SIZE / 4, &from_cache)) < 0)
+        goto end;
+    printf("concurrent: file%d, 2 readers\n", file);
+end:
+    ffurl_closep(&a);
+    ffurl_closep(&b);
+    return ret;
+}
+
+static void remove_cache_dir(void)
+{
+    struct dirent *de;
+    DIR *dir;
+
+    if (!(dir = opendir(cache_dir)))
+        return;
+    while ((de = readdir(dir))) {
+        char path[1024];
+        if (de->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", cache_dir, de->d_name);
+        unlink(path);
+    }
+    closedir(dir);
+    rmdir(cache_dir);
+}
+
+/* Set the validator length of the saved indexes to INT_MIN. */
+static void corrupt_indexes(void)
+{
+    static const uint8_t len[4] = { 0x00, 0x00, 0x00, 0x80 };
+    struct dirent *de;
+    DIR *dir;
+
+    if (!(dir = opendir(cache_dir)))
+        return;
+    while ((de = readdir(dir))) {
+        const char *ext = strrchr(de->d_name, '.');
+        char path[1024];
+        int fd;
+
+        if (!ext || strcmp(ext, ".index"))
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", cache_dir, de->d_name);
+        if ((fd = open(path, O_WRONLY)) < 0)
+            continue;
+        if (lseek(fd, 24, SEEK_SET) != 24 || write(fd, len, sizeof(len)) != sizeof(len))
+            fprintf(stderr, "Cannot corrupt %s\n", path);
+        close(fd);
+    }
+    closedir(dir);
+}
+
+int main(void)
+{
+    HTTPServer server;
+    int port, ret = 1;
+
+    avformat_network_init();
+
+    snprintf(cache_dir, sizeof(cache_dir), "cache-test-%d", (int)getpid());
+    remove_cache_dir();
+
+    if (http_server_start(&server, serve_request, 0) < 0) {
+        fprintf(stderr, "Cannot set up the server\n");
+        return 1;
+    }
+    port = server.port;
+
+    if (play(port, 1, 0, FILE_SIZE / 2, INT64_MAX, "first") < 0 ||
+        /* resume: the watched half comes from the disk */
+        play(port, 1, 0, FILE_SIZE, INT64_MAX, "resume") < 0 ||
+        play(port, 1, FILE_SIZE / 3, FILE_SIZE, INT64_MAX, "again") < 0)
+        goto end;
+
+    /* a corrupt index is ignored */
+    corrupt_indexes();
+    if (play(port, 1, 0, FILE_SIZE, INT64_MAX, "corrupt index") < 0 ||
+        play(port, 1, 0, FILE_SIZE, INT64_MAX, "after corrupt index") < 0)
+        goto end;
+
+    /* a new ETag invalidates the entry */
+    atomic_fetch_add(&etag_version, 1);
+    if (play(port, 1, 0, FILE_SIZE, INT64_MAX, "new etag") < 0 ||
+        play(port, 1, 0, FILE_SIZE, INT64_MAX, "after new etag") < 0)
+        goto end;
+
+    if (play_concurrent(port, 2) < 0 ||
+        play(port, 2, 0, FILE_SIZE, INT64_MAX, "merged") < 0)
+        goto end;
+
+    /* the least recently used files are evicted above the size cap */
+    if (play(port, 3, 0, FILE_SIZE, 2 * FILE_SIZE, "fill") < 0 ||
+        play(port, 4, 0, FILE_SIZE, 2 * FILE_SIZE, "fill") < 0 ||
+        play(port, 3, 0, FILE_SIZE, 2 * FILE_SIZE, "lru") < 0 ||
+        play(port, 4, 0, FILE_SIZE, 2 * FILE_SIZE, "lru") < 0 ||
+        play(port, 1, 0, FILE_SIZE, 2 * FILE_SIZE, "lru") < 0 ||
+        play(port, 2, 0, FILE_SIZE, 2 * FILE_SIZE, "lru") < 0)
+        goto end;
+    ret = 0;
+
+end:
+    remove_cache_dir();
+    http_server_stop(&server);
+    avformat_network_deinit();
+    return ret;
+}
@@ -0,0 +1,405 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <signal.h>
+
+#include "libavutil/avstring.h"
+#include "libavutil/bprint.h"
+#include "libavutil/intreadwrite.h"
+#include "libavutil/md5.h"
+#include "libavutil/thread.h"
+#include "libavutil/time.h"
+#include "libavformat/avformat.h"
+
+#include "httpserver.h"
+
+#define FRAMES         20
+#define FRAME_SIZE     200
+/* duration of a segment in the timescale of the sample rate */
+#define SEGMENT_TIME   (FRAMES * 1024)
+
+/* the synthetic on demand timeline */
+#define BENCH_SEGMENTS 50000
+/* the on demand MPD with two representations, its duration in seconds */
+#define VOD_DURATION   3
+/* first byte latency of its fragments, and time the player spends per frame */
+#define SERVER_DELAY   20000
+#define FRAME_DELAY    500
+/* the live timeline: the window, and the segments played */
+#define LIVE_WINDOW    10
+#define LIVE_SEGMENTS  40
+
+/*
+ * A HTTP/1.1 server serving each connection in its own thread:
+ *   /bench.mpd         a static MPD with one S element per segment
+ *   /live.mpd          a dynamic MPD, its window advancing by one segment
+ *                      on each request
+ *   /seg_<time>.aac    the ADTS segment starting at <time>
+ *   /vod.mpd           a static MPD with the representations a and b in
+ *                      two adaptation sets, using a template with $Number$
+ *   /<a|b>/<n>.ts      the segment <n> of a representation, ADTS in
+ *                      MPEG-TS for timestamps, replied with a first byte
+ *                      latency
+ */
+static int nb_requests;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int live_published;
+
+/*
+ * An ADTS frame, AAC LC, 44100 Hz, stereo. The payload starts with the
+ * segment number, the frame number in it and the representation.
+ */
+static void make_frame(uint8_t *frame, int segment, int index, char rep)
+{
+    frame[0] = 0xff;
+    frame[1] = 0xf1;
+    frame[2] = 0x50;
+    frame[3] = 0x80 | (FRAME_SIZE >> 11);
+    frame[4] = FRAME_SIZE >> 3;
+    frame[5] = (FRAME_SIZE & 7) << 5 | 0x1f;
+    frame[6] = 0xfc;
+    memset(frame + 7, 0, FRAME_SIZE - 7);
+    AV_WB32(frame + 7, segment);
+    frame[11] = index;
+    frame[12] = rep;
+}
+
+/* An MPD with the segments first to end - 1 in its SegmentTimeline. */
+static void make_mpd(AVBPrint *bp, int live, int first, int end)
+{
+    int i;
+
+    av_bprintf(bp, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+               "<MPD xmlns=\"urn:mpeg:dash:schema:mpd:2011\" ");
+    if (live)
+        av_bprintf(bp, "type=\"dynamic\"");
+    else
+        av_bprintf(bp, "type=\"static\" mediaPresentationDuration=\"PT%dS\"",
+                   (int)((int64_t)end * SEGMENT_TIME / 44100 + 1));
+    av_bprintf(bp, " profiles=\"urn:mpeg:dash:profile:isoff-live:2011\">\n"
+               "  <Period id=\"0\" start=\"PT0S\">\n"
+               "    <AdaptationSet contentType=\"audio\" mimeType=\"audio/aac\">\n"
+               "      <SegmentTemplate timescale=\"44100\" media=\"seg_$Time$.aac\">\n"
+               "        <SegmentTimeline>\n");
+    for (i = first; i < end; i++)
+        if (i == first)
+            av_bprintf(bp, "          <S t=\"%"PRId64"\" d=\"%d\"/>\n",
+                       (int64_t)i * SEGMENT_TIME, SEGMENT_TIME);
+        else
+            av_bprintf(bp, "          <S d=\"%d\"/>\n", SEGMENT_TIME);
+    av_bprintf(bp, "        </SegmentTimeline>\n"
+               "      </SegmentTemplate>\n"
+               "      <Representation id=\"a\" bandwidth=\"70000\"/>\n"
+               "    </AdaptationSet>\n"
+               "  </Period>\n"
+               "</MPD>\n");
+}
+
+static void make_vod_mpd(AVBPrint *bp)
+{
+    int i;
+
+    av_bprintf(bp, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+               "<MPD xmlns=\"urn:mpeg:dash:schema:mpd:2011\" type=\"static\" "
+               "mediaPresentationDuration=\"PT%dS\" "
+               "profiles=\"urn:mpeg:dash:profile:isoff-live:2011\">\n"
+               "  <Period id=\"0\" start=\"PT0S\">\n", VOD_DURATION);
+    for (i = 0; i < 2; i++)
+        av_bprintf(bp, "    <AdaptationSet contentType=\"audio\" mimeType=\"audio/aac\">\n"
+                   "      <SegmentTemplate timescale=\"44100\" duration=\"%d\" "
+                   "startNumber=\"1\" media=\"$RepresentationID$/$Number$.ts\"/>\n"
+                   "      <Representation id=\"%c\" bandwidth=\"70000\"/>\n"
+                   "    </AdaptationSet>\n", SEGMENT_TIME, 'a' + i);
+    av_bprintf(bp, "  </Period>\n"
+               "</MPD>\n");
+}
+
+/* The segment n of a representation of the on demand MPD. */
+static int make_ts_segment(AVBPrint *bp, int n, char rep)
+{
+    AVFormatContext *s = NULL;
+    AVDictionary *opts = NULL;
+    AVStream *st;
+    uint8_t frame[FRAME_SIZE], *data;
+    int ret, i, size;
+
+    if ((ret = avformat_alloc_output_context2(&s, NULL, "mpegts", NULL)) < 0)
+        return ret;
+    if (!(st = avformat_new_stream(s, NULL))) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    st->codecpar->codec_type  = AVMEDIA_TYPE_AUDIO;
+    st->codecpar->codec_id    = AV_CODEC_ID_AAC;
+    st->codecpar->sample_rate = 44100;
+    st->codecpar->channels    = 2;
+    st->time_base             = (AVRational){ 1, 44100 };
+    av_dict_set(&opts, "pcr_period", "100", 0);
+    if ((ret = avio_open_dyn_buf(&s->pb)) < 0 ||
+        (ret = avformat_write_header(s, &opts)) < 0)
+        goto fail;
+    for (i = 0; i < FRAMES; i++) {
+        AVPacket pkt;
+
+        av_init_packet(&pkt);
+        make_frame(frame, n, i, rep);
+        pkt.data = frame;
+        pkt.size = FRAME_SIZE;
+        pkt.pts  = pkt.dts = ((int64_t)n * FRAMES + i) * 1024;
+        pkt.duration = 1024;
+        av_packet_rescale_ts(&pkt, (AVRational){ 1, 44100 }, st->time_base);
+        if ((ret = av_write_frame(s, &pkt)) < 0)
+            goto fail;
+    }
+    ret = av_write_trailer(s);
+
+fail:
+    av_dict_free(&opts);
+    if (s->pb) {
+        size = avio_close_dyn_buf(s->pb, &data);
+        if (ret >= 0)
+            av_bprint_append_data(bp, data, size);
+        av_free(data);
+    }
+    avformat_free_context(s);
+    return ret;
+}
+
+static int serve_request(int fd, const char *request)
+{
+    static const char fmt[] = "HTTP/1.1 %s\r\nContent-Length: %d\r\n\r\n";
+    const char *path = request + 4;
+    uint8_t segment[FRAMES * FRAME_SIZE];
+    char header[128];
+    AVBPrint bp, reply;
+    int64_t time;
+    char rep[2];
+    int i, n, ret;
+
+    pthread_mutex_lock(&lock);
+    nb_requests++;
+    pthread_mutex_unlock(&lock);
+
+    av_bprint_init(&bp, 0, AV_BPRINT_SIZE_UNLIMITED);
+    if (sscanf(path, "/seg_%"SCNd64".aac ", &time) == 1 &&
+        time >= 0 && time % SEGMENT_TIME == 0) {
+        for (i = 0; i < FRAMES; i++)
+            make_frame(segment + i * FRAME_SIZE, time / SEGMENT_TIME, i, 0);
+        av_bprint_append_data(&bp, segment, sizeof(segment));
+    } else if (sscanf(path, "/%1[ab]/%d.ts ", rep, &n) == 2 && n > 0) {
+        av_usleep(SERVER_DELAY);
+        if (make_ts_segment(&bp, n, rep[0]) < 0) {
+            av_bprint_finalize(&bp, NULL);
+            return -1;
+        }
+    } else if (av_strstart(path, "/vod.mpd ", NULL)) {
+        make_vod_mpd(&bp);
+    } else if (av_strstart(path, "/bench.mpd ", NULL)) {
+        make_mpd(&bp, 0, 0, BENCH_SEGMENTS);
+    } else if (av_strstart(path, "/live.mpd ", NULL)) {
+        pthread_mutex_lock(&lock);
+        live_published++;
+        make_mpd(&bp, 1, FFMAX(live_published - LIVE_WINDOW, 0), live_published);
+        pthread_mutex_unlock(&lock);
+    } else {
+        snprintf(header, sizeof(header), fmt, "404 Not Found", 0);
+        return http_server_send(fd, header, strlen(header));
+    }
+    if (!av_bprint_is_complete(&bp)) {
+        av_bprint_finalize(&bp, NULL);
+        return -1;
+    }
+
+    /* a single send, not to wait for a delayed ACK of the header */
+    av_bprint_init(&reply, 0, AV_BPRINT_SIZE_UNLIMITED);
+    av_bprintf(&reply, fmt, "200 OK", bp.len);
+    av_bprint_append_data(&reply, bp.str, bp.len);
+    av_bprint_finalize(&bp, NULL);
+    ret = av_bprint_is_complete(&reply) ? http_server_send(fd, reply.str, reply.len) : -1;
+    av_bprint_finalize(&reply, NULL);
+    return ret;
+}
+
+/*
+ * Open the on demand MPD with its 50k entry SegmentTimeline, then seek near
+ * its end: the segment played shows that all the entries were parsed.
+ */
+static int play_bench(int port)
+{
+    AVFormatContext *s = NULL;
+    char url[64];
+    AVPacket pkt;
+    int64_t start = av_gettime_relative(), opened;
+    int ret, first, last;
+
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/bench.mpd", port);
+    ret = avformat_open_input(&s, url, NULL, NULL);
+    if (ret < 0) {
+        fprintf(stderr, "Cannot open %s: %s\n", url, av_err2str(ret));
+        return ret;
+    }
+    opened = av_gettime_relative();
+    if ((ret = av_read_frame(s, &pkt)) < 0)
+        goto fail;
+    first = AV_RB32(pkt.data + 7);
+    av_packet_unref(&pkt);
+
+    ret = av_seek_frame(s, -1, av_rescale(BENCH_SEGMENTS - 1,
+                                          (int64_t)SEGMENT_TIME * AV_TIME_BASE,
+                                          44100), 0);
+    if (ret < 0 || (ret = av_read_frame(s, &pkt)) < 0)
+        goto fail;
+    last = AV_RB32(pkt.data + 7);
+    av_packet_unref(&pkt);
+    avformat_close_input(&s);
+
+    fprintf(stderr, "bench: opened in %"PRId64" ms\n", (opened - start) / 1000);
+    printf("bench: %d entries, first segment %d, last segment %d\n",
+           BENCH_SEGMENTS, first, last);
+    return 0;
+fail:
+    avformat_close_input(&s);
+    fprintf(stderr, "Reading %s failed: %s\n", url, av_err2str(ret));
+    return ret;
+}
+
+/*
+ * Play the on demand MPD, whose two representations are read in turn. The
+ * data and the number of requests must not depend on prefetching.
+ */
+static int play_vod(int port, int prefetch_segments)
+{
+    AVFormatContext *s = NULL;
+    AVDictionary *opts = NULL;
+    struct AVMD5 *md5 = av_md5_alloc();
+    uint8_t digest[16];
+    char url[64], hex[33];
+    AVPacket pkt;
+    int64_t start = av_gettime_relative(), bytes = 0;
+    int ret, i, packets = 0, requests;
+
+    if (!md5)
+        return AVERROR(ENOMEM);
+    av_md5_init(md5);
+    pthread_mutex_lock(&lock);
+    requests = nb_requests;
+    pthread_mutex_unlock(&lock);
+
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/vod.mpd", port);
+    av_dict_set_int(&opts, "prefetch_segments", prefetch_segments, 0);
+    ret = avformat_open_input(&s, url, NULL, &opts);
+    av_dict_free(&opts);
+    if (ret < 0) {
+        fprintf(stderr, "Cannot open %s: %s\n", url, av_err2str(ret));
+        av_free(md5);
+        return ret;
+    }
+    while ((ret = av_read_frame(s, &pkt)) >= 0) {
+        av_md5_update(md5, pkt.data, pkt.size);
+        bytes += pkt.size;
+        packets++;
+        av_packet_unref(&pkt);
+        /* a player consuming the frames in real time would be slower */
+        av_usleep(FRAME_DELAY);
+    }
+    avformat_close_input(&s);
+    av_md5_final(md5, digest);
+    av_free(md5);
+    if (ret != AVERROR_EOF) {
+        fprintf(stderr, "Reading %s failed: %s\n", url, av_err2str(ret));
+        return ret;
+    }
+
+    for (i = 0; i < sizeof(digest); i++)
+        snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+    fprintf(stderr, "vod prefetch_segments %d: %"PRId64" ms\n",
+            prefetch_segments, (av_gettime_relative() - start) / 1000);
+    pthread_mutex_lock(&lock);
+    printf("vod, prefetch_segments %d: %d packets, %"PRId64" bytes, md5 %s, %d requests\n",
+           prefetch_segments, packets, bytes, hex, nb_requests - requests);
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+/*
+ * Play the live MPD, refreshed for each segment: its timeline is merged
+ * into the one known, and the segments must follow each other.
+ */
+static int play_live(int port)
+{
+    AVFormatContext *s = NULL;
+    char url[64];
+    AVPacket pkt;
+    int ret, packets = 0, first = -1, continuous = 1;
+
+    live_published = LIVE_WINDOW / 2 - 1;
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/live.mpd", port);
+    ret = avformat_open_input(&s, url, NULL, NULL);
+    if (ret < 0) {
+        fprintf(stderr, "Cannot open %s: %s\n", url, av_err2str(ret));
+        return ret;
+    }
+    while (packets < LIVE_SEGMENTS * FRAMES && (ret = av_read_frame(s, &pkt)) >= 0) {
+        int n = AV_RB32(pkt.data + 7) * FRAMES + pkt.data[11];
+
+        if (first < 0)
+            first = n;
+        if (n != first + packets)
+            continuous = 0;
+        packets++;
+        av_packet_unref(&pkt);
+    }
+    avformat_close_input(&s);
+    if (ret < 0) {
+        fprintf(stderr, "Reading %s failed: %s\n", url, av_err2str(ret));
+        return ret;
+    }
+
+    printf("live: %d packets from segment %d, %s\n", packets, first / FRAMES,
+           continuous ? "continuous" : "not continuous");
+    return 0;
+}
+
+int main(void)
+{
+    HTTPServer server;
+    int port, ret = 1;
+
+    avformat_network_init();
+#ifdef SIGPIPE
+    /* the client closes connections in the middle of replies */
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    if (http_server_start(&server, serve_request, 0) < 0) {
+        fprintf(stderr, "Cannot set up the server\n");
+        return 1;
+    }
+    port = server.port;
+
+    if (play_bench(port) < 0 ||
+        play_vod(port, 0) < 0 || play_vod(port, 2) < 0 ||
+        play_live(port) < 0)
+        goto end;
+    ret = 0;
+
+end:
+    http_server_stop(&server);
+    avformat_network_deinit();
+    return ret;
+}
@@ -0,0 +1,339 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "libavutil/avstring.h"
+#include "libavutil/thread.h"
+
+/* The protocol is only registered in jni builds, so test it directly. */
+#include "libavformat/downloadhttp.c"
+
+#include "httpserver.h"
+
+#define FILE_SIZE  (1024 * 1024 + 4321)
+#define BLOCK_SIZE 65536
+#define NB_BLOCKS  ((FILE_SIZE + BLOCK_SIZE - 1) / BLOCK_SIZE)
+/* the first reply is cut there, in the middle of a block */
+#define DROP_AT    300000
+
+#define MAX_REQUESTS 16
+
+static pthread_mutex_t request_lock = PTHREAD_MUTEX_INITIALIZER;
+static int64_t request_starts[MAX_REQUESTS];
+static int nb_requests;
+
+static uint8_t file_byte(int64_t pos)
+{
+    return (uint32_t)(pos * 2654435761U) >> 24;
+}
+
+static int serve_request(int fd, const char *request)
+{
+    const char *range = av_stristr(request, "\r\nRange: bytes=");
+    int64_t start = 0, end = FILE_SIZE, pos;
+    uint8_t buf[16384 + 256];
+    int len;
+
+    if (range)
+        start = strtoll(range + 15, NULL, 10);
+    pthread_mutex_lock(&request_lock);
+    if (nb_requests < MAX_REQUESTS)
+        request_starts[nb_requests++] = start;
+    pthread_mutex_unlock(&request_lock);
+    len = snprintf((char *)buf, sizeof(buf), "HTTP/1.1 %s\r\n"
+                   "Content-Range: bytes %"PRId64"-%d/%d\r\n"
+                   "Content-Length: %"PRId64"\r\n\r\n",
+                   range ? "206 Partial Content" : "200 OK",
+                   start, FILE_SIZE - 1, FILE_SIZE, FILE_SIZE - start);
+    if (!start)
+        end = DROP_AT;
+    for (pos = start; pos < end; len = 0) {
+        int n = FFMIN(16384, end - pos);
+        while (n--)
+            buf[len++] = file_byte(pos++);
+        if (http_server_send(fd, buf, len))
+            return -1;
+    }
+    /* the download is interrupted */
+    return end < FILE_SIZE ? -1 : 0;
+}
+
+/*
+ * A download manager standing in for the host wrapper: a thread downloads
+ * the file into a temporary file and sets the bit of each block completely
+ * written. When the download is interrupted, it is resumed from the first
+ * missing block at the position the player waits for.
+ */
+typedef struct Download {
+    char url[64];
+    FILE *file;
+    uint8_t bitmap[(NB_BLOCKS + 7) / 8];
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    int interrupted;
+    int64_t wait_pos;
+    int64_t first_wait;
+    atomic_int stop;
+} Download;
+
+static Download dl;
+
+static int block_done(int block)
+{
+    return dl.bitmap[block >> 3] & (1 << (block & 7));
+}
+
+/* First missing block from block on, wrapping around, -1 if there is none. */
+static int next_missing(int block)
+{
+    int i;
+
+    for (i = 0; i < NB_BLOCKS; i++)
+        if (!block_done((block + i) % NB_BLOCKS))
+            return (block + i) % NB_BLOCKS;
+    return -1;
+}
+
+static int download_interrupt_cb(void *arg)
+{
+    return atomic_load(&dl.stop);
+}
+
+static void download_range(int64_t pos)
+{
+    AVIOInterruptCB int_cb = { download_interrupt_cb, NULL };
+    AVDictionary *opts = NULL;
+    URLContext *h = NULL;
+    uint8_t buf[8192];
+    int ret;
+
+    av_dict_set_int(&opts, "offset", pos, 0);
+    ret = ffurl_open_whitelist(&h, dl.url, AVIO_FLAG_READ, &int_cb, &opts,
+                               NULL, NULL, NULL);
+    av_dict_free(&opts);
+    while (ret >= 0 && pos < FILE_SIZE) {
+        int block;
+
+        if ((ret = ffurl_read(h, buf, sizeof(buf))) <= 0 ||
+            pwrite(fileno(dl.file), buf, ret, pos) != ret)
+            break;
+        pthread_mutex_lock(&dl.lock);
+        for (block = pos / BLOCK_SIZE; block < NB_BLOCKS &&
+             FFMIN((block + 1) * BLOCK_SIZE, FILE_SIZE) <= pos + ret; block++)
+            dl.bitmap[block >> 3] |= 1 << (block & 7);
+        pthread_mutex_unlock(&dl.lock);
+        pos += ret;
+    }
+    ffurl_closep(&h);
+}
+
+static void *download_thread(void *arg)
+{
+    int64_t pos = 0;
+    int block;
+
+    while (1) {
+        download_range(pos);
+
+        pthread_mutex_lock(&dl.lock);
+        if (next_missing(0) < 0 || atomic_load(&dl.stop)) {
+            pthread_mutex_unlock(&dl.lock);
+            break;
+        }
+        if (!dl.interrupted) {
+            /* wait for the player before resuming */
+            dl.interrupted = 1;
+            pthread_cond_broadcast(&dl.cond);
+            while (dl.wait_pos < 0 && !atomic_load(&dl.stop))
+                pthread_cond_wait(&dl.cond, &dl.lock);
+            block = next_missing(dl.wait_pos / BLOCK_SIZE);
+        } else {
+            block = next_missing(0);
+        }
+        pthread_mutex_unlock(&dl.lock);
+        pos = (int64_t)block * BLOCK_SIZE;
+    }
+    return NULL;
+}
+
+int download_http_open(void *context, const char *url, int flags)
+{
+    HTTPContext *s = context;
+
+    av_strlcpy(dl.url, url, sizeof(dl.url));
+    memset(dl.bitmap, 0, sizeof(dl.bitmap));
+    dl.interrupted = 0;
+    dl.wait_pos = dl.first_wait = -1;
+    atomic_store(&dl.stop, 0);
+    if (!(s->file = dl.file = tmpfile()))
+        return AVERROR(errno);
+    if (pthread_create(&dl.thread, NULL, download_thread, NULL)) {
+        fclose(dl.file);
+        return AVERROR(ENOMEM);
+    }
+    return 0;
+}
+
+int download_http_close(void *context)
+{
+    pthread_mutex_lock(&dl.lock);
+    atomic_store(&dl.stop, 1);
+    pthread_cond_broadcast(&dl.cond);
+    pthread_mutex_unlock(&dl.lock);
+    pthread_join(dl.thread, NULL);
+    return fclose(dl.file);
+}
+
+int download_http_get_ranges(void *context, const uint8_t **bitmap,
+                             pthread_mutex_t **lock, int *block_size,
+                             int64_t *total_size)
+{
+    *bitmap     = dl.bitmap;
+    *lock       = &dl.lock;
+    *block_size = BLOCK_SIZE;
+    *total_size = FILE_SIZE;
+    return 0;
+}
+
+void download_http_wait(void *context, int64_t pos, int waiting)
+{
+    pthread_mutex_lock(&dl.lock);
+    if (waiting) {
+        if (dl.first_wait < 0)
+            dl.first_wait = pos;
+        dl.wait_pos = pos;
+        pthread_cond_broadcast(&dl.cond);
+    }
+    pthread_mutex_unlock(&dl.lock);
+}
+
+static int open_download(URLContext **hp, const char *url)
+{
+    URLContext *h = av_mallocz(sizeof(*h));
+    int ret;
+
+    if (!h || !(h->priv_data = av_mallocz(ff_download_http_protocol.priv_data_size))) {
+        av_free(h);
+        return AVERROR(ENOMEM);
+    }
+    h->prot     = &ff_download_http_protocol;
+    h->filename = (char *)url;
+    h->flags    = AVIO_FLAG_READ;
+    *hp = h;
+    if ((ret = ff_download_http_protocol.url_open2(h, url, h->flags, NULL)) < 0)
+        return ret;
+    h->is_connected = 1;
+    return 0;
+}
+
+/* Read from pos to the end of the file and check the bytes. */
+static int read_from(URLContext *h, int64_t pos)
+{
+    uint8_t buf[10000];
+    int ret, i;
+
+    if (ffurl_seek(h, pos, SEEK_SET) != pos)
+        return AVERROR(EIO);
+    while ((ret = ffurl_read(h, buf, sizeof(buf))) > 0) {
+        for (i = 0; i < ret; i++)
+            if (buf[i] != file_byte(pos + i)) {
+                fprintf(stderr, "Wrong data at %"PRId64"\n", pos + i);
+                return AVERROR_INVALIDDATA;
+            }
+        pos += ret;
+    }
+    if (ret != AVERROR_EOF || pos != FILE_SIZE) {
+        fprintf(stderr, "Read stopped at %"PRId64": %s\n", pos, av_err2str(ret));
+        return ret < 0 ? ret : AVERROR(EIO);
+    }
+    return 0;
+}
+
+/* Play from pos once the download is interrupted, then from the start. */
+static int play(int port, int64_t pos)
+{
+    URLContext *h = NULL;
+    char url[64];
+    int ret, i, nb_done = 0;
+
+    pthread_mutex_lock(&request_lock);
+    nb_requests = 0;
+    pthread_mutex_unlock(&request_lock);
+    snprintf(url, sizeof(url), "downloadhttp://127.0.0.1:%d/file", port);
+    if ((ret = open_download(&h, url)) < 0) {
+        fprintf(stderr, "Cannot open %s: %s\n", url, av_err2str(ret));
+        ffurl_closep(&h);
+        return ret;
+    }
+
+    pthread_mutex_lock(&dl.lock);
+    while (!dl.interrupted)
+        pthread_cond_wait(&dl.cond, &dl.lock);
+    for (i = 0; i < NB_BLOCKS; i++)
+        nb_done += !!block_done(i);
+    pthread_mutex_unlock(&dl.lock);
+
+    if ((ret = read_from(h, pos)) >= 0)
+        ret = read_from(h, 0);
+    ffurl_closep(&h);
+    if (ret < 0)
+        return ret;
+
+    printf("play from %"PRId64": %d of %d blocks before the resume, "
+           "first wait at %"PRId64", requests at",
+           pos, nb_done, NB_BLOCKS, dl.first_wait);
+    pthread_mutex_lock(&request_lock);
+    for (i = 0; i < nb_requests; i++)
+        printf(" %"PRId64, request_starts[i]);
+    pthread_mutex_unlock(&request_lock);
+    printf("\n");
+    return 0;
+}
+
+int main(void)
+{
+    HTTPServer server;
+    int ret = 1;
+
+    avformat_network_init();
+    pthread_mutex_init(&dl.lock, NULL);
+    pthread_cond_init(&dl.cond, NULL);
+
+    if (http_server_start(&server, serve_request, 0) < 0) {
+        fprintf(stderr, "Cannot set up the server\n");
+        return 1;
+    }
+
+    /* the partly written block after the cut is not read */
+    if (play(server.port, 0) < 0 ||
+        /* the range the player waits for is downloaded first */
+        play(server.port, 900000) < 0)
+        goto end;
+    ret = 0;
+
+end:
+    http_server_stop(&server);
+    pthread_cond_destroy(&dl.cond);
+    pthread_mutex_destroy(&dl.lock);
+    avformat_network_deinit();
+    return ret;
+}
@@ -0,0 +1,468 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <signal.h>
+
+#include "libavutil/aes.h"
+#include "libavutil/avstring.h"
+#include "libavutil/md5.h"
+#include "libavutil/thread.h"
+#include "libavutil/time.h"
+#include "libavformat/avformat.h"
+
+#include "httpserver.h"
+
+#define NB_SEGMENTS    6
+#define FRAMES         20
+#define FRAME_SIZE     200
+#define SEGMENT_SIZE   (FRAMES * FRAME_SIZE)
+/* first byte latency of the server, and time the player spends per frame */
+#define SERVER_DELAY   20000
+#define FRAME_DELAY    1000
+
+/* the variants of the ABR playlist, about 70 and 700 kbit/s */
+#define ABR_SEGMENTS   30
+static const int abr_frame_size[] = { 200, 2000 };
+
+/* the live playlist, a window over the segments of ABR variant 0 */
+#define LIVE_SEGMENTS  12
+#define LIVE_WINDOW    4
+
+/*
+ * A HTTP/1.1 server with a first byte latency, serving each connection in
+ * its own thread:
+ *   /plain.m3u8, /seg<n>.aac   one ADTS file per segment
+ *   /range.m3u8, /all.aac      the segments as byte ranges of one file
+ *   /aes.m3u8, /enc<n>.aac     AES-128 encrypted segments, key /key.bin
+ *   /abr.m3u8, /v<k>.m3u8      two variants with segments /v<k>_<n>.aac
+ *   /live.m3u8                 a live playlist supporting blocking reloads
+ *                              and delta updates
+ * When a throughput trace is set, replies are paced by it instead.
+ */
+static int nb_requests;
+/* segments published in the live playlist, and the kinds of its requests */
+static int live_published, live_full, live_delta, live_blocking;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * A throughput trace, as rates in bit/s and the time they last, the last one
+ * lasting until the end. The trace is replayed in link time, i.e. it only
+ * advances while the server sends, so the result does not depend on the
+ * speed of the client or of the machine.
+ */
+typedef struct TracePoint {
+    int64_t duration;
+    int rate;
+} TracePoint;
+
+static const TracePoint *trace;
+static int64_t link_time;
+
+static uint8_t media[NB_SEGMENTS * SEGMENT_SIZE];
+static uint8_t encrypted[NB_SEGMENTS][SEGMENT_SIZE + 16];
+static const uint8_t key[16] = "0123456789abcdef";
+static const uint8_t iv[16]  = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+
+/* An ADTS frame, AAC LC, 44100 Hz, stereo. The payload is the frame number. */
+static void make_frame(uint8_t *frame, int size, int index)
+{
+    frame[0] = 0xff;
+    frame[1] = 0xf1;
+    frame[2] = 0x50;
+    frame[3] = 0x80 | (size >> 11);
+    frame[4] = size >> 3;
+    frame[5] = (size & 7) << 5 | 0x1f;
+    frame[6] = 0xfc;
+    memset(frame + 7, index, size - 7);
+}
+
+static void make_media(void)
+{
+    struct AVAES *aes = av_aes_alloc();
+    uint8_t padded[SEGMENT_SIZE + 16];
+    int i;
+
+    for (i = 0; i < NB_SEGMENTS * FRAMES; i++)
+        make_frame(media + i * FRAME_SIZE, FRAME_SIZE, i);
+
+    av_aes_init(aes, key, 128, 0);
+    for (i = 0; i < NB_SEGMENTS; i++) {
+        uint8_t tmp_iv[16];
+
+        memcpy(padded, media + i * SEGMENT_SIZE, SEGMENT_SIZE);
+        memset(padded + SEGMENT_SIZE, 16, 16);
+        memcpy(tmp_iv, iv, 16);
+        av_aes_crypt(aes, encrypted[i], padded, sizeof(padded) / 16, tmp_iv, 0);
+    }
+    av_free(aes);
+}
+
+/* name is the name of the playlist, or the number of an ABR variant */
+static int make_playlist(char *buf, int size, const char *name, int variant)
+{
+    int len, i, nb_segments = name ? NB_SEGMENTS : ABR_SEGMENTS;
+
+    if (name && !strcmp(name, "abr")) {
+        len = snprintf(buf, size, "#EXTM3U\n");
+        for (i = 0; i < FF_ARRAY_ELEMS(abr_frame_size); i++)
+            len += snprintf(buf + len, size - len,
+                            "#EXT-X-STREAM-INF:BANDWIDTH=%d\nv%d.m3u8\n",
+                            abr_frame_size[i] * 8 * 44100 / 1024, i);
+        return len;
+    }
+
+    len = snprintf(buf, size, "#EXTM3U\n#EXT-X-VERSION:4\n"
+                   "#EXT-X-TARGETDURATION:1\n#EXT-X-MEDIA-SEQUENCE:0\n");
+    if (name && !strcmp(name, "aes"))
+        len += snprintf(buf + len, size - len, "#EXT-X-KEY:METHOD=AES-128,"
+                        "URI=\"key.bin\",IV=0x000102030405060708090a0b0c0d0e0f\n");
+    for (i = 0; i < nb_segments; i++) {
+        len += snprintf(buf + len, size - len, "#EXTINF:%f,\n",
+                        FRAMES * 1024 / 44100.0);
+        if (!name)
+            len += snprintf(buf + len, size - len, "v%d_%d.aac\n", variant, i);
+        else if (!strcmp(name, "range"))
+            len += snprintf(buf + len, size - len,
+                            "#EXT-X-BYTERANGE:%d@%d\nall.aac\n",
+                            SEGMENT_SIZE, i * SEGMENT_SIZE);
+        else
+            len += snprintf(buf + len, size - len, "%s%d.aac\n",
+                            strcmp(name, "aes") ? "seg" : "enc", i);
+    }
+    len += snprintf(buf + len, size - len, "#EXT-X-ENDLIST\n");
+    return len;
+}
+
+/*
+ * The live playlist, with the segments older than the last two skipped in
+ * delta updates. The server control tag advertises the minimum skip
+ * boundary of six target durations.
+ */
+static int make_live_playlist(char *buf, int size, int skip)
+{
+    int i = live_published - LIVE_WINDOW, len;
+
+    len = snprintf(buf, size, "#EXTM3U\n#EXT-X-VERSION:9\n#EXT-X-TARGETDURATION:1\n"
+                   "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,CAN-SKIP-UNTIL=6.0\n"
+                   "#EXT-X-MEDIA-SEQUENCE:%d\n", i);
+    if (skip) {
+        len += snprintf(buf + len, size - len, "#EXT-X-SKIP:SKIPPED-SEGMENTS=%d\n",
+                        LIVE_WINDOW - 2);
+        i += LIVE_WINDOW - 2;
+    }
+    for (; i < live_published; i++)
+        len += snprintf(buf + len, size - len, "#EXTINF:%f,\nv0_%d.aac\n",
+                        FRAMES * 1024 / 44100.0, i);
+    if (live_published == LIVE_SEGMENTS)
+        len += snprintf(buf + len, size - len, "#EXT-X-ENDLIST\n");
+    return len;
+}
+
+/* Send at the rate of the trace, in packets of at most 1000 bytes. */
+static int send_paced(int fd, const char *buf, int size)
+{
+    while (size > 0) {
+        int len = FFMIN(size, 1000), i;
+        int64_t t, delay;
+
+        pthread_mutex_lock(&lock);
+        for (i = 0, t = link_time; trace[i].duration && t >= trace[i].duration; i++)
+            t -= trace[i].duration;
+        delay = len * 8 * 1000000LL / trace[i].rate;
+        link_time += delay;
+        pthread_mutex_unlock(&lock);
+
+        av_usleep(delay);
+        if (http_server_send(fd, buf, len))
+            return -1;
+        buf  += len;
+        size -= len;
+    }
+    return 0;
+}
+
+static int serve_request(int fd, const char *request)
+{
+    static const char fmt[] = "HTTP/1.1 %s\r\nContent-Length: %d\r\n%s\r\n";
+    char reply[sizeof(media) + 256], playlist[2048], range[128] = "";
+    uint8_t segment[FRAMES * 2000];
+    const char *path = request + 4, *data, *r;
+    int64_t start = 0, end = -1;
+    int size, n, k, len;
+
+    pthread_mutex_lock(&lock);
+    nb_requests++;
+    pthread_mutex_unlock(&lock);
+    if (!trace)
+        av_usleep(SERVER_DELAY);
+
+    if (sscanf(path, "/v%d_%d.aac ", &k, &n) == 2 && k >= 0 &&
+        k < FF_ARRAY_ELEMS(abr_frame_size) && n >= 0 && n < ABR_SEGMENTS) {
+        for (size = 0; size < FRAMES * abr_frame_size[k]; size += abr_frame_size[k])
+            make_frame(segment + size, abr_frame_size[k],
+                       n * FRAMES + size / abr_frame_size[k]);
+        data = segment;
+    } else if (av_strstart(path, "/live.m3u8", &r)) {
+        /* a blocking reload is held until the segment is published, which
+         * happens right away here */
+        int msn = -1, skip = (data = strstr(r, "_HLS_skip=YES")) &&
+                             data < strchr(r, ' ');
+
+        sscanf(r, "?_HLS_msn=%d", &msn);
+        pthread_mutex_lock(&lock);
+        if (msn >= 0) {
+            live_blocking++;
+            live_published = av_clip(msn + 1, live_published, LIVE_SEGMENTS);
+        }
+        if (skip)
+            live_delta++;
+        else
+            live_full++;
+        size = make_live_playlist(playlist, sizeof(playlist), skip);
+        pthread_mutex_unlock(&lock);
+        data = playlist;
+    } else if (sscanf(path, "/v%d.m3u8 ", &k) == 1) {
+        size = make_playlist(playlist, sizeof(playlist), NULL, k);
+        data = playlist;
+    } else if (sscanf(path, "/seg%d.aac ", &n) == 1 && n >= 0 && n < NB_SEGMENTS) {
+        data = media + n * SEGMENT_SIZE;
+        size = SEGMENT_SIZE;
+    } else if (sscanf(path, "/enc%d.aac ", &n) == 1 && n >= 0 && n < NB_SEGMENTS) {
+        data = encrypted[n];
+        size = sizeof(encrypted[n]);
+    } else if (av_strstart(path, "/all.aac ", NULL)) {
+        data = media;
+        size = sizeof(media);
+    } else if (av_strstart(path, "/key.bin ", NULL)) {
+        data = key;
+        size = sizeof(key);
+    } else if (sscanf(path, "/%15[a-z].m3u8 ", range) == 1) {
+        size = make_playlist(playlist, sizeof(playlist), range, 0);
+        data = playlist;
+        range[0] = '\0';
+    } else {
+        len = snprintf(reply, sizeof(reply), fmt, "404 Not Found", 0, "");
+        return http_server_send(fd, reply, len);
+    }
+
+    if ((r = av_stristr(request, "\r\nRange: bytes=")) &&
+        sscanf(r + 15, "%"SCNd64"-%"SCNd64, &start, &end) >= 1) {
+        if (end < 0 || end >= size)
+            end = size - 1;
+        snprintf(range, sizeof(range), "Content-Range: bytes %"PRId64"-%"PRId64"/%d\r\n",
+                 start, end, size);
+        data += start;
+        size  = end - start + 1;
+    }
+    /* one send per reply, so that Nagle does not delay the end of it */
+    len = snprintf(reply, sizeof(reply), fmt, range[0] ? "206 Partial Content" : "200 OK",
+                   size, range);
+    if (trace)
+        return http_server_send(fd, reply, len) || send_paced(fd, data, size) ? -1 : 0;
+    memcpy(reply + len, data, size);
+    return http_server_send(fd, reply, len + size);
+}
+
+static int play(int port, const char *name, int prefetch_segments)
+{
+    AVFormatContext *s = NULL;
+    AVDictionary *opts = NULL;
+    struct AVMD5 *md5 = av_md5_alloc();
+    uint8_t digest[16];
+    char url[64], hex[33];
+    AVPacket pkt;
+    int64_t start = av_gettime_relative(), bytes = 0;
+    int ret, i, packets = 0, requests = nb_requests;
+
+    if (!md5)
+        return AVERROR(ENOMEM);
+    av_md5_init(md5);
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/%s.m3u8", port, name);
+    av_dict_set_int(&opts, "prefetch_segments", prefetch_segments, 0);
+    ret = avformat_open_input(&s, url, NULL, &opts);
+    av_dict_free(&opts);
+    if (ret < 0) {
+        fprintf(stderr, "Cannot open %s: %s\n", url, av_err2str(ret));
+        av_free(md5);
+        return ret;
+    }
+    while ((ret = av_read_frame(s, &pkt)) >= 0) {
+        av_md5_update(md5, pkt.data, pkt.size);
+        bytes += pkt.size;
+        packets++;
+        av_packet_unref(&pkt);
+        /* a player consuming the frames in real time would be slower */
+        av_usleep(FRAME_DELAY);
+    }
+    avformat_close_input(&s);
+    av_md5_final(md5, digest);
+    av_free(md5);
+    if (ret != AVERROR_EOF) {
+        fprintf(stderr, "Reading %s failed: %s\n", url, av_err2str(ret));
+        return ret;
+    }
+
+    for (i = 0; i < sizeof(digest); i++)
+        snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+    fprintf(stderr, "%-5s prefetch_segments %d: %"PRId64" ms\n", name,
+            prefetch_segments, (av_gettime_relative() - start) / 1000);
+    pthread_mutex_lock(&lock);
+    printf("%s, prefetch_segments %d: %d packets, %"PRId64" bytes, md5 %s, %d requests\n",
+           name, prefetch_segments, packets, bytes, hex, nb_requests - requests);
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+/*
+ * Play the ABR playlist with a throughput trace: 8 Mbit/s, then 160 kbit/s,
+ * then 8 Mbit/s again. The variant of each packet is known from its size.
+ */
+static int play_abr(int port)
+{
+    static const TracePoint abr_trace[] = {
+        {  150000, 8000000 },
+        { 1000000,  160000 },
+        {       0, 8000000 },
+    };
+    AVFormatContext *s = NULL;
+    AVDictionary *opts = NULL;
+    char url[64], variants[64] = "";
+    AVPacket pkt;
+    int64_t start = av_gettime_relative();
+    int ret, variant = -1, packets = 0, continuous = 1, streams = 0;
+
+    trace     = abr_trace;
+    link_time = 0;
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/abr.m3u8", port);
+    av_dict_set(&opts, "abr", "1", 0);
+    av_dict_set(&opts, "abr_min_buffer", "0.5", 0);
+    /* concurrent downloads would share the link */
+    av_dict_set(&opts, "prefetch_segments", "0", 0);
+    av_dict_set(&opts, "http_multiple", "0", 0);
+    ret = avformat_open_input(&s, url, NULL, &opts);
+    av_dict_free(&opts);
+    if (ret < 0) {
+        fprintf(stderr, "Cannot open %s: %s\n", url, av_err2str(ret));
+        return ret;
+    }
+    while ((ret = av_read_frame(s, &pkt)) >= 0) {
+        int i;
+
+        for (i = 0; i < FF_ARRAY_ELEMS(abr_frame_size); i++)
+            if (pkt.size == abr_frame_size[i] && i != variant) {
+                variant = i;
+                av_strlcatf(variants, sizeof(variants), " %d", i);
+            }
+        if (pkt.size < 8 || pkt.data[7] != (packets & 0xff))
+            continuous = 0;
+        streams |= 1 << pkt.stream_index;
+        packets++;
+        av_packet_unref(&pkt);
+    }
+    avformat_close_input(&s);
+    trace = NULL;
+    if (ret != AVERROR_EOF) {
+        fprintf(stderr, "Reading %s failed: %s\n", url, av_err2str(ret));
+        return ret;
+    }
+
+    fprintf(stderr, "abr: %"PRId64" ms\n", (av_gettime_relative() - start) / 1000);
+    printf("abr: %d packets, %s, streams 0x%x, variants%s\n", packets,
+           continuous ? "continuous" : "not continuous", streams, variants);
+    return 0;
+}
+
+/*
+ * Play the live playlist from its start point, three segments from the end.
+ * The player reloads it only once its segments are exhausted, with blocking
+ * delta updates.
+ */
+static int play_live(int port)
+{
+    AVFormatContext *s = NULL;
+    char url[64];
+    AVPacket pkt;
+    int ret, packets = 0, first = -1, continuous = 1;
+
+    live_published = LIVE_WINDOW;
+    live_full = live_delta = live_blocking = 0;
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/live.m3u8", port);
+    ret = avformat_open_input(&s, url, NULL, NULL);
+    if (ret < 0) {
+        fprintf(stderr, "Cannot open %s: %s\n", url, av_err2str(ret));
+        return ret;
+    }
+    while ((ret = av_read_frame(s, &pkt)) >= 0) {
+        if (first < 0 && pkt.size >= 8)
+            first = pkt.data[7];
+        if (pkt.size < 8 || pkt.data[7] != ((first + packets) & 0xff))
+            continuous = 0;
+        packets++;
+        av_packet_unref(&pkt);
+    }
+    avformat_close_input(&s);
+    if (ret != AVERROR_EOF) {
+        fprintf(stderr, "Reading %s failed: %s\n", url, av_err2str(ret));
+        return ret;
+    }
+
+    pthread_mutex_lock(&lock);
+    printf("live: %d packets from segment %d, %s, %d full, %d delta, %d blocking reloads\n",
+           packets, first / FRAMES, continuous ? "continuous" : "not continuous",
+           live_full, live_delta, live_blocking);
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+int main(void)
+{
+    static const char *const names[] = { "plain", "range", "aes" };
+    HTTPServer server;
+    int port, i, ret = 1;
+
+    make_media();
+    avformat_network_init();
+#ifdef SIGPIPE
+    /* the client closes connections in the middle of replies */
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    /* paced replies are sent in small packets */
+    if (http_server_start(&server, serve_request, HTTP_SERVER_NODELAY) < 0) {
+        fprintf(stderr, "Cannot set up the server\n");
+        return 1;
+    }
+    port = server.port;
+
+    /* the prefetched segments are the same, each fetched once; with
+     * prefetching the key is fetched once more by the download thread */
+    for (i = 0; i < FF_ARRAY_ELEMS(names); i++)
+        if (play(port, names[i], 0) < 0 ||
+            play(port, names[i], 2) < 0)
+            goto end;
+    if (play_abr(port) < 0)
+        goto end;
+    if (play_live(port) < 0)
+        goto end;
+    ret = 0;
+
+end:
+    http_server_stop(&server);
+    avformat_network_deinit();
+    return ret;
+}
@@ -0,0 +1,142 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "libavutil/avstring.h"
+#include "libavutil/thread.h"
+#include "libavutil/time.h"
+#include "libavformat/avformat.h"
+#include "libavformat/url.h"
+
+#include "httpserver.h"
+
+#define SEGMENT_SIZE 20000
+#define NB_SEGMENTS  8
+
+/*
+ * A minimal persistent HTTP/1.1 server, serving one connection at a time.
+ * Paths containing "chunked" are sent with chunked encoding, paths
+ * containing "drop" are answered and then the connection is closed without
+ * a "Connection: close" header, like a server whose idle timeout expired.
+ */
+static HTTPServer server;
+
+static void fill_segment(char *buf)
+{
+    int i;
+
+    for (i = 0; i < SEGMENT_SIZE; i++)
+        buf[i] = 'a' + i % 26;
+}
+
+static int serve_request(int fd, const char *request)
+{
+    static char reply[SEGMENT_SIZE + 128];
+    int len;
+
+    /* one send per reply, so that Nagle does not delay the end of it */
+    if (strstr(request, "chunked")) {
+        len = snprintf(reply, sizeof(reply), "HTTP/1.1 200 OK\r\n"
+                       "Transfer-Encoding: chunked\r\n\r\n%x\r\n", SEGMENT_SIZE);
+        fill_segment(reply + len);
+        len += SEGMENT_SIZE;
+        len += snprintf(reply + len, sizeof(reply) - len, "\r\n0\r\n\r\n");
+    } else {
+        len = snprintf(reply, sizeof(reply), "HTTP/1.1 200 OK\r\n"
+                       "Content-Length: %d\r\n\r\n", SEGMENT_SIZE);
+        fill_segment(reply + len);
+        len += SEGMENT_SIZE;
+    }
+    if (http_server_send(fd, reply, len))
+        return -1;
+    return strstr(request, "drop") || av_stristr(request, "Connection: close") ? -1 : 0;
+}
+
+/* Read size bytes of the segment, or all of it if size is 0. */
+static int fetch(int port, const char *path, int idle_timeout, int size)
+{
+    char expected[SEGMENT_SIZE];
+    uint8_t buf[SEGMENT_SIZE + 1];
+    AVDictionary *opts = NULL;
+    URLContext *h = NULL;
+    char url[64];
+    int ret, len = 0, max_size = size ? size : sizeof(buf);
+
+    fill_segment(expected);
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/%s", port, path);
+    av_dict_set_int(&opts, "idle_timeout", idle_timeout, 0);
+    ret = ffurl_open_whitelist(&h, url, AVIO_FLAG_READ, NULL, &opts,
+                               NULL, NULL, NULL);
+    av_dict_free(&opts);
+    if (ret < 0) {
+        fprintf(stderr, "Cannot open %s: %s\n", url, av_err2str(ret));
+        return ret;
+    }
+    while (len < max_size && (ret = ffurl_read(h, buf + len, max_size - len)) > 0)
+        len += ret;
+    ffurl_closep(&h);
+    if (len != (size ? size : SEGMENT_SIZE) || memcmp(buf, expected, len)) {
+        fprintf(stderr, "Wrong data for %s\n", url);
+        return AVERROR_INVALIDDATA;
+    }
+    return 0;
+}
+
+static int fetch_segments(int port, const char *path, int idle_timeout,
+                          int size)
+{
+    int64_t start = av_gettime_relative();
+    int i, ret, accepts = server.nb_accepts;
+
+    for (i = 0; i < NB_SEGMENTS; i++)
+        if ((ret = fetch(port, path, idle_timeout, size)) < 0)
+            return ret;
+    fprintf(stderr, "%-12s idle_timeout %2d: %"PRId64" us per segment\n",
+            path, idle_timeout, (av_gettime_relative() - start) / NB_SEGMENTS);
+    printf("%s, idle_timeout %d: %d connections for %d segments\n",
+           path, idle_timeout, server.nb_accepts - accepts, NB_SEGMENTS);
+    return 0;
+}
+
+int main(void)
+{
+    int port, ret = 1;
+
+    avformat_network_init();
+
+    if (http_server_start(&server, serve_request, HTTP_SERVER_SERIAL) < 0) {
+        fprintf(stderr, "Cannot set up the server\n");
+        return 1;
+    }
+    port = server.port;
+
+    /* the requests are serialized, so nb_accepts is stable between them */
+    if (fetch_segments(port, "segment", 0, 0) < 0 ||
+        fetch_segments(port, "segment", 30, 0) < 0 ||
+        fetch_segments(port, "chunked", 30, 0) < 0 ||
+        /* the server closes the pooled connections */
+        fetch_segments(port, "drop", 30, 0) < 0 ||
+        /* a partially read reply is not reusable */
+        fetch_segments(port, "partial", 30, SEGMENT_SIZE / 2) < 0)
+        goto end;
+    ret = 0;
+
+end:
+    http_server_stop(&server);
+    avformat_network_deinit();
+    return ret;
+}
@@ -0,0 +1,171 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * A minimal persistent HTTP/1.1 server on the loopback interface, for the
+ * tests of the network protocols and demuxers. The requests of a connection
+ * are read in turn and passed to the handler of the test, which sends the
+ * reply; the connection is closed when the handler returns < 0.
+ */
+
+#ifndef AVFORMAT_TESTS_HTTPSERVER_H
+#define AVFORMAT_TESTS_HTTPSERVER_H
+
+#include <stdint.h>
+
+#include "libavutil/mem.h"
+#include "libavutil/thread.h"
+#include "libavformat/network.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/* serve one connection at a time, from the thread accepting them */
+#define HTTP_SERVER_SERIAL  1
+/* disable Nagle, for replies sent in several pieces */
+#define HTTP_SERVER_NODELAY 2
+
+typedef struct HTTPServer {
+    int (*handler)(int fd, const char *request);
+    int flags;
+    int fd;
+    int port;
+    /* connections accepted so far */
+    int nb_accepts;
+    pthread_t thread;
+} HTTPServer;
+
+typedef struct HTTPServerConnection {
+    HTTPServer *server;
+    int fd;
+} HTTPServerConnection;
+
+static int http_server_send(int fd, const void *buf, int size)
+{
+    const uint8_t *p = buf;
+
+    while (size > 0) {
+        /* the clients drop connections in the middle of replies */
+        int ret = send(fd, p, size, MSG_NOSIGNAL);
+        if (ret <= 0)
+            return -1;
+        p    += ret;
+        size -= ret;
+    }
+    return 0;
+}
+
+static void http_server_serve(HTTPServer *server, int fd)
+{
+    char request[4096];
+    int len = 0, ret;
+
+    while ((ret = recv(fd, request + len, sizeof(request) - 1 - len, 0)) > 0) {
+        char *end;
+
+        len += ret;
+        request[len] = '\0';
+        if (!(end = strstr(request, "\r\n\r\n")))
+            continue;
+        end += 4;
+        if (server->handler(fd, request) < 0)
+            break;
+        len -= end - request;
+        memmove(request, end, len + 1);
+    }
+    closesocket(fd);
+}
+
+static void *http_server_connection_thread(void *arg)
+{
+    HTTPServerConnection *conn = arg;
+
+    http_server_serve(conn->server, conn->fd);
+    av_free(conn);
+    return NULL;
+}
+
+static void *http_server_thread(void *arg)
+{
+    HTTPServer *server = arg;
+    int fd;
+
+    while ((fd = accept(server->fd, NULL, NULL)) >= 0) {
+        HTTPServerConnection *conn;
+        pthread_t thread;
+        int one = 1;
+
+        server->nb_accepts++;
+        if (server->flags & HTTP_SERVER_NODELAY)
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (server->flags & HTTP_SERVER_SERIAL) {
+            http_server_serve(server, fd);
+            continue;
+        }
+        if (!(conn = av_malloc(sizeof(*conn)))) {
+            closesocket(fd);
+            continue;
+        }
+        conn->server = server;
+        conn->fd     = fd;
+        if (pthread_create(&thread, NULL, http_server_connection_thread, conn)) {
+            av_free(conn);
+            closesocket(fd);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+/* Listen on a free port of the loopback interface, stored in server->port. */
+static int http_server_start(HTTPServer *server,
+                             int (*handler)(int fd, const char *request),
+                             int flags)
+{
+    struct sockaddr_in addr = { 0 };
+    socklen_t addr_len = sizeof(addr);
+
+    server->handler    = handler;
+    server->flags      = flags;
+    server->nb_accepts = 0;
+
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((server->fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        return AVERROR(errno);
+    if (bind(server->fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        listen(server->fd, 16) ||
+        getsockname(server->fd, (struct sockaddr *)&addr, &addr_len) ||
+        pthread_create(&server->thread, NULL, http_server_thread, server)) {
+        closesocket(server->fd);
+        return AVERROR(EIO);
+    }
+    server->port = ntohs(addr.sin_port);
+    return 0;
+}
+
+static void http_server_stop(HTTPServer *server)
+{
+    shutdown(server->fd, SHUT_RDWR);
+    closesocket(server->fd);
+    pthread_join(server->thread, NULL);
+}
+
+#endif /* AVFORMAT_TESTS_HTTPSERVER_H */
@@ -0,0 +1,175 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "libavutil/avstring.h"
+#include "libavutil/intreadwrite.h"
+#include "libavformat/avformat.h"
+#include "libavformat/indexcache.h"
+
+#define FILE_SIZE (64 * 1024)
+
+static const int nb_entries[] = { 20, 10 };
+
+static int write_file(const char *path, const uint8_t *buf, int size)
+{
+    AVIOContext *pb;
+    int ret;
+
+    if ((ret = avio_open(&pb, path, AVIO_FLAG_WRITE)) < 0)
+        return ret;
+    avio_write(pb, buf, size);
+    return avio_closep(&pb);
+}
+
+static int read_file(const char *path, uint8_t *buf, int size)
+{
+    AVIOContext *pb;
+    int ret;
+
+    if ((ret = avio_open(&pb, path, AVIO_FLAG_READ)) < 0)
+        return ret;
+    ret = avio_read(pb, buf, size);
+    avio_closep(&pb);
+    return ret;
+}
+
+/* A context reading the media file, with a stream per nb_entries entry. */
+static AVFormatContext *open_media(const char *path)
+{
+    AVFormatContext *s = avformat_alloc_context();
+    int i;
+
+    if (!s || !(s->url = av_strdup(path)) ||
+        avio_open(&s->pb, path, AVIO_FLAG_READ) < 0) {
+        avformat_free_context(s);
+        return NULL;
+    }
+    for (i = 0; i < FF_ARRAY_ELEMS(nb_entries); i++)
+        if (!avformat_new_stream(s, NULL)) {
+            avio_closep(&s->pb);
+            avformat_free_context(s);
+            return NULL;
+        }
+    return s;
+}
+
+static void close_media(AVFormatContext *s)
+{
+    avio_closep(&s->pb);
+    avformat_free_context(s);
+}
+
+static int count_entries(AVFormatContext *s)
+{
+    int i, nb = 0;
+
+    for (i = 0; i < s->nb_streams; i++)
+        nb += s->streams[i]->nb_index_entries;
+    return nb;
+}
+
+/* Load the cache and print what was found in it. */
+static int load(const char *name, const char *media, const char *dir)
+{
+    AVFormatContext *s = open_media(media);
+    FFIndexCache c;
+    int i, j, ret, match = 1;
+
+    if (!s)
+        return AVERROR(ENOMEM);
+    ret = ff_index_cache_open(s, &c, dir);
+    for (i = 0; i < s->nb_streams; i++) {
+        AVStream *st = s->streams[i];
+
+        match &= st->nb_index_entries == (ret > 0 ? nb_entries[i] : 0);
+        for (j = 0; j < st->nb_index_entries; j++)
+            match &= st->index_entries[j].pos       == j * 3000 + i &&
+                     st->index_entries[j].timestamp == j * 40;
+    }
+    if (ret < 0)
+        printf("%s: %s, %d entries%s\n", name, av_err2str(ret),
+               count_entries(s), match ? "" : ", mismatch");
+    else
+        printf("%s: %d entries%s\n", name, ret, match ? "" : ", mismatch");
+    ff_index_cache_close(s, &c);
+    close_media(s);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = argc > 1 ? argv[1] : ".";
+    uint8_t *buf = av_malloc(FILE_SIZE);
+    char *media = av_asprintf("%s/indexcache.dat", dir), *cache = NULL;
+    AVFormatContext *s;
+    FFIndexCache c;
+    int i, j, size, ret = 1;
+
+    av_log_set_level(AV_LOG_ERROR);
+    if (!buf || !media)
+        goto end;
+    for (i = 0; i < FILE_SIZE; i++)
+        buf[i] = (uint32_t)(i * 2654435761U) >> 24;
+    if (write_file(media, buf, FILE_SIZE) < 0)
+        goto end;
+
+    /* nothing cached yet, the demuxer builds the index and the cache is
+     * written on close */
+    if (!(s = open_media(media)))
+        goto end;
+    if (ff_index_cache_open(s, &c, dir) != 0 ||
+        !(cache = av_strdup(c.path))) {
+        ff_index_cache_close(s, &c);
+        close_media(s);
+        goto end;
+    }
+    for (i = 0; i < s->nb_streams; i++)
+        for (j = 0; j < nb_entries[i]; j++)
+            av_add_index_entry(s->streams[i], j * 3000 + i, j * 40,
+                               0, 0, AVINDEX_KEYFRAME);
+    ff_index_cache_close(s, &c);
+    close_media(s);
+
+    if (load("round trip", media, dir) < 0 ||
+        (size = read_file(cache, buf, FILE_SIZE)) <= 0)
+        goto end;
+
+    /* broken caches are rejected as a whole */
+    if (write_file(cache, buf, size - 5) < 0 ||
+        load("truncated", media, dir) >= 0)
+        goto end;
+    AV_WB64(buf + size - 16, FILE_SIZE);
+    if (write_file(cache, buf, size) < 0 ||
+        load("position out of the file", media, dir) >= 0)
+        goto end;
+    AV_WB64(buf + size - 16, (nb_entries[1] - 1) * 3000 + 1);
+    if (write_file(cache, buf, size + 1) < 0 ||
+        load("trailing data", media, dir) >= 0)
+        goto end;
+    ret = 0;
+
+end:
+    if (cache)
+        avpriv_io_delete(cache);
+    if (media)
+        avpriv_io_delete(media);
+    av_free(cache);
+    av_free(media);
+    av_free(buf);
+    return ret;
+}
@@ -0,0 +1,78 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "libavutil/time.h"
+#include "libavformat/avformat.h"
+#include "libavformat/network.h"
+
+#define CANCEL_AFTER 200000
+
+static int64_t cancel_time;
+
+static int interrupt_cb(void *opaque)
+{
+    return av_gettime_relative() >= cancel_time;
+}
+
+/*
+ * Open a file on a server that accepts the connection but never answers,
+ * and check that the interrupt callback cancels the negotiation promptly.
+ */
+int main(void)
+{
+    AVIOInterruptCB cb = { interrupt_cb, NULL };
+    AVIOContext *pb = NULL;
+    struct sockaddr_in addr = { 0 };
+    socklen_t addr_len = sizeof(addr);
+    char url[64];
+    int64_t latency;
+    int fd, ret;
+
+    avformat_network_init();
+
+    /* connecting succeeds through the listen backlog, nothing is accepted */
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0 ||
+        bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        listen(fd, 1) ||
+        getsockname(fd, (struct sockaddr *)&addr, &addr_len)) {
+        fprintf(stderr, "Cannot set up the server socket\n");
+        return 1;
+    }
+    snprintf(url, sizeof(url), "smb://127.0.0.1:%d/share/file", ntohs(addr.sin_port));
+
+    cancel_time = av_gettime_relative() + CANCEL_AFTER;
+    ret = avio_open2(&pb, url, AVIO_FLAG_READ, &cb, NULL);
+    latency = av_gettime_relative() - cancel_time;
+    closesocket(fd);
+    avformat_network_deinit();
+
+    if (ret != AVERROR_EXIT) {
+        fprintf(stderr, "Expected AVERROR_EXIT, got %s\n", av_err2str(ret));
+        avio_closep(&pb);
+        return 1;
+    }
+    if (latency > 2 * POLLING_TIME * 1000) {
+        fprintf(stderr, "Cancelled after %"PRId64" ms\n", latency / 1000);
+        return 1;
+    }
+    printf("cancelled\n");
+    return 0;
+}
@@ -0,0 +1,209 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "libavutil/avstring.h"
+#include "libavutil/md5.h"
+#include "libavutil/thread.h"
+#include "libavutil/time.h"
+#include "libavformat/avformat.h"
+#include "libavformat/url.h"
+
+#include "httpserver.h"
+
+#define FILE_SIZE  (2 * 1024 * 1024 + 1234)
+#define RANGE_SIZE (128 * 1024)
+
+/* each reply starts after LATENCY us, then CHUNK bytes are sent every PACING us */
+#define LATENCY    20000
+#define CHUNK      16384
+#define PACING     4000
+
+static uint8_t file_byte(int64_t pos)
+{
+    return (uint32_t)(pos * 2654435761U) >> 24;
+}
+
+/*
+ * Answer a GET with a byte range when the path is "file", or with the whole
+ * file when it is "norange", like a server without range support.
+ */
+static int serve_request(int fd, const char *request)
+{
+    uint8_t buf[CHUNK + 256];
+    int64_t start = 0, end = FILE_SIZE - 1, pos;
+    const char *range = av_stristr(request, "\r\nRange: bytes=");
+    int ranged = !strstr(request, "norange") && range;
+    int len;
+
+    if (ranged) {
+        char *p;
+        start = strtoll(range + 15, &p, 10);
+        if (*p == '-' && p[1] >= '0' && p[1] <= '9')
+            end = FFMIN(strtoll(p + 1, NULL, 10), FILE_SIZE - 1);
+        len = snprintf((char *)buf, sizeof(buf), "HTTP/1.1 206 Partial Content\r\n"
+                       "Content-Range: bytes %"PRId64"-%"PRId64"/%d\r\n"
+                       "Content-Length: %"PRId64"\r\n\r\n",
+                       start, end, FILE_SIZE, end - start + 1);
+    } else {
+        len = snprintf((char *)buf, sizeof(buf), "HTTP/1.1 200 OK\r\n"
+                       "Content-Length: %d\r\n\r\n", FILE_SIZE);
+    }
+
+    av_usleep(LATENCY);
+    /* the header goes with the first chunk */
+    for (pos = start; pos <= end; len = 0) {
+        int n = FFMIN(CHUNK, end - pos + 1);
+        while (n--)
+            buf[len++] = file_byte(pos++);
+        if (http_server_send(fd, buf, len))
+            return -1;
+        if (pos <= end)
+            av_usleep(PACING);
+    }
+    return 0;
+}
+
+static int open_url(URLContext **h, int port, const char *proto, const char *path)
+{
+    AVDictionary *opts = NULL;
+    char url[128];
+    int ret;
+
+    snprintf(url, sizeof(url), "%shttp://127.0.0.1:%d/%s", proto, port, path);
+    av_dict_set_int(&opts, "range_size", RANGE_SIZE, 0);
+    av_dict_set_int(&opts, "buffer_size", 8 * RANGE_SIZE, 0);
+    ret = ffurl_open_whitelist(h, url, AVIO_FLAG_READ, NULL, &opts,
+                               NULL, NULL, NULL);
+    av_dict_free(&opts);
+    if (ret < 0)
+        fprintf(stderr, "Cannot open %s: %s\n", url, av_err2str(ret));
+    return ret;
+}
+
+/* Read size bytes at pos, or up to the end of the file, and check them. */
+static int read_check(URLContext *h, int64_t pos, int size, struct AVMD5 *md5)
+{
+    uint8_t buf[10000];
+    int len = 0, ret, i;
+
+    while (len < size) {
+        ret = ffurl_read(h, buf, FFMIN(sizeof(buf), size - len));
+        if (ret == AVERROR_EOF)
+            break;
+        if (ret < 0)
+            return ret;
+        for (i = 0; i < ret; i++)
+            if (buf[i] != file_byte(pos + len + i)) {
+                fprintf(stderr, "Wrong data at %"PRId64"\n", pos + len + i);
+                return AVERROR_INVALIDDATA;
+            }
+        if (md5)
+            av_md5_update(md5, buf, ret);
+        len += ret;
+    }
+    return len;
+}
+
+static int play(int port, const char *proto, const char *path)
+{
+    struct AVMD5 *md5 = av_md5_alloc();
+    int64_t start = av_gettime_relative();
+    URLContext *h = NULL;
+    uint8_t digest[16];
+    int ret, i;
+
+    if (!md5)
+        return AVERROR(ENOMEM);
+    av_md5_init(md5);
+    if ((ret = open_url(&h, port, proto, path)) >= 0) {
+        ret = read_check(h, 0, INT_MAX, md5);
+        ffurl_closep(&h);
+    }
+    av_md5_final(md5, digest);
+    av_free(md5);
+    if (ret < 0)
+        return ret;
+
+    fprintf(stderr, "%-11s %-8s %"PRId64" ms\n", proto, path,
+            (av_gettime_relative() - start) / 1000);
+    printf("%shttp, %s: %d bytes, md5 ", proto, path, ret);
+    for (i = 0; i < 16; i++)
+        printf("%02x", digest[i]);
+    printf("\n");
+    return 0;
+}
+
+static int seeks(int port)
+{
+    static const int64_t positions[] = {
+        1500000, 10, 2000000, RANGE_SIZE - 5, FILE_SIZE - 100, 700000,
+        700000 + 3 * RANGE_SIZE, 650000,
+        /* all the connections are busy after the range of the read position */
+        1400000, 1400000 - RANGE_SIZE, FILE_SIZE,
+    };
+    URLContext *h = NULL;
+    int ret, i;
+
+    if ((ret = open_url(&h, port, "multirange:", "file")) < 0)
+        return ret;
+    if (ffurl_size(h) != FILE_SIZE) {
+        fprintf(stderr, "Wrong size %"PRId64"\n", ffurl_size(h));
+        ret = AVERROR_INVALIDDATA;
+    }
+    for (i = 0; ret >= 0 && i < FF_ARRAY_ELEMS(positions); i++) {
+        int64_t pos = ffurl_seek(h, positions[i], SEEK_SET);
+        if (pos != positions[i]) {
+            fprintf(stderr, "Seek to %"PRId64" failed\n", positions[i]);
+            ret = AVERROR(EIO);
+            break;
+        }
+        /* stop in the middle of a range, before the next seek */
+        ret = read_check(h, pos, 70000, NULL);
+        if (ret >= 0)
+            printf("seek %"PRId64": %d bytes\n", pos, ret);
+    }
+    ffurl_closep(&h);
+    return ret;
+}
+
+int main(void)
+{
+    HTTPServer server;
+    int port, ret = 1;
+
+    avformat_network_init();
+
+    if (http_server_start(&server, serve_request, HTTP_SERVER_NODELAY) < 0) {
+        fprintf(stderr, "Cannot set up the server\n");
+        return 1;
+    }
+    port = server.port;
+
+    if (play(port, "", "file") < 0 ||
+        play(port, "multirange:", "file") < 0 ||
+        /* read over a single connection */
+        play(port, "multirange:", "norange") < 0 ||
+        seeks(port) < 0)
+        goto end;
+    ret = 0;
+
+end:
+    http_server_stop(&server);
+    avformat_network_deinit();
+    return ret;
+}
@@ -0,0 +1,198 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "libavutil/lfg.h"
+
+/* The protocol is only registered in jni builds, so test it directly. */
+#include "libavformat/usb.c"
+
+#define FILE_SIZE (3 * 1024 * 1024 + 12345)
+
+/*
+ * File backed stand-ins for the host callbacks of the usb: protocol. Like
+ * the real host, they keep their state at the start of priv_data.
+ */
+static int host_reads, host_seeks;
+
+static int *host_fd(void *context)
+{
+    return ((URLContext *)context)->priv_data;
+}
+
+int usb_open(void *context, const char *url, int flags)
+{
+    av_strstart(url, "usb:", &url);
+    if ((*host_fd(context) = open(url, O_RDONLY)) < 0)
+        return AVERROR(errno);
+    return 0;
+}
+
+int usb_read(void *context, unsigned char *buf, int size)
+{
+    int ret = read(*host_fd(context), buf, size);
+    host_reads++;
+    return ret < 0 ? AVERROR(errno) : ret;
+}
+
+int usb_write(void *context, const unsigned char *buf, int size)
+{
+    return AVERROR(ENOSYS);
+}
+
+int64_t usb_seek(void *context, int64_t pos, int whence)
+{
+    struct stat st;
+    int64_t ret;
+
+    if (whence == AVSEEK_SIZE)
+        return fstat(*host_fd(context), &st) < 0 ? AVERROR(errno) : st.st_size;
+    ret = lseek(*host_fd(context), pos, whence);
+    host_seeks++;
+    return ret < 0 ? AVERROR(errno) : ret;
+}
+
+int usb_close(void *context)
+{
+    return close(*host_fd(context));
+}
+
+int usb_open_dir(void *context)             { return AVERROR(ENOSYS); }
+int usb_read_dir(void *context, void **next) { return AVERROR(ENOSYS); }
+int usb_close_dir(void *context)            { return AVERROR(ENOSYS); }
+int usb_delete(void *context)               { return AVERROR(ENOSYS); }
+int usb_move(void *src, void *dst)          { return AVERROR(ENOSYS); }
+
+static int open_usb(URLContext **hp, const char *url)
+{
+    URLContext *h = av_mallocz(sizeof(*h));
+    int ret;
+
+    if (!h || !(h->priv_data = av_mallocz(ff_usb_protocol.priv_data_size))) {
+        av_free(h);
+        return AVERROR(ENOMEM);
+    }
+    h->prot     = &ff_usb_protocol;
+    h->filename = (char *)url;
+    h->flags    = AVIO_FLAG_READ;
+    *hp = h;
+    if ((ret = ff_usb_protocol.url_open(h, url, h->flags)) < 0)
+        return ret;
+    h->is_connected = 1;
+    return 0;
+}
+
+static int read_at(URLContext *h, const uint8_t *ref, uint8_t *buf,
+                   int64_t pos, int size)
+{
+    int64_t ret = ffurl_seek(h, pos, SEEK_SET);
+    int done = 0;
+
+    if (ret != pos) {
+        fprintf(stderr, "seek to %"PRId64" returned %"PRId64"\n", pos, ret);
+        return -1;
+    }
+    while (done < size) {
+        ret = ffurl_read(h, buf + done, size - done);
+        if (ret == AVERROR_EOF)
+            break;
+        if (ret <= 0) {
+            fprintf(stderr, "read at %"PRId64" failed\n", pos + done);
+            return -1;
+        }
+        done += ret;
+    }
+    if (done != FFMIN(size, FFMAX(FILE_SIZE - pos, 0)) ||
+        (done && memcmp(buf, ref + pos, done))) {
+        fprintf(stderr, "wrong data at %"PRId64"\n", pos);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    char path[] = "usb-test-XXXXXX";
+    uint8_t *ref = av_malloc(FILE_SIZE), buf[8192];
+    URLContext *h = NULL;
+    char url[64];
+    AVLFG lfg;
+    int64_t pos;
+    int fd, i, ret = 1;
+
+    av_lfg_init(&lfg, 0x5b);
+    for (i = 0; ref && i < FILE_SIZE; i++)
+        ref[i] = av_lfg_get(&lfg);
+    if (!ref || (fd = mkstemp(path)) < 0)
+        return 1;
+    if (write(fd, ref, FILE_SIZE) != FILE_SIZE) {
+        close(fd);
+        goto end;
+    }
+    close(fd);
+
+    snprintf(url, sizeof(url), "usb:%s", path);
+    if (open_usb(&h, url) < 0) {
+        fprintf(stderr, "Cannot open %s\n", url);
+        goto end;
+    }
+    if (ffurl_seek(h, 0, AVSEEK_SIZE) != FILE_SIZE) {
+        fprintf(stderr, "Wrong size\n");
+        goto end;
+    }
+
+    /* small sequential reads become a few block transfers */
+    for (pos = 0; pos < FILE_SIZE; pos += 100)
+        if (read_at(h, ref, buf, pos, 100) < 0)
+            goto end;
+    if (host_reads > 2 * (FILE_SIZE / (256 * 1024) + 2) || host_seeks > 1) {
+        fprintf(stderr, "Sequential reads: %d host reads, %d host seeks\n",
+                host_reads, host_seeks);
+        goto end;
+    }
+
+    /* header parsing style back and forth seeks stay in the cache */
+    host_reads = host_seeks = 0;
+    for (i = 0; i < 1000; i++)
+        if (read_at(h, ref, buf, av_lfg_get(&lfg) % 65536,
+                    1 + av_lfg_get(&lfg) % 256) < 0)
+            goto end;
+    if (host_reads > 2 || host_seeks > 1) {
+        fprintf(stderr, "Seeks in cached data: %d host reads, %d host seeks\n",
+                host_reads, host_seeks);
+        goto end;
+    }
+
+    /* random access over the whole file, including past the end */
+    for (i = 0; i < 1000; i++)
+        if (read_at(h, ref, buf, av_lfg_get(&lfg) % (FILE_SIZE + 1000),
+                    1 + av_lfg_get(&lfg) % sizeof(buf)) < 0)
+            goto end;
+
+    printf("ok\n");
+    ret = 0;
+end:
+    ffurl_closep(&h);
+    unlink(path);
+    av_free(ref);
+    return ret;
+}
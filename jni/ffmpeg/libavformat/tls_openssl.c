@@ -46,8 +46,36 @@ typedef struct TLSContext {
 #if OPENSSL_VERSION_NUMBER >= 0x1010000fL
     BIO_METHOD* url_bio_method;
 #endif
+    int session_cache;
+    char *session_key;
 } TLSContext;
 
+/*
+ * Connections with the same settings share one SSL_CTX, which is created on
+ * first use and kept until the last ff_openssl_deinit(), since loading the
+ * CA file is a large part of the connection setup. The sessions of client
+ * connections are kept per settings, host and port, and offered on the next
+ * connection to the same server, which then only needs an abbreviated
+ * handshake (session ticket or session id).
+ */
+typedef struct TLSSharedContext {
+    char *key;
+    SSL_CTX *ctx;
+    struct TLSSharedContext *next;
+} TLSSharedContext;
+
+typedef struct TLSSession {
+    char *key;
+    SSL_SESSION *session;
+    struct TLSSession *next;
+} TLSSession;
+
+#define MAX_TLS_SESSIONS 16
+
+static AVMutex tls_cache_mutex = AV_MUTEX_INITIALIZER;
+static TLSSharedContext *shared_contexts;
+static TLSSession *sessions;
+
 #if HAVE_THREADS && OPENSSL_VERSION_NUMBER < 0x10100000L
 #include <openssl/crypto.h>
 pthread_mutex_t *openssl_mutexes;
@@ -103,11 +131,32 @@ int ff_openssl_init(void)
     return 0;
 }
 
+static void tls_cache_free(void)
+{
+    ff_mutex_lock(&tls_cache_mutex);
+    while (shared_contexts) {
+        TLSSharedContext *shared = shared_contexts;
+        shared_contexts = shared->next;
+        SSL_CTX_free(shared->ctx);
+        av_free(shared->key);
+        av_free(shared);
+    }
+    while (sessions) {
+        TLSSession *sess = sessions;
+        sessions = sess->next;
+        SSL_SESSION_free(sess->session);
+        av_free(sess->key);
+        av_free(sess);
+    }
+    ff_mutex_unlock(&tls_cache_mutex);
+}
+
 void ff_openssl_deinit(void)
 {
     ff_lock_avformat();
     openssl_init--;
     if (!openssl_init) {
+        tls_cache_free();
 #if HAVE_THREADS && OPENSSL_VERSION_NUMBER < 0x10100000L
         if (CRYPTO_get_locking_callback() == openssl_lock) {
             int i;
@@ -148,6 +197,7 @@ static int tls_close(URLContext *h)
     if (c->url_bio_method)
         BIO_meth_free(c->url_bio_method);
 #endif
+    av_freep(&c->session_key);
     ff_openssl_deinit();
     return 0;
 }
@@ -233,50 +283,178 @@ static BIO_METHOD url_bio_method = {
 };
 #endif
 
-static int tls_open(URLContext *h, const char *uri, int flags, AVDictionary **options)
+/* Called by OpenSSL with a new client session, which we keep. */
+static int new_session_cb(SSL *ssl, SSL_SESSION *session)
 {
-    TLSContext *p = h->priv_data;
-    TLSShared *c = &p->tls_shared;
-    BIO *bio;
-    int ret;
+    TLSContext *p = SSL_get_app_data(ssl);
+    TLSSession *sess, **s;
+    int nb_sessions = 0;
 
-    if ((ret = ff_openssl_init()) < 0)
-        return ret;
+    if (!p || !p->session_key)
+        return 0;
 
-    if ((ret = ff_tls_open_underlying(c, h, uri, options)) < 0)
-        goto fail;
+    ff_mutex_lock(&tls_cache_mutex);
+    for (s = &sessions; *s; s = &(*s)->next, nb_sessions++)
+        if (!strcmp((*s)->key, p->session_key))
+            break;
+    if (*s) {
+        sess = *s;
+        *s = sess->next;
+        SSL_SESSION_free(sess->session);
+    } else {
+        if (!(sess = av_mallocz(sizeof(*sess))) ||
+            !(sess->key = av_strdup(p->session_key))) {
+            av_free(sess);
+            ff_mutex_unlock(&tls_cache_mutex);
+            return 0;
+        }
+        /* the most recently used sessions come first, drop the oldest */
+        if (nb_sessions >= MAX_TLS_SESSIONS) {
+            for (s = &sessions; (*s)->next; s = &(*s)->next)
+                ;
+            SSL_SESSION_free((*s)->session);
+            av_free((*s)->key);
+            av_freep(s);
+        }
+    }
+    sess->session = session;
+    sess->next    = sessions;
+    sessions      = sess;
+    ff_mutex_unlock(&tls_cache_mutex);
+    return 1;
+}
+
+/* Offer the last session with the server, if there is one. */
+static void set_cached_session(TLSContext *p)
+{
+    TLSSession *sess;
+
+    ff_mutex_lock(&tls_cache_mutex);
+    for (sess = sessions; sess; sess = sess->next) {
+        if (!strcmp(sess->key, p->session_key)) {
+            SSL_set_session(p->ssl, sess->session);
+            break;
+        }
+    }
+    ff_mutex_unlock(&tls_cache_mutex);
+}
+
+static SSL_CTX *create_context(URLContext *h)
+{
+    TLSContext *p = h->priv_data;
+    TLSShared *c = &p->tls_shared;
+    SSL_CTX *ctx;
 
     // We want to support all versions of TLS >= 1.0, but not the deprecated
     // and insecure SSLv2 and SSLv3.  Despite the name, SSLv23_*_method()
     // enables support for all versions of SSL and TLS, and we then disable
     // support for the old protocols immediately after creating the context.
-    p->ctx = SSL_CTX_new(c->listen ? SSLv23_server_method() : SSLv23_client_method());
-    if (!p->ctx) {
+    ctx = SSL_CTX_new(c->listen ? SSLv23_server_method() : SSLv23_client_method());
+    if (!ctx) {
         av_log(h, AV_LOG_ERROR, "%s\n", ERR_error_string(ERR_get_error(), NULL));
-        ret = AVERROR(EIO);
-        goto fail;
+        return NULL;
     }
-    SSL_CTX_set_options(p->ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
+    SSL_CTX_set_options(ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
     if (c->ca_file) {
-        if (!SSL_CTX_load_verify_locations(p->ctx, c->ca_file, NULL))
+        if (!SSL_CTX_load_verify_locations(ctx, c->ca_file, NULL))
             av_log(h, AV_LOG_ERROR, "SSL_CTX_load_verify_locations %s\n", ERR_error_string(ERR_get_error(), NULL));
     }
-    if (c->cert_file && !SSL_CTX_use_certificate_chain_file(p->ctx, c->cert_file)) {
+    if (c->cert_file && !SSL_CTX_use_certificate_chain_file(ctx, c->cert_file)) {
         av_log(h, AV_LOG_ERROR, "Unable to load cert file %s: %s\n",
                c->cert_file, ERR_error_string(ERR_get_error(), NULL));
-        ret = AVERROR(EIO);
         goto fail;
     }
-    if (c->key_file && !SSL_CTX_use_PrivateKey_file(p->ctx, c->key_file, SSL_FILETYPE_PEM)) {
+    if (c->key_file && !SSL_CTX_use_PrivateKey_file(ctx, c->key_file, SSL_FILETYPE_PEM)) {
         av_log(h, AV_LOG_ERROR, "Unable to load key file %s: %s\n",
                c->key_file, ERR_error_string(ERR_get_error(), NULL));
-        ret = AVERROR(EIO);
         goto fail;
     }
     // Note, this doesn't check that the peer certificate actually matches
     // the requested hostname.
     if (c->verify)
-        SSL_CTX_set_verify(p->ctx, SSL_VERIFY_PEER|SSL_VERIFY_FAIL_IF_NO_PEER_CERT, NULL);
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER|SSL_VERIFY_FAIL_IF_NO_PEER_CERT, NULL);
+    if (!c->listen) {
+        /* new sessions are given to new_session_cb, see there */
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT |
+                                            SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(ctx, new_session_cb);
+    }
+    return ctx;
+fail:
+    SSL_CTX_free(ctx);
+    return NULL;
+}
+
+static void context_ref(SSL_CTX *ctx)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    SSL_CTX_up_ref(ctx);
+#else
+    CRYPTO_add(&ctx->references, 1, CRYPTO_LOCK_SSL_CTX);
+#endif
+}
+
+/**
+ * Get a reference to the SSL_CTX for the settings of h, creating it if
+ * there is none yet.
+ */
+static int get_shared_context(URLContext *h, SSL_CTX **ctx)
+{
+    TLSContext *p = h->priv_data;
+    TLSShared *c = &p->tls_shared;
+    TLSSharedContext *shared;
+    char *key;
+    int ret = 0;
+
+    key = av_asprintf("%d;%d;%s;%s;%s", c->listen, c->verify,
+                      c->ca_file   ? c->ca_file   : "",
+                      c->cert_file ? c->cert_file : "",
+                      c->key_file  ? c->key_file  : "");
+    if (!key)
+        return AVERROR(ENOMEM);
+
+    ff_mutex_lock(&tls_cache_mutex);
+    for (shared = shared_contexts; shared; shared = shared->next)
+        if (!strcmp(shared->key, key))
+            break;
+    if (!shared) {
+        if (!(shared = av_mallocz(sizeof(*shared)))) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        if (!(shared->ctx = create_context(h))) {
+            av_free(shared);
+            ret = AVERROR(EIO);
+            goto end;
+        }
+        shared->key     = key;
+        shared->next    = shared_contexts;
+        shared_contexts = shared;
+        key = NULL;
+    }
+    context_ref(shared->ctx);
+    *ctx = shared->ctx;
+end:
+    ff_mutex_unlock(&tls_cache_mutex);
+    av_free(key);
+    return ret;
+}
+
+static int tls_open(URLContext *h, const char *uri, int flags, AVDictionary **options)
+{
+    TLSContext *p = h->priv_data;
+    TLSShared *c = &p->tls_shared;
+    BIO *bio;
+    int ret;
+
+    if ((ret = ff_openssl_init()) < 0)
+        return ret;
+
+    if ((ret = ff_tls_open_underlying(c, h, uri, options)) < 0)
+        goto fail;
+
+    if ((ret = get_shared_context(h, &p->ctx)) < 0)
+        goto fail;
     p->ssl = SSL_new(p->ctx);
     if (!p->ssl) {
         av_log(h, AV_LOG_ERROR, "%s\n", ERR_error_string(ERR_get_error(), NULL));
@@ -300,6 +478,20 @@ static int tls_open(URLContext *h, const char *uri, int flags, AVDictionary **op
     SSL_set_bio(p->ssl, bio, bio);
     if (!c->listen && !c->numerichost)
         SSL_set_tlsext_host_name(p->ssl, c->host);
+    if (!c->listen && p->session_cache) {
+        int port;
+        av_url_split(NULL, 0, NULL, 0, NULL, 0, &port, NULL, 0, uri);
+        p->session_key = av_asprintf("%d;%s;%s;%s;%s:%d", c->verify,
+                                     c->ca_file   ? c->ca_file   : "",
+                                     c->cert_file ? c->cert_file : "",
+                                     c->host, c->underlying_host, port);
+        if (!p->session_key) {
+            ret = AVERROR(ENOMEM);
+            goto fail;
+        }
+        SSL_set_app_data(p->ssl, p);
+        set_cached_session(p);
+    }
     ret = c->listen ? SSL_accept(p->ssl) : SSL_connect(p->ssl);
     if (ret == 0) {
         av_log(h, AV_LOG_ERROR, "Unable to negotiate TLS/SSL session\n");
@@ -309,6 +501,9 @@ static int tls_open(URLContext *h, const char *uri, int flags, AVDictionary **op
         ret = print_tls_error(h, ret);
         goto fail;
     }
+    if (p->session_key)
+        av_log(h, AV_LOG_DEBUG, "%s TLS session\n",
+               SSL_session_reused(p->ssl) ? "Resumed" : "New");
 
     return 0;
 fail:
@@ -354,6 +549,7 @@ static int tls_get_file_handle(URLContext *h)
 
 static const AVOption options[] = {
     TLS_COMMON_OPTIONS(TLSContext, tls_shared),
+    { "session_cache", "Resume the TLS sessions of earlier connections to the same server", offsetof(TLSContext, session_cache), AV_OPT_TYPE_BOOL, { .i64 = 1 }, 0, 1, .flags = TLS_OPTFL },
     { NULL }
 };
 
@@ -35,19 +35,154 @@
 
 #include "usb_wrap.h"
 
+/* The start of priv_data belongs to the host wrapper. */
+#define USB_WRAP_PRIV_SIZE 1024
+
+/*
+ * Reads are served from a small LRU cache of aligned blocks. On USB mass
+ * storage every host call is a bulk transfer, so the many small reads and
+ * the back and forth seeks of the demuxers are much cheaper as a few large
+ * block reads. Seeks only move the cache position, the host is asked to
+ * seek when a block it has not read next is missed.
+ */
+#define USB_BLOCK_SIZE   (256 * 1024)
+#define USB_CACHE_BLOCKS 8
+
+typedef struct USBBlock {
+    int64_t  pos;           ///< offset of the block, -1 if unused
+    int      size;          ///< bytes read, less than USB_BLOCK_SIZE at EOF
+    unsigned last_used;
+    uint8_t *data;
+} USBBlock;
+
+typedef struct USBContext {
+    uint8_t  wrap_priv[USB_WRAP_PRIV_SIZE];
+    int      cached;
+    int64_t  pos;           ///< logical position
+    int64_t  host_pos;      ///< position of the host file, -1 if unknown
+    int64_t  size;          ///< file size, -1 if not known yet
+    unsigned use_count;
+    USBBlock blocks[USB_CACHE_BLOCKS];
+} USBContext;
+
+static void usb_cache_free(USBContext *c)
+{
+    int i;
+
+    for (i = 0; i < USB_CACHE_BLOCKS; i++)
+        av_freep(&c->blocks[i].data);
+    c->cached = 0;
+}
+
 static av_cold int usb_wrapper_open(URLContext *h, const char *url, int flags)
 {
-    return usb_open(h, url, flags);
+    USBContext *c = h->priv_data;
+    int i, ret;
+
+    if ((ret = usb_open(h, url, flags)) < 0)
+        return ret;
+
+    c->cached   = !(flags & AVIO_FLAG_WRITE);
+    c->pos      = 0;
+    c->host_pos = 0;
+    c->size     = -1;
+    for (i = 0; i < USB_CACHE_BLOCKS; i++)
+        c->blocks[i].pos = -1;
+    return ret;
 }
 
 static int64_t usb_wrapper_seek(URLContext *h, int64_t pos, int whence)
 {
-    return usb_seek(h, pos, whence);
+    USBContext *c = h->priv_data;
+
+    if (!c->cached)
+        return usb_seek(h, pos, whence);
+
+    if (whence == AVSEEK_SIZE || whence == SEEK_END) {
+        if (c->size < 0) {
+            int64_t size = usb_seek(h, 0, AVSEEK_SIZE);
+            if (size < 0)
+                return size;
+            c->size = size;
+        }
+        if (whence == AVSEEK_SIZE)
+            return c->size;
+        pos += c->size;
+    } else if (whence == SEEK_CUR) {
+        pos += c->pos;
+    } else if (whence != SEEK_SET) {
+        return AVERROR(EINVAL);
+    }
+    if (pos < 0)
+        return AVERROR(EINVAL);
+    c->pos = pos;
+    return pos;
+}
+
+/* Read the block at pos, as a single host transfer if the host allows it. */
+static int usb_load_block(URLContext *h, USBBlock *b, int64_t pos)
+{
+    USBContext *c = h->priv_data;
+    int64_t ret;
+    int size = 0;
+
+    b->pos = -1;
+    if (!b->data && !(b->data = av_malloc(USB_BLOCK_SIZE)))
+        return AVERROR(ENOMEM);
+
+    if (c->host_pos != pos) {
+        c->host_pos = -1;
+        if ((ret = usb_seek(h, pos, SEEK_SET)) < 0)
+            return ret;
+        c->host_pos = pos;
+    }
+    while (size < USB_BLOCK_SIZE) {
+        ret = usb_read(h, b->data + size, USB_BLOCK_SIZE - size);
+        if (ret == 0 || ret == AVERROR_EOF)
+            break;
+        if (ret < 0) {
+            c->host_pos = -1;
+            return ret;
+        }
+        size        += ret;
+        c->host_pos += ret;
+    }
+
+    b->pos  = pos;
+    b->size = size;
+    return 0;
 }
 
 static int usb_wrapper_read(URLContext *h, unsigned char *buf, int size)
 {
-    return usb_read(h, buf, size);
+    USBContext *c = h->priv_data;
+    int64_t block_pos = c->pos - c->pos % USB_BLOCK_SIZE;
+    USBBlock *b = NULL;
+    int i, ret;
+
+    if (!c->cached)
+        return usb_read(h, buf, size);
+
+    for (i = 0; i < USB_CACHE_BLOCKS; i++) {
+        USBBlock *cur = &c->blocks[i];
+        if (cur->pos == block_pos) {
+            b = cur;
+            break;
+        }
+        if (!b || cur->pos < 0 ||
+            (b->pos >= 0 && cur->last_used < b->last_used))
+            b = cur;
+    }
+    if (b->pos != block_pos && (ret = usb_load_block(h, b, block_pos)) < 0)
+        return ret;
+    b->last_used = ++c->use_count;
+
+    if (c->pos - b->pos >= b->size)
+        return AVERROR_EOF;
+    size = FFMIN(size, b->size - (c->pos - b->pos));
+    memcpy(buf, b->data + c->pos - b->pos, size);
+    c->pos += size;
+    return size;
 }
 
 static int usb_wrapper_write(URLContext *h, const unsigned char *buf, int size)
@@ -67,6 +202,7 @@ static int usb_wrapper_move(URLContext *h_src, URLContext *h_dst)
 
 static av_cold int usb_wrapper_close(URLContext *h)
 {
+    usb_cache_free(h->priv_data);
     return usb_close(h);
 }
 
@@ -98,6 +234,6 @@ const URLProtocol ff_usb_protocol = {
     .url_open_dir        = usb_wrapper_open_dir,
     .url_read_dir        = usb_wrapper_read_dir,
     .url_close_dir       = usb_wrapper_close_dir,
-    .priv_data_size      = 1024,
+    .priv_data_size      = sizeof(USBContext),
     .flags               = URL_PROTOCOL_FLAG_NETWORK,
 };
@@ -40,4 +40,10 @@ typedef struct AVAES {
     void (*crypt)(struct AVAES *a, uint8_t *dst, const uint8_t *src, int count, uint8_t *iv, int rounds);
 } AVAES;
 
+/**
+ * Select optimized en/decryption functions. May replace the round keys
+ * with a layout only usable by the functions it installs.
+ */
+void ff_init_aes_x86(AVAES *a, const uint8_t *key, int key_bits, int decrypt);
+
 #endif /* AVUTIL_AES_INTERNAL_H */
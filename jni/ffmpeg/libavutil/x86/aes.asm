@@ -0,0 +1,402 @@
+;*****************************************************************************
+;* AES-NI and SSSE3 optimized AES
+;*
+;* The SSSE3 version uses the vector permutation technique described in
+;* "Accelerating AES with Vector Permute Instructions", Mike Hamburg,
+;* CHES 2009, which does not index memory with secret data. Its round keys
+;* are computed by ff_init_aes_x86().
+;*
+;* This file is part of FFmpeg.
+;*
+;* FFmpeg is free software; you can redistribute it and/or
+;* modify it under the terms of the GNU Lesser General Public
+;* License as published by the Free Software Foundation; either
+;* version 2.1 of the License, or (at your option) any later version.
+;*
+;* FFmpeg is distributed in the hope that it will be useful,
+;* but WITHOUT ANY WARRANTY; without even the implied warranty of
+;* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;* Lesser General Public License for more details.
+;*
+;* You should have received a copy of the GNU Lesser General Public
+;* License along with FFmpeg; if not, write to the Free Software
+;* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+;******************************************************************************
+
+%include "libavutil/x86/x86util.asm"
+
+; Only built for x86_64: the tables would need text relocations in 32-bit
+; PIC code, which Android refuses, and the i686 build disables SIMD anyway.
+%if ARCH_X86_64
+
+SECTION_RODATA
+
+pb_0f:          times 16 db 0x0f
+vp_inv:         dq 0x0E05060F0D080180, 0x040703090A0B0C02
+vp_inva:        dq 0x01040A060F0B0780, 0x030D0E0C02050809
+vp_ipt:         dq 0xC2B2E8985A2A7000, 0xCABAE09052227808
+                dq 0x4C01307D317C4D00, 0xCD80B1FCB0FDCC81
+vp_sb1:         dq 0xB19BE18FCB503E00, 0xA5DF7A6E142AF544
+                dq 0x3618D415FAE22300, 0x3BF7CCC10D2ED9EF
+vp_sb2:         dq 0xE27A93C60B712400, 0x5EB7E955BC982FCD
+                dq 0x69EB88400AE12900, 0xC2A163C8AB82234A
+vp_sbo:         dq 0xD0D26D176FBDC700, 0x15AABF7AC502A878
+                dq 0xCFE474A55FBB6A00, 0x8E1E90D1412B35FA
+vp_mc_forward:  dq 0x0407060500030201, 0x0C0F0E0D080B0A09
+                dq 0x080B0A0904070605, 0x000302010C0F0E0D
+                dq 0x0C0F0E0D080B0A09, 0x0407060500030201
+                dq 0x000302010C0F0E0D, 0x080B0A0904070605
+vp_mc_backward: dq 0x020100030E0D0C0F, 0x0A09080B06050407
+vp_sr:          dq 0x0706050403020100, 0x0F0E0D0C0B0A0908
+                dq 0x030E09040F0A0500, 0x0B06010C07020D08
+                dq 0x0F060D040B020900, 0x070E050C030A0108
+vp_dipt:        dq 0x0F505B040B545F00, 0x154A411E114E451A
+                dq 0x86E383E660056500, 0x12771772F491F194
+vp_dsb9:        dq 0x851C03539A86D600, 0xCAD51F504F994CC9
+                dq 0xC03B1789ECD74900, 0x725E2C9EB2FBA565
+vp_dsbd:        dq 0x7D57CCDFE6B1A200, 0xF56E9B13882A4439
+                dq 0x3CE2FAF724C6CB00, 0x2931180D15DEEFD3
+vp_dsbb:        dq 0xD022649296B44200, 0x602646F6B0F2D404
+                dq 0xC19498A6CD596700, 0xF3FF0C3E3255AA6B
+vp_dsbe:        dq 0x46F2929626D4D000, 0x2242600464B4F6B0
+                dq 0x0C55A6CDFFAAC100, 0x9467F36B98593E32
+vp_dsbo:        dq 0x1387EA537EF94000, 0xC7AA6DB9D4943E2D
+                dq 0x12D7560F93441D00, 0xCA4B8159D8C58E9C
+
+SECTION .text
+
+; The round keys are in the order AVAES uses them: [keyq+roundsq] is xored
+; first, [keyq] is used by the last round.
+; %1 = enc/dec, %2 = number of blocks in m0..
+%macro AESNI_CRYPT 2
+    mova           m4, [keyq+roundsq]
+%assign %%i 0
+%rep %2
+    pxor           m %+ %%i, m4
+%assign %%i %%i+1
+%endrep
+    lea            kq, [roundsq-16]
+%%round:
+    mova           m4, [keyq+kq]
+%assign %%i 0
+%rep %2
+    aes%1          m %+ %%i, m4
+%assign %%i %%i+1
+%endrep
+    sub            kq, 16
+    jnz %%round
+    mova           m4, [keyq]
+%assign %%i 0
+%rep %2
+    aes%1last      m %+ %%i, m4
+%assign %%i %%i+1
+%endrep
+%endmacro
+
+; %1 = 1 for CBC with the iv in m5
+%macro AESNI_DECRYPT_LOOP 1
+    sub        countd, 4
+    jl %%tail
+%%loop4:
+    movu           m0, [srcq+0*mmsize]
+    movu           m1, [srcq+1*mmsize]
+    movu           m2, [srcq+2*mmsize]
+    movu           m3, [srcq+3*mmsize]
+    AESNI_CRYPT   dec, 4
+%if %1
+    pxor           m0, m5
+    movu           m4, [srcq+0*mmsize]
+    pxor           m1, m4
+    movu           m4, [srcq+1*mmsize]
+    pxor           m2, m4
+    movu           m4, [srcq+2*mmsize]
+    pxor           m3, m4
+    movu           m5, [srcq+3*mmsize]
+%endif
+    movu [dstq+0*mmsize], m0
+    movu [dstq+1*mmsize], m1
+    movu [dstq+2*mmsize], m2
+    movu [dstq+3*mmsize], m3
+    add          srcq, 4*mmsize
+    add          dstq, 4*mmsize
+    sub        countd, 4
+    jge %%loop4
+%%tail:
+    add        countd, 4
+    jz %%end
+%%loop1:
+    movu           m0, [srcq]
+    AESNI_CRYPT   dec, 1
+%if %1
+    pxor           m0, m5
+    movu           m5, [srcq]
+%endif
+    movu        [dstq], m0
+    add          srcq, mmsize
+    add          dstq, mmsize
+    dec        countd
+    jg %%loop1
+%%end:
+%endmacro
+
+INIT_XMM aesni
+;-----------------------------------------------------------------------------
+; void ff_aes_encrypt(AVAES *a, uint8_t *dst, const uint8_t *src,
+;                     int count, uint8_t *iv, int rounds)
+;-----------------------------------------------------------------------------
+cglobal aes_encrypt, 6, 7, 6, key, dst, src, count, iv, rounds, k
+    shl       roundsd, 4
+    test       countd, countd
+    jle .end
+    test          ivq, ivq
+    jz .ecb
+    movu           m5, [ivq]
+.cbc:
+    ; CBC encryption is serial
+    movu           m0, [srcq]
+    pxor           m0, m5
+    AESNI_CRYPT   enc, 1
+    mova           m5, m0
+    movu        [dstq], m0
+    add          srcq, mmsize
+    add          dstq, mmsize
+    dec        countd
+    jg .cbc
+    movu         [ivq], m5
+    RET
+
+.ecb:
+    sub        countd, 4
+    jl .ecb_tail
+.ecb4:
+    movu           m0, [srcq+0*mmsize]
+    movu           m1, [srcq+1*mmsize]
+    movu           m2, [srcq+2*mmsize]
+    movu           m3, [srcq+3*mmsize]
+    AESNI_CRYPT   enc, 4
+    movu [dstq+0*mmsize], m0
+    movu [dstq+1*mmsize], m1
+    movu [dstq+2*mmsize], m2
+    movu [dstq+3*mmsize], m3
+    add          srcq, 4*mmsize
+    add          dstq, 4*mmsize
+    sub        countd, 4
+    jge .ecb4
+.ecb_tail:
+    add        countd, 4
+    jz .end
+.ecb1:
+    movu           m0, [srcq]
+    AESNI_CRYPT   enc, 1
+    movu        [dstq], m0
+    add          srcq, mmsize
+    add          dstq, mmsize
+    dec        countd
+    jg .ecb1
+.end:
+    RET
+
+cglobal aes_decrypt, 6, 7, 6, key, dst, src, count, iv, rounds, k
+    shl       roundsd, 4
+    test       countd, countd
+    jle .end
+    test          ivq, ivq
+    jnz .cbc
+    AESNI_DECRYPT_LOOP 0
+    RET
+.cbc:
+    movu           m5, [ivq]
+    AESNI_DECRYPT_LOOP 1
+    movu         [ivq], m5
+.end:
+    RET
+
+; Split the bytes of m0 into nibbles and invert them in GF(2^4).
+; Out: m2 = io, m3 = jo, the next round key in %2. Clobbers m0, m1, m4, %1.
+; Does not touch the flags, the caller's loop counter test is still pending.
+%macro VPAES_INVERT 2 ; tmp, key
+    mova           m1, m0
+    psrlw          m1, 4
+    pand           m0, [pb_0f]              ; k
+    pand           m1, [pb_0f]              ; i
+    mova           %1, [vp_inva]
+    pshufb         %1, m0                   ; a/k
+    pxor           m0, m1                   ; j
+    mova           m3, [vp_inv]
+    pshufb         m3, m1                   ; 1/i
+    pxor           m3, %1                   ; iak = 1/i + a/k
+    mova           m4, [vp_inv]
+    pshufb         m4, m0                   ; 1/j
+    pxor           m4, %1                   ; jak = 1/j + a/k
+    mova           m2, [vp_inv]
+    pshufb         m2, m3                   ; 1/iak
+    pxor           m2, m0                   ; io
+    mova           m3, [vp_inv]
+    pshufb         m3, m4                   ; 1/jak
+    pxor           m3, m1                   ; jo
+    mova           %2, [keyq+kq]
+%endmacro
+
+; m0 = transform of m0 by the table pair at %1
+%macro VPAES_TRANSFORM 1
+    mova           m1, m0
+    psrlw          m1, 4
+    pand           m0, [pb_0f]
+    pand           m1, [pb_0f]
+    mova           m2, [%1]
+    pshufb         m2, m0
+    mova           m0, [%1+16]
+    pshufb         m0, m1
+    pxor           m0, m2
+%endmacro
+
+; The iv (zero for ECB) is kept at [rsp], the final shiftrows permutation
+; at [rsp+16]. keyq points past the schedule, so that [keyq+roundsq] is the
+; first round key and the round loop ends when kq reaches zero.
+%macro VPAES_PROLOGUE 0
+    shl       roundsd, 4
+    add          keyq, roundsq
+    neg        roundsq
+    pxor           m0, m0
+    test          ivq, ivq
+    jz .no_iv
+    movu           m0, [ivq]
+.no_iv:
+    mova        [rsp], m0
+    mova           m0, [vp_sr+2*16]
+    cmp       roundsq, -12*16
+    jne .sr
+    mova           m0, [vp_sr]
+.sr:
+    mova     [rsp+16], m0
+    test       countd, countd
+    jle .end
+%endmacro
+
+%macro VPAES_EPILOGUE 0
+    add          srcq, mmsize
+    add          dstq, mmsize
+    dec        countd
+    jg .block
+    test          ivq, ivq
+    jz .end
+    mova           m0, [rsp]
+    movu         [ivq], m0
+.end:
+    RET
+%endmacro
+
+INIT_XMM ssse3
+cglobal aes_encrypt, 6, 7, 8, -2*mmsize, key, dst, src, count, iv, rounds, k
+    VPAES_PROLOGUE
+.block:
+    movu           m0, [srcq]
+    pxor           m0, [rsp]
+    VPAES_TRANSFORM vp_ipt
+    pxor           m0, [keyq+roundsq]
+    mova           m6, [vp_mc_forward+16]
+    mova           m7, [vp_mc_backward]
+    mov            kq, roundsq
+    jmp .next
+
+.round:
+    mova           m4, [vp_sb1]
+    pshufb         m4, m2                   ; sb1u
+    mova           m0, [vp_sb1+16]
+    pshufb         m0, m3                   ; sb1t
+    pxor           m4, m5                   ; sb1u + k
+    pxor           m0, m4                   ; A
+    mova           m5, [vp_sb2]
+    pshufb         m5, m2                   ; sb2u
+    mova           m2, [vp_sb2+16]
+    pshufb         m2, m3                   ; sb2t
+    pxor           m2, m5                   ; 2A
+    mova           m3, m0
+    pshufb         m0, m6                   ; B
+    pxor           m0, m2                   ; 2A+B
+    pshufb         m3, m7                   ; D
+    pxor           m3, m0                   ; 2A+B+D
+    pshufb         m0, m6                   ; 2B+C
+    pxor           m0, m3                   ; 2A+3B+C+D
+    palignr        m6, m6, 4
+    palignr        m7, m7, 12
+.next:
+    add            kq, 16
+    VPAES_INVERT   m5, m5
+    jnz .round
+
+    mova           m4, [vp_sbo]
+    pshufb         m4, m2
+    pxor           m4, m5
+    mova           m0, [vp_sbo+16]
+    pshufb         m0, m3
+    pxor           m0, m4
+    pshufb         m0, [rsp+16]
+    test          ivq, ivq
+    jz .store
+    mova        [rsp], m0
+.store:
+    movu        [dstq], m0
+    VPAES_EPILOGUE
+
+cglobal aes_decrypt, 6, 7, 8, -2*mmsize, key, dst, src, count, iv, rounds, k
+    VPAES_PROLOGUE
+.block:
+    movu           m0, [srcq]
+    VPAES_TRANSFORM vp_dipt
+    pxor           m0, [keyq+roundsq]
+    mova           m5, [vp_mc_forward+3*16]
+    mov            kq, roundsq
+    jmp .next
+
+.round:
+    mova           m4, [vp_dsb9]
+    pshufb         m4, m2
+    pxor           m0, m4
+    mova           m1, [vp_dsb9+16]
+    pshufb         m1, m3
+    pxor           m0, m1
+    pshufb         m0, m5
+    mova           m4, [vp_dsbd]
+    pshufb         m4, m2
+    pxor           m0, m4
+    mova           m1, [vp_dsbd+16]
+    pshufb         m1, m3
+    pxor           m0, m1
+    pshufb         m0, m5
+    mova           m4, [vp_dsbb]
+    pshufb         m4, m2
+    pxor           m0, m4
+    mova           m1, [vp_dsbb+16]
+    pshufb         m1, m3
+    pxor           m0, m1
+    pshufb         m0, m5
+    mova           m4, [vp_dsbe]
+    pshufb         m4, m2
+    pxor           m0, m4
+    mova           m1, [vp_dsbe+16]
+    pshufb         m1, m3
+    pxor           m0, m1
+    palignr        m5, m5, 12
+.next:
+    add            kq, 16
+    VPAES_INVERT   m6, m0
+    jnz .round
+
+    mova           m4, [vp_dsbo]
+    pshufb         m4, m2
+    pxor           m4, m0
+    mova           m0, [vp_dsbo+16]
+    pshufb         m0, m3
+    pxor           m0, m4
+    pshufb         m0, [rsp+16]
+    pxor           m0, [rsp]
+    test          ivq, ivq
+    jz .store
+    movu           m1, [srcq]
+    mova        [rsp], m1
+.store:
+    movu        [dstq], m0
+    VPAES_EPILOGUE
+
+%endif ; ARCH_X86_64
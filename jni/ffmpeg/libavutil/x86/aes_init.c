@@ -0,0 +1,304 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <string.h>
+
+#include "config.h"
+
+#include "libavutil/aes_internal.h"
+#include "libavutil/attributes.h"
+#include "libavutil/cpu.h"
+#include "cpu.h"
+
+void ff_aes_encrypt_aesni(AVAES *a, uint8_t *dst, const uint8_t *src,
+                          int count, uint8_t *iv, int rounds);
+void ff_aes_decrypt_aesni(AVAES *a, uint8_t *dst, const uint8_t *src,
+                          int count, uint8_t *iv, int rounds);
+void ff_aes_encrypt_ssse3(AVAES *a, uint8_t *dst, const uint8_t *src,
+                          int count, uint8_t *iv, int rounds);
+void ff_aes_decrypt_ssse3(AVAES *a, uint8_t *dst, const uint8_t *src,
+                          int count, uint8_t *iv, int rounds);
+
+/*
+ * Key schedule for the SSSE3 vector permutation code, see
+ * "Accelerating AES with Vector Permute Instructions", Mike Hamburg,
+ * CHES 2009. The round functions never index memory with secret data, but
+ * they work in a different basis, so the round keys are stored transformed.
+ * The tables are the public domain ones from the reference implementation.
+ */
+#define BLOCK(lo, hi) { { UINT64_C(lo), UINT64_C(hi) } }
+
+static const av_aes_block vp_inv[2] = {
+    BLOCK(0x0E05060F0D080180, 0x040703090A0B0C02),
+    BLOCK(0x01040A060F0B0780, 0x030D0E0C02050809),
+};
+static const av_aes_block vp_ipt[2] = {
+    BLOCK(0xC2B2E8985A2A7000, 0xCABAE09052227808),
+    BLOCK(0x4C01307D317C4D00, 0xCD80B1FCB0FDCC81),
+};
+static const av_aes_block vp_sb1[2] = {
+    BLOCK(0xB19BE18FCB503E00, 0xA5DF7A6E142AF544),
+    BLOCK(0x3618D415FAE22300, 0x3BF7CCC10D2ED9EF),
+};
+static const av_aes_block vp_mc_forward =
+    BLOCK(0x0407060500030201, 0x0C0F0E0D080B0A09);
+static const av_aes_block vp_sr[4] = {
+    BLOCK(0x0706050403020100, 0x0F0E0D0C0B0A0908),
+    BLOCK(0x030E09040F0A0500, 0x0B06010C07020D08),
+    BLOCK(0x0F060D040B020900, 0x070E050C030A0108),
+    BLOCK(0x0B0E0104070A0D00, 0x0306090C0F020508),
+};
+static const av_aes_block vp_rcon =
+    BLOCK(0x1F8391B9AF9DEEB6, 0x702A98084D7C7D81);
+static const av_aes_block vp_s63 =
+    BLOCK(0x5B5B5B5B5B5B5B5B, 0x5B5B5B5B5B5B5B5B);
+static const av_aes_block vp_opt[2] = {
+    BLOCK(0xFF9F4929D6B66000, 0xF7974121DEBE6808),
+    BLOCK(0x01EDBD5150BCEC00, 0xE10D5DB1B05C0CE0),
+};
+static const av_aes_block vp_deskew[2] = {
+    BLOCK(0x07E4A34047A4E300, 0x1DFEB95A5DBEF91A),
+    BLOCK(0x5F36B5DC83EA6900, 0x2841C2ABF49D1E77),
+};
+static const av_aes_block vp_dks[4][2] = {
+    { BLOCK(0xFEB91A5DA3E44700, 0x0740E3A45A1DBEF9),     /* invskew x*D */
+      BLOCK(0x41C277F4B5368300, 0x5FDC69EAAB289D1E) },
+    { BLOCK(0x9A4FCA1F8550D500, 0x03D653861CC94C99),     /* invskew x*B */
+      BLOCK(0x115BEDA7B6FC4A00, 0xD993256F7E3482C8) },
+    { BLOCK(0xD5031CCA1FC9D600, 0x53859A4C994F5086),     /* invskew x*E + 0x63 */
+      BLOCK(0xA23196054FDC7BE8, 0xCD5EF96A20B31487) },
+    { BLOCK(0xB6116FC87ED9A700, 0x4AED933482255BFC),     /* invskew x*9 */
+      BLOCK(0x4576516227143300, 0x8BB89FACE9DAFDCE) },
+};
+
+/* pshufb: out[i] = tbl[idx[i] & 15], or 0 if the top bit of idx[i] is set */
+static inline uint8_t vp_lookup(const av_aes_block *tbl, uint8_t idx)
+{
+    return idx & 0x80 ? 0 : tbl->u8[idx & 15];
+}
+
+static av_aes_block vp_shuffle(av_aes_block x, const av_aes_block *idx)
+{
+    av_aes_block r;
+    int i;
+
+    for (i = 0; i < 16; i++)
+        r.u8[i] = vp_lookup(&x, idx->u8[i]);
+    return r;
+}
+
+static av_aes_block vp_xor(av_aes_block a, av_aes_block b)
+{
+    a.u64[0] ^= b.u64[0];
+    a.u64[1] ^= b.u64[1];
+    return a;
+}
+
+static av_aes_block vp_transform(av_aes_block x, const av_aes_block tbl[2])
+{
+    int i;
+
+    for (i = 0; i < 16; i++)
+        x.u8[i] = tbl[0].u8[x.u8[i] & 15] ^ tbl[1].u8[x.u8[i] >> 4];
+    return x;
+}
+
+static av_aes_block vp_subbytes(av_aes_block x)
+{
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        uint8_t k   = x.u8[i] & 15;
+        uint8_t hi  = x.u8[i] >> 4;
+        uint8_t j   = hi ^ k;
+        uint8_t ak  = vp_inv[1].u8[k];
+        uint8_t iak = vp_inv[0].u8[hi] ^ ak;
+        uint8_t jak = vp_inv[0].u8[j]  ^ ak;
+        uint8_t io  = vp_lookup(&vp_inv[0], iak) ^ j;
+        uint8_t jo  = vp_lookup(&vp_inv[0], jak) ^ hi;
+
+        x.u8[i] = vp_lookup(&vp_sb1[0], io) ^ vp_lookup(&vp_sb1[1], jo);
+    }
+    return x;
+}
+
+typedef struct VPAESSchedule {
+    av_aes_block *out;
+    av_aes_block rcon, x6, x7;
+    int sr, decrypt;
+} VPAESSchedule;
+
+static av_aes_block vp_schedule_round(VPAESSchedule *s, av_aes_block x, int low)
+{
+    av_aes_block t;
+    int i;
+
+    if (!low) {
+        /* add rcon, rotate it for the next round */
+        s->x7.u8[0] ^= s->rcon.u8[15];
+        t = s->rcon;
+        for (i = 0; i < 16; i++)
+            s->rcon.u8[i] = t.u8[(i + 15) & 15];
+        /* rotword of the high dword */
+        t.u32[0] = t.u32[1] = t.u32[2] = t.u32[3] = x.u32[3];
+        for (i = 0; i < 16; i++)
+            x.u8[i] = t.u8[(i + 1) & 15];
+    }
+
+    /* smear the dwords of the previous key */
+    s->x7.u32[3] ^= s->x7.u32[2] ^= s->x7.u32[1] ^= s->x7.u32[0];
+    s->x7 = vp_xor(s->x7, vp_s63);
+
+    s->x7 = vp_xor(vp_subbytes(x), s->x7);
+    return s->x7;
+}
+
+static void vp_schedule_mangle(VPAESSchedule *s, av_aes_block x)
+{
+    av_aes_block t, r;
+    int i;
+
+    if (!s->decrypt) {
+        /* multiply by circulant 0,1,1,1 */
+        t = vp_shuffle(vp_xor(x, vp_s63), &vp_mc_forward);
+        r = t;
+        for (i = 0; i < 2; i++) {
+            t = vp_shuffle(t, &vp_mc_forward);
+            r = vp_xor(r, t);
+        }
+        s->out++;
+    } else {
+        /* multiply by inverse mixcolumns circulant E,B,D,9 and deskew */
+        r = vp_transform(x, vp_dks[0]);
+        for (i = 1; i < 4; i++)
+            r = vp_xor(vp_shuffle(r, &vp_mc_forward), vp_transform(x, vp_dks[i]));
+        s->out--;
+    }
+    *s->out = vp_shuffle(r, &vp_sr[s->sr]);
+    s->sr = (s->sr - 1) & 3;
+}
+
+static void vp_schedule_mangle_last(VPAESSchedule *s, av_aes_block x)
+{
+    if (!s->decrypt) {
+        x = vp_shuffle(x, &vp_sr[s->sr]);
+        s->out++;
+        *s->out = vp_transform(vp_xor(x, vp_s63), vp_opt);
+    } else {
+        s->out--;
+        *s->out = vp_transform(vp_xor(x, vp_s63), vp_deskew);
+    }
+}
+
+static void vp_schedule_192_smear(VPAESSchedule *s, av_aes_block *x)
+{
+    av_aes_block *x6 = &s->x6;
+
+    x6->u32[3] ^= x6->u32[2] ^ s->x7.u32[3];
+    x6->u32[2] ^= x6->u32[0] ^ s->x7.u32[3];
+    x6->u32[1] ^= x6->u32[0] ^ s->x7.u32[3];
+    x6->u32[0] ^= x6->u32[0] ^ s->x7.u32[2];
+    *x = *x6;
+    x6->u64[0] = 0;
+}
+
+static void vpaes_key_schedule(AVAES *a, const uint8_t *key, int key_bits,
+                               int decrypt)
+{
+    VPAESSchedule s = { a->round_key, vp_rcon };
+    av_aes_block x, t;
+    int n;
+
+    s.decrypt = decrypt;
+    s.sr      = decrypt ? (key_bits == 192 ? 0 : 2) : 3;
+
+    memcpy(t.u8, key, 16);
+    x = s.x7 = vp_transform(t, vp_ipt);
+    if (decrypt) {
+        s.out += a->rounds;
+        *s.out = vp_shuffle(t, &vp_sr[s.sr]);
+        s.sr ^= 3;
+    } else {
+        *s.out = x;
+    }
+
+    switch (key_bits) {
+    case 128:
+        for (n = 10; ; ) {
+            x = vp_schedule_round(&s, x, 0);
+            if (!--n)
+                break;
+            vp_schedule_mangle(&s, x);
+        }
+        break;
+    case 192:
+        memcpy(t.u8, key + 8, 16);
+        x = s.x6 = vp_transform(t, vp_ipt);
+        s.x6.u64[0] = 0;
+        for (n = 4; ; ) {
+            x = vp_schedule_round(&s, x, 0);
+            t = x;
+            x.u64[0] = s.x6.u64[1];
+            x.u64[1] = t.u64[0];
+            vp_schedule_mangle(&s, x);
+            vp_schedule_192_smear(&s, &x);
+            vp_schedule_mangle(&s, x);
+            x = vp_schedule_round(&s, x, 0);
+            if (!--n)
+                break;
+            vp_schedule_mangle(&s, x);
+            vp_schedule_192_smear(&s, &x);
+        }
+        break;
+    case 256:
+        memcpy(t.u8, key + 16, 16);
+        x = vp_transform(t, vp_ipt);
+        for (n = 7; ; ) {
+            vp_schedule_mangle(&s, x);
+            s.x6 = x;
+            x = vp_schedule_round(&s, x, 0);
+            if (!--n)
+                break;
+            vp_schedule_mangle(&s, x);
+            /* low round: no rotation and no rcon, on the other half */
+            t = s.x7;
+            s.x7 = s.x6;
+            x.u32[0] = x.u32[1] = x.u32[2] = x.u32[3];
+            x = vp_schedule_round(&s, x, 1);
+            s.x7 = t;
+        }
+        break;
+    }
+    vp_schedule_mangle_last(&s, x);
+}
+
+void ff_init_aes_x86(AVAES *a, const uint8_t *key, int key_bits, int decrypt)
+{
+    int cpu_flags = av_get_cpu_flags();
+
+    if (!ARCH_X86_64)
+        return;
+
+    /* AES-NI works on the regular key schedule, SSSE3 needs its own */
+    if (EXTERNAL_AESNI(cpu_flags)) {
+        a->crypt = decrypt ? ff_aes_decrypt_aesni : ff_aes_encrypt_aesni;
+    } else if (EXTERNAL_SSSE3(cpu_flags)) {
+        vpaes_key_schedule(a, key, key_bits, decrypt);
+        a->crypt = decrypt ? ff_aes_decrypt_ssse3 : ff_aes_encrypt_ssse3;
+    }
+}
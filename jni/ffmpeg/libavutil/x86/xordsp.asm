@@ -0,0 +1,71 @@
+;*****************************************************************************
+;* x86-optimized XOR functions
+;*
+;* This file is part of FFmpeg.
+;*
+;* FFmpeg is free software; you can redistribute it and/or
+;* modify it under the terms of the GNU Lesser General Public
+;* License as published by the Free Software Foundation; either
+;* version 2.1 of the License, or (at your option) any later version.
+;*
+;* FFmpeg is distributed in the hope that it will be useful,
+;* but WITHOUT ANY WARRANTY; without even the implied warranty of
+;* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;* Lesser General Public License for more details.
+;*
+;* You should have received a copy of the GNU Lesser General Public
+;* License along with FFmpeg; if not, write to the Free Software
+;* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+;******************************************************************************
+
+%include "x86util.asm"
+
+SECTION .text
+
+;-----------------------------------------------------------------------------
+; void ff_xor_const(uint8_t *buf, ptrdiff_t len, int key);
+;-----------------------------------------------------------------------------
+%macro XOR_CONST 0
+cglobal xor_const, 3, 4, 3, buf, len, key, cnt
+    movd          xm0, keyd
+%if cpuflag(avx2)
+    vpbroadcastb   m0, xm0
+%else
+    punpcklbw      m0, m0
+    pshuflw        m0, m0, 0
+    punpcklqdq     m0, m0
+%endif
+    mov          cntq, lenq
+    and          cntq, -2*mmsize
+    jz .tail
+    add          bufq, cntq
+    sub          lenq, cntq
+    neg          cntq
+.loop:
+    movu           m1, [bufq+cntq]
+    movu           m2, [bufq+cntq+mmsize]
+    pxor           m1, m0
+    pxor           m2, m0
+    movu [bufq+cntq], m1
+    movu [bufq+cntq+mmsize], m2
+    add          cntq, 2*mmsize
+    jl .loop
+.tail:
+    test         lenq, lenq
+    jz .end
+.tail_loop:
+    xor        [bufq], keyb
+    inc          bufq
+    dec          lenq
+    jg .tail_loop
+.end:
+    RET
+%endmacro
+
+INIT_XMM sse2
+XOR_CONST
+
+%if HAVE_AVX2_EXTERNAL
+INIT_YMM avx2
+XOR_CONST
+%endif
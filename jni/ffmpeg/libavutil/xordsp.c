@@ -0,0 +1,42 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "config.h"
+
+#include "attributes.h"
+#include "intreadwrite.h"
+#include "xordsp.h"
+
+static void xor_const_c(uint8_t *buf, ptrdiff_t len, int key)
+{
+    uint64_t key64 = 0x0101010101010101ULL * (key & 0xFF);
+    ptrdiff_t i = 0;
+
+    for (; i + 8 <= len; i += 8)
+        AV_WN64(buf + i, AV_RN64(buf + i) ^ key64);
+    for (; i < len; i++)
+        buf[i] ^= key;
+}
+
+av_cold void avpriv_xordsp_init(XORDSPContext *c)
+{
+    c->xor_const = xor_const_c;
+
+    if (ARCH_X86)
+        ff_xordsp_init_x86(c);
+}
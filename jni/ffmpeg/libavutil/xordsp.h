@@ -0,0 +1,44 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef AVUTIL_XORDSP_H
+#define AVUTIL_XORDSP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct XORDSPContext {
+    /**
+     * XOR every byte of buf with key, in place.
+     *
+     * @param buf  data, no alignment requirement
+     * @param len  number of bytes, may be 0
+     * @param key  byte value in the range 0-255
+     */
+    void (*xor_const)(uint8_t *buf, ptrdiff_t len, int key);
+} XORDSPContext;
+
+/**
+ * Initialize an XORDSPContext with the fastest functions available on the
+ * running CPU.
+ */
+void avpriv_xordsp_init(XORDSPContext *c);
+
+void ff_xordsp_init_x86(XORDSPContext *c);
+
+#endif /* AVUTIL_XORDSP_H */
@@ -0,0 +1,99 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with FFmpeg; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+
+#include "checkasm.h"
+#include "libavutil/aes.h"
+#include "libavutil/aes_internal.h"
+#include "libavutil/cpu.h"
+#include "libavutil/mem.h"
+
+#define BLOCKS 67
+
+static void check_crypt(int key_bits, int decrypt)
+{
+    LOCAL_ALIGNED_16(uint8_t, src,     [BLOCKS * 16]);
+    LOCAL_ALIGNED_16(uint8_t, dst_ref, [BLOCKS * 16]);
+    LOCAL_ALIGNED_16(uint8_t, dst_new, [BLOCKS * 16]);
+    uint8_t key[32], iv[16], iv_ref[16], iv_new[16];
+    AVAES *ref = av_aes_alloc(), *new = av_aes_alloc();
+    int cpu_flags, i, cbc;
+
+    declare_func(void, AVAES *a, uint8_t *dst, const uint8_t *src,
+                 int count, uint8_t *iv, int rounds);
+
+    if (!ref || !new)
+        goto end;
+
+    for (i = 0; i < sizeof(key); i++)
+        key[i] = rnd();
+    for (i = 0; i < sizeof(iv); i++)
+        iv[i] = rnd();
+    for (i = 0; i < BLOCKS * 16; i++)
+        src[i] = rnd();
+
+    /* the optimized functions may use their own key schedule layout, the
+     * reference one must be set up as if no extension was available */
+    cpu_flags = av_get_cpu_flags();
+    av_force_cpu_flags(0);
+    av_aes_init(ref, key, key_bits, decrypt);
+    av_force_cpu_flags(cpu_flags);
+    av_aes_init(new, key, key_bits, decrypt);
+
+    if (!check_func(new->crypt, "aes%d_%s", key_bits, decrypt ? "decrypt" : "encrypt"))
+        goto end;
+
+    for (cbc = 0; cbc < 2; cbc++) {
+        int count = 1 + rnd() % BLOCKS;
+
+        memcpy(iv_ref, iv, sizeof(iv));
+        memcpy(iv_new, iv, sizeof(iv));
+        /* not call_ref(): the last version that passed may need its own
+         * key schedule, the reference context has the C one */
+        ref->crypt(ref, dst_ref, src, count, cbc ? iv_ref : NULL, ref->rounds);
+        call_new(new, dst_new, src, count, cbc ? iv_new : NULL, new->rounds);
+        if (memcmp(dst_ref, dst_new, count * 16) ||
+            memcmp(iv_ref, iv_new, sizeof(iv)))
+            fail();
+
+        /* in place, as used by the demuxers */
+        memcpy(dst_new, src, count * 16);
+        memcpy(iv_new, iv, sizeof(iv));
+        call_new(new, dst_new, dst_new, count, cbc ? iv_new : NULL, new->rounds);
+        if (memcmp(dst_ref, dst_new, count * 16) ||
+            memcmp(iv_ref, iv_new, sizeof(iv)))
+            fail();
+    }
+
+    bench_new(new, dst_new, src, BLOCKS, NULL, new->rounds);
+
+end:
+    av_free(ref);
+    av_free(new);
+}
+
+void checkasm_check_aes(void)
+{
+    int key_bits, decrypt;
+
+    for (decrypt = 0; decrypt < 2; decrypt++)
+        for (key_bits = 128; key_bits <= 256; key_bits += 64)
+            check_crypt(key_bits, decrypt);
+    report("aes");
+}
@@ -185,8 +185,10 @@ static const struct {
     { "sw_rgb", checkasm_check_sw_rgb },
 #endif
 #if CONFIG_AVUTIL
+        { "aes", checkasm_check_aes },
         { "fixed_dsp", checkasm_check_fixed_dsp },
         { "float_dsp", checkasm_check_float_dsp },
+        { "xordsp", checkasm_check_xordsp },
 #endif
     { NULL }
 };
@@ -0,0 +1,60 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with FFmpeg; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+
+#include "checkasm.h"
+#include "libavutil/mem.h"
+#include "libavutil/xordsp.h"
+
+#define BUF_SIZE 4099
+
+void checkasm_check_xordsp(void)
+{
+    LOCAL_ALIGNED_32(uint8_t, buf,     [BUF_SIZE + 1]);
+    LOCAL_ALIGNED_32(uint8_t, buf_ref, [BUF_SIZE + 1]);
+    LOCAL_ALIGNED_32(uint8_t, buf_new, [BUF_SIZE + 1]);
+    XORDSPContext c;
+    int i;
+
+    declare_func(void, uint8_t *buf, ptrdiff_t len, int key);
+
+    avpriv_xordsp_init(&c);
+
+    for (i = 0; i < BUF_SIZE + 1; i++)
+        buf[i] = rnd();
+
+    if (check_func(c.xor_const, "xor_const")) {
+        int key = rnd() & 0xFF;
+
+        /* odd offsets and lengths exercise the unaligned head and tail */
+        for (i = 0; i < 4; i++) {
+            int offset = i & 1;
+            int len    = i < 2 ? rnd() % 64 : BUF_SIZE - (rnd() % 64);
+
+            memcpy(buf_ref, buf, BUF_SIZE + 1);
+            memcpy(buf_new, buf, BUF_SIZE + 1);
+            call_ref(buf_ref + offset, len, key);
+            call_new(buf_new + offset, len, key);
+            if (memcmp(buf_ref, buf_new, BUF_SIZE + 1))
+                fail();
+        }
+        bench_new(buf_new, BUF_SIZE, key);
+    }
+    report("xor_const");
+}
@@ -1,11 +1,48 @@
-#FATE_LIBAVFORMAT-$(HAVE_PTHREADS) += fate-async
-#fate-async: libavformat/tests/async$(EXESUF)
-#fate-async: CMD = run libavformat/tests/async
+FATE_ASYNC-$(call ALLYES, ASYNC_PROTOCOL HTTP_PROTOCOL) += fate-async
+FATE_LIBAVFORMAT-$(HAVE_THREADS) += $(FATE_ASYNC-yes)
+fate-async: libavformat/tests/async$(EXESUF)
+fate-async: CMD = run libavformat/tests/async$(EXESUF)
 
 FATE_LIBAVFORMAT-$(CONFIG_NETWORK) += fate-noproxy
 fate-noproxy: libavformat/tests/noproxy$(EXESUF)
 fate-noproxy: CMD = run libavformat/tests/noproxy$(EXESUF)
 
+FATE_CACHE-$(call ALLYES, CACHE_PROTOCOL HTTP_PROTOCOL) += fate-cache
+FATE_LIBAVFORMAT-$(HAVE_THREADS) += $(FATE_CACHE-yes)
+fate-cache: libavformat/tests/cache$(EXESUF)
+fate-cache: CMD = run libavformat/tests/cache$(EXESUF)
+
+FATE_HTTP-$(CONFIG_HTTP_PROTOCOL) += fate-downloadhttp fate-http
+FATE_LIBAVFORMAT-$(HAVE_THREADS) += $(FATE_HTTP-yes)
+fate-downloadhttp: libavformat/tests/downloadhttp$(EXESUF)
+fate-downloadhttp: CMD = run libavformat/tests/downloadhttp$(EXESUF)
+
+fate-http: libavformat/tests/http$(EXESUF)
+fate-http: CMD = run libavformat/tests/http$(EXESUF)
+
+FATE_DASH-$(call ALLYES, DASH_DEMUXER AAC_DEMUXER MPEGTS_DEMUXER MPEGTS_MUXER HTTP_PROTOCOL) += fate-dash
+FATE_LIBAVFORMAT-$(HAVE_THREADS) += $(FATE_DASH-yes)
+fate-dash: libavformat/tests/dash$(EXESUF)
+fate-dash: CMD = run libavformat/tests/dash$(EXESUF)
+
+FATE_HLS-$(call ALLYES, HLS_DEMUXER AAC_DEMUXER HTTP_PROTOCOL CRYPTO_PROTOCOL) += fate-hls
+FATE_LIBAVFORMAT-$(HAVE_THREADS) += $(FATE_HLS-yes)
+fate-hls: libavformat/tests/hls$(EXESUF)
+fate-hls: CMD = run libavformat/tests/hls$(EXESUF)
+
+FATE_MULTIRANGE-$(call ALLYES, MULTIRANGE_PROTOCOL HTTP_PROTOCOL) += fate-multirange
+FATE_LIBAVFORMAT-$(HAVE_THREADS) += $(FATE_MULTIRANGE-yes)
+fate-multirange: libavformat/tests/multirange$(EXESUF)
+fate-multirange: CMD = run libavformat/tests/multirange$(EXESUF)
+
+FATE_LIBAVFORMAT-$(CONFIG_MATROSKA_DEMUXER) += fate-indexcache
+fate-indexcache: libavformat/tests/indexcache$(EXESUF)
+fate-indexcache: CMD = run libavformat/tests/indexcache$(EXESUF) $(TARGET_PATH)/tests/data/fate
+
+FATE_LIBAVFORMAT-$(CONFIG_LIBSMB2_PROTOCOL) += fate-libsmb2
+fate-libsmb2: libavformat/tests/libsmb2$(EXESUF)
+fate-libsmb2: CMD = run libavformat/tests/libsmb2$(EXESUF)
+
 FATE_LIBAVFORMAT-$(CONFIG_FFRTMPCRYPT_PROTOCOL) += fate-rtmpdh
 fate-rtmpdh: libavformat/tests/rtmpdh$(EXESUF)
 fate-rtmpdh: CMD = run libavformat/tests/rtmpdh$(EXESUF)
@@ -14,6 +51,10 @@ FATE_LIBAVFORMAT-$(CONFIG_SRTP) += fate-srtp
 fate-srtp: libavformat/tests/srtp$(EXESUF)
 fate-srtp: CMD = run libavformat/tests/srtp$(EXESUF)
 
+FATE_LIBAVFORMAT-$(HAVE_UNISTD_H) += fate-usb
+fate-usb: libavformat/tests/usb$(EXESUF)
+fate-usb: CMD = run libavformat/tests/usb$(EXESUF)
+
 FATE_LIBAVFORMAT-yes += fate-url
 fate-url: libavformat/tests/url$(EXESUF)
 fate-url: CMD = run libavformat/tests/url$(EXESUF)
@@ -0,0 +1,403 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with FFmpeg; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Demuxer/remuxer throughput benchmark.
+ *
+ * Reads every packet of the input and reports packets and bytes per second,
+ * e.g. on an encrypted MXV generated with
+ *     ffmpeg -i input.mkv -c copy -f mxv bench.mxv
+ *     tools/demux_bench -n 10 bench.mxv
+ * With -o the packets are also remuxed, which measures muxer throughput:
+ *     tools/demux_bench -n 10 -o out.mxv input.mkv
+ * With -a all streams but the default audio one are discarded, as during
+ * background playback or with alternate audio languages present:
+ *     tools/demux_bench -n 10 -a bench.mxv
+ * The time spent opening the input, and until its first packet, is reported
+ * separately, which together with -v verbose shows startup cost and I/O of
+ * network inputs, e.g.
+ *     tools/demux_bench -v -n 10 http://127.0.0.1:8000/bench.mxd
+ * With -s the input is not read through; instead it is seeked to random
+ * positions, and the time until every stream delivered a packet after each
+ * seek is reported:
+ *     tools/demux_bench -s 100 bench.mxd
+ * With -r the input is only read through the protocol, without demuxing,
+ * which measures the throughput of network protocols. Protocol options can
+ * be given with -O, e.g. against a Samba share on loopback:
+ *     tools/demux_bench -r -n 5 -O readahead_requests=8 smb://127.0.0.1/share/bench.mkv
+ * With -l the input is a directory, which is listed, e.g. with a share
+ * holding 10000 empty files made with
+ *     mkdir dir && (cd dir && seq -f %05g.mkv 10000 | xargs touch)
+ *     tools/demux_bench -l -n 5 smb://127.0.0.1/share/dir
+ */
+
+#include "config.h"
+#if HAVE_UNISTD_H
+#include <unistd.h>             /* getopt */
+#endif
+
+#include "libavformat/avformat.h"
+#include "libavutil/dict.h"
+#include "libavutil/lfg.h"
+#include "libavutil/time.h"
+
+#if !HAVE_GETOPT
+#include "compat/getopt.c"
+#endif
+
+static void usage(int ret)
+{
+    fprintf(ret ? stderr : stdout,
+            "Usage: demux_bench [-a] [-l] [-n runs] [-o output] [-O options] [-r] [-s seeks] [-v] file\n"
+            "    -a        only demux the default audio stream\n"
+            "    -l        list the directory instead\n"
+            "    -n runs   number of passes over the file (default 1)\n"
+            "    -o output remux all packets into output\n"
+            "    -O opts   input options, as key=value pairs separated by ':'\n"
+            "    -r        only read the input, without demuxing\n"
+            "    -s seeks  measure the latency of random seeks instead\n"
+            "    -v        verbose logging\n"
+            );
+    exit(ret);
+}
+
+static int open_output(AVFormatContext **out, AVFormatContext *in, const char *output)
+{
+    AVFormatContext *ofmt;
+    int i, ret;
+
+    if ((ret = avformat_alloc_output_context2(out, NULL, NULL, output)) < 0)
+        return ret;
+    ofmt = *out;
+
+    for (i = 0; i < in->nb_streams; i++) {
+        AVStream *st = avformat_new_stream(ofmt, NULL);
+        if (!st)
+            return AVERROR(ENOMEM);
+        if ((ret = avcodec_parameters_copy(st->codecpar, in->streams[i]->codecpar)) < 0)
+            return ret;
+        st->codecpar->codec_tag = 0;
+        st->time_base = in->streams[i]->time_base;
+    }
+
+    if (!(ofmt->oformat->flags & AVFMT_NOFILE) &&
+        (ret = avio_open(&ofmt->pb, output, AVIO_FLAG_WRITE)) < 0)
+        return ret;
+    return avformat_write_header(ofmt, NULL);
+}
+
+static void close_output(AVFormatContext *ofmt)
+{
+    if (!ofmt)
+        return;
+    if (!(ofmt->oformat->flags & AVFMT_NOFILE))
+        avio_closep(&ofmt->pb);
+    avformat_free_context(ofmt);
+}
+
+static int discard_all_but_audio(AVFormatContext *avf)
+{
+    int i, audio;
+
+    if ((audio = av_find_best_stream(avf, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0)) < 0)
+        return audio;
+    for (i = 0; i < avf->nb_streams; i++)
+        if (i != audio)
+            avf->streams[i]->discard = AVDISCARD_ALL;
+    return 0;
+}
+
+typedef struct SeekStats {
+    int     nb_seeks;
+    int64_t total;
+    int64_t max;
+} SeekStats;
+
+/*
+ * Seek to a random position and read until every stream that is not
+ * discarded returned a packet, which is what a player needs to resume.
+ */
+static int run_seeks(AVFormatContext *avf, AVLFG *lfg, int nb_seeks, SeekStats *stats)
+{
+    AVPacket packet;
+    int64_t duration = avf->duration, start, elapsed;
+    int i, j, ret, nb_streams, pending;
+    uint8_t *seen;
+
+    if (duration <= 0) {
+        fprintf(stderr, "%s: unknown duration, cannot seek\n", avf->url);
+        return AVERROR(EINVAL);
+    }
+    if (!(seen = av_malloc(avf->nb_streams)))
+        return AVERROR(ENOMEM);
+
+    for (nb_streams = 0, i = 0; i < avf->nb_streams; i++)
+        nb_streams += avf->streams[i]->discard < AVDISCARD_ALL;
+
+    for (i = 0; i < nb_seeks; i++) {
+        int64_t ts = av_rescale(av_lfg_get(lfg), duration, UINT32_MAX);
+
+        if (avf->start_time != AV_NOPTS_VALUE)
+            ts += avf->start_time;
+        memset(seen, 0, avf->nb_streams);
+        pending = nb_streams;
+
+        start = av_gettime_relative();
+        if ((ret = avformat_seek_file(avf, -1, INT64_MIN, ts, INT64_MAX, 0)) < 0)
+            goto end;
+        while (pending > 0 && (ret = av_read_frame(avf, &packet)) >= 0) {
+            j = packet.stream_index;
+            if (!seen[j]) {
+                seen[j] = 1;
+                pending--;
+            }
+            av_packet_unref(&packet);
+        }
+        elapsed = av_gettime_relative() - start;
+        /* a stream may end before the seek target */
+        if (ret < 0 && ret != AVERROR_EOF)
+            goto end;
+
+        stats->nb_seeks++;
+        stats->total += elapsed;
+        stats->max    = FFMAX(stats->max, elapsed);
+    }
+    ret = 0;
+
+end:
+    av_free(seen);
+    return ret;
+}
+
+static int read_pass(const char *filename, AVDictionary *options,
+                     int64_t *nb_packets, int64_t *nb_bytes, int64_t *open_time)
+{
+    AVDictionary *opts = NULL;
+    AVIOContext *pb = NULL;
+    int64_t start = av_gettime_relative();
+    uint8_t *buf;
+    int ret;
+
+    av_dict_copy(&opts, options, 0);
+    ret = avio_open2(&pb, filename, AVIO_FLAG_READ, NULL, &opts);
+    av_dict_free(&opts);
+    if (ret < 0) {
+        fprintf(stderr, "%s: %s\n", filename, av_err2str(ret));
+        return ret;
+    }
+    *open_time += av_gettime_relative() - start;
+
+    if (!(buf = av_malloc(1 << 20))) {
+        avio_closep(&pb);
+        return AVERROR(ENOMEM);
+    }
+    while ((ret = avio_read(pb, buf, 1 << 20)) > 0) {
+        (*nb_packets)++;
+        *nb_bytes += ret;
+    }
+    if (ret == AVERROR_EOF)
+        ret = 0;
+
+    av_free(buf);
+    avio_closep(&pb);
+    return ret;
+}
+
+static int list_pass(const char *url, AVDictionary *options,
+                     int64_t *nb_entries, int64_t *total_size, int64_t *open_time)
+{
+    AVDictionary *opts = NULL;
+    AVIODirContext *ctx = NULL;
+    AVIODirEntry *entry;
+    int64_t start = av_gettime_relative();
+    int ret;
+
+    av_dict_copy(&opts, options, 0);
+    ret = avio_open_dir(&ctx, url, &opts);
+    av_dict_free(&opts);
+    if (ret < 0) {
+        fprintf(stderr, "%s: %s\n", url, av_err2str(ret));
+        return ret;
+    }
+    *open_time += av_gettime_relative() - start;
+
+    while ((ret = avio_read_dir(ctx, &entry)) >= 0 && entry) {
+        (*nb_entries)++;
+        *total_size += FFMAX(entry->size, 0);
+        avio_free_directory_entry(&entry);
+    }
+
+    avio_close_dir(&ctx);
+    return FFMIN(ret, 0);
+}
+
+static int run_pass(const char *filename, const char *output, int audio_only,
+                    AVDictionary *options, int nb_seeks, AVLFG *lfg, SeekStats *seek_stats,
+                    int64_t *nb_packets, int64_t *nb_bytes, int64_t *open_time,
+                    int64_t *first_packet_time)
+{
+    AVFormatContext *avf = NULL, *ofmt = NULL;
+    AVDictionary *opts = NULL;
+    AVPacket packet;
+    int64_t start = av_gettime_relative();
+    int ret, first = 1;
+
+    av_dict_copy(&opts, options, 0);
+    ret = avformat_open_input(&avf, filename, NULL, &opts);
+    av_dict_free(&opts);
+    if (ret < 0) {
+        fprintf(stderr, "%s: %s\n", filename, av_err2str(ret));
+        return ret;
+    }
+    *open_time += av_gettime_relative() - start;
+    if (audio_only && (ret = discard_all_but_audio(avf)) < 0) {
+        fprintf(stderr, "%s: no audio stream\n", filename);
+        goto end;
+    }
+    if (output && (ret = open_output(&ofmt, avf, output)) < 0) {
+        fprintf(stderr, "%s: %s\n", output, av_err2str(ret));
+        goto end;
+    }
+    if (nb_seeks) {
+        ret = run_seeks(avf, lfg, nb_seeks, seek_stats);
+        goto end;
+    }
+
+    while ((ret = av_read_frame(avf, &packet)) >= 0) {
+        if (first) {
+            *first_packet_time += av_gettime_relative() - start;
+            first = 0;
+        }
+        (*nb_packets)++;
+        *nb_bytes += packet.size;
+        if (ofmt) {
+            av_packet_rescale_ts(&packet, avf->streams[packet.stream_index]->time_base,
+                                 ofmt->streams[packet.stream_index]->time_base);
+            packet.pos = -1;
+            if ((ret = av_interleaved_write_frame(ofmt, &packet)) < 0)
+                break;
+        }
+        av_packet_unref(&packet);
+    }
+    if (ret == AVERROR_EOF)
+        ret = 0;
+    if (ofmt && ret >= 0)
+        ret = av_write_trailer(ofmt);
+
+end:
+    close_output(ofmt);
+    avformat_close_input(&avf);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    int opt, ret, i, runs = 1, audio_only = 0, read_only = 0, list = 0, nb_seeks = 0;
+    int64_t nb_packets = 0, nb_bytes = 0, open_time = 0, first_packet_time = 0;
+    int64_t start, elapsed;
+    const char *filename, *output = NULL;
+    SeekStats seek_stats = { 0 };
+    AVDictionary *options = NULL;
+    AVLFG lfg;
+
+    while ((opt = getopt(argc, argv, "ahln:o:O:rs:v")) != -1) {
+        switch (opt) {
+        case 'a':
+            audio_only = 1;
+            break;
+        case 'l':
+            list = 1;
+            break;
+        case 'n':
+            runs = atoi(optarg);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'O':
+            if (av_dict_parse_string(&options, optarg, "=", ":", 0) < 0) {
+                fprintf(stderr, "Invalid options: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'r':
+            read_only = 1;
+            break;
+        case 's':
+            nb_seeks = atoi(optarg);
+            break;
+        case 'v':
+            av_log_set_level(AV_LOG_VERBOSE);
+            break;
+        case 'h':
+            usage(0);
+        default:
+            usage(1);
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (argc != 1 || runs <= 0 || nb_seeks < 0 || (nb_seeks && output) ||
+        ((read_only || list) && (nb_seeks || output || audio_only)) ||
+        (read_only && list))
+        usage(1);
+    filename = *argv;
+    av_lfg_init(&lfg, 0x5eec);
+
+    start = av_gettime_relative();
+    for (i = 0; i < runs; i++) {
+        if (list)
+            ret = list_pass(filename, options, &nb_packets, &nb_bytes, &open_time);
+        else if (read_only)
+            ret = read_pass(filename, options, &nb_packets, &nb_bytes, &open_time);
+        else
+            ret = run_pass(filename, output, audio_only, options, nb_seeks, &lfg,
+                           &seek_stats, &nb_packets, &nb_bytes, &open_time,
+                           &first_packet_time);
+        if (ret < 0) {
+            fprintf(stderr, "%s: %s\n", filename, av_err2str(ret));
+            return 1;
+        }
+    }
+    elapsed = FFMAX(av_gettime_relative() - start, 1);
+    av_dict_free(&options);
+
+    if (list) {
+        printf("%"PRId64" entries, %"PRId64" bytes in %.3f s: %.0f entries/s\n",
+               nb_packets, nb_bytes, elapsed / 1000000.0,
+               nb_packets * 1000000.0 / elapsed);
+        printf("open: %.1f ms per run\n", open_time / 1000.0 / runs);
+        return 0;
+    }
+    if (nb_seeks) {
+        printf("%d seeks: %.1f ms average, %.1f ms max\n", seek_stats.nb_seeks,
+               seek_stats.total / 1000.0 / FFMAX(seek_stats.nb_seeks, 1),
+               seek_stats.max / 1000.0);
+        printf("open: %.1f ms per run\n", open_time / 1000.0 / runs);
+        return 0;
+    }
+
+    printf("%"PRId64" packets, %"PRId64" bytes in %.3f s: %.0f packets/s, %.2f MiB/s\n",
+           nb_packets, nb_bytes, elapsed / 1000000.0,
+           nb_packets * 1000000.0 / elapsed,
+           nb_bytes * 1000000.0 / elapsed / (1 << 20));
+    printf("open: %.1f ms per run\n", open_time / 1000.0 / runs);
+    if (!read_only)
+        printf("first packet: %.1f ms per run\n", first_packet_time / 1000.0 / runs);
+    return 0;
+}
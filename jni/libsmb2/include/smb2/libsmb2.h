@@ -74,6 +74,7 @@ struct smb2_statvfs {
 struct smb2dirent {
         const char *name;
         struct smb2_stat_64 st;
+        uint32_t file_attributes;       /* SMB2_FILE_ATTRIBUTE_* */
 };
 
 #ifdef _MSC_VER
@@ -450,6 +451,16 @@ struct smb2dir;
 int smb2_opendir_async(struct smb2_context *smb2, const char *path,
                        smb2_command_cb cb, void *cb_data);
 
+/*
+ * Same as smb2_opendir_async(), but stops sending QUERY_DIRECTORY requests
+ * once at least max_entries entries, "." and ".." included, have been
+ * received. The directory may then hold more than max_entries entries,
+ * those of the last reply. 0 lists the whole directory.
+ */
+int smb2_opendir_max_async(struct smb2_context *smb2, const char *path,
+                           int max_entries, smb2_command_cb cb,
+                           void *cb_data);
+
 /*
  * Sync opendir()
  *
@@ -0,0 +1,186 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation; either version 2.1 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include <string.h>
+
+#include "aes-ni.h"
+
+#ifdef HAVE_AESNI
+
+#include <cpuid.h>
+#include <tmmintrin.h>
+#include <wmmintrin.h>
+
+#define AESNI_TARGET __attribute__((target("aes,ssse3")))
+
+static int aesni_state;
+
+/* Probed once when the library is loaded, before any thread can use it. */
+static void __attribute__((constructor)) aesni_probe(void)
+{
+        unsigned int eax, ebx, ecx, edx;
+
+        if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+                aesni_state = (ecx & bit_AES) && (ecx & bit_SSSE3);
+        }
+}
+
+int aesni_available(void)
+{
+        return aesni_state;
+}
+
+void aesni_set_enabled(int enabled)
+{
+        aesni_state = 0;
+        if (enabled) {
+                aesni_probe();
+        }
+}
+
+#define LOAD_ROUND_KEYS(rk, round_key)                                  \
+        do {                                                            \
+                int k_;                                                 \
+                for (k_ = 0; k_ < 11; k_++) {                           \
+                        rk[k_] = _mm_loadu_si128((const __m128i *)      \
+                                                 (round_key + 16 * k_));\
+                }                                                       \
+        } while (0)
+
+static inline AESNI_TARGET __m128i aesni_encrypt(const __m128i *rk, __m128i x)
+{
+        int i;
+
+        x = _mm_xor_si128(x, rk[0]);
+        for (i = 1; i < 10; i++) {
+                x = _mm_aesenc_si128(x, rk[i]);
+        }
+        return _mm_aesenclast_si128(x, rk[10]);
+}
+
+AESNI_TARGET
+void aesni_encrypt_block(const uint8_t *round_key,
+                         const uint8_t *in, uint8_t *out)
+{
+        __m128i rk[11];
+
+        LOAD_ROUND_KEYS(rk, round_key);
+        _mm_storeu_si128((__m128i *)out,
+                         aesni_encrypt(rk, _mm_loadu_si128((const __m128i *)in)));
+}
+
+AESNI_TARGET
+void aesni_cbc_mac(const uint8_t *round_key, uint8_t *mac,
+                   const uint8_t *data, size_t nblocks)
+{
+        __m128i rk[11];
+        __m128i y = _mm_loadu_si128((const __m128i *)mac);
+
+        LOAD_ROUND_KEYS(rk, round_key);
+        while (nblocks--) {
+                y = _mm_xor_si128(y, _mm_loadu_si128((const __m128i *)data));
+                y = aesni_encrypt(rk, y);
+                data += 16;
+        }
+        _mm_storeu_si128((__m128i *)mac, y);
+}
+
+/*
+ * The CBC-MAC is a serial chain, so on its own it only keeps one AES unit
+ * busy. Each step below runs the MAC of one block and the counter mode
+ * keystream of a block through the rounds together; the keystream is then
+ * nearly free. When decrypting the MAC needs the plaintext, so the
+ * keystream is computed one block ahead.
+ */
+AESNI_TARGET
+void aesni_ccm_crypt(const uint8_t *round_key, uint8_t *mac,
+                     const uint8_t *ctr, uint8_t *buf, size_t len,
+                     int decrypt)
+{
+        const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+                                           8, 9, 10, 11, 12, 13, 14, 15);
+        const __m128i one = _mm_set_epi32(0, 0, 0, 1);
+        __m128i rk[11];
+        __m128i y = _mm_loadu_si128((const __m128i *)mac);
+        /* byte reversed, so the big-endian counter is the low lane */
+        __m128i c = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)ctr),
+                                     bswap);
+        __m128i k = _mm_setzero_si128();
+        int i;
+
+        LOAD_ROUND_KEYS(rk, round_key);
+
+        if (decrypt && len) {
+                k = aesni_encrypt(rk, _mm_shuffle_epi8(c, bswap));
+                c = _mm_add_epi32(c, one);
+        }
+
+        for (; len >= 16; len -= 16, buf += 16) {
+                __m128i x = _mm_loadu_si128((const __m128i *)buf);
+                __m128i s = _mm_xor_si128(_mm_shuffle_epi8(c, bswap), rk[0]);
+
+                c = _mm_add_epi32(c, one);
+                if (decrypt) {
+                        x = _mm_xor_si128(x, k);
+                        _mm_storeu_si128((__m128i *)buf, x);
+                }
+                y = _mm_xor_si128(_mm_xor_si128(y, x), rk[0]);
+                for (i = 1; i < 10; i++) {
+                        y = _mm_aesenc_si128(y, rk[i]);
+                        s = _mm_aesenc_si128(s, rk[i]);
+                }
+                y = _mm_aesenclast_si128(y, rk[10]);
+                s = _mm_aesenclast_si128(s, rk[10]);
+                if (decrypt) {
+                        k = s;
+                } else {
+                        _mm_storeu_si128((__m128i *)buf, _mm_xor_si128(x, s));
+                }
+        }
+
+        if (len) {
+                uint8_t tmp[16];
+
+                if (!decrypt) {
+                        k = aesni_encrypt(rk, _mm_shuffle_epi8(c, bswap));
+                }
+                memset(tmp, 0, sizeof(tmp));
+                memcpy(tmp, buf, len);
+                if (decrypt) {
+                        _mm_storeu_si128((__m128i *)tmp,
+                                         _mm_xor_si128(_mm_loadu_si128((__m128i *)tmp), k));
+                        memset(tmp + len, 0, sizeof(tmp) - len);
+                        memcpy(buf, tmp, len);
+                }
+                y = aesni_encrypt(rk, _mm_xor_si128(y, _mm_loadu_si128((__m128i *)tmp)));
+                if (!decrypt) {
+                        _mm_storeu_si128((__m128i *)tmp,
+                                         _mm_xor_si128(_mm_loadu_si128((__m128i *)tmp), k));
+                        memcpy(buf, tmp, len);
+                }
+        }
+
+        _mm_storeu_si128((__m128i *)mac, y);
+}
+
+#endif /* HAVE_AESNI */
@@ -0,0 +1,77 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+#ifndef _AES_NI_H_
+#define _AES_NI_H_
+
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation; either version 2.1 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stddef.h>
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * AES-128 with the x86 AES-NI instructions, for the SMB3 encryption and
+ * signing hot paths. The functions take the round keys computed by
+ * AES128_expand_key() and must only be called if aesni_available()
+ * returned non-zero.
+ *
+ * The code is built with per-function target attributes, so the rest of
+ * the library does not need to be compiled for a newer CPU.
+ */
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__GNUC__) || defined(__clang__)) && \
+    !defined(ESP_PLATFORM) && !defined(PS2_EE_PLATFORM)
+#define HAVE_AESNI 1
+
+int aesni_available(void);
+
+/*
+ * Override the CPU detection, for testing the portable code. Not thread
+ * safe, call it before using the library.
+ */
+void aesni_set_enabled(int enabled);
+
+void aesni_encrypt_block(const uint8_t *round_key,
+                         const uint8_t *in, uint8_t *out);
+
+/*
+ * CBC-MAC: for each of the nblocks 16 byte blocks of data,
+ * mac = AES(mac ^ block).
+ */
+void aesni_cbc_mac(const uint8_t *round_key, uint8_t *mac,
+                   const uint8_t *data, size_t nblocks);
+
+/*
+ * The payload part of AES-CCM: encrypt or decrypt buf in place in counter
+ * mode, starting with the counter block ctr (the 32-bit big-endian counter
+ * is in its last 4 bytes), and update the CBC-MAC in mac with the
+ * plaintext. The last block may be partial and is zero padded for the MAC.
+ */
+void aesni_ccm_crypt(const uint8_t *round_key, uint8_t *mac,
+                     const uint8_t *ctr, uint8_t *buf, size_t len,
+                     int decrypt);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _AES_NI_H_ */
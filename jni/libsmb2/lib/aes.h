@@ -34,6 +34,13 @@
 void AES128_ECB_encrypt(uint8_t* input, const uint8_t* key, uint8_t *output);
 void AES128_ECB_decrypt(uint8_t* input, const uint8_t* key, uint8_t *output);
 
+// Size of the expanded key (11 round keys), in the layout the AES-NI
+// instructions use as well.
+#define AES128_ROUND_KEY_SIZE 176
+
+void AES128_expand_key(const uint8_t* key, uint8_t* roundKey);
+void AES128_encrypt_block(const uint8_t* roundKey, const uint8_t* input, uint8_t* output);
+
 #endif // #if defined(ECB) && ECB
 
 
@@ -34,6 +34,8 @@
 
 #include "portable-endian.h"
 #include "aes.h"
+#include "aes-ni.h"
+#include "aes128ccm.h"
 
 static void aes_ccm_generate_b0(unsigned char *nonce, int nlen,
                                 int alen, int plen, int mlen,
@@ -53,7 +55,7 @@ static void aes_ccm_generate_b0(unsigned char *nonce, int nlen,
         memcpy(&buf[1], nonce, nlen);
 }
 
-static inline void bxory(unsigned char *b, unsigned char *y, int num)
+static inline void bxory(unsigned char *b, const unsigned char *y, int num)
 {
         int i;
 
@@ -62,19 +64,44 @@ static inline void bxory(unsigned char *b, unsigned char *y, int num)
         }
 }
 
-static void ccm_generate_T(unsigned char *key,
+static void ccm_generate_a(unsigned char *nonce, int nlen, uint32_t i,
+                           unsigned char *a)
+{
+        uint32_t l;
+
+        memset(a, 0, 16);
+        a[0] |= (15 - nlen - 1) & 0x07;
+
+        l = htobe32(i);
+        memcpy(&a[12], &l, 4);
+
+        memcpy(&a[1], nonce, nlen);
+}
+
+static void aes_encrypt(const unsigned char *rk, const unsigned char *in,
+                        unsigned char *out)
+{
+#ifdef HAVE_AESNI
+        if (aesni_available()) {
+                aesni_encrypt_block(rk, in, out);
+                return;
+        }
+#endif
+        AES128_encrypt_block(rk, in, out);
+}
+
+/* CBC-MAC of B0 and of the formatted additional data */
+static void ccm_mac_header(const unsigned char *rk,
                            unsigned char *nonce, int nlen,
                            unsigned char *aad, int alen,
-                           unsigned char *p, int plen,
-                           unsigned char *m, int mlen)
+                           int plen, int mlen, unsigned char *y)
 {
-        unsigned char b[16], y[16];
+        unsigned char b[16];
         uint16_t l;
 
         aes_ccm_generate_b0(nonce, nlen, alen, plen, mlen, &b[0]);
-        AES128_ECB_encrypt(b, key, y);
+        aes_encrypt(rk, b, y);
 
-        /* Create Aad */
         if (alen) {
                 /* First block */
                 memset(b, 0, 16);
@@ -86,8 +113,8 @@ static void ccm_generate_T(unsigned char *key,
                 aad  += l;
                 alen -= l;
 
-                bxory(b, y, 16);
-                AES128_ECB_encrypt(b, key, y);
+                bxory(y, b, 16);
+                aes_encrypt(rk, y, y);
 
                 while (alen) {
                         memset(b, 0, 16);
@@ -96,56 +123,51 @@ static void ccm_generate_T(unsigned char *key,
                         aad  += l;
                         alen -= l;
 
-                        bxory(b, y, 16);
-                        AES128_ECB_encrypt(b, key, y);
+                        bxory(y, b, 16);
+                        aes_encrypt(rk, y, y);
                 }
         }
-
-        /* Create Payload */
-        while (plen) {
-                memset(b, 0, 16);
-                l = (plen > 16) ? 16 : plen;
-                memcpy(b, p, l);
-                p    += l;
-                plen -= l;
-
-                bxory(b, y, 16);
-                AES128_ECB_encrypt(b, key, y);
-        }
-
-        memcpy(m, y, mlen);
 }
 
-static void ccm_generate_s(unsigned char *key, unsigned char *nonce, int nlen,
-                           int plen, int i, unsigned char *s)
-{
-        uint32_t l;
-
-        memset(s, 0, 16);
-        s[0] |= (15 - nlen - 1) & 0x07;
-
-        l = htobe32(i);
-        memcpy(&s[12], &l, 4);
-
-        memcpy(&s[1], nonce, nlen);
-
-        AES128_ECB_encrypt(s, key, s);
-}
-
-static void aes_ccm_crypt(unsigned char *key,
-                          unsigned char *nonce, int nlen,
-                          unsigned char *p, int plen)
+/*
+ * Counter mode over the payload, starting with the counter block a, and
+ * CBC-MAC of the plaintext into y.
+ */
+static void ccm_crypt(const unsigned char *rk, unsigned char *y,
+                      unsigned char *a, unsigned char *p, int plen,
+                      int decrypt)
 {
-        int j, l;
-        unsigned char s[16];
+        unsigned char b[16], s[16];
+        uint32_t ctr, u32;
+        int l;
+
+#ifdef HAVE_AESNI
+        if (aesni_available()) {
+                aesni_ccm_crypt(rk, y, a, p, plen, decrypt);
+                return;
+        }
+#endif
+        memcpy(&ctr, &a[12], 4);
+        ctr = be32toh(ctr);
 
-        j = 0;
         while (plen) {
                 l = (plen > 16) ? 16 : plen;
-                ccm_generate_s(key, nonce, nlen, plen, j + 1, &s[0]);
-                bxory(&p[j * 16], &s[0], l);
+                aes_encrypt(rk, a, s);
+                u32 = htobe32(++ctr);
+                memcpy(&a[12], &u32, 4);
 
-                j++;
+                if (decrypt) {
+                        bxory(p, s, l);
+                }
+                memset(b, 0, 16);
+                memcpy(b, p, l);
+                bxory(y, b, 16);
+                aes_encrypt(rk, y, y);
+                if (!decrypt) {
+                        bxory(p, s, l);
+                }
+
+                p    += l;
                 plen -= l;
         }
 }
@@ -156,13 +178,19 @@ void aes128ccm_encrypt(unsigned char *key,
                        unsigned char *p, int plen,
                        unsigned char *m, int mlen)
 {
-        unsigned char s[16];
+        unsigned char rk[AES128_ROUND_KEY_SIZE];
+        unsigned char a[16], s[16], y[16];
+
+        AES128_expand_key(key, rk);
 
-        ccm_generate_T(key, nonce, nlen, aad, alen, p, plen, m, mlen);
-        ccm_generate_s(key, nonce, nlen, plen, 0, &s[0]);
-        bxory(m, &s[0], mlen);
+        ccm_mac_header(rk, nonce, nlen, aad, alen, plen, mlen, y);
+        ccm_generate_a(nonce, nlen, 1, a);
+        ccm_crypt(rk, y, a, p, plen, 0);
 
-        aes_ccm_crypt(key, nonce, nlen, p, plen);
+        ccm_generate_a(nonce, nlen, 0, a);
+        aes_encrypt(rk, a, s);
+        bxory(y, s, mlen);
+        memcpy(m, y, mlen);
 }
 
 int aes128ccm_decrypt(unsigned char *key,
@@ -171,14 +199,18 @@ int aes128ccm_decrypt(unsigned char *key,
                       unsigned char *p, int plen,
                       unsigned char *m, int mlen)
 {
-        unsigned char s[16];
-        unsigned char tmp[16];
+        unsigned char rk[AES128_ROUND_KEY_SIZE];
+        unsigned char a[16], s[16], y[16];
+
+        AES128_expand_key(key, rk);
 
-        aes_ccm_crypt(key, nonce, nlen, p, plen);
+        ccm_mac_header(rk, nonce, nlen, aad, alen, plen, mlen, y);
+        ccm_generate_a(nonce, nlen, 1, a);
+        ccm_crypt(rk, y, a, p, plen, 1);
 
-        ccm_generate_T(key, nonce, nlen, aad, alen, p, plen, tmp, mlen);
-        ccm_generate_s(key, nonce, nlen, plen, 0, &s[0]);
-        bxory(tmp, &s[0], mlen);
+        ccm_generate_a(nonce, nlen, 0, a);
+        aes_encrypt(rk, a, s);
+        bxory(y, s, mlen);
 
-        return memcmp(tmp, m, mlen);
+        return memcmp(y, m, mlen);
 }
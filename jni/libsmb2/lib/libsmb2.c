@@ -94,6 +94,9 @@
 #define DEFAULT_OUTPUT_BUFFER_LENGTH 0xffff
 #endif
 
+/* Upper bound for the QUERY_DIRECTORY output buffer */
+#define MAX_QUERY_DIRECTORY_LENGTH (1024 * 1024)
+
 /* strings used to derive SMB signing and encryption keys */
 static const char SMBSigningKey[] = "SMBSigningKey";
 static const char SMBC2SCipherKey[] = "SMBC2SCipherKey";
@@ -151,6 +154,8 @@ struct smb2dir {
         struct smb2_dirent_internal *entries;
         struct smb2_dirent_internal *current_entry;
         int index;
+        int nb_entries;
+        int max_entries;        /* stop listing after that many, 0 for all */
 };
 
 struct smb2fh {
@@ -300,7 +305,7 @@ decode_dirents(struct smb2_context *smb2, struct smb2dir *dir,
                         return -1;
                 }
                 SMB2_LIST_ADD(&dir->entries, ent);
-
+                dir->nb_entries++;
 
                 tmp_vec.buf = &vec->buf[offset];
                 tmp_vec.len = vec->len - offset;
@@ -316,6 +321,7 @@ decode_dirents(struct smb2_context *smb2, struct smb2dir *dir,
                 if (fs.file_attributes & SMB2_FILE_ATTRIBUTE_REPARSE_POINT) {
                         ent->dirent.st.smb2_type = SMB2_TYPE_LINK;
                 }
+                ent->dirent.file_attributes = fs.file_attributes;
                 ent->dirent.st.smb2_nlink = 0;
                 ent->dirent.st.smb2_ino = fs.file_id;
                 ent->dirent.st.smb2_size = fs.end_of_file;
@@ -334,11 +340,34 @@ decode_dirents(struct smb2_context *smb2, struct smb2dir *dir,
         return 0;
 }
 
+/*
+ * Large directories are listed with fewer round trips if the server
+ * supports multi-credit requests. The buffer is limited by the credits
+ * available right now, the request could never be sent otherwise.
+ */
+static uint32_t
+query_directory_length(struct smb2_context *smb2)
+{
+        uint32_t length = DEFAULT_OUTPUT_BUFFER_LENGTH;
+
+#if !defined(ESP_PLATFORM) && !defined(PS2_EE_PLATFORM) && !defined(PS2_IOP_PLATFORM)
+        if (smb2->supports_multi_credit &&
+            smb2->max_transact_size > DEFAULT_OUTPUT_BUFFER_LENGTH &&
+            smb2->credits > 1) {
+                length = MIN(smb2->max_transact_size,
+                             MAX_QUERY_DIRECTORY_LENGTH);
+                length = MIN(length, (uint32_t)smb2->credits * 65536);
+        }
+#endif
+        return length;
+}
+
 static void
 od_close_cb(struct smb2_context *smb2, int status,
          void *command_data, void *private_data)
 {
         struct smb2dir *dir = private_data;
+        struct smb2_dirent_internal *ent, *next, *entries = NULL;
 
         if (status != SMB2_STATUS_SUCCESS) {
                 dir->cb(smb2, -ENOMEM, NULL, dir->cb_data);
@@ -346,6 +375,12 @@ od_close_cb(struct smb2_context *smb2, int status,
                 return;
         }
 
+        /* entries were prepended, return them in the server's order */
+        for (ent = dir->entries; ent; ent = next) {
+                next = ent->next;
+                SMB2_LIST_ADD(&entries, ent);
+        }
+        dir->entries = entries;
         dir->current_entry = dir->entries;
         dir->index = 0;
 
@@ -353,6 +388,25 @@ od_close_cb(struct smb2_context *smb2, int status,
         dir->cb(smb2, 0, dir, dir->cb_data);
 }
 
+static void
+od_close(struct smb2_context *smb2, struct smb2dir *dir)
+{
+        struct smb2_close_request req;
+        struct smb2_pdu *pdu;
+
+        memset(&req, 0, sizeof(struct smb2_close_request));
+        req.flags = SMB2_CLOSE_FLAG_POSTQUERY_ATTRIB;
+        memcpy(req.file_id, dir->file_id, SMB2_FD_SIZE);
+
+        pdu = smb2_cmd_close_async(smb2, &req, od_close_cb, dir);
+        if (pdu == NULL) {
+                dir->cb(smb2, -ENOMEM, NULL, dir->cb_data);
+                free_smb2dir(smb2, dir);
+                return;
+        }
+        smb2_queue_pdu(smb2, pdu);
+}
+
 static void
 query_cb(struct smb2_context *smb2, int status,
          void *command_data, void *private_data)
@@ -374,12 +428,18 @@ query_cb(struct smb2_context *smb2, int status,
                         return;
                 }
 
+                if (dir->max_entries &&
+                    dir->nb_entries >= dir->max_entries) {
+                        od_close(smb2, dir);
+                        return;
+                }
+
                 /* We need to get more data */
                 memset(&req, 0, sizeof(struct smb2_query_directory_request));
                 req.file_information_class = SMB2_FILE_ID_FULL_DIRECTORY_INFORMATION;
                 req.flags = 0;
                 memcpy(req.file_id, dir->file_id, SMB2_FD_SIZE);
-                req.output_buffer_length = DEFAULT_OUTPUT_BUFFER_LENGTH;
+                req.output_buffer_length = query_directory_length(smb2);
                 req.name = "*";
 
                 pdu = smb2_cmd_query_directory_async(smb2, &req, query_cb, dir);
@@ -394,22 +454,8 @@ query_cb(struct smb2_context *smb2, int status,
         }
 
         if (status == SMB2_STATUS_NO_MORE_FILES) {
-                struct smb2_close_request req;
-                struct smb2_pdu *pdu;
-
                 /* We have all the data */
-                memset(&req, 0, sizeof(struct smb2_close_request));
-                req.flags = SMB2_CLOSE_FLAG_POSTQUERY_ATTRIB;
-                memcpy(req.file_id, dir->file_id, SMB2_FD_SIZE);
-
-                pdu = smb2_cmd_close_async(smb2, &req, od_close_cb, dir);
-                if (pdu == NULL) {
-                        dir->cb(smb2, -ENOMEM, NULL, dir->cb_data);
-                        free_smb2dir(smb2, dir);
-                        return;
-                }
-                smb2_queue_pdu(smb2, pdu);
-
+                od_close(smb2, dir);
                 return;
         }
 
@@ -443,7 +489,7 @@ opendir_cb(struct smb2_context *smb2, int status,
         req.file_information_class = SMB2_FILE_ID_FULL_DIRECTORY_INFORMATION;
         req.flags = 0;
         memcpy(req.file_id, dir->file_id, SMB2_FD_SIZE);
-        req.output_buffer_length = DEFAULT_OUTPUT_BUFFER_LENGTH;
+        req.output_buffer_length = query_directory_length(smb2);
         req.name = "*";
 
         pdu = smb2_cmd_query_directory_async(smb2, &req, query_cb, dir);
@@ -459,6 +505,13 @@ opendir_cb(struct smb2_context *smb2, int status,
 int
 smb2_opendir_async(struct smb2_context *smb2, const char *path,
                    smb2_command_cb cb, void *cb_data)
+{
+        return smb2_opendir_max_async(smb2, path, 0, cb, cb_data);
+}
+
+int
+smb2_opendir_max_async(struct smb2_context *smb2, const char *path,
+                       int max_entries, smb2_command_cb cb, void *cb_data)
 {
         struct smb2_create_request req;
         struct smb2dir *dir;
@@ -480,6 +533,7 @@ smb2_opendir_async(struct smb2_context *smb2, const char *path,
         SMB2_LIST_ADD(&smb2->dirs, dir);
         dir->cb = cb;
         dir->cb_data = cb_data;
+        dir->max_entries = max_entries;
 
         memset(&req, 0, sizeof(struct smb2_create_request));
         req.requested_oplock_level = SMB2_OPLOCK_LEVEL_NONE;
@@ -59,6 +59,7 @@
 #define CBC 1
 
 #include "aes.h"
+#include "aes-ni.h"
 #include "sha.h"
 #include "sha-private.h"
 
@@ -94,17 +95,46 @@ void aes_cmac_xor(
         }
 }
 
+static void
+aes_cmac_encrypt(const uint8_t *rk, uint8_t block[AES_BLOCK_SIZE])
+{
+#ifdef HAVE_AESNI
+        if (aesni_available()) {
+                aesni_encrypt_block(rk, block, block);
+                return;
+        }
+#endif
+        AES128_encrypt_block(rk, block, block);
+}
+
+static void
+aes_cmac_blocks(const uint8_t *rk, uint8_t mac[AES_BLOCK_SIZE],
+                const uint8_t *msg, size_t nblocks)
+{
+#ifdef HAVE_AESNI
+        if (aesni_available()) {
+                aesni_cbc_mac(rk, mac, msg, nblocks);
+                return;
+        }
+#endif
+        while (nblocks--) {
+                aes_cmac_xor(mac, msg);
+                AES128_encrypt_block(rk, mac, mac);
+                msg += AES_BLOCK_SIZE;
+        }
+}
+
 static
 void aes_cmac_sub_keys(
-    uint8_t key[AES128_KEY_LEN],
+    const uint8_t *rk,
     uint8_t sub_key1[AES128_KEY_LEN],
     uint8_t sub_key2[AES128_KEY_LEN]
     )
 {
-        uint8_t zero[AES128_KEY_LEN] = {0};
         static const uint8_t rb[AES128_KEY_LEN] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0x87};
 
-        AES128_ECB_encrypt(zero, key, sub_key1);
+        memset(sub_key1, 0, AES128_KEY_LEN);
+        aes_cmac_encrypt(rk, sub_key1);
         if (aes_cmac_shift_left(sub_key1)) {
                 aes_cmac_xor(sub_key1, rb);
         }
@@ -116,47 +146,85 @@ void aes_cmac_sub_keys(
         }
 }
 
-void smb3_aes_cmac_128(uint8_t key[AES128_KEY_LEN],
-                   uint8_t * msg,
-                   uint64_t msg_len,
-                   uint8_t mac[AES128_KEY_LEN]
-                  )
+/*
+ * Incremental AES-CMAC, so that a PDU can be signed straight from its
+ * iovectors. The last block gets a different treatment, so up to one full
+ * block is kept back in buf until aes_cmac_final().
+ */
+struct aes_cmac_ctx {
+        uint8_t rk[AES128_ROUND_KEY_SIZE];
+        uint8_t mac[AES_BLOCK_SIZE];
+        uint8_t buf[AES_BLOCK_SIZE];
+        size_t len;
+};
+
+static void
+aes_cmac_init(struct aes_cmac_ctx *ctx, const uint8_t key[AES128_KEY_LEN])
 {
-        uint8_t sub_key1[AES128_KEY_LEN] = {0};
-        uint8_t sub_key2[AES128_KEY_LEN] = {0};
-        uint8_t scratch[AES128_KEY_LEN] = {0};
-        uint64_t n = (msg_len + AES128_KEY_LEN - 1) / AES128_KEY_LEN;
-        uint64_t rem = msg_len % AES128_KEY_LEN;
-        uint64_t i = 0;
-        int is_last_block_complete = n != 0 && rem == 0;
-
-        if (n == 0) {
-                n = 1;
-        }
-
-        aes_cmac_sub_keys(key, sub_key1, sub_key2);
+        AES128_expand_key(key, ctx->rk);
+        memset(ctx->mac, 0, AES_BLOCK_SIZE);
+        ctx->len = 0;
+}
 
-        memset(mac, 0, AES128_KEY_LEN);
+static void
+aes_cmac_update(struct aes_cmac_ctx *ctx, const uint8_t *msg, size_t len)
+{
+        size_t l;
 
-        for (i = 0; i < n - 1; i++) {
-                aes_cmac_xor(mac, &msg[i*AES128_KEY_LEN]);
-                AES128_ECB_encrypt(mac, key, scratch);
-                memcpy(mac, scratch, AES128_KEY_LEN);
+        while (len) {
+                if (ctx->len == AES_BLOCK_SIZE) {
+                        aes_cmac_blocks(ctx->rk, ctx->mac, ctx->buf, 1);
+                        ctx->len = 0;
+                }
+                if (ctx->len == 0 && len > AES_BLOCK_SIZE) {
+                        /* everything but the last block of msg */
+                        l = (len - 1) / AES_BLOCK_SIZE;
+                        aes_cmac_blocks(ctx->rk, ctx->mac, msg, l);
+                        msg += l * AES_BLOCK_SIZE;
+                        len -= l * AES_BLOCK_SIZE;
+                }
+                l = AES_BLOCK_SIZE - ctx->len;
+                if (l > len) {
+                        l = len;
+                }
+                memcpy(ctx->buf + ctx->len, msg, l);
+                ctx->len += l;
+                msg += l;
+                len -= l;
         }
+}
+
+static void
+aes_cmac_final(struct aes_cmac_ctx *ctx, uint8_t mac[AES128_KEY_LEN])
+{
+        uint8_t sub_key1[AES128_KEY_LEN];
+        uint8_t sub_key2[AES128_KEY_LEN];
 
-        if (is_last_block_complete) {
-                memcpy(scratch, &msg[i*AES128_KEY_LEN], AES128_KEY_LEN);
-                aes_cmac_xor(scratch, sub_key1);
+        aes_cmac_sub_keys(ctx->rk, sub_key1, sub_key2);
+
+        if (ctx->len == AES_BLOCK_SIZE) {
+                aes_cmac_xor(ctx->buf, sub_key1);
         } else {
-                memcpy(scratch, &msg[i*AES128_KEY_LEN], rem);
-                scratch[rem] = 0x80;
-                memset(&scratch[rem + 1], 0, AES128_KEY_LEN - (rem + 1));
-                aes_cmac_xor(scratch, sub_key2);
+                ctx->buf[ctx->len] = 0x80;
+                memset(&ctx->buf[ctx->len + 1], 0,
+                       AES_BLOCK_SIZE - (ctx->len + 1));
+                aes_cmac_xor(ctx->buf, sub_key2);
         }
+        aes_cmac_blocks(ctx->rk, ctx->mac, ctx->buf, 1);
+        memcpy(mac, ctx->mac, AES128_KEY_LEN);
+}
 
-        aes_cmac_xor(mac, scratch);
-        AES128_ECB_encrypt(mac, key, scratch);
-        memcpy(mac, scratch, AES128_KEY_LEN);
+void smb3_aes_cmac_128(uint8_t key[AES128_KEY_LEN],
+                   uint8_t * msg,
+                   uint64_t msg_len,
+                   uint8_t mac[AES128_KEY_LEN]
+                  )
+{
+        struct aes_cmac_ctx ctx;
+
+        aes_cmac_init(&ctx, key);
+        aes_cmac_update(&ctx, msg, msg_len);
+        aes_cmac_final(&ctx, mac);
 }
 
 int
@@ -168,27 +236,15 @@ smb2_calc_signature(struct smb2_context *smb2, uint8_t *signature,
         memset(iov[0].buf + 48, 0, 16);
 
         if (smb2->dialect > SMB2_VERSION_0210) {
-                int i = 0, offset = 0, len = 0;
+                struct aes_cmac_ctx ctx;
                 uint8_t aes_mac[AES_BLOCK_SIZE];
-                /* combine the buffers into one */
-                uint8_t *msg = NULL;
-
-                for (i=0; i < niov; i++) {
-                        len += iov[i].len;
-                }
-                msg = (uint8_t *) malloc(len);
-                if (msg == NULL) {
-                        smb2_set_error(smb2, "Failed to allocate buffer for "
-                                       "signature calculation");
-                        return -1;
-                }
+                int i;
 
-                for (i=0; i < niov; i++) {
-                        memcpy(msg + offset, iov[i].buf, iov[i].len);
-                        offset += iov[i].len;
+                aes_cmac_init(&ctx, smb2->signing_key);
+                for (i = 0; i < niov; i++) {
+                        aes_cmac_update(&ctx, iov[i].buf, iov[i].len);
                 }
-                smb3_aes_cmac_128(smb2->signing_key, msg, offset, aes_mac);
-                free(msg);
+                aes_cmac_final(&ctx, aes_mac);
                 memcpy(&signature[0], aes_mac, SMB2_SIGNATURE_SIZE);
         } else {
                 HMACContext ctx;
@@ -0,0 +1,149 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/*
+ * Throughput of the SMB3 AES-128-CCM code, with and without AES-NI.
+ *
+ * Both code paths are first checked against each other on random
+ * payloads, then each one encrypts and decrypts a READ-sized buffer for a
+ * second. Build from this directory with:
+ *
+ *   cc -O2 -DHAVE_STDINT_H -I../lib -I../include aes128ccm-speed.c \
+ *      ../lib/aes.c ../lib/aes128ccm.c ../lib/aes-ni.c -o aes128ccm-speed
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "aes-ni.h"
+#include "aes128ccm.h"
+
+#define PAYLOAD_SIZE (1024 * 1024)
+
+static double now(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void set_accel(int enabled)
+{
+#ifdef HAVE_AESNI
+        aesni_set_enabled(enabled);
+#endif
+}
+
+#ifdef HAVE_AESNI
+static int check(unsigned char *key, unsigned char *nonce, unsigned char *aad,
+                 unsigned char *ref, unsigned char *buf, int len)
+{
+        unsigned char m_ref[16], m_new[16];
+        unsigned char *p = buf + len;
+
+        /* the C code is the reference */
+        memcpy(p, ref, len);
+        memcpy(buf, ref, len);
+        set_accel(0);
+        aes128ccm_encrypt(key, nonce, 11, aad, 32, p, len, m_ref, 16);
+        set_accel(1);
+        aes128ccm_encrypt(key, nonce, 11, aad, 32, buf, len, m_new, 16);
+        if (memcmp(buf, p, len) || memcmp(m_ref, m_new, 16)) {
+                printf("encrypt mismatch, %d bytes\n", len);
+                return -1;
+        }
+        if (aes128ccm_decrypt(key, nonce, 11, aad, 32, buf, len, m_new, 16) ||
+            memcmp(buf, ref, len)) {
+                printf("decrypt mismatch, %d bytes\n", len);
+                return -1;
+        }
+        if (len == 0) {
+                return 0;
+        }
+        buf[len / 2] ^= 1;
+        if (!aes128ccm_decrypt(key, nonce, 11, aad, 32, buf, len, m_ref, 16)) {
+                printf("forged payload accepted, %d bytes\n", len);
+                return -1;
+        }
+        return 0;
+}
+#endif
+
+static void bench(const char *name, unsigned char *key, unsigned char *nonce,
+                  unsigned char *aad, unsigned char *buf)
+{
+        unsigned char m[16];
+        double start = now(), t;
+        int n = 0;
+
+        do {
+                aes128ccm_encrypt(key, nonce, 11, aad, 32,
+                                  buf, PAYLOAD_SIZE, m, 16);
+                aes128ccm_decrypt(key, nonce, 11, aad, 32,
+                                  buf, PAYLOAD_SIZE, m, 16);
+                n += 2;
+                t = now() - start;
+        } while (t < 1.0);
+
+        printf("%-8s %8.1f MB/s\n", name, n * (PAYLOAD_SIZE / 1e6) / t);
+}
+
+int main(int argc, char *argv[])
+{
+        unsigned char key[16], nonce[11], aad[32];
+        unsigned char *ref, *buf;
+        int i;
+
+        ref = malloc(PAYLOAD_SIZE);
+        buf = malloc(2 * PAYLOAD_SIZE);
+        if (ref == NULL || buf == NULL) {
+                return 1;
+        }
+
+        srand(1);
+        for (i = 0; i < 16; i++) {
+                key[i] = rand();
+        }
+        for (i = 0; i < 11; i++) {
+                nonce[i] = rand();
+        }
+        for (i = 0; i < 32; i++) {
+                aad[i] = rand();
+        }
+        for (i = 0; i < PAYLOAD_SIZE; i++) {
+                ref[i] = rand();
+        }
+
+#ifdef HAVE_AESNI
+        if (aesni_available()) {
+                int len;
+
+                for (len = 0; len < 100; len++) {
+                        if (check(key, nonce, aad, ref, buf, len)) {
+                                return 10;
+                        }
+                }
+                for (i = 0; i < 100; i++) {
+                        if (check(key, nonce, aad, ref, buf,
+                                  rand() % PAYLOAD_SIZE)) {
+                                return 10;
+                        }
+                }
+        }
+#endif
+
+        set_accel(0);
+        bench("c", key, nonce, aad, buf);
+#ifdef HAVE_AESNI
+        set_accel(1);
+        if (aesni_available()) {
+                bench("aes-ni", key, nonce, aad, buf);
+        }
+#endif
+
+        free(ref);
+        free(buf);
+        return 0;
+}
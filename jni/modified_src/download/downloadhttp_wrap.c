@@ -2,6 +2,8 @@
 
 static pdownload_http_open      _open;
 static pdownload_http_close     _close;
+static pdownload_http_get_ranges _get_ranges;
+static pdownload_http_wait      _wait;
 
 
 void download_http_connect( pdownload_http_open open, pdownload_http_close close)
@@ -10,6 +12,13 @@ void download_http_connect( pdownload_http_open open, pdownload_http_close close
     _close     = close;
 }
 
+void download_http_connect_ranges( pdownload_http_get_ranges get_ranges,
+                                   pdownload_http_wait wait )
+{
+    _get_ranges = get_ranges;
+    _wait       = wait;
+}
+
 int download_http_open( void* context, const char* url, int flags )
 {
     return _open( context, url, flags );
@@ -19,3 +28,18 @@ int download_http_close( void* context )
 {
     return _close( context );
 }
+
+int download_http_get_ranges( void* context, const uint8_t** bitmap,
+                              pthread_mutex_t** lock, int* block_size,
+                              int64_t* total_size )
+{
+    if ( !_get_ranges )
+        return -1;
+    return _get_ranges( context, bitmap, lock, block_size, total_size );
+}
+
+void download_http_wait( void* context, int64_t pos, int waiting )
+{
+    if ( _wait )
+        _wait( context, pos, waiting );
+}
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <stdint.h>
+#include <pthread.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -8,10 +9,34 @@ extern "C" {
 typedef int ( *pdownload_http_open )( void* context, const char* url, int flags );
 typedef int ( *pdownload_http_close )( void* context );
 
+/*
+ * Downloaded ranges of the file opened on context. On success *bitmap points
+ * to a bitmap owned by the download manager, with one bit per block of
+ * *block_size bytes (bit i & 7 of byte i >> 3 for block i), set once the
+ * whole block is written to the file. The manager sets the bits with *lock
+ * held, and the bitmap is only read with it held. Bits are never cleared
+ * while the file is open. *total_size is the final size of the file.
+ */
+typedef int ( *pdownload_http_get_ranges )( void* context, const uint8_t** bitmap,
+                                            pthread_mutex_t** lock, int* block_size,
+                                            int64_t* total_size );
+
+/* Called when a read has to wait for the bytes at pos (waiting = 1) and
+ * when it can go on again (waiting = 0). */
+typedef void ( *pdownload_http_wait )( void* context, int64_t pos, int waiting );
+
 void download_http_connect( pdownload_http_open open, pdownload_http_close read);
 
+/* Optional, without it the whole file is taken as downloaded. */
+void download_http_connect_ranges( pdownload_http_get_ranges get_ranges,
+                                   pdownload_http_wait wait );
+
 int download_http_open( void* context, const char* url, int flags );
 int download_http_close( void* context );
+int download_http_get_ranges( void* context, const uint8_t** bitmap,
+                              pthread_mutex_t** lock, int* block_size,
+                              int64_t* total_size );
+void download_http_wait( void* context, int64_t pos, int waiting );
 
 #ifdef __cplusplus
 }   // extern "C"